@@ -1,7 +1,24 @@
 #include "Image.h"
+#include "ImageAllocator.h"
+#include "Profile.h"
+#include "simd_kernels.h"
 
 #include <cassert>
 #include <cstring>
+#include <new>
+
+namespace
+{
+    // Leaked on purpose: Images released during static destruction still need their allocator.
+    PoolAllocator& global_pool()
+    {
+        static PoolAllocator* pool = new PoolAllocator();
+        return *pool;
+    }
+
+    std::atomic<ImageAllocator*> g_allocator{ nullptr };
+    std::atomic<std::size_t> g_rowAlignment{ 1 };
+}
 
 Image::Image()
     : controlBlock(nullptr),
@@ -9,7 +26,11 @@ Image::Image()
       rowsCount(0),
       colsCount(0),
       channelsCount(0),
-      rowStepBytes(0)
+      pixelDepth(PixelDepth::U8),
+      pixelLayout(PixelLayout::Interleaved),
+      rowStepBytes(0),
+      pixelStepBytes(0),
+      planeStepBytes(0)
 {
 }
 
@@ -19,13 +40,29 @@ Image::Image(int rows, int cols, int channels)
     create(rows, cols, channels);
 }
 
+Image::Image(int rows, int cols, int channels, PixelDepth depth)
+    : Image()
+{
+    create(rows, cols, channels, depth);
+}
+
+Image::Image(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout)
+    : Image()
+{
+    create(rows, cols, channels, depth, layout);
+}
+
 Image::Image(int rows, int cols, int channels, unsigned char* data)
     : controlBlock(nullptr),
       topLeftPointer(nullptr),
       rowsCount(0),
       colsCount(0),
       channelsCount(0),
-      rowStepBytes(0)
+      pixelDepth(PixelDepth::U8),
+      pixelLayout(PixelLayout::Interleaved),
+      rowStepBytes(0),
+      pixelStepBytes(0),
+      planeStepBytes(0)
 {
     if (rows <= 0 || cols <= 0 || channels <= 0 || data == nullptr)
     {
@@ -33,12 +70,59 @@ Image::Image(int rows, int cols, int channels, unsigned char* data)
     }
 
     std::size_t totalBytes = static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels);
-    controlBlock = new ControlBlock{ data, totalBytes, 1, false /* owning external */ };
+    controlBlock = newControlBlock(data, totalBytes, false /* owning external */, nullptr);
+    if (controlBlock == nullptr)
+    {
+        return;
+    }
     topLeftPointer = data;
     rowsCount = rows;
     colsCount = cols;
     channelsCount = channels;
-    rowStepBytes = static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels);
+    rowStepBytes = static_cast<std::ptrdiff_t>(cols) * channels;
+    pixelStepBytes = channels;
+}
+
+Image::Image(int rows, int cols, int channels, unsigned char* data, const ExternalBuffer& buffer)
+    : Image()
+{
+    // The buffer belongs to the Image from here on, so every way out that does not adopt it releases it.
+    auto releaseBuffer = [&buffer]
+    {
+        if (buffer.base != nullptr && buffer.release != nullptr)
+        {
+            buffer.release(buffer.base, buffer.byteSize);
+        }
+    };
+    if (rows <= 0 || cols <= 0 || channels <= 0 || data == nullptr || buffer.base == nullptr)
+    {
+        releaseBuffer();
+        return;
+    }
+
+    const std::size_t rowBytes = static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels);
+    assert(data >= buffer.base && data + rowBytes * static_cast<std::size_t>(rows) <= buffer.base + buffer.byteSize);
+
+    try
+    {
+        controlBlock = newControlBlock(buffer.base, buffer.byteSize, true, buffer.release);
+    }
+    catch (...)
+    {
+        releaseBuffer();
+        throw;
+    }
+    if (controlBlock == nullptr)
+    {
+        releaseBuffer();
+        return;
+    }
+    topLeftPointer = data;
+    rowsCount = rows;
+    colsCount = cols;
+    channelsCount = channels;
+    rowStepBytes = static_cast<std::ptrdiff_t>(rowBytes);
+    pixelStepBytes = channels;
 }
 
 Image::Image(const Image& other)
@@ -47,11 +131,37 @@ Image::Image(const Image& other)
       rowsCount(other.rowsCount),
       colsCount(other.colsCount),
       channelsCount(other.channelsCount),
-      rowStepBytes(other.rowStepBytes)
+      pixelDepth(other.pixelDepth),
+      pixelLayout(other.pixelLayout),
+      rowStepBytes(other.rowStepBytes),
+      pixelStepBytes(other.pixelStepBytes),
+      planeStepBytes(other.planeStepBytes)
 {
     retain();
 }
 
+Image::Image(Image&& other) noexcept
+    : controlBlock(other.controlBlock),
+      topLeftPointer(other.topLeftPointer),
+      rowsCount(other.rowsCount),
+      colsCount(other.colsCount),
+      channelsCount(other.channelsCount),
+      pixelDepth(other.pixelDepth),
+      pixelLayout(other.pixelLayout),
+      rowStepBytes(other.rowStepBytes),
+      pixelStepBytes(other.pixelStepBytes),
+      planeStepBytes(other.planeStepBytes)
+{
+    other.controlBlock = nullptr;
+    other.topLeftPointer = nullptr;
+    other.rowsCount = other.colsCount = other.channelsCount = 0;
+    other.pixelDepth = PixelDepth::U8;
+    other.pixelLayout = PixelLayout::Interleaved;
+    other.rowStepBytes = 0;
+    other.pixelStepBytes = 0;
+    other.planeStepBytes = 0;
+}
+
 Image::Image(const Image& image, const Range& rowRange, const Range& colRange)
     : Image()
 {
@@ -72,13 +182,15 @@ Image::Image(const Image& image, const Range& rowRange, const Range& colRange)
     controlBlock = image.controlBlock;
     retain();
     channelsCount = image.channelsCount;
+    pixelDepth = image.pixelDepth;
+    pixelLayout = image.pixelLayout;
     rowStepBytes = image.rowStepBytes;
+    pixelStepBytes = image.pixelStepBytes;
+    planeStepBytes = image.planeStepBytes;
     rowsCount = rEnd - rStart;
     colsCount = cEnd - cStart;
-
-    std::size_t offset = static_cast<std::size_t>(rStart) * image.rowStepBytes
-                       + static_cast<std::size_t>(cStart) * static_cast<std::size_t>(channelsCount);
-    topLeftPointer = image.topLeftPointer + offset;
+    topLeftPointer = image.topLeftPointer + static_cast<std::ptrdiff_t>(rStart) * rowStepBytes
+                                          + static_cast<std::ptrdiff_t>(cStart) * pixelStepBytes;
 }
 
 Image::~Image()
@@ -98,7 +210,11 @@ Image& Image::operator=(const Image& other)
         rowsCount == other.rowsCount &&
         colsCount == other.colsCount &&
         channelsCount == other.channelsCount &&
-        rowStepBytes == other.rowStepBytes)
+        pixelDepth == other.pixelDepth &&
+        pixelLayout == other.pixelLayout &&
+        rowStepBytes == other.rowStepBytes &&
+        pixelStepBytes == other.pixelStepBytes &&
+        planeStepBytes == other.planeStepBytes)
     {
         return *this;
     }
@@ -110,12 +226,47 @@ Image& Image::operator=(const Image& other)
     rowsCount = other.rowsCount;
     colsCount = other.colsCount;
     channelsCount = other.channelsCount;
+    pixelDepth = other.pixelDepth;
+    pixelLayout = other.pixelLayout;
     rowStepBytes = other.rowStepBytes;
+    pixelStepBytes = other.pixelStepBytes;
+    planeStepBytes = other.planeStepBytes;
 
     retain();
     return *this;
 }
 
+Image& Image::operator=(Image&& other) noexcept
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+
+    releaseInternal();
+
+    controlBlock = other.controlBlock;
+    topLeftPointer = other.topLeftPointer;
+    rowsCount = other.rowsCount;
+    colsCount = other.colsCount;
+    channelsCount = other.channelsCount;
+    pixelDepth = other.pixelDepth;
+    pixelLayout = other.pixelLayout;
+    rowStepBytes = other.rowStepBytes;
+    pixelStepBytes = other.pixelStepBytes;
+    planeStepBytes = other.planeStepBytes;
+
+    other.controlBlock = nullptr;
+    other.topLeftPointer = nullptr;
+    other.rowsCount = other.colsCount = other.channelsCount = 0;
+    other.pixelDepth = PixelDepth::U8;
+    other.pixelLayout = PixelLayout::Interleaved;
+    other.rowStepBytes = 0;
+    other.pixelStepBytes = 0;
+    other.planeStepBytes = 0;
+    return *this;
+}
+
 Image Image::operator()(const Range& rowRange, const Range& colRange) const
 {
     return Image(*this, rowRange, colRange);
@@ -123,19 +274,44 @@ Image Image::operator()(const Range& rowRange, const Range& colRange) const
 
 Image Image::clone() const
 {
+    IMG_PROFILE_SCOPE("clone", profile_bytes(*this));
     if (empty())
     {
         return makeEmpty();
     }
 
-    Image result(rowsCount, colsCount, channelsCount);
+    Image result;
+    result.create(rowsCount, colsCount, channelsCount, pixelDepth, pixelLayout, 1);
+    if (result.empty())
+    {
+        return result;
+    }
 
-    const std::size_t contiguousRowBytes = static_cast<std::size_t>(colsCount) * static_cast<std::size_t>(channelsCount);
-    for (int r = 0; r < rowsCount; ++r)
+    const bool planar = pixelLayout == PixelLayout::Planar;
+    const std::size_t contiguousRowBytes = static_cast<std::size_t>(colsCount) * (planar ? elemSize1() : elemSize());
+    const int planes = planar ? channelsCount : 1;
+    if (isContinuous())
     {
-        const unsigned char* srcRow = topLeftPointer + static_cast<std::size_t>(r) * rowStepBytes;
-        unsigned char* dstRow = result.topLeftPointer + static_cast<std::size_t>(r) * result.rowStepBytes;
-        std::memcpy(dstRow, srcRow, contiguousRowBytes);
+        std::memcpy(result.topLeftPointer, topLeftPointer,
+                    contiguousRowBytes * static_cast<std::size_t>(rowsCount) * static_cast<std::size_t>(planes));
+        return result;
+    }
+    // A mirrored row starts at its last pixel in memory and is copied back to front.
+    const std::ptrdiff_t mirrorOffset = pixelStepBytes < 0 ? static_cast<std::ptrdiff_t>(colsCount - 1) * pixelStepBytes : 0;
+    const PixelKernels& kernels = active_kernels();
+    for (int k = 0; k < planes; ++k)
+    {
+        for (int r = 0; r < rowsCount; ++r)
+        {
+            const unsigned char* srcRow = topLeftPointer + static_cast<std::size_t>(k) * planeStepBytes + static_cast<std::ptrdiff_t>(r) * rowStepBytes;
+            unsigned char* dstRow = result.topLeftPointer + static_cast<std::size_t>(k) * result.planeStepBytes + static_cast<std::ptrdiff_t>(r) * result.rowStepBytes;
+            if (mirrorOffset != 0)
+            {
+                kernels.reverseRow(srcRow + mirrorOffset, dstRow, colsCount, static_cast<std::size_t>(-pixelStepBytes));
+                continue;
+            }
+            std::memcpy(dstRow, srcRow, contiguousRowBytes);
+        }
     }
     return result;
 }
@@ -146,6 +322,31 @@ void Image::copyTo(Image& image) const
 }
 
 void Image::create(int rows, int cols, int channels)
+{
+    create(rows, cols, channels, defaultRowAlignment());
+}
+
+void Image::create(int rows, int cols, int channels, std::size_t rowAlignment)
+{
+    create(rows, cols, channels, PixelDepth::U8, rowAlignment);
+}
+
+void Image::create(int rows, int cols, int channels, PixelDepth depth)
+{
+    create(rows, cols, channels, depth, defaultRowAlignment());
+}
+
+void Image::create(int rows, int cols, int channels, PixelDepth depth, std::size_t rowAlignment)
+{
+    create(rows, cols, channels, depth, PixelLayout::Interleaved, rowAlignment);
+}
+
+void Image::create(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout)
+{
+    create(rows, cols, channels, depth, layout, defaultRowAlignment());
+}
+
+void Image::create(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout, std::size_t rowAlignment)
 {
     if (rows <= 0 || cols <= 0 || channels <= 0)
     {
@@ -153,13 +354,28 @@ void Image::create(int rows, int cols, int channels)
         return;
     }
 
+    if (rowAlignment == 0)
+    {
+        rowAlignment = 1;
+    }
+    const bool planar = layout == PixelLayout::Planar;
+    const std::size_t rowBytes = static_cast<std::size_t>(cols) * static_cast<std::size_t>(planar ? 1 : channels) * depth_bytes(depth);
+    const std::size_t step = (rowBytes + rowAlignment - 1) / rowAlignment * rowAlignment;
+    const std::size_t planeStep = planar ? step * static_cast<std::size_t>(rows) : 0;
+    const std::ptrdiff_t pixelStep = static_cast<std::ptrdiff_t>(depth_bytes(depth)) * (planar ? 1 : channels);
+
     bool canReuse =
         controlBlock != nullptr &&
         controlBlock->owning &&
+        controlBlock->releaseBuffer == nullptr &&
         rows == rowsCount &&
         cols == colsCount &&
         channels == channelsCount &&
-        rowStepBytes == static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels) &&
+        depth == pixelDepth &&
+        layout == pixelLayout &&
+        rowStepBytes == static_cast<std::ptrdiff_t>(step) &&
+        pixelStepBytes == pixelStep &&
+        planeStepBytes == planeStep &&
         topLeftPointer == controlBlock->basePointer;
 
     if (canReuse)
@@ -169,27 +385,30 @@ void Image::create(int rows, int cols, int channels)
 
     releaseInternal();
 
-    std::size_t totalBytes = static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels);
-    unsigned char* buffer = nullptr;
-    try
+    ImageAllocator& allocator = defaultAllocator();
+    const std::size_t totalBytes = planar ? planeStep * static_cast<std::size_t>(channels) : step * static_cast<std::size_t>(rows);
+    unsigned char* buffer = allocator.allocate(totalBytes);
+    if (buffer == nullptr)
     {
-        buffer = new unsigned char[totalBytes];
+        return;
     }
-    catch (...)
+
+    controlBlock = newControlBlock(buffer, totalBytes, true, nullptr);
+    if (controlBlock == nullptr)
     {
-        controlBlock = nullptr;
-        topLeftPointer = nullptr;
-        rowsCount = colsCount = channelsCount = 0;
-        rowStepBytes = 0;
+        allocator.deallocate(buffer, totalBytes);
         return;
     }
-
-    controlBlock = new ControlBlock{ buffer, totalBytes, 1, true };
+    IMG_PROFILE_ALLOCATION(totalBytes);
     topLeftPointer = buffer;
     rowsCount = rows;
     colsCount = cols;
     channelsCount = channels;
-    rowStepBytes = static_cast<std::size_t>(cols) * static_cast<std::size_t>(channels);
+    pixelDepth = depth;
+    pixelLayout = layout;
+    rowStepBytes = static_cast<std::ptrdiff_t>(step);
+    pixelStepBytes = pixelStep;
+    planeStepBytes = planeStep;
 }
 
 bool Image::empty() const
@@ -230,6 +449,49 @@ Image Image::rowRange(const Range& range) const
     return (*this)(range, Range(0, colsCount));
 }
 
+Image Image::plane(int k) const
+{
+    if (empty() || k < 0 || k >= channelsCount || (pixelLayout == PixelLayout::Interleaved && channelsCount != 1))
+    {
+        return makeEmpty();
+    }
+    Image view(*this);
+    view.topLeftPointer += static_cast<std::size_t>(k) * planeStepBytes;
+    view.channelsCount = 1;
+    view.pixelLayout = PixelLayout::Interleaved;
+    view.planeStepBytes = 0;
+    return view;
+}
+
+Image Image::flipV() const
+{
+    if (empty())
+    {
+        return makeEmpty();
+    }
+    Image view(*this);
+    view.topLeftPointer += static_cast<std::ptrdiff_t>(rowsCount - 1) * rowStepBytes;
+    view.rowStepBytes = -rowStepBytes;
+    return view;
+}
+
+Image Image::flipH() const
+{
+    if (empty())
+    {
+        return makeEmpty();
+    }
+    Image view(*this);
+    view.topLeftPointer += static_cast<std::ptrdiff_t>(colsCount - 1) * pixelStepBytes;
+    view.pixelStepBytes = -pixelStepBytes;
+    return view;
+}
+
+Image Image::unmirrored() const
+{
+    return isMirrored() ? clone() : *this;
+}
+
 const unsigned char* Image::data() const
 {
     return topLeftPointer;
@@ -260,28 +522,80 @@ int Image::channels() const
     return channelsCount;
 }
 
+PixelDepth Image::depth() const
+{
+    return pixelDepth;
+}
+
+PixelLayout Image::layout() const
+{
+    return pixelLayout;
+}
+
+bool Image::isPlanar() const
+{
+    return pixelLayout == PixelLayout::Planar;
+}
+
+std::ptrdiff_t Image::step() const
+{
+    return rowStepBytes;
+}
+
+std::ptrdiff_t Image::pixelStep() const
+{
+    return pixelStepBytes;
+}
+
+std::size_t Image::planeStep() const
+{
+    return planeStepBytes;
+}
+
 unsigned char& Image::at(int index)
 {
     assert(!empty());
-    const std::size_t rowWidth = static_cast<std::size_t>(colsCount) * static_cast<std::size_t>(channelsCount);
     assert(index >= 0);
+    if (isContinuous())
+    {
+        return topLeftPointer[index];
+    }
+    const bool planar = pixelLayout == PixelLayout::Planar;
+    const std::size_t pixelBytes = planar ? elemSize1() : elemSize();
+    const std::size_t rowWidth = static_cast<std::size_t>(colsCount) * pixelBytes;
     std::size_t idx = static_cast<std::size_t>(index);
+    const std::size_t planeBytes = rowWidth * static_cast<std::size_t>(rowsCount);
+    const std::size_t planeIndex = planar ? idx / planeBytes : 0;
+    idx -= planeIndex * planeBytes;
     int row = static_cast<int>(idx / rowWidth);
     std::size_t offsetInRow = idx % rowWidth;
     assert(row >= 0 && row < rowsCount);
-    return *(topLeftPointer + static_cast<std::size_t>(row) * rowStepBytes + offsetInRow);
+    const std::ptrdiff_t pixel = static_cast<std::ptrdiff_t>(offsetInRow / pixelBytes);
+    return *(topLeftPointer + planeIndex * planeStepBytes + static_cast<std::ptrdiff_t>(row) * rowStepBytes
+             + pixel * pixelStepBytes + static_cast<std::ptrdiff_t>(offsetInRow % pixelBytes));
 }
 
 const unsigned char& Image::at(int index) const
 {
     assert(!empty());
-    const std::size_t rowWidth = static_cast<std::size_t>(colsCount) * static_cast<std::size_t>(channelsCount);
     assert(index >= 0);
+    if (isContinuous())
+    {
+        return topLeftPointer[index];
+    }
+    const bool planar = pixelLayout == PixelLayout::Planar;
+    const std::size_t pixelBytes = planar ? elemSize1() : elemSize();
+    const std::size_t rowWidth = static_cast<std::size_t>(colsCount) * pixelBytes;
     std::size_t idx = static_cast<std::size_t>(index);
+    const std::size_t planeBytes = rowWidth * static_cast<std::size_t>(rowsCount);
+    const std::size_t planeIndex = planar ? idx / planeBytes : 0;
+    idx -= planeIndex * planeBytes;
     int row = static_cast<int>(idx / rowWidth);
     std::size_t offsetInRow = idx % rowWidth;
     assert(row >= 0 && row < rowsCount);
-    return *(topLeftPointer + static_cast<std::size_t>(row) * rowStepBytes + offsetInRow);
+    const std::ptrdiff_t pixel = static_cast<std::ptrdiff_t>(offsetInRow / pixelBytes);
+    return *(topLeftPointer + planeIndex * planeStepBytes + static_cast<std::ptrdiff_t>(row) * rowStepBytes
+             + pixel * pixelStepBytes + static_cast<std::ptrdiff_t>(offsetInRow % pixelBytes));
 }
 
 Image Image::zeros(int rows, int cols, int channels)
@@ -306,14 +620,15 @@ Image Image::values(int rows, int cols, int channels, unsigned char value)
 
 std::size_t Image::countRef() const
 {
-    return controlBlock ? controlBlock->refCount : 0;
+    return controlBlock ? controlBlock->refCount.load(std::memory_order_relaxed) : 0;
 }
 
 void Image::retain()
 {
     if (controlBlock != nullptr)
     {
-        ++controlBlock->refCount;
+        // A new reference is always made from an existing one, so no ordering is needed here.
+        controlBlock->refCount.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
@@ -323,27 +638,33 @@ void Image::releaseInternal()
     {
         topLeftPointer = nullptr;
         rowsCount = colsCount = channelsCount = 0;
+        pixelDepth = PixelDepth::U8;
+        pixelLayout = PixelLayout::Interleaved;
         rowStepBytes = 0;
+        pixelStepBytes = 0;
+        planeStepBytes = 0;
         return;
     }
 
-    assert(controlBlock->refCount > 0);
-    --controlBlock->refCount;
+    // Release publishes this owner's writes; the acquire fence makes all of them
+    // visible to whichever thread frees the buffer.
+    const std::size_t previous = controlBlock->refCount.fetch_sub(1, std::memory_order_release);
+    assert(previous > 0);
 
-    if (controlBlock->refCount == 0)
+    if (previous == 1)
     {
-        if (controlBlock->owning && controlBlock->basePointer != nullptr)
-        {
-            delete[] controlBlock->basePointer;
-            controlBlock->basePointer = nullptr;
-        }
-        delete controlBlock;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        destroyControlBlock(controlBlock);
     }
 
     controlBlock = nullptr;
     topLeftPointer = nullptr;
     rowsCount = colsCount = channelsCount = 0;
+    pixelDepth = PixelDepth::U8;
+    pixelLayout = PixelLayout::Interleaved;
     rowStepBytes = 0;
+    pixelStepBytes = 0;
+    planeStepBytes = 0;
 }
 
 void Image::clampRange(const Range& in, int maxValue, int& outStart, int& outEnd)
@@ -363,6 +684,59 @@ void Image::clampRange(const Range& in, int maxValue, int& outStart, int& outEnd
     outEnd = e;
 }
 
+Image::ControlBlock* Image::newControlBlock(unsigned char* base, std::size_t byteSize, bool owning,
+                                            void (*releaseBuffer)(unsigned char*, std::size_t))
+{
+    ImageAllocator& allocator = defaultAllocator();
+    unsigned char* memory = allocator.allocate(sizeof(ControlBlock));
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+    return new (memory) ControlBlock{ base, byteSize, 1, owning, releaseBuffer, &allocator };
+}
+
+void Image::destroyControlBlock(ControlBlock* block)
+{
+    ImageAllocator* allocator = block->allocator;
+    if (block->owning && block->releaseBuffer != nullptr)
+    {
+        block->releaseBuffer(block->basePointer, block->byteSize);
+    }
+    else if (block->owning && block->basePointer != nullptr)
+    {
+        allocator->deallocate(block->basePointer, block->byteSize);
+    }
+    block->~ControlBlock();
+    allocator->deallocate(reinterpret_cast<unsigned char*>(block), sizeof(ControlBlock));
+}
+
+ImageAllocator& Image::defaultAllocator()
+{
+    ImageAllocator* allocator = g_allocator.load(std::memory_order_acquire);
+    return allocator != nullptr ? *allocator : global_pool();
+}
+
+void Image::setDefaultAllocator(ImageAllocator* allocator)
+{
+    g_allocator.store(allocator, std::memory_order_release);
+}
+
+PoolAllocator& Image::bufferPool()
+{
+    return global_pool();
+}
+
+std::size_t Image::defaultRowAlignment()
+{
+    return g_rowAlignment.load(std::memory_order_relaxed);
+}
+
+void Image::setDefaultRowAlignment(std::size_t bytes)
+{
+    g_rowAlignment.store(bytes == 0 ? 1 : bytes, std::memory_order_relaxed);
+}
+
 Image Image::makeEmpty()
 {
     return Image();
@@ -1,20 +1,100 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include "Range.h"
 
+class ImageAllocator;
+class PoolAllocator;
+
+// Type of one channel sample. U16 is native-endian; F32 is nominally in [0, 1].
+enum class PixelDepth : unsigned char
+{
+    U8,
+    U16,
+    F32
+};
+
+inline constexpr std::size_t depth_bytes(PixelDepth depth)
+{
+    return depth == PixelDepth::U8 ? 1 : depth == PixelDepth::U16 ? 2 : 4;
+}
+
+// Interleaved stores the channels of a pixel next to each other (RGBRGB...). Planar stores one
+// plane per channel (RRR...GGG...BBB...); every plane has the same row step and plane k starts
+// k * planeStep() bytes after plane 0.
+enum class PixelLayout : unsigned char
+{
+    Interleaved,
+    Planar
+};
+
+// Compile-time mapping from sample type to depth, for ops specialized per type.
+template <typename T> struct PixelDepthOf;
+template <> struct PixelDepthOf<std::uint8_t> { static constexpr PixelDepth value = PixelDepth::U8; };
+template <> struct PixelDepthOf<std::uint16_t> { static constexpr PixelDepth value = PixelDepth::U16; };
+template <> struct PixelDepthOf<float> { static constexpr PixelDepth value = PixelDepth::F32; };
+
 class Image
 {
 public:
+    template <typename T>
+    class RowIterator
+    {
+    public:
+        RowIterator(T* row, std::ptrdiff_t step) : rowPointer(row), stepBytes(step) {}
+
+        T* operator*() const { return rowPointer; }
+        RowIterator& operator++() { rowPointer += stepBytes; return *this; }
+        bool operator==(const RowIterator& other) const { return rowPointer == other.rowPointer; }
+        bool operator!=(const RowIterator& other) const { return rowPointer != other.rowPointer; }
+
+    private:
+        T* rowPointer;
+        std::ptrdiff_t stepBytes;
+    };
+
+    template <typename T>
+    class RowSequence
+    {
+    public:
+        RowSequence(T* first, std::ptrdiff_t step, int rows)
+            : firstRow(first), stepBytes(step), rowsCount(rows) {}
+
+        RowIterator<T> begin() const { return RowIterator<T>(firstRow, stepBytes); }
+        RowIterator<T> end() const { return RowIterator<T>(firstRow + static_cast<std::ptrdiff_t>(rowsCount) * stepBytes, stepBytes); }
+
+    private:
+        T* firstRow;
+        std::ptrdiff_t stepBytes;
+        int rowsCount;
+    };
+
+    // Memory the Image does not allocate itself but takes over: release(base, byteSize)
+    // runs when the last reference goes away (e.g. munmap for a mapped file), or at once
+    // when construction fails, so the caller never releases it.
+    struct ExternalBuffer
+    {
+        unsigned char* base;
+        std::size_t byteSize;
+        void (*release)(unsigned char* base, std::size_t byteSize);
+    };
+
     Image();
     Image(int rows, int cols, int channels);
+    Image(int rows, int cols, int channels, PixelDepth depth);
+    Image(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout);
     Image(int rows, int cols, int channels, unsigned char* data);
+    Image(int rows, int cols, int channels, unsigned char* data, const ExternalBuffer& buffer);
     Image(const Image& image);
+    Image(Image&& image) noexcept;
     Image(const Image& image, const Range& rowRange, const Range& colRange);
     virtual ~Image();
 
     Image& operator=(const Image& image);
+    Image& operator=(Image&& image) noexcept;
 
     Image operator()(const Range& rowRange, const Range& colRange) const;
 
@@ -22,6 +102,12 @@ public:
     void copyTo(Image& image) const;
 
     void create(int rows, int cols, int channels);
+    // Rows start rowAlignment bytes apart (rounded up); 1 packs them back to back.
+    void create(int rows, int cols, int channels, std::size_t rowAlignment);
+    void create(int rows, int cols, int channels, PixelDepth depth);
+    void create(int rows, int cols, int channels, PixelDepth depth, std::size_t rowAlignment);
+    void create(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout);
+    void create(int rows, int cols, int channels, PixelDepth depth, PixelLayout layout, std::size_t rowAlignment);
     bool empty() const;
     void release();
 
@@ -30,6 +116,19 @@ public:
     Image row(int y) const;
     Image rowRange(const Range& range) const;
 
+    // Channel k as a single-channel view. Every channel of a planar image has one; an interleaved
+    // image only has plane(0) when it is single-channel, otherwise the result is empty.
+    Image plane(int k) const;
+
+    // Mirrored views sharing the pixels: flipV() walks the rows bottom-up through a negative
+    // step(), flipH() walks each row right to left through a negative pixelStep().
+    Image flipV() const;
+    Image flipH() const;
+    // pixelStep() < 0. Row kernels walk pixels forwards, so ops take such a source through
+    // unmirrored(): *this when not mirrored, otherwise a packed copy.
+    bool isMirrored() const;
+    Image unmirrored() const;
+
     const unsigned char* data() const;
     unsigned char* data();
 
@@ -37,7 +136,43 @@ public:
     int cols() const;
     int total() const;
     int channels() const;
+    PixelDepth depth() const;
+    PixelLayout layout() const;
+    bool isPlanar() const;
+    // Bytes from one row to the next; negative for a flipV() view.
+    std::ptrdiff_t step() const;
+    // Bytes from one pixel of a row to the next (one sample for planar images); negative for a flipH() view.
+    std::ptrdiff_t pixelStep() const;
+    // Bytes from one plane to the next; 0 for interleaved images.
+    std::size_t planeStep() const;
+    // Bytes per pixel (all channels) and per sample.
+    std::size_t elemSize() const;
+    std::size_t elemSize1() const;
+    // No gaps between rows (and, for planar images, between planes), all in forward order.
+    bool isContinuous() const;
+
+    // Planar images: rows and columns of plane 0; other planes through planePtr() or plane().
+    unsigned char* ptr(int row);
+    const unsigned char* ptr(int row) const;
+    template <typename T> T* ptr(int row, int col);
+    template <typename T> const T* ptr(int row, int col) const;
+    unsigned char* planePtr(int plane, int row);
+    const unsigned char* planePtr(int plane, int row) const;
+
+    RowSequence<unsigned char> rowPointers();
+    RowSequence<const unsigned char> rowPointers() const;
+
+    // fn(unsigned char* row, int y); each row holds cols() * elemSize() bytes. Planar images
+    // visit the rows of plane 0, then plane 1 and so on, each cols() * elemSize1() bytes long.
+    // Not for mirrored images.
+    template <typename F> void forEachRow(F&& fn);
+    template <typename F> void forEachRow(F&& fn) const;
 
+    // fn(unsigned char* pixel); continuous images are walked as one flat run. Interleaved only.
+    template <typename F> void forEachPixel(F&& fn);
+    template <typename F> void forEachPixel(F&& fn) const;
+
+    // Byte index in row-major order, ignoring row padding; planar images count plane by plane.
     unsigned char& at(int index);
     const unsigned char& at(int index) const;
 
@@ -46,13 +181,25 @@ public:
 
     std::size_t countRef() const;
 
+    // Buffers and control blocks come from the default allocator, a PoolAllocator unless replaced.
+    // The allocator must outlive every Image created while it was installed.
+    static ImageAllocator& defaultAllocator();
+    static void setDefaultAllocator(ImageAllocator* allocator);
+    static PoolAllocator& bufferPool();
+
+    // Row alignment used by create(rows, cols, channels); 1 (packed) by default.
+    static std::size_t defaultRowAlignment();
+    static void setDefaultRowAlignment(std::size_t bytes);
+
 private:
     struct ControlBlock
     {
         unsigned char* basePointer;
         std::size_t byteSize;
-        std::size_t refCount;
+        std::atomic<std::size_t> refCount;
         bool owning;
+        void (*releaseBuffer)(unsigned char* base, std::size_t byteSize);
+        ImageAllocator* allocator;
     };
 
     ControlBlock* controlBlock;
@@ -60,11 +207,175 @@ private:
     int rowsCount;
     int colsCount;
     int channelsCount;
-    std::size_t rowStepBytes;
+    PixelDepth pixelDepth;
+    PixelLayout pixelLayout;
+    std::ptrdiff_t rowStepBytes;
+    std::ptrdiff_t pixelStepBytes;
+    std::size_t planeStepBytes;
 
     void retain();
     void releaseInternal();
 
+    static ControlBlock* newControlBlock(unsigned char* base, std::size_t byteSize, bool owning,
+                                         void (*releaseBuffer)(unsigned char*, std::size_t));
+    static void destroyControlBlock(ControlBlock* block);
+
     static void clampRange(const Range& in, int maxValue, int& outStart, int& outEnd);
     static Image makeEmpty();
 };
+
+inline std::size_t Image::elemSize() const
+{
+    return static_cast<std::size_t>(channelsCount) * depth_bytes(pixelDepth);
+}
+
+inline std::size_t Image::elemSize1() const
+{
+    return depth_bytes(pixelDepth);
+}
+
+inline bool Image::isContinuous() const
+{
+    if (pixelStepBytes < 0)
+    {
+        return false;
+    }
+    if (pixelLayout == PixelLayout::Interleaved)
+    {
+        return rowsCount <= 1 || rowStepBytes == static_cast<std::ptrdiff_t>(static_cast<std::size_t>(colsCount) * elemSize());
+    }
+    const std::size_t rowBytes = static_cast<std::size_t>(colsCount) * elemSize1();
+    return (rowsCount <= 1 || rowStepBytes == static_cast<std::ptrdiff_t>(rowBytes)) &&
+           (channelsCount <= 1 || planeStepBytes == rowBytes * static_cast<std::size_t>(rowsCount));
+}
+
+inline bool Image::isMirrored() const
+{
+    return pixelStepBytes < 0;
+}
+
+inline unsigned char* Image::ptr(int row)
+{
+    assert(!empty() && row >= 0 && row < rowsCount);
+    return topLeftPointer + static_cast<std::ptrdiff_t>(row) * rowStepBytes;
+}
+
+inline const unsigned char* Image::ptr(int row) const
+{
+    assert(!empty() && row >= 0 && row < rowsCount);
+    return topLeftPointer + static_cast<std::ptrdiff_t>(row) * rowStepBytes;
+}
+
+template <typename T>
+T* Image::ptr(int row, int col)
+{
+    assert(col >= 0 && col < colsCount);
+    return reinterpret_cast<T*>(ptr(row) + static_cast<std::ptrdiff_t>(col) * pixelStepBytes);
+}
+
+template <typename T>
+const T* Image::ptr(int row, int col) const
+{
+    assert(col >= 0 && col < colsCount);
+    return reinterpret_cast<const T*>(ptr(row) + static_cast<std::ptrdiff_t>(col) * pixelStepBytes);
+}
+
+inline unsigned char* Image::planePtr(int plane, int row)
+{
+    assert(plane >= 0 && plane < (pixelLayout == PixelLayout::Planar ? channelsCount : 1));
+    return ptr(row) + static_cast<std::size_t>(plane) * planeStepBytes;
+}
+
+inline const unsigned char* Image::planePtr(int plane, int row) const
+{
+    assert(plane >= 0 && plane < (pixelLayout == PixelLayout::Planar ? channelsCount : 1));
+    return ptr(row) + static_cast<std::size_t>(plane) * planeStepBytes;
+}
+
+inline Image::RowSequence<unsigned char> Image::rowPointers()
+{
+    return RowSequence<unsigned char>(topLeftPointer, rowStepBytes, empty() ? 0 : rowsCount);
+}
+
+inline Image::RowSequence<const unsigned char> Image::rowPointers() const
+{
+    return RowSequence<const unsigned char>(topLeftPointer, rowStepBytes, empty() ? 0 : rowsCount);
+}
+
+template <typename F>
+void Image::forEachRow(F&& fn)
+{
+    assert(pixelStepBytes >= 0);
+    if (empty())
+    {
+        return;
+    }
+    const int planes = pixelLayout == PixelLayout::Planar ? channelsCount : 1;
+    for (int k = 0; k < planes; ++k)
+    {
+        unsigned char* row = topLeftPointer + static_cast<std::size_t>(k) * planeStepBytes;
+        for (int y = 0; y < rowsCount; ++y, row += rowStepBytes)
+        {
+            fn(row, y);
+        }
+    }
+}
+
+template <typename F>
+void Image::forEachRow(F&& fn) const
+{
+    assert(pixelStepBytes >= 0);
+    if (empty())
+    {
+        return;
+    }
+    const int planes = pixelLayout == PixelLayout::Planar ? channelsCount : 1;
+    for (int k = 0; k < planes; ++k)
+    {
+        const unsigned char* row = topLeftPointer + static_cast<std::size_t>(k) * planeStepBytes;
+        for (int y = 0; y < rowsCount; ++y, row += rowStepBytes)
+        {
+            fn(row, y);
+        }
+    }
+}
+
+template <typename F>
+void Image::forEachPixel(F&& fn)
+{
+    assert(pixelLayout == PixelLayout::Interleaved);
+    if (empty())
+    {
+        return;
+    }
+    const int rows = isContinuous() ? 1 : rowsCount;
+    const std::ptrdiff_t pixelsPerRun = isContinuous() ? static_cast<std::ptrdiff_t>(rowsCount) * colsCount : colsCount;
+    unsigned char* row = topLeftPointer;
+    for (int y = 0; y < rows; ++y, row += rowStepBytes)
+    {
+        for (std::ptrdiff_t i = 0; i < pixelsPerRun; ++i)
+        {
+            fn(row + i * pixelStepBytes);
+        }
+    }
+}
+
+template <typename F>
+void Image::forEachPixel(F&& fn) const
+{
+    assert(pixelLayout == PixelLayout::Interleaved);
+    if (empty())
+    {
+        return;
+    }
+    const int rows = isContinuous() ? 1 : rowsCount;
+    const std::ptrdiff_t pixelsPerRun = isContinuous() ? static_cast<std::ptrdiff_t>(rowsCount) * colsCount : colsCount;
+    const unsigned char* row = topLeftPointer;
+    for (int y = 0; y < rows; ++y, row += rowStepBytes)
+    {
+        for (std::ptrdiff_t i = 0; i < pixelsPerRun; ++i)
+        {
+            fn(row + i * pixelStepBytes);
+        }
+    }
+}
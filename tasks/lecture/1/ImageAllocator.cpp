@@ -0,0 +1,123 @@
+#include "ImageAllocator.h"
+
+#include <new>
+
+namespace
+{
+    unsigned char* aligned_new(std::size_t bytes)
+    {
+        return static_cast<unsigned char*>(::operator new(bytes, std::align_val_t(ImageAllocator::kAlignment), std::nothrow));
+    }
+
+    void aligned_delete(unsigned char* pointer)
+    {
+        ::operator delete(pointer, std::align_val_t(ImageAllocator::kAlignment));
+    }
+}
+
+unsigned char* SystemAllocator::allocate(std::size_t bytes)
+{
+    return aligned_new(bytes);
+}
+
+void SystemAllocator::deallocate(unsigned char* pointer, std::size_t)
+{
+    aligned_delete(pointer);
+}
+
+PoolAllocator::PoolAllocator(std::size_t maxBytesHeld)
+    : maxBytesHeld(maxBytesHeld)
+{
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    trim();
+}
+
+std::size_t PoolAllocator::sizeClass(std::size_t bytes)
+{
+    if (bytes <= kAlignment)
+    {
+        return kAlignment;
+    }
+    std::size_t power = kAlignment;
+    while (power < bytes && power * 2 > power)
+    {
+        power *= 2;
+    }
+    // bytes lies in (power / 2, power]; split that interval into four classes.
+    const std::size_t quarter = power / 8;
+    return (bytes + quarter - 1) / quarter * quarter;
+}
+
+unsigned char* PoolAllocator::allocate(std::size_t bytes)
+{
+    const std::size_t cls = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = freeBlocks.find(cls);
+        if (it != freeBlocks.end() && !it->second.empty())
+        {
+            unsigned char* block = it->second.back();
+            it->second.pop_back();
+            counters.bytesHeld -= cls;
+            --counters.blocksHeld;
+            ++counters.hits;
+            return block;
+        }
+        ++counters.misses;
+    }
+    return aligned_new(cls);
+}
+
+void PoolAllocator::deallocate(unsigned char* pointer, std::size_t bytes)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    const std::size_t cls = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (counters.bytesHeld + cls <= maxBytesHeld)
+        {
+            freeBlocks[cls].push_back(pointer);
+            counters.bytesHeld += cls;
+            ++counters.blocksHeld;
+            return;
+        }
+    }
+    aligned_delete(pointer);
+}
+
+PoolAllocator::Stats PoolAllocator::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void PoolAllocator::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.hits = 0;
+    counters.misses = 0;
+}
+
+void PoolAllocator::trim()
+{
+    std::unordered_map<std::size_t, std::vector<unsigned char*>> released;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released.swap(freeBlocks);
+        counters.bytesHeld = 0;
+        counters.blocksHeld = 0;
+    }
+    for (auto& entry : released)
+    {
+        for (unsigned char* block : entry.second)
+        {
+            aligned_delete(block);
+        }
+    }
+}
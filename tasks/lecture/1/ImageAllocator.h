@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Source of pixel buffers and control blocks for Image. Every block is aligned to kAlignment.
+class ImageAllocator
+{
+public:
+    static constexpr std::size_t kAlignment = 64;
+
+    virtual ~ImageAllocator() = default;
+
+    // Returns nullptr when the memory cannot be provided.
+    virtual unsigned char* allocate(std::size_t bytes) = 0;
+    // `bytes` is the value passed to the matching allocate().
+    virtual void deallocate(unsigned char* pointer, std::size_t bytes) = 0;
+};
+
+// Plain aligned operator new/delete, no caching.
+class SystemAllocator : public ImageAllocator
+{
+public:
+    unsigned char* allocate(std::size_t bytes) override;
+    void deallocate(unsigned char* pointer, std::size_t bytes) override;
+};
+
+// Keeps freed blocks in size classes (four per power of two, so at most 25% slack)
+// and hands them out again, which turns create/destroy cycles of same-sized
+// images into a free-list pop and push.
+class PoolAllocator : public ImageAllocator
+{
+public:
+    struct Stats
+    {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t bytesHeld = 0;
+        std::size_t blocksHeld = 0;
+    };
+
+    explicit PoolAllocator(std::size_t maxBytesHeld = std::size_t(256) << 20);
+    ~PoolAllocator() override;
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    unsigned char* allocate(std::size_t bytes) override;
+    void deallocate(unsigned char* pointer, std::size_t bytes) override;
+
+    Stats stats() const;
+    void resetStats();
+    // Returns every cached block to the system.
+    void trim();
+
+    static std::size_t sizeClass(std::size_t bytes);
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::size_t, std::vector<unsigned char*>> freeBlocks;
+    std::size_t maxBytesHeld;
+    Stats counters;
+};
@@ -0,0 +1,131 @@
+#include "ImagePyramid.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+namespace
+{
+    template <typename T>
+    void halve_samples(const T* top, const T* bottom, T* dst, int dstCols, int channels)
+    {
+        const std::size_t ch = static_cast<std::size_t>(channels);
+        const std::size_t samples = static_cast<std::size_t>(dstCols) * ch;
+        for (std::size_t j = 0; j < samples; ++j)
+        {
+            const std::size_t i = 2 * j - j % ch;
+            if constexpr (std::is_same_v<T, float>)
+            {
+                dst[j] = ((top[i] + top[i + ch]) + (bottom[i] + bottom[i + ch])) * 0.25f;
+            }
+            else
+            {
+                const std::uint32_t sum = std::uint32_t{ top[i] } + top[i + ch] + bottom[i] + bottom[i + ch];
+                dst[j] = static_cast<T>((sum + 2) >> 2);
+            }
+        }
+    }
+
+    // One plane (or an interleaved image): dst row y averages rows 2y and 2y + 1 of src.
+    void halve_rows(const Image& src, Image& dst)
+    {
+        const PixelKernels& kernels = active_kernels();
+        const int cols = dst.cols();
+        const int ch = src.channels();
+        parallel_rows(dst.rows(), 2 * static_cast<std::size_t>(src.cols()) * src.elemSize(), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                switch (src.depth())
+                {
+                case PixelDepth::U8:
+                    kernels.halveRow(src.ptr(2 * y), src.ptr(2 * y + 1), dst.ptr(y), cols, ch);
+                    break;
+                case PixelDepth::U16:
+                    halve_samples(src.ptr<std::uint16_t>(2 * y, 0), src.ptr<std::uint16_t>(2 * y + 1, 0), dst.ptr<std::uint16_t>(y, 0), cols, ch);
+                    break;
+                case PixelDepth::F32:
+                    halve_samples(src.ptr<float>(2 * y, 0), src.ptr<float>(2 * y + 1, 0), dst.ptr<float>(y, 0), cols, ch);
+                    break;
+                }
+            }
+        });
+    }
+
+    Image halve(const Image& level)
+    {
+        // Only the source can be mirrored; the rows need forward pixel order.
+        const Image src = level.unmirrored();
+        Image dst(src.rows() / 2, src.cols() / 2, src.channels(), src.depth(), src.layout());
+        if (dst.empty())
+        {
+            return Image();
+        }
+        if (!src.isPlanar())
+        {
+            halve_rows(src, dst);
+            return dst;
+        }
+        for (int k = 0; k < src.channels(); ++k)
+        {
+            Image dstPlane = dst.plane(k);
+            halve_rows(src.plane(k), dstPlane);
+        }
+        return dst;
+    }
+}
+
+ImagePyramid::ImagePyramid(const Image& source)
+    : count(0), sourceRows(source.rows()), sourceCols(source.cols())
+{
+    if (source.empty())
+    {
+        return;
+    }
+    levels.push_back(source);
+    for (int side = std::min(sourceRows, sourceCols); side >= 1; side /= 2)
+    {
+        ++count;
+    }
+}
+
+int ImagePyramid::levelCount() const
+{
+    return count;
+}
+
+Image ImagePyramid::level(int k) const
+{
+    if (k < 0 || k >= count)
+    {
+        return Image();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    while (levels.size() <= static_cast<std::size_t>(k))
+    {
+        levels.push_back(halve(levels.back()));
+    }
+    return levels[static_cast<std::size_t>(k)];
+}
+
+Image ImagePyramid::resize(int newWidth, int newHeight, Interpolation interpolation) const
+{
+    if (count == 0 || newWidth <= 0 || newHeight <= 0)
+    {
+        return Image();
+    }
+    // Level k is (cols >> k) x (rows >> k).
+    int k = 0;
+    while (k + 1 < count && (sourceCols >> (k + 1)) >= newWidth && (sourceRows >> (k + 1)) >= newHeight)
+    {
+        ++k;
+    }
+    const Image base = level(k);
+    if (base.cols() == newWidth && base.rows() == newHeight)
+    {
+        return base.clone();
+    }
+    return ::resize(base, newWidth, newHeight, interpolation);
+}
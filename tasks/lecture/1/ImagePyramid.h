@@ -0,0 +1,36 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "Image.h"
+#include "resize.h"
+
+// Mipmap chain over one source image. Level 0 is the source itself (shared, not copied);
+// level k + 1 is the 2x2 box average of level k, with an odd last row or column dropped.
+// Levels are built on first use and kept, so level() hands out views of the cached pixels
+// and repeated downscales only pay for the part below the closest level. Safe to share
+// between threads.
+class ImagePyramid
+{
+public:
+    explicit ImagePyramid(const Image& source);
+
+    ImagePyramid(const ImagePyramid&) = delete;
+    ImagePyramid& operator=(const ImagePyramid&) = delete;
+
+    // Levels go down until the shorter side is one pixel; 0 for an empty source.
+    int levelCount() const;
+    // Empty when k is out of range.
+    Image level(int k) const;
+
+    // Resizes the smallest level that still covers newWidth x newHeight, so the
+    // result is always a new image. Upscales start from the source.
+    Image resize(int newWidth, int newHeight, Interpolation interpolation = Interpolation::Nearest) const;
+
+private:
+    int count;
+    int sourceRows;
+    int sourceCols;
+    mutable std::mutex mutex;
+    mutable std::vector<Image> levels;
+};
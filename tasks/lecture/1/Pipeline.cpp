@@ -0,0 +1,293 @@
+#include "Pipeline.h"
+#include "lut.h"
+#include "ops.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+
+namespace
+{
+    // Source coordinates of every output column/row; crop slices them, resize resamples them.
+    struct CoordinateMap
+    {
+        std::vector<int> xs;
+        std::vector<int> ys;
+    };
+
+    std::vector<int> identity(int size)
+    {
+        std::vector<int> v(static_cast<std::size_t>(size));
+        for (int i = 0; i < size; ++i)
+        {
+            v[static_cast<std::size_t>(i)] = i;
+        }
+        return v;
+    }
+
+    // Same index rule as resize_nearest.
+    std::vector<int> resample_nearest(const std::vector<int>& axis, int newSize)
+    {
+        const int oldSize = static_cast<int>(axis.size());
+        const float scale = static_cast<float>(oldSize) / static_cast<float>(newSize);
+        std::vector<int> v(static_cast<std::size_t>(newSize));
+        for (int i = 0; i < newSize; ++i)
+        {
+            int j = static_cast<int>(i * scale);
+            if (j >= oldSize) j = oldSize - 1;
+            v[static_cast<std::size_t>(i)] = axis[static_cast<std::size_t>(j)];
+        }
+        return v;
+    }
+
+    // Same bounds rule as crop(): Range semantics on each axis.
+    bool slice(std::vector<int>& axis, int start, int length)
+    {
+        const Range range(start, start + length);
+        const int size = static_cast<int>(axis.size());
+        const int s = range.start() > size ? size : range.start();
+        const int e = range.end() > size ? size : range.end();
+        if (range.empty() || s >= e)
+        {
+            return false;
+        }
+        axis = std::vector<int>(axis.begin() + s, axis.begin() + e);
+        return true;
+    }
+
+    bool is_run(const std::vector<int>& axis)
+    {
+        for (std::size_t i = 1; i < axis.size(); ++i)
+        {
+            if (axis[i] != axis[0] + static_cast<int>(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+Pipeline& Pipeline::crop(int x, int y, int w, int h)
+{
+    stages.push_back(Stage{ StageKind::Crop, x, y, w, h, kIdentityLut });
+    return *this;
+}
+
+Pipeline& Pipeline::grayscale()
+{
+    stages.push_back(Stage{ StageKind::Grayscale, 0, 0, 0, 0, kIdentityLut });
+    return *this;
+}
+
+Pipeline& Pipeline::invert()
+{
+    stages.push_back(Stage{ StageKind::Invert, 0, 0, 0, 0, kInvertLut });
+    return *this;
+}
+
+Pipeline& Pipeline::resize(int newWidth, int newHeight)
+{
+    stages.push_back(Stage{ StageKind::Resize, 0, 0, newWidth, newHeight, kIdentityLut });
+    return *this;
+}
+
+Pipeline& Pipeline::brightness(int delta)
+{
+    return lut(lut_brightness(delta));
+}
+
+Pipeline& Pipeline::contrast(double factor)
+{
+    return lut(lut_contrast(factor));
+}
+
+Pipeline& Pipeline::gamma(double gamma)
+{
+    return lut(lut_gamma(gamma));
+}
+
+Pipeline& Pipeline::threshold(int level)
+{
+    return lut(lut_threshold(level));
+}
+
+Pipeline& Pipeline::posterize(int levels)
+{
+    return lut(lut_posterize(levels));
+}
+
+Pipeline& Pipeline::lut(const Lut& table)
+{
+    stages.push_back(Stage{ StageKind::Point, 0, 0, 0, 0, table });
+    return *this;
+}
+
+bool Pipeline::empty() const
+{
+    return stages.empty();
+}
+
+std::size_t Pipeline::size() const
+{
+    return stages.size();
+}
+
+Image Pipeline::run(const Image& src) const
+{
+    IMG_PROFILE_SCOPE("pipeline", profile_bytes(src));
+    if (src.empty())
+    {
+        return Image();
+    }
+    if (src.depth() != PixelDepth::U8 || src.isPlanar())
+    {
+        return runStaged(src);
+    }
+    if (src.isMirrored())
+    {
+        return run(src.unmirrored());
+    }
+
+    CoordinateMap map{ identity(src.cols()), identity(src.rows()) };
+    const int srcChannels = src.channels();
+    int channels = srcChannels;
+
+    // Per-pixel part of the chain: the point ops before the (first effective) grayscale, the grayscale,
+    // the point ops after it.
+    Lut before = kIdentityLut;
+    bool gray = false;
+    Lut after = kIdentityLut;
+
+    for (const Stage& stage : stages)
+    {
+        switch (stage.kind)
+        {
+        case StageKind::Crop:
+            if (stage.width <= 0 || stage.height <= 0 ||
+                !slice(map.xs, stage.x, stage.width) || !slice(map.ys, stage.y, stage.height))
+            {
+                return Image();
+            }
+            break;
+        case StageKind::Resize:
+            if (stage.width <= 0 || stage.height <= 0)
+            {
+                return Image();
+            }
+            map.xs = resample_nearest(map.xs, stage.width);
+            map.ys = resample_nearest(map.ys, stage.height);
+            break;
+        case StageKind::Grayscale:
+            if (channels != 1)
+            {
+                gray = true;
+                channels = 1;
+            }
+            break;
+        case StageKind::Invert:
+        case StageKind::Point:
+            if (gray)
+            {
+                after = chain_luts(after, stage.table);
+            }
+            else
+            {
+                before = chain_luts(before, stage.table);
+            }
+            break;
+        }
+    }
+
+    const int outW = static_cast<int>(map.xs.size());
+    const int outH = static_cast<int>(map.ys.size());
+    Image dst(outH, outW, channels);
+    if (dst.empty())
+    {
+        return Image();
+    }
+
+    const PixelKernels& kernels = active_kernels();
+    const LutRowPass beforePass(before);
+    const LutRowPass afterPass(after);
+    const bool contiguousX = is_run(map.xs);
+    const std::size_t pixelBytes = static_cast<std::size_t>(srcChannels);
+    const std::size_t srcRunBytes = static_cast<std::size_t>(outW) * pixelBytes;
+
+    parallel_rows(outH, dst.step(), [&](int begin, int end)
+    {
+        // One row of scratch per band replaces the full-size intermediates of the eager ops.
+        std::vector<unsigned char> scratch(gray ? srcRunBytes : 0);
+
+        for (int y = begin; y < end; ++y)
+        {
+            const unsigned char* srcRow = src.ptr(map.ys[static_cast<std::size_t>(y)]);
+            unsigned char* dstRow = dst.ptr(y);
+
+            // Pixels of this output row in source layout, gathered only when the columns were resampled.
+            unsigned char* gatherTarget = gray ? scratch.data() : dstRow;
+            const unsigned char* pixels = srcRow + static_cast<std::size_t>(map.xs[0]) * pixelBytes;
+            if (!contiguousX)
+            {
+                for (int x = 0; x < outW; ++x)
+                {
+                    std::memcpy(gatherTarget + static_cast<std::size_t>(x) * pixelBytes,
+                                srcRow + static_cast<std::size_t>(map.xs[static_cast<std::size_t>(x)]) * pixelBytes,
+                                pixelBytes);
+                }
+                pixels = gatherTarget;
+            }
+
+            if (!gray)
+            {
+                beforePass.run(pixels, dstRow, srcRunBytes);
+                continue;
+            }
+
+            if (!beforePass.identity())
+            {
+                beforePass.run(pixels, scratch.data(), srcRunBytes);
+                pixels = scratch.data();
+            }
+            kernels.grayRow(pixels, dstRow, outW, srcChannels);
+            if (!afterPass.identity())
+            {
+                afterPass.run(dstRow, dstRow, static_cast<std::size_t>(outW));
+            }
+        }
+    });
+
+    return dst;
+}
+
+Image Pipeline::runStaged(const Image& src) const
+{
+    Image current = src;
+    for (const Stage& stage : stages)
+    {
+        switch (stage.kind)
+        {
+        case StageKind::Crop:
+            current = ::crop(current, stage.x, stage.y, stage.width, stage.height);
+            break;
+        case StageKind::Resize:
+            current = resize_nearest(current, stage.width, stage.height);
+            break;
+        case StageKind::Grayscale:
+            current = to_grayscale(current);
+            break;
+        case StageKind::Invert:
+            current = ::invert(current);
+            break;
+        case StageKind::Point:
+            current = apply_lut(current, stage.table);
+            break;
+        }
+        if (current.empty())
+        {
+            return Image();
+        }
+    }
+    return stages.empty() ? src.clone() : current;
+}
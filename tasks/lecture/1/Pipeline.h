@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include "Image.h"
+#include "lut.h"
+
+// Lazily recorded chain of ops from ops.h, evaluated in a single pass by run().
+//
+// crop and resize only select source pixels, and grayscale and the point ops
+// (lut.h) only look at one pixel, so the chain is split into a source-coordinate
+// map per axis plus a per-pixel transform: the point ops on each side of the
+// grayscale compose into one table. No intermediate image is allocated; the
+// result is identical to calling the ops one after another.
+class Pipeline
+{
+public:
+    Pipeline& crop(int x, int y, int w, int h);
+    Pipeline& grayscale();
+    Pipeline& invert();
+    Pipeline& resize(int newWidth, int newHeight);
+
+    // Point ops through lut.h tables; they need 8-bit images.
+    Pipeline& brightness(int delta);
+    Pipeline& contrast(double factor);
+    Pipeline& gamma(double gamma);
+    Pipeline& threshold(int level);
+    Pipeline& posterize(int levels);
+    Pipeline& lut(const Lut& table);
+
+    bool empty() const;
+    std::size_t size() const;
+
+    Image run(const Image& src) const;
+
+private:
+    enum class StageKind
+    {
+        Crop,
+        Grayscale,
+        Invert,
+        Resize,
+        Point
+    };
+
+    struct Stage
+    {
+        StageKind kind;
+        int x;
+        int y;
+        int width;
+        int height;
+        Lut table;  // per-sample map of Invert and Point stages, identity for the others
+    };
+
+    std::vector<Stage> stages;
+
+    // The fused pass works on 8-bit rows; other depths apply the ops one by one.
+    Image runStaged(const Image& src) const;
+};
@@ -0,0 +1,122 @@
+#include "Profile.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+    std::atomic<bool> g_profiling{ false };
+    std::atomic<std::uint64_t> g_allocations{ 0 };
+    std::atomic<std::uint64_t> g_allocatedBytes{ 0 };
+
+    std::mutex& stages_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    std::vector<ProfileStage>& stages()
+    {
+        static std::vector<ProfileStage> list;
+        return list;
+    }
+
+    // Innermost active scope of this thread; scopes link to their parents.
+    thread_local const ProfileScope* t_innermost = nullptr;
+
+    std::int64_t now_nanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+void set_profiling_enabled(bool enabled)
+{
+    g_profiling.store(enabled, std::memory_order_relaxed);
+}
+
+bool profiling_enabled()
+{
+    return g_profiling.load(std::memory_order_relaxed);
+}
+
+void reset_profile()
+{
+    std::lock_guard<std::mutex> lock(stages_mutex());
+    stages().clear();
+    g_allocations = 0;
+    g_allocatedBytes = 0;
+}
+
+ProfileReport profile_report()
+{
+    ProfileReport report;
+    {
+        std::lock_guard<std::mutex> lock(stages_mutex());
+        report.stages = stages();
+    }
+    report.allocations = g_allocations;
+    report.allocatedBytes = g_allocatedBytes;
+    return report;
+}
+
+ProfileScope::ProfileScope(const char* name, std::uint64_t bytes)
+    : stageName(name), parent(nullptr), stageBytes(bytes), startNanos(0), active(false)
+{
+    if (!g_profiling.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    for (const ProfileScope* scope = t_innermost; scope != nullptr; scope = scope->parent)
+    {
+        if (std::strcmp(scope->stageName, name) == 0)
+        {
+            return;
+        }
+    }
+    parent = t_innermost;
+    t_innermost = this;
+    active = true;
+    startNanos = now_nanos();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!active)
+    {
+        return;
+    }
+    const double seconds = static_cast<double>(now_nanos() - startNanos) * 1e-9;
+    t_innermost = parent;
+
+    std::lock_guard<std::mutex> lock(stages_mutex());
+    std::vector<ProfileStage>& list = stages();
+    auto it = list.begin();
+    while (it != list.end() && it->name != stageName)
+    {
+        ++it;
+    }
+    if (it == list.end())
+    {
+        it = list.insert(list.end(), ProfileStage{ stageName, 0, 0.0, 0 });
+    }
+    ++it->calls;
+    it->seconds += seconds;
+    it->bytes += stageBytes;
+}
+
+void ProfileScope::addBytes(std::uint64_t bytes)
+{
+    stageBytes += bytes;
+}
+
+void profile_count_allocation(std::uint64_t bytes)
+{
+    if (g_profiling.load(std::memory_order_relaxed))
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
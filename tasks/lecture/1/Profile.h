@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Image.h"
+
+// Opt-in instrumentation of the image library. Probes are the IMG_PROFILE_* macros below: built with
+// IMG_PROFILING=0 they expand to nothing, otherwise each checks one relaxed atomic flag until
+// set_profiling_enabled(true). Stage times are inclusive (rotate90 also shows up under transpose)
+// and summed over threads; a call nested in a stage of the same name is not counted again.
+
+#ifndef IMG_PROFILING
+#define IMG_PROFILING 1
+#endif
+
+struct ProfileStage
+{
+    std::string name;
+    std::uint64_t calls = 0;
+    double seconds = 0.0;
+    std::uint64_t bytes = 0;
+};
+
+struct ProfileReport
+{
+    // In order of each stage's first completed call, so nested stages come before their callers.
+    std::vector<ProfileStage> stages;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocatedBytes = 0;
+};
+
+void set_profiling_enabled(bool enabled);
+bool profiling_enabled();
+void reset_profile();
+ProfileReport profile_report();
+
+// Times one call of a stage; `name` must be a string literal.
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, std::uint64_t bytes);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    void addBytes(std::uint64_t bytes);
+
+private:
+    const char* stageName;
+    const ProfileScope* parent;
+    std::uint64_t stageBytes;
+    std::int64_t startNanos;
+    bool active;
+};
+
+void profile_count_allocation(std::uint64_t bytes);
+
+// Pixel bytes of an image, the unit of every stage's byte count.
+inline std::uint64_t profile_bytes(const Image& image)
+{
+    return static_cast<std::uint64_t>(image.total()) * image.elemSize();
+}
+
+#if IMG_PROFILING
+#define IMG_PROFILE_SCOPE(name, bytes) ProfileScope imgProfileScope_(name, (bytes))
+#define IMG_PROFILE_BYTES(bytes) imgProfileScope_.addBytes(bytes)
+#define IMG_PROFILE_ALLOCATION(bytes) profile_count_allocation(bytes)
+#else
+#define IMG_PROFILE_SCOPE(name, bytes) ((void)0)
+#define IMG_PROFILE_BYTES(bytes) ((void)0)
+#define IMG_PROFILE_ALLOCATION(bytes) ((void)0)
+#endif
@@ -0,0 +1,349 @@
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMG_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+    constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ull;
+    constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+    constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+    // Temporary files end in this marker plus a per-writer suffix; scans skip them.
+    constexpr const char* kTempMarker = ".tmp";
+
+    inline std::uint64_t rotl(std::uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline std::uint64_t read64(const unsigned char* p)
+    {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline std::uint32_t read32(const unsigned char* p)
+    {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline std::uint64_t mix_round(std::uint64_t acc, std::uint64_t input)
+    {
+        acc += input * kPrime2;
+        return rotl(acc, 31) * kPrime1;
+    }
+
+    inline std::uint64_t merge_round(std::uint64_t acc, std::uint64_t lane)
+    {
+        acc ^= mix_round(0, lane);
+        return acc * kPrime1 + kPrime4;
+    }
+
+    bool hash_file(const std::string& path, std::uint64_t& outHash)
+    {
+#ifdef IMG_HAVE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            ::close(fd);
+            return false;
+        }
+        const std::size_t size = static_cast<std::size_t>(st.st_size);
+        if (size == 0)
+        {
+            ::close(fd);
+            outHash = hash_bytes(nullptr, 0);
+            return true;
+        }
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        outHash = hash_bytes(mapping, size);
+        ::munmap(mapping, size);
+        return true;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        outHash = hash_bytes(bytes.data(), bytes.size());
+        return !in.bad();
+#endif
+    }
+
+    // Unique among the processes and threads writing to the same directory.
+    std::string temp_suffix(std::uint64_t counter)
+    {
+#ifdef IMG_HAVE_MMAP
+        const std::uint64_t process = static_cast<std::uint64_t>(::getpid());
+#else
+        static const std::uint64_t process = std::random_device{}();
+#endif
+        return std::string(kTempMarker) + std::to_string(process) + "-" + std::to_string(counter);
+    }
+}
+
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + size;
+    std::uint64_t h;
+    if (size >= 32)
+    {
+        // Four independent lanes over 32-byte stripes.
+        std::uint64_t v1 = seed + kPrime1 + kPrime2;
+        std::uint64_t v2 = seed + kPrime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - kPrime1;
+        for (const unsigned char* limit = end - 32; p <= limit; p += 32)
+        {
+            v1 = mix_round(v1, read64(p));
+            v2 = mix_round(v2, read64(p + 8));
+            v3 = mix_round(v3, read64(p + 16));
+            v4 = mix_round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + kPrime5;
+    }
+    h += static_cast<std::uint64_t>(size);
+
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= mix_round(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (end - p >= 4)
+    {
+        h ^= static_cast<std::uint64_t>(read32(p)) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+ResultCache::ResultCache(const std::string& dir, std::uint64_t maxBytes)
+    : directory(dir), capacity(maxBytes), ready(false), hitCount(0), missCount(0), tempCounter(0), usedBytes(0)
+{
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    ready = !ec && fs::is_directory(directory, ec);
+    if (ready)
+    {
+        usedBytes = scan(false);
+    }
+}
+
+bool ResultCache::valid() const
+{
+    return ready;
+}
+
+bool ResultCache::key(const std::string& inputPath, const std::string& operation, std::string& outKey) const
+{
+    std::uint64_t contentHash = 0;
+    if (!hash_file(inputPath, contentHash))
+    {
+        return false;
+    }
+    const std::uint64_t h = hash_bytes(operation.data(), operation.size(), contentHash);
+    const char* hex = "0123456789abcdef";
+    outKey.assign(16, '0');
+    for (int i = 0; i < 16; ++i)
+    {
+        outKey[static_cast<std::size_t>(i)] = hex[(h >> (60 - 4 * i)) & 0xF];
+    }
+    return true;
+}
+
+std::string ResultCache::entryPath(const std::string& key, const std::string& outPath) const
+{
+    return (fs::path(directory) / (key + fs::path(outPath).extension().string())).string();
+}
+
+bool ResultCache::fetch(const std::string& key, const std::vector<std::string>& outPaths, std::size_t& which)
+{
+    if (ready)
+    {
+        for (std::size_t i = 0; i < outPaths.size(); ++i)
+        {
+            // Another process may evict the entry at any point; a failed copy is a miss. The copy goes
+            // next to the output and is renamed over it, so readers of the output never see part of it.
+            const std::string entry = entryPath(key, outPaths[i]);
+            std::error_code ec;
+            if (!fs::is_regular_file(entry, ec))
+            {
+                continue;
+            }
+            const std::string temp = outPaths[i] + temp_suffix(tempCounter++);
+            if (fs::copy_file(entry, temp, fs::copy_options::overwrite_existing, ec))
+            {
+                fs::rename(temp, outPaths[i], ec);
+            }
+            if (ec)
+            {
+                fs::remove(temp, ec);
+                continue;
+            }
+            fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+            which = i;
+            ++hitCount;
+            return true;
+        }
+    }
+    ++missCount;
+    return false;
+}
+
+bool ResultCache::fetch(const std::string& key, const std::string& outPath)
+{
+    std::size_t which = 0;
+    return fetch(key, std::vector<std::string>{ outPath }, which);
+}
+
+bool ResultCache::store(const std::string& key, const std::string& outPath)
+{
+    if (!ready)
+    {
+        return false;
+    }
+    const std::string entry = entryPath(key, outPath);
+    const std::string temp = entry + temp_suffix(tempCounter++);
+    std::error_code ec;
+    if (!fs::copy_file(outPath, temp, fs::copy_options::overwrite_existing, ec))
+    {
+        fs::remove(temp, ec);
+        return false;
+    }
+    const std::uint64_t size = fs::file_size(temp, ec);
+    // A replaced entry gives its bytes back; one that is not there counts as empty.
+    std::uint64_t replaced = fs::file_size(entry, ec);
+    if (ec)
+    {
+        replaced = 0;
+    }
+    // rename replaces an existing entry atomically, so readers never see a partial file.
+    fs::rename(temp, entry, ec);
+    if (ec)
+    {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(usageMutex);
+    usedBytes = usedBytes - std::min(usedBytes, replaced) + size;
+    if (usedBytes > capacity)
+    {
+        usedBytes = scan(true);
+    }
+    return true;
+}
+
+std::uint64_t ResultCache::hits() const
+{
+    return hitCount;
+}
+
+std::uint64_t ResultCache::misses() const
+{
+    return missCount;
+}
+
+// Sums the entries; with evict, removes the least recently used ones until they fit in 7/8 of
+// the capacity, so that the next few stores do not rescan.
+std::uint64_t ResultCache::scan(bool evict)
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type used;
+        std::uint64_t size;
+    };
+    std::vector<Entry> entries;
+    std::uint64_t total = 0;
+    std::error_code ec;
+    for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code entryEc;
+        if (!it->is_regular_file(entryEc) || it->path().filename().string().find(kTempMarker) != std::string::npos)
+        {
+            continue;
+        }
+        const std::uint64_t size = it->file_size(entryEc);
+        const fs::file_time_type used = it->last_write_time(entryEc);
+        if (entryEc)
+        {
+            continue;
+        }
+        entries.push_back(Entry{ it->path(), used, size });
+        total += size;
+    }
+    if (!evict || total <= capacity)
+    {
+        return total;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    const std::uint64_t target = capacity - capacity / 8;
+    for (const Entry& entry : entries)
+    {
+        if (total <= target)
+        {
+            break;
+        }
+        if (fs::remove(entry.path, ec))
+        {
+            total -= entry.size;
+        }
+    }
+    return total;
+}
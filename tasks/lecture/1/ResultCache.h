@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// XXH64 of `size` bytes.
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+// On-disk cache of finished output files, safe to share between processes. The entry for a key is
+// <dir>/<key><extension of the output path>. Entries are written under a temporary name and renamed
+// into place, so a reader sees a whole file or none. A hit refreshes the entry's mtime, and once the
+// directory holds more than maxBytes the least recently used entries are removed.
+class ResultCache
+{
+public:
+    ResultCache(const std::string& dir, std::uint64_t maxBytes);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // False when the directory cannot be created.
+    bool valid() const;
+
+    // 16 hex digits: the hash of the memory-mapped input file, then of `operation` (everything
+    // besides the input that changes the result) seeded with it. False when the input cannot be read.
+    bool key(const std::string& inputPath, const std::string& operation, std::string& outKey) const;
+
+    // Copies the entry for key to the first of outPaths whose extension has one, and sets
+    // `which` to its index. Like entries, the output is written under a temporary name and renamed.
+    // Counts one hit or one miss.
+    bool fetch(const std::string& key, const std::vector<std::string>& outPaths, std::size_t& which);
+    bool fetch(const std::string& key, const std::string& outPath);
+
+    // Adds the finished file at outPath as the entry for key.
+    bool store(const std::string& key, const std::string& outPath);
+
+    std::uint64_t hits() const;
+    std::uint64_t misses() const;
+
+private:
+    std::string directory;
+    std::uint64_t capacity;
+    bool ready;
+    std::atomic<std::uint64_t> hitCount;
+    std::atomic<std::uint64_t> missCount;
+    std::atomic<std::uint64_t> tempCounter;
+    // Bytes in the directory as of the last scan plus what this process stored since.
+    std::mutex usageMutex;
+    std::uint64_t usedBytes;
+
+    std::string entryPath(const std::string& key, const std::string& outPath) const;
+    std::uint64_t scan(bool evict);
+};
@@ -0,0 +1,202 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+    std::unique_ptr<ThreadPool>& shared_pool()
+    {
+        static std::unique_ptr<ThreadPool> pool;
+        return pool;
+    }
+
+    std::mutex& shared_pool_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    int default_thread_count()
+    {
+        const unsigned hw = std::thread::hardware_concurrency();
+        return hw == 0 ? 1 : static_cast<int>(hw);
+    }
+}
+
+ThreadPool::ThreadPool(int threads)
+    : pending(0),
+      nextQueue(0),
+      stopping(false)
+{
+    const int workerCount = std::max(threads, 1) - 1;
+    for (int i = 0; i < workerCount; ++i)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (int i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, static_cast<std::size_t>(i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+int ThreadPool::threadCount() const
+{
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void ThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)>& fn)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    grain = std::max(grain, 1);
+
+    // Around four chunks per thread keeps stealing useful without drowning in tiny tasks.
+    const int maxChunks = threadCount() * 4;
+    const int chunk = std::max(grain, (count + maxChunks - 1) / maxChunks);
+    const int chunks = (count + chunk - 1) / chunk;
+
+    if (workers.empty() || chunks == 1)
+    {
+        fn(0, count);
+        return;
+    }
+
+    Batch batch;
+    batch.fn = &fn;
+    batch.remaining.store(chunks, std::memory_order_relaxed);
+    batch.finished = false;
+
+    const std::size_t queueCount = queues.size();
+    const unsigned first = nextQueue.fetch_add(1, std::memory_order_relaxed);
+    for (int c = 0; c < chunks; ++c)
+    {
+        Queue& q = *queues[(first + static_cast<unsigned>(c)) % queueCount];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(Task{ &batch, c * chunk, std::min(count, (c + 1) * chunk) });
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending.fetch_add(chunks, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    // The caller is not a worker, so it only steals; any queue is fair game.
+    Task task;
+    while (batch.remaining.load(std::memory_order_acquire) > 0 && trySteal(queueCount, task))
+    {
+        run(task);
+    }
+
+    std::unique_lock<std::mutex> lock(batch.doneMutex);
+    batch.done.wait(lock, [&] { return batch.finished; });
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    std::lock_guard<std::mutex> lock(shared_pool_mutex());
+    std::unique_ptr<ThreadPool>& pool = shared_pool();
+    if (!pool)
+    {
+        pool = std::make_unique<ThreadPool>(default_thread_count());
+    }
+    return *pool;
+}
+
+void ThreadPool::setSharedThreadCount(int threads)
+{
+    std::lock_guard<std::mutex> lock(shared_pool_mutex());
+    shared_pool() = std::make_unique<ThreadPool>(threads > 0 ? threads : default_thread_count());
+}
+
+void ThreadPool::workerLoop(std::size_t self)
+{
+    for (;;)
+    {
+        Task task;
+        if (tryPop(self, task) || trySteal(self, task))
+        {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::tryPop(std::size_t self, Task& task)
+{
+    Queue& q = *queues[self];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())
+    {
+        return false;
+    }
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::trySteal(std::size_t self, Task& task)
+{
+    const std::size_t queueCount = queues.size();
+    for (std::size_t i = 1; i <= queueCount; ++i)
+    {
+        const std::size_t victim = (self + i) % queueCount;
+        if (victim == self)
+        {
+            continue;
+        }
+        Queue& q = *queues[victim];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(const Task& task)
+{
+    Batch* batch = task.batch;
+    (*batch->fn)(task.begin, task.end);
+    if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // The owner may destroy the batch as soon as it observes `finished`, so nothing touches it after the unlock.
+        std::lock_guard<std::mutex> lock(batch->doneMutex);
+        batch->finished = true;
+        batch->done.notify_all();
+    }
+}
+
+void parallel_rows(int rows, std::size_t rowBytes, const std::function<void(int, int)>& fn)
+{
+    constexpr std::size_t kBandBytes = 64 * 1024;
+    const std::size_t perBand = rowBytes == 0 ? 1 : std::max<std::size_t>(1, kBandBytes / rowBytes);
+    const int grain = static_cast<int>(std::min<std::size_t>(perBand, static_cast<std::size_t>(std::max(rows, 1))));
+    ThreadPool::shared().parallelFor(rows, grain, fn);
+}
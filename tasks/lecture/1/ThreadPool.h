@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker owns a deque, pops its own work LIFO and
+// steals FIFO from the others when it runs dry. The thread that calls
+// parallelFor helps until its batch is done, so nested calls cannot deadlock.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Workers plus the calling thread.
+    int threadCount() const;
+
+    // Calls fn(begin, end) on disjoint chunks covering [0, count), each at least `grain` long,
+    // and returns when all of them have finished.
+    void parallelFor(int count, int grain, const std::function<void(int, int)>& fn);
+
+    static ThreadPool& shared();
+    // Replaces the shared pool; must not race with work running on it. threads <= 0 means all cores.
+    static void setSharedThreadCount(int threads);
+
+private:
+    struct Batch
+    {
+        const std::function<void(int, int)>* fn;
+        std::atomic<int> remaining;
+        std::mutex doneMutex;
+        std::condition_variable done;
+        bool finished;
+    };
+
+    struct Task
+    {
+        Batch* batch;
+        int begin;
+        int end;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> pending;
+    std::atomic<unsigned> nextQueue;
+    bool stopping;
+
+    void workerLoop(std::size_t self);
+    bool tryPop(std::size_t self, Task& task);
+    bool trySteal(std::size_t self, Task& task);
+    void run(const Task& task);
+};
+
+// Splits [0, rows) into bands sized so that each holds roughly 64 KiB of rowBytes-wide rows.
+void parallel_rows(int rows, std::size_t rowBytes, const std::function<void(int, int)>& fn);
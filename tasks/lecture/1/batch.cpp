@@ -0,0 +1,207 @@
+#include "batch.h"
+#include "ppm_io.h"
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace
+{
+    std::uint64_t pixel_bytes(const Image& image)
+    {
+        return static_cast<std::uint64_t>(image.rows()) * static_cast<std::uint64_t>(image.cols()) * image.elemSize();
+    }
+
+    bool has_image_extension(const std::filesystem::path& path)
+    {
+        const std::string ext = path.extension().string();
+        return ext == ".ppm" || ext == ".pgm" || ext == ".pam" || ext == ".qoi" ||
+               ext == ".PPM" || ext == ".PGM" || ext == ".PAM" || ext == ".QOI";
+    }
+}
+
+bool list_batch_inputs(const std::string& manifestOrDir, std::vector<std::string>& inputs)
+{
+    inputs.clear();
+    std::error_code ec;
+    if (std::filesystem::is_directory(manifestOrDir, ec))
+    {
+        for (std::filesystem::directory_iterator it(manifestOrDir, ec), end; !ec && it != end; it.increment(ec))
+        {
+            if (it->is_regular_file(ec) && has_image_extension(it->path()))
+            {
+                inputs.push_back(it->path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return !ec;
+    }
+
+    std::ifstream manifest(manifestOrDir);
+    if (!manifest)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        const std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+        const std::size_t last = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(first, last - first + 1));
+    }
+    return true;
+}
+
+std::string batch_output_path(const std::string& outDir, const std::string& input, int channels)
+{
+    std::filesystem::path name = std::filesystem::path(input).filename();
+    // RGBA results go to QOI, which compresses; grey + alpha has no QOI encoding and goes to PAM.
+    name.replace_extension(channels == 1 ? ".pgm" : channels == 2 ? ".pam" : channels == 4 ? ".qoi" : ".ppm");
+    return (std::filesystem::path(outDir) / name).string();
+}
+
+BatchReport run_batch(const std::vector<std::string>& inputs, const std::string& outDir,
+                      const BatchOperation& operation, int jobs,
+                      ResultCache* cache, const std::string& description)
+{
+    BatchReport report;
+    const auto started = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+    if (ec)
+    {
+        for (const std::string& input : inputs)
+        {
+            report.failures.push_back(BatchFailure{ input, "cannot create output directory " + outDir });
+        }
+        return report;
+    }
+
+    if (jobs <= 0)
+    {
+        jobs = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    jobs = std::min<int>(jobs, static_cast<int>(std::max<std::size_t>(inputs.size(), 1)));
+
+    std::atomic<std::size_t> next{ 0 };
+    std::atomic<std::size_t> succeeded{ 0 };
+    std::atomic<std::uint64_t> bytesRead{ 0 };
+    std::atomic<std::uint64_t> bytesWritten{ 0 };
+    std::mutex failuresMutex;
+    std::vector<std::pair<std::size_t, BatchFailure>> failures;
+
+    // Outputs are named by stem alone, so a.ppm and a.pgm, or d1/x.ppm and d2/x.ppm, would
+    // overwrite each other. The first input keeps the name; the others fail before any work.
+    std::vector<char> collides(inputs.size(), 0);
+    std::map<std::string, std::size_t> owners;
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+        const std::string stem = std::filesystem::path(inputs[i]).filename().replace_extension().string();
+        const auto owner = owners.emplace(stem, i);
+        if (!owner.second)
+        {
+            collides[i] = 1;
+            failures.emplace_back(i, BatchFailure{ inputs[i], "output name collides with " + inputs[owner.first->second] });
+        }
+    }
+
+    auto worker = [&]()
+    {
+        // Handles are reassigned per file, so released buffers go back to the pool
+        // and the next image of the same size gets them without a system allocation.
+        Image input;
+        Image output;
+        for (std::size_t i = next.fetch_add(1); i < inputs.size(); i = next.fetch_add(1))
+        {
+            if (collides[i])
+            {
+                continue;
+            }
+            const char* reason = nullptr;
+            std::string key;
+            if (cache != nullptr && cache->key(inputs[i], description, key))
+            {
+                // The output format follows the result's channel count, so every candidate name is tried.
+                const std::vector<std::string> candidates = { batch_output_path(outDir, inputs[i], 1),
+                                                              batch_output_path(outDir, inputs[i], 2),
+                                                              batch_output_path(outDir, inputs[i], 3),
+                                                              batch_output_path(outDir, inputs[i], 4) };
+                std::size_t which = 0;
+                if (cache->fetch(key, candidates, which))
+                {
+                    ++succeeded;
+                    continue;
+                }
+            }
+            if (!load_image_mapped(inputs[i], input))
+            {
+                reason = "failed to load image";
+            }
+            else
+            {
+                bytesRead += pixel_bytes(input);
+                output = operation(input);
+                if (output.empty())
+                {
+                    reason = "operation failed";
+                }
+                else if (!save_image(batch_output_path(outDir, inputs[i], output.channels()), output))
+                {
+                    reason = "failed to save image";
+                }
+                else
+                {
+                    bytesWritten += pixel_bytes(output);
+                    ++succeeded;
+                    if (!key.empty())
+                    {
+                        cache->store(key, batch_output_path(outDir, inputs[i], output.channels()));
+                    }
+                }
+            }
+            input.release();
+            output.release();
+
+            if (reason != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(failuresMutex);
+                failures.emplace_back(i, BatchFailure{ inputs[i], reason });
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < jobs; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::sort(failures.begin(), failures.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& failure : failures)
+    {
+        report.failures.push_back(std::move(failure.second));
+    }
+    report.succeeded = succeeded;
+    report.bytesRead = bytesRead;
+    report.bytesWritten = bytesWritten;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Image.h"
+
+class ResultCache;
+
+// Many images through one operation in a single process: files are handed
+// to `jobs` worker threads one at a time, pixel buffers are recycled by the
+// Image buffer pool, and a failing file is recorded instead of stopping the run.
+
+// Returns an empty Image on failure.
+using BatchOperation = std::function<Image(const Image&)>;
+
+struct BatchFailure
+{
+    std::string path;
+    std::string reason;
+};
+
+struct BatchReport
+{
+    std::size_t succeeded = 0;
+    std::vector<BatchFailure> failures;
+    std::uint64_t bytesRead = 0;
+    std::uint64_t bytesWritten = 0;
+    double seconds = 0.0;
+};
+
+// A directory yields its .pgm/.ppm/.qoi files sorted by name; any other path is read
+// as a manifest with one input per line (blank lines and '#' comments skipped).
+bool list_batch_inputs(const std::string& manifestOrDir, std::vector<std::string>& inputs);
+
+// outDir/<input stem>.pgm, .pam, .ppm or .qoi for 1, 2, 3 or 4 channels in the result.
+std::string batch_output_path(const std::string& outDir, const std::string& input, int channels);
+
+// jobs <= 0 means one worker per core. Failures are listed in input order.
+// Inputs whose output name is already taken by an earlier input (same stem) fail unprocessed.
+// With a cache, an input whose result is already stored under `description` (the operation
+// and its arguments) is copied from there instead of being loaded and processed.
+BatchReport run_batch(const std::vector<std::string>& inputs, const std::string& outDir,
+                      const BatchOperation& operation, int jobs,
+                      ResultCache* cache = nullptr, const std::string& description = std::string());
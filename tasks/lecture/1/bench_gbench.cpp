@@ -0,0 +1,474 @@
+#include <benchmark/benchmark.h>
+#include "Image.h"
+#include "Range.h"
+#include "ops.h"
+#include "ppm_io.h"
+#include "filters.h"
+#include "stats.h"
+#include "color.h"
+#include "resize.h"
+#include "ImagePyramid.h"
+#include "lut.h"
+#include "Pipeline.h"
+#include "composite.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Arguments are {size index, channels}; bytes/s counts source pixel bytes per iteration.
+// JSON for comparing releases: --benchmark_out=FILE --benchmark_out_format=json (or the bench_json target).
+
+namespace
+{
+    struct BenchSize
+    {
+        const char* name;
+        int width;
+        int height;
+    };
+
+    constexpr BenchSize kSizes[] = {
+        { "VGA", 640, 480 },
+        { "FHD", 1920, 1080 },
+        { "4K", 3840, 2160 },
+        { "8K", 7680, 4320 },
+        { "16K", 15360, 8640 },
+    };
+
+    // One image at a time: runs of the same benchmark share it and 16K images are not kept around.
+    const Image& source(int sizeIndex, int channels)
+    {
+        static Image cached;
+        static int cachedSize = -1;
+        static int cachedChannels = 0;
+        if (sizeIndex != cachedSize || channels != cachedChannels)
+        {
+            const BenchSize& size = kSizes[sizeIndex];
+            cached.release();
+            cached = Image(size.height, size.width, channels);
+            std::uint32_t state = 0x9E3779B9u;
+            cached.forEachRow([&](unsigned char* row, int)
+            {
+                for (int i = 0; i < size.width * channels; ++i)
+                {
+                    state = state * 1664525u + 1013904223u;
+                    row[i] = static_cast<unsigned char>(state >> 24);
+                }
+            });
+            cachedSize = sizeIndex;
+            cachedChannels = channels;
+        }
+        return cached;
+    }
+
+    // Gradients with a little noise: compresses like a photograph, where source() does not compress at all.
+    const Image& photo_source(int sizeIndex, int channels)
+    {
+        static Image cached;
+        static int cachedSize = -1;
+        static int cachedChannels = 0;
+        if (sizeIndex != cachedSize || channels != cachedChannels)
+        {
+            const BenchSize& size = kSizes[sizeIndex];
+            cached.release();
+            cached = Image(size.height, size.width, channels);
+            std::uint32_t state = 0x9E3779B9u;
+            cached.forEachRow([&](unsigned char* row, int y)
+            {
+                for (int x = 0; x < size.width; ++x)
+                {
+                    for (int k = 0; k < channels; ++k)
+                    {
+                        state = state * 1664525u + 1013904223u;
+                        const int gradient = (x * 256 / size.width + y * 192 / size.height + k * 60) & 255;
+                        row[x * channels + k] = static_cast<unsigned char>(std::min(255, gradient + static_cast<int>(state >> 30)));
+                    }
+                }
+            });
+            cachedSize = sizeIndex;
+            cachedChannels = channels;
+        }
+        return cached;
+    }
+
+    // The central half of the image in each direction: a strided view.
+    Image central_roi(const Image& img)
+    {
+        return img(Range(img.rows() / 4, img.rows() / 4 + img.rows() / 2),
+                   Range(img.cols() / 4, img.cols() / 4 + img.cols() / 2));
+    }
+
+    std::int64_t pixel_bytes(const Image& img)
+    {
+        return static_cast<std::int64_t>(img.rows()) * img.cols() * img.channels();
+    }
+
+    void finish(benchmark::State& state, std::int64_t bytesPerIteration)
+    {
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * bytesPerIteration);
+        state.SetLabel(kSizes[state.range(0)].name);
+    }
+
+    void all_sizes(benchmark::internal::Benchmark* b, std::initializer_list<int> channels)
+    {
+        b->ArgNames({ "size", "ch" });
+        for (int i = 0; i < static_cast<int>(std::size(kSizes)); ++i)
+        {
+            for (int ch : channels)
+            {
+                b->Args({ i, ch });
+            }
+        }
+        b->Unit(benchmark::kMillisecond)->UseRealTime();
+    }
+
+    void pixel_sizes(benchmark::internal::Benchmark* b)
+    {
+        all_sizes(b, { 1, 3, 4 });
+    }
+
+    void color_sizes(benchmark::internal::Benchmark* b)
+    {
+        all_sizes(b, { 3, 4 });
+    }
+
+    // PGM, PPM and, with alpha, PAM.
+    void file_sizes(benchmark::internal::Benchmark* b)
+    {
+        all_sizes(b, { 1, 3, 4 });
+    }
+
+    // The channel count both PPM and QOI can store.
+    void rgb_sizes(benchmark::internal::Benchmark* b)
+    {
+        all_sizes(b, { 3 });
+    }
+
+    std::string bench_path(const benchmark::State& state, const char* extension = ".pnm")
+    {
+        return (std::filesystem::temp_directory_path() /
+                ("image_bench_" + std::to_string(state.range(0)) + "_" + std::to_string(state.range(1)) + extension)).string();
+    }
+}
+
+static void BM_Clone(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image copy = img.clone();
+        benchmark::DoNotOptimize(copy.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Clone)->Apply(pixel_sizes);
+
+static void BM_CloneRoi(benchmark::State& state)
+{
+    const Image roi = central_roi(source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1))));
+    for (auto _ : state)
+    {
+        Image copy = roi.clone();
+        benchmark::DoNotOptimize(copy.data());
+    }
+    finish(state, pixel_bytes(roi));
+}
+BENCHMARK(BM_CloneRoi)->Apply(pixel_sizes);
+
+static void BM_Invert(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = invert(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Invert)->Apply(pixel_sizes);
+
+// invert, gamma and threshold: three eager passes against one fused table.
+static void BM_PointOps(benchmark::State& state, bool fused)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const Pipeline pipeline = Pipeline().invert().gamma(2.2).threshold(128);
+    const Lut gamma = lut_gamma(2.2);
+    const Lut threshold = lut_threshold(128);
+    for (auto _ : state)
+    {
+        Image out = fused ? pipeline.run(img) : apply_lut(apply_lut(invert(img), gamma), threshold);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK_CAPTURE(BM_PointOps, eager, false)->Apply(pixel_sizes);
+BENCHMARK_CAPTURE(BM_PointOps, fused, true)->Apply(pixel_sizes);
+
+// A full-frame RGBA overlay blended in place onto an RGB or RGBA image.
+static void BM_AlphaBlend(benchmark::State& state)
+{
+    const Image mark = source(static_cast<int>(state.range(0)), 4).clone();
+    Image img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1))).clone();
+    for (auto _ : state)
+    {
+        alpha_blend(img, mark, 0, 0);
+        benchmark::ClobberMemory();
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_AlphaBlend)->Apply(color_sizes);
+
+static void BM_ToGrayscale(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = to_grayscale(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_ToGrayscale)->Apply(color_sizes);
+
+static void BM_ToPlanar(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = to_planar(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_ToPlanar)->Apply(color_sizes);
+
+static void BM_ToGrayscalePlanar(benchmark::State& state)
+{
+    const Image planar = to_planar(source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1))));
+    for (auto _ : state)
+    {
+        Image out = to_grayscale(planar);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(planar));
+}
+BENCHMARK(BM_ToGrayscalePlanar)->Apply(color_sizes);
+
+static void BM_ResizeNearestHalf(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = resize_nearest(img, img.cols() / 2, img.rows() / 2);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_ResizeNearestHalf)->Apply(pixel_sizes);
+
+// Three area-filtered thumbnails, each from the full image or from a pyramid built in the same iteration.
+static void BM_Thumbnails(benchmark::State& state, bool pyramid)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        ImagePyramid levels(img);
+        for (int divisor : { 3, 6, 12 })
+        {
+            const int w = img.cols() / divisor;
+            const int h = img.rows() / divisor;
+            Image out = pyramid ? levels.resize(w, h, Interpolation::Area) : resize(img, w, h, Interpolation::Area);
+            benchmark::DoNotOptimize(out.data());
+        }
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK_CAPTURE(BM_Thumbnails, direct, false)->Apply(pixel_sizes);
+BENCHMARK_CAPTURE(BM_Thumbnails, pyramid, true)->Apply(pixel_sizes);
+
+static void BM_Transpose(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = transpose(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Transpose)->Apply(pixel_sizes);
+
+static void BM_Rotate90(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = rotate90(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Rotate90)->Apply(pixel_sizes);
+
+static void BM_Rotate180(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = rotate180(img);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Rotate180)->Apply(pixel_sizes);
+
+static void BM_Crop(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = crop(img, img.cols() / 4, img.rows() / 4, img.cols() / 2, img.rows() / 2);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img) / 4);
+}
+BENCHMARK(BM_Crop)->Apply(pixel_sizes);
+
+static void BM_GaussianBlur(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = gaussian_blur(img, 2.0);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_GaussianBlur)->Apply(pixel_sizes);
+
+static void BM_BoxBlur(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = box_blur(img, 7);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_BoxBlur)->Apply(pixel_sizes);
+
+static void BM_Stats(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        ImageStats stats = compute_stats(img);
+        benchmark::DoNotOptimize(stats.channels.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK(BM_Stats)->Apply(pixel_sizes);
+
+static void BM_ConvertColor(benchmark::State& state, ColorSpace to)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _ : state)
+    {
+        Image out = convert_color(img, ColorSpace::SRGB, to);
+        benchmark::DoNotOptimize(out.data());
+    }
+    finish(state, pixel_bytes(img));
+}
+BENCHMARK_CAPTURE(BM_ConvertColor, Linear, ColorSpace::Linear)->Apply(color_sizes);
+BENCHMARK_CAPTURE(BM_ConvertColor, YCbCr601, ColorSpace::YCbCr601)->Apply(color_sizes);
+BENCHMARK_CAPTURE(BM_ConvertColor, HSV, ColorSpace::HSV)->Apply(color_sizes);
+
+static void BM_SaveImage(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const std::string path = bench_path(state);
+    for (auto _ : state)
+    {
+        if (!save_image(path, img))
+        {
+            state.SkipWithError("save_image failed");
+            break;
+        }
+    }
+    finish(state, pixel_bytes(img));
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_SaveImage)->Apply(file_sizes);
+
+static void BM_LoadImage(benchmark::State& state)
+{
+    const Image& img = source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const std::string path = bench_path(state);
+    if (!save_image(path, img))
+    {
+        state.SkipWithError("save_image failed");
+        return;
+    }
+    for (auto _ : state)
+    {
+        Image loaded;
+        if (!load_image(path, loaded))
+        {
+            state.SkipWithError("load_image failed");
+            break;
+        }
+        benchmark::DoNotOptimize(loaded.data());
+    }
+    finish(state, pixel_bytes(img));
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_LoadImage)->Apply(file_sizes);
+
+// PPM against QOI on photo_source(); "ratio" is pixel bytes over file bytes.
+static void BM_SaveFile(benchmark::State& state, const char* extension)
+{
+    const Image& img = photo_source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const std::string path = bench_path(state, extension);
+    for (auto _ : state)
+    {
+        if (!save_image(path, img))
+        {
+            state.SkipWithError("save_image failed");
+            break;
+        }
+    }
+    finish(state, pixel_bytes(img));
+    state.counters["ratio"] = static_cast<double>(pixel_bytes(img)) / static_cast<double>(std::filesystem::file_size(path));
+    std::filesystem::remove(path);
+}
+BENCHMARK_CAPTURE(BM_SaveFile, ppm, ".ppm")->Apply(rgb_sizes);
+BENCHMARK_CAPTURE(BM_SaveFile, qoi, ".qoi")->Apply(rgb_sizes);
+
+static void BM_LoadFile(benchmark::State& state, const char* extension)
+{
+    const Image& img = photo_source(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const std::string path = bench_path(state, extension);
+    if (!save_image(path, img))
+    {
+        state.SkipWithError("save_image failed");
+        return;
+    }
+    for (auto _ : state)
+    {
+        Image loaded;
+        if (!load_image(path, loaded))
+        {
+            state.SkipWithError("load_image failed");
+            break;
+        }
+        benchmark::DoNotOptimize(loaded.data());
+    }
+    finish(state, pixel_bytes(img));
+    state.counters["ratio"] = static_cast<double>(pixel_bytes(img)) / static_cast<double>(std::filesystem::file_size(path));
+    std::filesystem::remove(path);
+}
+BENCHMARK_CAPTURE(BM_LoadFile, ppm, ".ppm")->Apply(rgb_sizes);
+BENCHMARK_CAPTURE(BM_LoadFile, qoi, ".qoi")->Apply(rgb_sizes);
@@ -0,0 +1,392 @@
+#include "color.h"
+#include "ops.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    bool has_alpha(int channels)
+    {
+        return channels == 2 || channels == 4;
+    }
+
+    double srgb_to_linear_value(double v)
+    {
+        return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+    }
+
+    double linear_to_srgb_value(double v)
+    {
+        return v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+    }
+
+    template <typename T>
+    std::vector<T> build_transfer_lut(bool toLinear)
+    {
+        constexpr double maxValue = std::numeric_limits<T>::max();
+        std::vector<T> lut(static_cast<std::size_t>(maxValue) + 1);
+        for (std::size_t v = 0; v < lut.size(); ++v)
+        {
+            const double x = static_cast<double>(v) / maxValue;
+            const double y = toLinear ? srgb_to_linear_value(x) : linear_to_srgb_value(x);
+            lut[v] = static_cast<T>(std::lround(std::clamp(y, 0.0, 1.0) * maxValue));
+        }
+        return lut;
+    }
+
+    // Built on first use; the 16-bit tables hold 65536 entries each.
+    template <typename T>
+    const std::vector<T>& transfer_lut(bool toLinear)
+    {
+        static const std::vector<T> toLinearLut = build_transfer_lut<T>(true);
+        static const std::vector<T> toSrgbLut = build_transfer_lut<T>(false);
+        return toLinear ? toLinearLut : toSrgbLut;
+    }
+
+    // Samples k < colourChannels of every pixel go through the table, the rest are copied.
+    template <typename T>
+    void transfer_rows(const Image& src, Image& dst, const std::vector<T>& lut, int colourChannels)
+    {
+        const int cols = src.cols();
+        const int ch = src.channels();
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * src.elemSize(), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                const T* s = src.ptr<T>(y, 0);
+                T* d = dst.ptr<T>(y, 0);
+                if (colourChannels == ch)
+                {
+                    const std::size_t samples = static_cast<std::size_t>(cols) * static_cast<std::size_t>(ch);
+                    for (std::size_t i = 0; i < samples; ++i)
+                    {
+                        d[i] = lut[s[i]];
+                    }
+                    continue;
+                }
+                for (int x = 0; x < cols; ++x)
+                {
+                    for (int k = 0; k < ch; ++k)
+                    {
+                        d[k] = k < colourChannels ? lut[s[k]] : s[k];
+                    }
+                    s += ch;
+                    d += ch;
+                }
+            }
+        });
+    }
+
+    template <typename T>
+    void run_transfer(const Image& src, Image& dst, bool toLinear)
+    {
+        const std::vector<T>& lut = transfer_lut<T>(toLinear);
+        const int ch = src.channels();
+        const int colour = has_alpha(ch) ? ch - 1 : ch;
+        if (!src.isPlanar())
+        {
+            transfer_rows<T>(src, dst, lut, colour);
+            return;
+        }
+        for (int k = 0; k < ch; ++k)
+        {
+            Image to = dst.plane(k);
+            transfer_rows<T>(src.plane(k), to, lut, k < colour ? 1 : 0);
+        }
+    }
+
+    Image transfer(const Image& src, bool toLinear)
+    {
+        if (src.depth() == PixelDepth::F32)
+        {
+            return Image();
+        }
+        Image dst(src.rows(), src.cols(), src.channels(), src.depth(), src.layout());
+        if (src.depth() == PixelDepth::U8)
+        {
+            run_transfer<std::uint8_t>(src, dst, toLinear);
+        }
+        else
+        {
+            run_transfer<std::uint16_t>(src, dst, toLinear);
+        }
+        return dst;
+    }
+
+    // Arguments of PixelKernels::colorMatrixRow.
+    struct ColorMatrix
+    {
+        std::array<short, 9> coefficients;
+        std::array<int, 3> bias;
+    };
+
+    constexpr int kOne = 1 << kColorMatrixShift;
+    constexpr int kHalf = kOne / 2;
+
+    short fixed(double v)
+    {
+        return static_cast<short>(std::lround(v * kOne));
+    }
+
+    // Y = kr R + kg G + kb B, Cb = (B - Y) / (2 - 2 kb) + 128, Cr = (R - Y) / (2 - 2 kr) + 128.
+    // One weight per row is derived from the others so that the Y row sums to exactly one and
+    // the chroma rows to zero: white stays 255 and grays get Cb = Cr = 128.
+    ColorMatrix rgb_to_ycbcr_matrix(double kr, double kb)
+    {
+        const double kg = 1.0 - kr - kb;
+        const short yr = fixed(kr);
+        const short yb = fixed(kb);
+        const short cbr = fixed(-kr / (2.0 - 2.0 * kb));
+        const short cbg = fixed(-kg / (2.0 - 2.0 * kb));
+        const short crg = fixed(-kg / (2.0 - 2.0 * kr));
+        const short crb = fixed(-kb / (2.0 - 2.0 * kr));
+        return ColorMatrix{ { yr, static_cast<short>(kOne - yr - yb), yb,
+                              cbr, cbg, static_cast<short>(-cbr - cbg),
+                              static_cast<short>(-crg - crb), crg, crb },
+                            { kHalf, (128 << kColorMatrixShift) + kHalf, (128 << kColorMatrixShift) + kHalf } };
+    }
+
+    // Inverse of the above; the -128 chroma offsets are folded into the bias.
+    ColorMatrix ycbcr_to_rgb_matrix(double kr, double kb)
+    {
+        const double kg = 1.0 - kr - kb;
+        const short crToR = fixed(2.0 - 2.0 * kr);
+        const short cbToG = fixed(-kb * (2.0 - 2.0 * kb) / kg);
+        const short crToG = fixed(-kr * (2.0 - 2.0 * kr) / kg);
+        const short cbToB = fixed(2.0 - 2.0 * kb);
+        ColorMatrix matrix{ { static_cast<short>(kOne), 0, crToR,
+                              static_cast<short>(kOne), cbToG, crToG,
+                              static_cast<short>(kOne), cbToB, 0 },
+                            {} };
+        for (int k = 0; k < 3; ++k)
+        {
+            matrix.bias[k] = kHalf - 128 * (matrix.coefficients[3 * k + 1] + matrix.coefficients[3 * k + 2]);
+        }
+        return matrix;
+    }
+
+    Image apply_matrix(const Image& src, const ColorMatrix& matrix)
+    {
+        const int cols = src.cols();
+        const int ch = src.channels();
+        Image dst(src.rows(), cols, ch);
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * static_cast<std::size_t>(ch), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                kernels.colorMatrixRow(src.ptr(y), dst.ptr(y), cols, ch, matrix.coefficients.data(), matrix.bias.data());
+            }
+        });
+        return dst;
+    }
+
+    // Divisions by the per-pixel max and range use reciprocals in 12-bit fixed point.
+    constexpr int kHsvShift = 12;
+    // A third of the hue circle, 256 / 3 hue units.
+    constexpr int kHueThird = (256 << kHsvShift) / 3;
+
+    struct HsvTables
+    {
+        std::array<int, 256> saturation{};  // 255 / v
+        std::array<int, 256> hue{};         // (256 / 6) / delta
+    };
+
+    const HsvTables& hsv_tables()
+    {
+        static const HsvTables tables = []
+        {
+            HsvTables t;
+            for (int i = 1; i < 256; ++i)
+            {
+                t.saturation[static_cast<std::size_t>(i)] = static_cast<int>(std::lround(255.0 * (1 << kHsvShift) / i));
+                t.hue[static_cast<std::size_t>(i)] = static_cast<int>(std::lround(256.0 / 6.0 * (1 << kHsvShift) / i));
+            }
+            return t;
+        }();
+        return tables;
+    }
+
+    void rgb_to_hsv_row(const unsigned char* src, unsigned char* dst, int cols, int ch, const HsvTables& t)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const int r = src[0];
+            const int g = src[1];
+            const int b = src[2];
+            const int v = std::max({ r, g, b });
+            const int delta = v - std::min({ r, g, b });
+            int h = 0;
+            int s = 0;
+            if (delta != 0)
+            {
+                const int step = t.hue[static_cast<std::size_t>(delta)];
+                const int hue = v == r ? (g - b) * step : v == g ? (b - r) * step + kHueThird : (r - g) * step + 2 * kHueThird;
+                h = ((hue + (1 << (kHsvShift - 1))) >> kHsvShift) & 255;
+                s = (delta * t.saturation[static_cast<std::size_t>(v)] + (1 << (kHsvShift - 1))) >> kHsvShift;
+            }
+            dst[0] = static_cast<unsigned char>(h);
+            dst[1] = static_cast<unsigned char>(s);
+            dst[2] = static_cast<unsigned char>(v);
+            if (ch == 4)
+            {
+                dst[3] = src[3];
+            }
+            src += ch;
+            dst += ch;
+        }
+    }
+
+    constexpr int div_round(int n, int d)
+    {
+        return (n + d / 2) / d;
+    }
+
+    void hsv_to_rgb_row(const unsigned char* src, unsigned char* dst, int cols, int ch)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const int h6 = src[0] * 6;
+            const int s = src[1];
+            const int v = src[2];
+            const int f = h6 & 255;  // position inside the sector, in 1/256
+            const int p = div_round(v * (255 - s), 255);
+            const int q = div_round(v * (255 * 256 - s * f), 255 * 256);
+            const int u = div_round(v * (255 * 256 - s * (256 - f)), 255 * 256);
+            int r = v;
+            int g = v;
+            int b = v;
+            switch (h6 >> 8)
+            {
+            case 0: g = u; b = p; break;
+            case 1: r = q; b = p; break;
+            case 2: r = p; b = u; break;
+            case 3: r = p; g = q; break;
+            case 4: r = u; g = p; break;
+            default: g = p; b = q; break;
+            }
+            dst[0] = static_cast<unsigned char>(r);
+            dst[1] = static_cast<unsigned char>(g);
+            dst[2] = static_cast<unsigned char>(b);
+            if (ch == 4)
+            {
+                dst[3] = src[3];
+            }
+            src += ch;
+            dst += ch;
+        }
+    }
+
+    Image apply_hsv(const Image& src, bool toHsv)
+    {
+        const int cols = src.cols();
+        const int ch = src.channels();
+        Image dst(src.rows(), cols, ch);
+        const HsvTables& tables = hsv_tables();
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * static_cast<std::size_t>(ch), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                if (toHsv)
+                {
+                    rgb_to_hsv_row(src.ptr(y), dst.ptr(y), cols, ch, tables);
+                }
+                else
+                {
+                    hsv_to_rgb_row(src.ptr(y), dst.ptr(y), cols, ch);
+                }
+            }
+        });
+        return dst;
+    }
+
+    // One leg to or from sRGB.
+    Image convert_from_or_to_srgb(const Image& src, ColorSpace from, ColorSpace to)
+    {
+        if (from == ColorSpace::Linear || to == ColorSpace::Linear)
+        {
+            return transfer(src, to == ColorSpace::Linear);
+        }
+        if (src.depth() != PixelDepth::U8 || (src.channels() != 3 && src.channels() != 4))
+        {
+            return Image();
+        }
+        if (src.isPlanar())
+        {
+            return to_planar(convert_from_or_to_srgb(to_interleaved(src), from, to));
+        }
+
+        const bool fromSrgb = from == ColorSpace::SRGB;
+        switch (fromSrgb ? to : from)
+        {
+        case ColorSpace::YCbCr601:
+            return apply_matrix(src, fromSrgb ? rgb_to_ycbcr_matrix(0.299, 0.114) : ycbcr_to_rgb_matrix(0.299, 0.114));
+        case ColorSpace::YCbCr709:
+            return apply_matrix(src, fromSrgb ? rgb_to_ycbcr_matrix(0.2126, 0.0722) : ycbcr_to_rgb_matrix(0.2126, 0.0722));
+        case ColorSpace::HSV:
+            return apply_hsv(src, fromSrgb);
+        default:
+            return Image();
+        }
+    }
+}
+
+Image convert_color(const Image& src, ColorSpace from, ColorSpace to)
+{
+    IMG_PROFILE_SCOPE("convert_color", profile_bytes(src));
+    if (src.empty())
+    {
+        return Image();
+    }
+    if (from == to)
+    {
+        return src.clone();
+    }
+    if (src.isMirrored())
+    {
+        return convert_color(src.unmirrored(), from, to);
+    }
+    if (from == ColorSpace::SRGB || to == ColorSpace::SRGB)
+    {
+        return convert_from_or_to_srgb(src, from, to);
+    }
+    const Image srgb = convert_from_or_to_srgb(src, from, ColorSpace::SRGB);
+    return srgb.empty() ? Image() : convert_from_or_to_srgb(srgb, ColorSpace::SRGB, to);
+}
+
+bool parse_color_space(const std::string& name, ColorSpace& space)
+{
+    if (name == "srgb")
+    {
+        space = ColorSpace::SRGB;
+    }
+    else if (name == "linear")
+    {
+        space = ColorSpace::Linear;
+    }
+    else if (name == "ycbcr" || name == "ycbcr601")
+    {
+        space = ColorSpace::YCbCr601;
+    }
+    else if (name == "ycbcr709")
+    {
+        space = ColorSpace::YCbCr709;
+    }
+    else if (name == "hsv")
+    {
+        space = ColorSpace::HSV;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include "Image.h"
+
+// The first three samples of a pixel carry the colour. In 2- and 4-channel images the last
+// sample is alpha and is copied unchanged.
+enum class ColorSpace
+{
+    SRGB,      // gamma-encoded R, G, B, as stored in PNM files
+    Linear,    // linear-light R, G, B (IEC 61966-2-1 transfer function)
+    YCbCr601,  // full-range Y, Cb, Cr as in JPEG, BT.601 weights
+    YCbCr709,  // full-range Y, Cb, Cr, BT.709 weights
+    HSV        // H, S, V in 0..255; H spans the whole hue circle in 256 steps
+};
+
+// Conversions not involving sRGB go through it. sRGB <-> linear works on 8- and 16-bit images
+// of any channel count through cached per-depth lookup tables; the others need an 8-bit image
+// with 3 or 4 channels and use 14-bit fixed-point matrices (YCbCr) or integer HSV arithmetic.
+// The result keeps the layout of src; from == to returns a copy. Returns an empty Image for an
+// empty or unsupported source.
+Image convert_color(const Image& src, ColorSpace from, ColorSpace to);
+
+// Accepts "srgb", "linear", "ycbcr" / "ycbcr601", "ycbcr709" and "hsv".
+bool parse_color_space(const std::string& name, ColorSpace& space);
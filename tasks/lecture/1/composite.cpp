@@ -0,0 +1,133 @@
+#include "composite.h"
+#include "ops.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    bool has_alpha(const Image& img)
+    {
+        return !img.empty() && img.depth() == PixelDepth::U8 && (img.channels() == 2 || img.channels() == 4);
+    }
+
+    // v / 255 rounded to nearest, exact for v <= 255 * 255.
+    inline unsigned div255(unsigned v)
+    {
+        v += 128;
+        return (v + (v >> 8)) >> 8;
+    }
+
+    Image scale_by_alpha(const Image& src, bool multiply)
+    {
+        if (src.isPlanar())
+        {
+            return to_planar(scale_by_alpha(to_interleaved(src), multiply));
+        }
+        if (src.isMirrored())
+        {
+            return scale_by_alpha(src.unmirrored(), multiply);
+        }
+
+        const int cols = src.cols();
+        const int ch = src.channels();
+        Image dst(src.rows(), cols, ch);
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * static_cast<std::size_t>(ch), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                const unsigned char* s = src.ptr(y);
+                unsigned char* d = dst.ptr(y);
+                for (int x = 0; x < cols; ++x, s += ch, d += ch)
+                {
+                    const unsigned a = s[ch - 1];
+                    for (int k = 0; k < ch - 1; ++k)
+                    {
+                        d[k] = static_cast<unsigned char>(multiply ? div255(s[k] * a)
+                                                          : a == 0 ? 0 : std::min(255u, (s[k] * 255 + a / 2) / a));
+                    }
+                    d[ch - 1] = static_cast<unsigned char>(a);
+                }
+            }
+        });
+        return dst;
+    }
+}
+
+bool alpha_blend(Image& dst, const Image& src, int x, int y, AlphaMode mode)
+{
+    IMG_PROFILE_SCOPE("alpha_blend", profile_bytes(src));
+    const int srcChannels = src.channels();
+    const int dstChannels = dst.channels();
+    if (!has_alpha(src) || dst.empty() || dst.depth() != PixelDepth::U8 ||
+        (dstChannels != srcChannels && dstChannels != srcChannels - 1))
+    {
+        return false;
+    }
+    if (src.isPlanar())
+    {
+        return alpha_blend(dst, to_interleaved(src), x, y, mode);
+    }
+    if (src.isMirrored())
+    {
+        return alpha_blend(dst, src.unmirrored(), x, y, mode);
+    }
+    if (dst.isMirrored())
+    {
+        // flipH() walks the same pixels forwards; src lands on them mirrored.
+        Image forward = dst.flipH();
+        return alpha_blend(forward, src.flipH(), dst.cols() - x - src.cols(), y, mode);
+    }
+
+    // Region of dst under src, in 64 bits so far-off positions cannot overflow.
+    const int x0 = static_cast<int>(std::max<long long>(x, 0));
+    const int y0 = static_cast<int>(std::max<long long>(y, 0));
+    const int x1 = static_cast<int>(std::min<long long>(static_cast<long long>(x) + src.cols(), dst.cols()));
+    const int y1 = static_cast<int>(std::min<long long>(static_cast<long long>(y) + src.rows(), dst.rows()));
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return true;
+    }
+
+    const int cols = x1 - x0;
+    const bool premultiplied = mode == AlphaMode::Premultiplied;
+    const bool planar = dst.isPlanar();
+    const PixelKernels& kernels = active_kernels();
+    parallel_rows(y1 - y0, static_cast<std::size_t>(cols) * static_cast<std::size_t>(srcChannels), [&](int begin, int end)
+    {
+        // A planar destination is interleaved one row at a time around the blend.
+        std::vector<unsigned char> pixels(planar ? static_cast<std::size_t>(cols) * static_cast<std::size_t>(dstChannels) : 0);
+        std::vector<unsigned char*> planes(planar ? static_cast<std::size_t>(dstChannels) : 0);
+        for (int r = y0 + begin; r < y0 + end; ++r)
+        {
+            const unsigned char* s = src.ptr<unsigned char>(r - y, x0 - x);
+            if (!planar)
+            {
+                kernels.blendRow(s, dst.ptr<unsigned char>(r, x0), cols, srcChannels, dstChannels, premultiplied);
+                continue;
+            }
+            for (int k = 0; k < dstChannels; ++k)
+            {
+                planes[static_cast<std::size_t>(k)] = dst.planePtr(k, r) + x0;
+            }
+            kernels.interleaveRow(planes.data(), pixels.data(), cols, dstChannels);
+            kernels.blendRow(s, pixels.data(), cols, srcChannels, dstChannels, premultiplied);
+            kernels.deinterleaveRow(pixels.data(), planes.data(), cols, dstChannels);
+        }
+    });
+    return true;
+}
+
+Image premultiply(const Image& src)
+{
+    IMG_PROFILE_SCOPE("premultiply", profile_bytes(src));
+    return has_alpha(src) ? scale_by_alpha(src, true) : Image();
+}
+
+Image unpremultiply(const Image& src)
+{
+    IMG_PROFILE_SCOPE("unpremultiply", profile_bytes(src));
+    return has_alpha(src) ? scale_by_alpha(src, false) : Image();
+}
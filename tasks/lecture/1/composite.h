@@ -0,0 +1,23 @@
+#pragma once
+#include "Image.h"
+
+// How the colour samples of an image with alpha relate to that alpha.
+enum class AlphaMode
+{
+    Straight,      // independent of alpha, as PAM and QOI files store them
+    Premultiplied  // already scaled by alpha / 255
+};
+
+// Composites src over dst with the top-left pixel of src at (x, y) of dst, clipped to dst. dst is
+// blended in place, so it may be an ROI view of a larger image. src is 8-bit with alpha as its last
+// sample (2 or 4 channels); dst is 8-bit with the same colour channels, with or without alpha.
+// Straight sources blend exactly onto opaque destinations; for translucent ones premultiply both
+// images and blend Premultiplied. Fixed point throughout (PixelKernels::blendRow). Returns false
+// for other images; a src entirely outside dst leaves it untouched and succeeds.
+bool alpha_blend(Image& dst, const Image& src, int x, int y, AlphaMode mode = AlphaMode::Straight);
+
+// Scale the colours of an 8-bit image with 2 or 4 channels by alpha / 255, and back by 255 / alpha
+// (rounded and clamped; fully transparent pixels turn black). Both keep the layout of src and
+// return an empty Image for other images.
+Image premultiply(const Image& src);
+Image unpremultiply(const Image& src);
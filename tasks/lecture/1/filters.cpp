@@ -0,0 +1,431 @@
+#include "filters.h"
+#include "Profile.h"
+#include "ThreadPool.h"
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+    // Output tiles: the horizontal results of one tile plus its halo rows stay in L2.
+    constexpr int kTileRows = 64;
+    constexpr int kTileCols = 256;
+
+    // Source index for position i on an axis of length n; -1 stands for a zero sample.
+    int border_index(int i, int n, BorderMode border)
+    {
+        if (i >= 0 && i < n)
+        {
+            return i;
+        }
+        switch (border)
+        {
+        case BorderMode::Replicate:
+            return i < 0 ? 0 : n - 1;
+        case BorderMode::Zero:
+            return -1;
+        default:
+        {
+            if (n == 1)
+            {
+                return 0;
+            }
+            const int period = 2 * (n - 1);
+            i %= period;
+            if (i < 0)
+            {
+                i += period;
+            }
+            return i < n ? i : period - i;
+        }
+        }
+    }
+
+    // Columns [x0, x1) of row y, border-extended, as interleaved samples of type T.
+    template <typename T>
+    void load_row(const Image& src, int y, int x0, int x1, BorderMode border, T* out)
+    {
+        const std::size_t ch = static_cast<std::size_t>(src.channels());
+        const int cols = src.cols();
+        const int sy = border_index(y, src.rows(), border);
+        if (sy < 0)
+        {
+            std::fill(out, out + static_cast<std::size_t>(x1 - x0) * ch, T(0));
+            return;
+        }
+        const unsigned char* row = src.ptr(sy);
+        auto outside = [&](int x)
+        {
+            T* o = out + static_cast<std::size_t>(x - x0) * ch;
+            const int sx = border_index(x, cols, border);
+            for (std::size_t k = 0; k < ch; ++k)
+            {
+                o[k] = sx < 0 ? T(0) : static_cast<T>(row[static_cast<std::size_t>(sx) * ch + k]);
+            }
+        };
+
+        const int inner0 = std::clamp(x0, 0, cols);
+        const int inner1 = std::clamp(x1, inner0, cols);
+        for (int x = x0; x < inner0; ++x)
+        {
+            outside(x);
+        }
+        const unsigned char* p = row + static_cast<std::size_t>(inner0) * ch;
+        T* o = out + static_cast<std::size_t>(inner0 - x0) * ch;
+        for (std::size_t i = 0; i < static_cast<std::size_t>(inner1 - inner0) * ch; ++i)
+        {
+            o[i] = static_cast<T>(p[i]);
+        }
+        for (int x = inner1; x < x1; ++x)
+        {
+            outside(x);
+        }
+    }
+
+    inline unsigned char saturate(float v)
+    {
+        return static_cast<unsigned char>(std::clamp(v, 0.0f, 255.0f) + 0.5f);
+    }
+
+    struct Pass
+    {
+        std::vector<float> x;
+        std::vector<float> y;
+    };
+
+    constexpr std::size_t kMaxPasses = 2;
+
+    // Allocates the result in the layout of src and runs filter(from, to) once for an interleaved
+    // source, or once per plane for a planar one, so planes take the single-channel path.
+    template <typename Filter>
+    Image filter_planes(const Image& src, Filter filter)
+    {
+        if (src.isMirrored())
+        {
+            return filter_planes(src.unmirrored(), filter);
+        }
+        Image dst(src.rows(), src.cols(), src.channels(), PixelDepth::U8, src.layout());
+        if (dst.empty())
+        {
+            return Image();
+        }
+        if (!src.isPlanar())
+        {
+            filter(src, dst);
+            return dst;
+        }
+        for (int k = 0; k < src.channels(); ++k)
+        {
+            Image to = dst.plane(k);
+            filter(src.plane(k), to);
+        }
+        return dst;
+    }
+
+    // Evaluates up to two separable passes tile by tile and hands each output row segment to
+    // combine(planes, srcRow, dstRow, samples), where planes[p] holds the result of pass p.
+    // src and dst are interleaved images of the same size.
+    template <typename Combine>
+    void run_tiled(const Image& src, Image& dst, const std::vector<Pass>& passes, BorderMode border, Combine combine)
+    {
+        const int rows = src.rows();
+        const int cols = src.cols();
+        const int ch = src.channels();
+
+        int rx = 0;
+        int ry = 0;
+        for (const Pass& pass : passes)
+        {
+            rx = std::max(rx, static_cast<int>(pass.x.size() / 2));
+            ry = std::max(ry, static_cast<int>(pass.y.size() / 2));
+        }
+
+        const int tilesX = (cols + kTileCols - 1) / kTileCols;
+        const int tilesY = (rows + kTileRows - 1) / kTileRows;
+        const std::size_t rowStride = static_cast<std::size_t>(kTileCols) * static_cast<std::size_t>(ch);
+        const std::size_t haloRows = static_cast<std::size_t>(kTileRows + 2 * ry);
+        const PixelKernels& kernels = active_kernels();
+
+        ThreadPool::shared().parallelFor(tilesX * tilesY, 1, [&](int begin, int end)
+        {
+            std::vector<float> ext(static_cast<std::size_t>(kTileCols + 2 * rx) * static_cast<std::size_t>(ch));
+            std::vector<float> horizontal(passes.size() * haloRows * rowStride);
+            std::vector<float> planes(passes.size() * rowStride);
+
+            for (int tile = begin; tile < end; ++tile)
+            {
+                const int x0 = (tile % tilesX) * kTileCols;
+                const int x1 = std::min(cols, x0 + kTileCols);
+                const int y0 = (tile / tilesX) * kTileRows;
+                const int y1 = std::min(rows, y0 + kTileRows);
+                const std::size_t samples = static_cast<std::size_t>(x1 - x0) * static_cast<std::size_t>(ch);
+
+                for (int j = 0; j < (y1 - y0) + 2 * ry; ++j)
+                {
+                    load_row(src, y0 - ry + j, x0 - rx, x1 + rx, border, ext.data());
+                    for (std::size_t p = 0; p < passes.size(); ++p)
+                    {
+                        const std::vector<float>& kx = passes[p].x;
+                        const float* base = ext.data() + static_cast<std::size_t>(rx - static_cast<int>(kx.size() / 2)) * static_cast<std::size_t>(ch);
+                        float* h = horizontal.data() + (p * haloRows + static_cast<std::size_t>(j)) * rowStride;
+                        kernels.convolveF32(base, static_cast<std::size_t>(ch), kx.data(), static_cast<int>(kx.size()), h, samples);
+                    }
+                }
+
+                std::array<const float*, kMaxPasses> planePointers{};
+                for (int y = y0; y < y1; ++y)
+                {
+                    for (std::size_t p = 0; p < passes.size(); ++p)
+                    {
+                        const std::vector<float>& ky = passes[p].y;
+                        float* out = planes.data() + p * rowStride;
+                        const std::size_t first = static_cast<std::size_t>(y - y0 + ry - static_cast<int>(ky.size() / 2));
+                        kernels.convolveF32(horizontal.data() + (p * haloRows + first) * rowStride, rowStride,
+                                            ky.data(), static_cast<int>(ky.size()), out, samples);
+                        planePointers[p] = out;
+                    }
+                    const std::size_t offset = static_cast<std::size_t>(x0) * static_cast<std::size_t>(ch);
+                    combine(planePointers, src.ptr(y) + offset, dst.ptr(y) + offset, samples);
+                }
+            }
+        });
+    }
+
+    template <typename Combine>
+    Image run_filter(const Image& src, const std::vector<Pass>& passes, BorderMode border, Combine combine)
+    {
+        return filter_planes(src, [&](const Image& from, Image& to)
+        {
+            run_tiled(from, to, passes, border, combine);
+        });
+    }
+
+    // Keeps 255 * (2 * radius + 1)^2 + rounding below 2^31.
+    constexpr int kMaxBoxRadius = 1024;
+
+    // floor(n / d) for n < 2^32 as one multiply and shift: multiplier = ceil(2^shift / d),
+    // shift = 32 + ceil(log2 d). Integer division per pixel would dominate the box filter.
+    struct Divider
+    {
+        std::uint64_t multiplier;
+        int shift;
+
+        std::uint32_t divide(std::uint32_t n) const
+        {
+            return static_cast<std::uint32_t>((static_cast<std::uint64_t>(n) * multiplier) >> shift);
+        }
+    };
+
+    Divider make_divider(std::uint32_t d)
+    {
+        int log2d = 0;
+        while ((std::uint64_t{ 1 } << log2d) < d)
+        {
+            ++log2d;
+        }
+        const int shift = 32 + log2d;
+        return Divider{ ((std::uint64_t{ 1 } << shift) + d - 1) / d, shift };
+    }
+
+    bool usable(const Image& src)
+    {
+        return !src.empty() && src.depth() == PixelDepth::U8;
+    }
+
+    bool odd_kernel(const std::vector<float>& kernel)
+    {
+        return kernel.size() % 2 == 1;
+    }
+
+    // ceil(3 * sigma) above this is refused: every worker holds (64 + 2 * radius) halo rows per tile
+    // and each output sample costs 2 * radius + 1 taps a pass, and the cast to int would overflow.
+    constexpr int kMaxGaussianRadius = 1024;
+
+    bool usable_sigma(double sigma)
+    {
+        return sigma > 0.0 && std::ceil(3.0 * sigma) <= kMaxGaussianRadius;
+    }
+
+    std::vector<float> gaussian_kernel(double sigma)
+    {
+        const int radius = std::max(1, static_cast<int>(std::ceil(3.0 * sigma)));
+        std::vector<float> kernel(static_cast<std::size_t>(2 * radius + 1));
+        double sum = 0.0;
+        for (int i = -radius; i <= radius; ++i)
+        {
+            const double w = std::exp(-(i * i) / (2.0 * sigma * sigma));
+            kernel[static_cast<std::size_t>(i + radius)] = static_cast<float>(w);
+            sum += w;
+        }
+        for (float& w : kernel)
+        {
+            w = static_cast<float>(w / sum);
+        }
+        return kernel;
+    }
+
+    void box_blur_rows(const Image& src, Image& dst, int radius, BorderMode border)
+    {
+        const int rows = src.rows();
+        const int cols = src.cols();
+        const int ch = src.channels();
+        const int diameter = 2 * radius + 1;
+        const std::uint32_t area = static_cast<std::uint32_t>(diameter) * static_cast<std::uint32_t>(diameter);
+        const Divider divider = make_divider(area);
+
+        // Bands are tall compared to the window, so priming the column sums stays a small share of the work.
+        const int band = std::max(kTileRows, 4 * diameter);
+        ThreadPool::shared().parallelFor(rows, band, [&](int begin, int end)
+        {
+            // Vertical window sums over the border-extended columns; each output row then slides along them.
+            const std::size_t extSamples = static_cast<std::size_t>(cols + 2 * radius) * static_cast<std::size_t>(ch);
+            std::vector<std::uint32_t> columnSums(extSamples, 0);
+            std::vector<std::uint32_t> entering(extSamples);
+            std::vector<std::uint32_t> leaving(extSamples);
+
+            for (int y = begin - radius; y <= begin + radius; ++y)
+            {
+                load_row(src, y, -radius, cols + radius, border, entering.data());
+                for (std::size_t i = 0; i < extSamples; ++i)
+                {
+                    columnSums[i] += entering[i];
+                }
+            }
+
+            for (int y = begin; y < end; ++y)
+            {
+                unsigned char* out = dst.ptr(y);
+                for (int k = 0; k < ch; ++k)
+                {
+                    std::uint32_t sum = 0;
+                    for (int t = 0; t < diameter; ++t)
+                    {
+                        sum += columnSums[static_cast<std::size_t>(t * ch + k)];
+                    }
+                    out[k] = static_cast<unsigned char>(divider.divide(sum + area / 2));
+                    for (int x = 1; x < cols; ++x)
+                    {
+                        sum += columnSums[static_cast<std::size_t>((x + diameter - 1) * ch + k)] - columnSums[static_cast<std::size_t>((x - 1) * ch + k)];
+                        out[static_cast<std::size_t>(x * ch + k)] = static_cast<unsigned char>(divider.divide(sum + area / 2));
+                    }
+                }
+                if (y + 1 < end)
+                {
+                    load_row(src, y + radius + 1, -radius, cols + radius, border, entering.data());
+                    load_row(src, y - radius, -radius, cols + radius, border, leaving.data());
+                    for (std::size_t i = 0; i < extSamples; ++i)
+                    {
+                        columnSums[i] += entering[i] - leaving[i];
+                    }
+                }
+            }
+        });
+    }
+}
+
+Image separable_filter(const Image& src, const std::vector<float>& kernelX, const std::vector<float>& kernelY,
+                       BorderMode border)
+{
+    IMG_PROFILE_SCOPE("separable_filter", profile_bytes(src));
+    if (!usable(src) || !odd_kernel(kernelX) || !odd_kernel(kernelY))
+    {
+        return Image();
+    }
+    return run_filter(src, { Pass{ kernelX, kernelY } }, border,
+                      [](const std::array<const float*, kMaxPasses>& planes, const unsigned char*, unsigned char* dst, std::size_t samples)
+    {
+        for (std::size_t i = 0; i < samples; ++i)
+        {
+            dst[i] = saturate(planes[0][i]);
+        }
+    });
+}
+
+Image box_blur(const Image& src, int radius, BorderMode border)
+{
+    IMG_PROFILE_SCOPE("box_blur", profile_bytes(src));
+    if (!usable(src) || radius < 0 || radius > kMaxBoxRadius)
+    {
+        return Image();
+    }
+    return filter_planes(src, [&](const Image& from, Image& to)
+    {
+        box_blur_rows(from, to, radius, border);
+    });
+}
+
+Image gaussian_blur(const Image& src, double sigma, BorderMode border)
+{
+    IMG_PROFILE_SCOPE("gaussian_blur", profile_bytes(src));
+    if (!usable_sigma(sigma))
+    {
+        return Image();
+    }
+    const std::vector<float> kernel = gaussian_kernel(sigma);
+    return separable_filter(src, kernel, kernel, border);
+}
+
+Image sobel(const Image& src, BorderMode border)
+{
+    IMG_PROFILE_SCOPE("sobel", profile_bytes(src));
+    if (!usable(src))
+    {
+        return Image();
+    }
+    const std::vector<float> derivative{ -1.0f, 0.0f, 1.0f };
+    const std::vector<float> smooth{ 1.0f, 2.0f, 1.0f };
+    return run_filter(src, { Pass{ derivative, smooth }, Pass{ smooth, derivative } }, border,
+                      [](const std::array<const float*, kMaxPasses>& planes, const unsigned char*, unsigned char* dst, std::size_t samples)
+    {
+        for (std::size_t i = 0; i < samples; ++i)
+        {
+            const float gx = planes[0][i];
+            const float gy = planes[1][i];
+            dst[i] = saturate(std::sqrt(gx * gx + gy * gy));
+        }
+    });
+}
+
+Image unsharp_mask(const Image& src, double sigma, double amount, BorderMode border)
+{
+    IMG_PROFILE_SCOPE("unsharp_mask", profile_bytes(src));
+    if (!usable(src) || !usable_sigma(sigma))
+    {
+        return Image();
+    }
+    const std::vector<float> kernel = gaussian_kernel(sigma);
+    const float gain = static_cast<float>(amount);
+    return run_filter(src, { Pass{ kernel, kernel } }, border,
+                      [gain](const std::array<const float*, kMaxPasses>& planes, const unsigned char* srcRow, unsigned char* dst, std::size_t samples)
+    {
+        for (std::size_t i = 0; i < samples; ++i)
+        {
+            const float s = srcRow[i];
+            dst[i] = saturate(s + gain * (s - planes[0][i]));
+        }
+    });
+}
+
+bool parse_border_mode(const std::string& name, BorderMode& border)
+{
+    if (name == "replicate")
+    {
+        border = BorderMode::Replicate;
+    }
+    else if (name == "reflect")
+    {
+        border = BorderMode::Reflect;
+    }
+    else if (name == "zero")
+    {
+        border = BorderMode::Zero;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
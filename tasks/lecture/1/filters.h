@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Image.h"
+
+// Neighbourhood filters for 8-bit images of any channel count. Sources may be
+// ROI views: pixels outside the view are produced by the border mode, never
+// read from the parent image. Results are new packed images in the layout of the
+// source (planar sources are filtered plane by plane); every function
+// returns an empty Image for an empty or non-8-bit source or bad parameters.
+
+enum class BorderMode
+{
+    Replicate,  // aaa|abcd|ddd
+    Reflect,    // cb|abcd|cb
+    Zero        // 000|abcd|000
+};
+
+// out(x, y) = sum over i, j of kernelX[i] * kernelY[j] * src(x + i - kernelX.size() / 2, y + j - kernelY.size() / 2),
+// rounded and saturated. Both kernels must have odd length.
+Image separable_filter(const Image& src, const std::vector<float>& kernelX, const std::vector<float>& kernelY,
+                       BorderMode border = BorderMode::Reflect);
+
+// Mean over a (2 * radius + 1)^2 window, radius <= 1024; running sums make the cost per pixel
+// independent of radius.
+Image box_blur(const Image& src, int radius, BorderMode border = BorderMode::Reflect);
+
+// Kernel radius is ceil(3 * sigma), at most 1024; a larger sigma gives an empty Image.
+Image gaussian_blur(const Image& src, double sigma, BorderMode border = BorderMode::Reflect);
+
+// Per-channel gradient magnitude sqrt(gx^2 + gy^2) of the 3x3 Sobel operators, saturated to 255.
+Image sobel(const Image& src, BorderMode border = BorderMode::Reflect);
+
+// src + amount * (src - gaussian_blur(src, sigma)), with the same limit on sigma.
+Image unsharp_mask(const Image& src, double sigma, double amount, BorderMode border = BorderMode::Reflect);
+
+// Accepts "replicate", "reflect" and "zero".
+bool parse_border_mode(const std::string& name, BorderMode& border);
@@ -0,0 +1,103 @@
+#include "lut.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    void lut_rows(const Image& src, Image& dst, const LutRowPass& pass)
+    {
+        const std::size_t rowBytes = static_cast<std::size_t>(src.cols()) * src.elemSize();
+        const bool continuous = src.isContinuous() && dst.isContinuous();
+        parallel_rows(src.rows(), rowBytes, [&](int begin, int end)
+        {
+            if (continuous)
+            {
+                pass.run(src.ptr(begin), dst.ptr(begin), rowBytes * static_cast<std::size_t>(end - begin));
+                return;
+            }
+            for (int y = begin; y < end; ++y)
+            {
+                pass.run(src.ptr(y), dst.ptr(y), rowBytes);
+            }
+        });
+    }
+}
+
+Lut lut_gamma(double gamma)
+{
+    if (!(gamma > 0.0))
+    {
+        return kIdentityLut;
+    }
+    return make_lut([gamma](int v) { return lut_saturate(255.0 * std::pow(v / 255.0, 1.0 / gamma)); });
+}
+
+Image apply_lut(const Image& src, const Lut& lut)
+{
+    IMG_PROFILE_SCOPE("apply_lut", profile_bytes(src));
+    if (src.depth() != PixelDepth::U8)
+    {
+        return Image();
+    }
+    return apply_lut_bytes(src, lut);
+}
+
+Image apply_lut_bytes(const Image& src, const Lut& lut)
+{
+    if (src.empty() || src.depth() == PixelDepth::F32)
+    {
+        return Image();
+    }
+    if (src.isMirrored())
+    {
+        return apply_lut_bytes(src.unmirrored(), lut);
+    }
+
+    Image dst(src.rows(), src.cols(), src.channels(), src.depth(), src.layout());
+    const LutRowPass pass(lut);
+    if (!src.isPlanar())
+    {
+        lut_rows(src, dst, pass);
+        return dst;
+    }
+    for (int k = 0; k < src.channels(); ++k)
+    {
+        Image dstPlane = dst.plane(k);
+        lut_rows(src.plane(k), dstPlane, pass);
+    }
+    return dst;
+}
+
+LutRowPass::LutRowPass(const Lut& lut)
+    : table(lut),
+      kernels(active_kernels()),
+      kind(lut == kIdentityLut ? Kind::Identity : lut == kInvertLut ? Kind::Invert : Kind::Table)
+{
+}
+
+bool LutRowPass::identity() const
+{
+    return kind == Kind::Identity;
+}
+
+void LutRowPass::run(const unsigned char* src, unsigned char* dst, std::size_t bytes) const
+{
+    switch (kind)
+    {
+    case Kind::Identity:
+        if (src != dst)
+        {
+            std::memmove(dst, src, bytes);
+        }
+        break;
+    case Kind::Invert:
+        kernels.invertRow(src, dst, bytes);
+        break;
+    case Kind::Table:
+        kernels.lutRow(src, dst, bytes, table.data());
+        break;
+    }
+}
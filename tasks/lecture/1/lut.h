@@ -0,0 +1,110 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include "Image.h"
+
+struct PixelKernels;
+
+// An 8-bit point operation as a table: output sample = lut[input sample]. Tables compose, so a
+// chain of point operations costs one lookup per sample however long it is.
+using Lut = std::array<unsigned char, 256>;
+
+// v rounded to the nearest integer and clamped to 0..255.
+constexpr unsigned char lut_saturate(double v)
+{
+    return v <= 0.0 ? 0 : v >= 254.5 ? 255 : static_cast<unsigned char>(v + 0.5);
+}
+
+// lut[v] = fn(v) for every v.
+template <typename F>
+constexpr Lut make_lut(F&& fn)
+{
+    Lut lut{};
+    for (int v = 0; v < 256; ++v)
+    {
+        lut[static_cast<std::size_t>(v)] = static_cast<unsigned char>(fn(v));
+    }
+    return lut;
+}
+
+constexpr Lut lut_identity()
+{
+    return make_lut([](int v) { return v; });
+}
+
+constexpr Lut lut_invert()
+{
+    return make_lut([](int v) { return 255 - v; });
+}
+
+// v + delta.
+constexpr Lut lut_brightness(int delta)
+{
+    return make_lut([delta](int v) { return lut_saturate(static_cast<double>(v) + delta); });
+}
+
+// Stretches (factor > 1) or flattens (factor < 1) the samples around mid-grey 127.5.
+constexpr Lut lut_contrast(double factor)
+{
+    return make_lut([factor](int v) { return lut_saturate((v - 127.5) * factor + 127.5); });
+}
+
+// 255 at and above level, 0 below it.
+constexpr Lut lut_threshold(int level)
+{
+    return make_lut([level](int v) { return v >= level ? 255 : 0; });
+}
+
+// Quantises to `levels` evenly spaced values including 0 and 255; levels is clamped to 2..256.
+constexpr Lut lut_posterize(int levels)
+{
+    const int n = levels < 2 ? 2 : levels > 256 ? 256 : levels;
+    return make_lut([n](int v) { return lut_saturate((v * n / 256) * 255.0 / (n - 1)); });
+}
+
+// 255 * (v / 255)^(1 / gamma): gamma > 1 brightens the mid-tones. Built at run time, since
+// std::pow is not constexpr; a gamma that is not positive gives the identity.
+Lut lut_gamma(double gamma);
+
+// The table of applying first, then second.
+constexpr Lut chain_luts(const Lut& first, const Lut& second)
+{
+    return make_lut([&](int v) { return second[first[static_cast<std::size_t>(v)]]; });
+}
+
+inline constexpr Lut kIdentityLut = lut_identity();
+inline constexpr Lut kInvertLut = lut_invert();
+
+// Every sample of an 8-bit image through lut; keeps the layout of src. Returns an empty Image
+// for an empty source or another depth.
+Image apply_lut(const Image& src, const Lut& lut);
+
+// The same pass over the raw bytes of an 8- or 16-bit image. invert() uses it for U16, where
+// flipping both bytes of a sample gives 65535 - v.
+Image apply_lut_bytes(const Image& src, const Lut& lut);
+
+// A table bound to the row kernel that serves it best, for passes that walk their own rows: the
+// identity copies and the invert table runs the XOR kernel, which stays vectorised on CPUs where
+// the lookup is scalar.
+class LutRowPass
+{
+public:
+    explicit LutRowPass(const Lut& lut);
+
+    bool identity() const;
+
+    // dst[i] = lut[src[i]] for i < bytes; src may equal dst.
+    void run(const unsigned char* src, unsigned char* dst, std::size_t bytes) const;
+
+private:
+    enum class Kind
+    {
+        Identity,
+        Invert,
+        Table
+    };
+
+    const Lut& table;
+    const PixelKernels& kernels;
+    Kind kind;
+};
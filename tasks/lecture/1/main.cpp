@@ -1,162 +1,871 @@
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <cstdlib>
+#include <fstream>
+#include <iterator>
 
 #include "ppm_io.h"
 #include "ops.h"
+#include "stream_ops.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+#include "resize.h"
+#include "batch.h"
+#include "filters.h"
+#include "stats.h"
+#include "color.h"
+#include "ResultCache.h"
+#include "Profile.h"
+#include "composite.h"
+
+struct ToolOptions
+{
+    int stripRows = 0;
+    int threads = 0;
+    Interpolation interpolation = Interpolation::Nearest;
+    std::string outDir;
+    int jobs = 0;
+    BorderMode border = BorderMode::Reflect;
+    ColorSpace colorFrom = ColorSpace::SRGB;
+    ColorSpace colorTo = ColorSpace::SRGB;
+    bool hasColorTarget = false;
+    std::string cacheDir;
+    std::uint64_t cacheBytes = 1024ull << 20;
+    bool profile = false;
+};
+
+// Part of every cache key; bump it when an op starts producing different pixels.
+static const char* const kCacheVersion = "imgtool-cache-1";
 
 static void print_usage(const char* argv0)
 {
     std::cout
         << "imgtool — минималистичная CLI-утилита на наших классах Image/Range от Ковалёва Всеволода Ярославовича\n"
-        << "Форматы: PGM(P5), PPM(P6) (только эти работают в наших каналах rgb для Image)\n\n"
+        << "Форматы: PGM(P2/P5), PPM(P3/P6), PAM(P7, 2 или 4 канала с альфой), QOI (.qoi, 3 или 4 канала)\n\n"
         << "Использование:\n"
         << "  " << argv0 << " info <input.ppm|pgm>\n"
+        << "  " << argv0 << " stats <input>           (JSON: гистограммы, min/max, mean/stddev по каналам)\n"
+        << "  " << argv0 << " equalize <input> <output>\n"
         << "  " << argv0 << " invert <input> <output>\n"
         << "  " << argv0 << " gray <input> <output>\n"
         << "  " << argv0 << " crop <input> <x> <y> <w> <h> <output>\n"
-        << "  " << argv0 << " resize <input> <newW> <newH> <output>\n\n"
+        << "  " << argv0 << " resize <input> <newW> <newH> <output>\n"
+        << "  " << argv0 << " rotate <input> <90|180|270> <output>   (по часовой стрелке)\n"
+        << "  " << argv0 << " transpose <input> <output>\n"
+        << "  " << argv0 << " flip <input> <h|v> <output>\n"
+        << "  " << argv0 << " pipeline <input> [--crop x y w h] [--gray] [--invert] [--resize w h] ... <output>\n"
+        << "        точечные этапы: [--brightness d] [--contrast k] [--gamma g] [--threshold t] [--posterize n]\n"
+        << "  " << argv0 << " blur <input> <gauss|box> <sigma|radius> <output>\n"
+        << "  " << argv0 << " sobel <input> <output>\n"
+        << "  " << argv0 << " sharpen <input> <sigma> <amount> <output>\n"
+        << "  " << argv0 << " convert <input> <output> --to=S [--from=S]\n"
+        << "  " << argv0 << " overlay <base> <overlay> <x> <y> <output>   (наложение по альфа-каналу overlay)\n"
+        << "  " << argv0 << " batch <manifest|dir> <invert|gray|equalize|crop x y w h|resize w h|overlay file x y|pipeline ...> --out=DIR\n\n"
+        << "Опции:\n"
+        << "  --strip=N   потоковая обработка полосами по N строк (для изображений больше RAM)\n"
+        << "  --threads=N число потоков (по умолчанию все ядра)\n"
+        << "  --interp=M  интерполяция для resize: nearest (по умолчанию), bilinear, area, lanczos\n"
+        << "  --out=DIR   каталог для результатов batch\n"
+        << "  --jobs=N    число файлов, обрабатываемых одновременно в batch (по умолчанию все ядра)\n"
+        << "  --border=B  края для blur/sobel/sharpen: reflect (по умолчанию), replicate, zero\n"
+        << "  --to=S      цветовое пространство результата convert: srgb, linear, ycbcr601, ycbcr709, hsv\n"
+        << "  --from=S    цветовое пространство входа convert (по умолчанию srgb)\n"
+        << "  --cache=DIR кэш результатов: повторный запуск с теми же входом и параметрами копирует готовый файл\n"
+        << "  --cache-size=MB  предельный размер кэша, давно не использованные записи удаляются (по умолчанию 1024)\n"
+        << "  --profile   JSON-строка в stderr: время, байты и MB/s по этапам (загрузка, операции, clone, сохранение)\n\n"
         << "Примеры:\n"
         << "  " << argv0 << " info test.ppm\n"
+        << "  " << argv0 << " stats test.ppm > stats.json\n"
         << "  " << argv0 << " invert test.ppm invert.ppm\n"
         << "  " << argv0 << " gray test.ppm gray.pgm\n"
         << "  " << argv0 << " crop test.ppm 100 80 256 256 crop.ppm\n"
-        << "  " << argv0 << " resize test.ppm 320 240 resize.ppm\n";
+        << "  " << argv0 << " resize test.ppm 320 240 resize.ppm\n"
+        << "  " << argv0 << " resize --interp=lanczos test.ppm 320 240 resize.ppm\n"
+        << "  " << argv0 << " rotate test.ppm 90 portrait.ppm\n"
+        << "  " << argv0 << " flip test.ppm h mirror.ppm\n"
+        << "  " << argv0 << " gray --strip=256 panorama.ppm gray.pgm\n"
+        << "  " << argv0 << " pipeline test.ppm --crop 100 80 512 512 --gray --resize 128 128 thumb.pgm\n"
+        << "  " << argv0 << " pipeline test.ppm --invert --gamma 2.2 --threshold 128 mask.ppm\n"
+        << "  " << argv0 << " blur test.ppm gauss 2.5 blur.ppm\n"
+        << "  " << argv0 << " blur --border=replicate test.ppm box 7 box.ppm\n"
+        << "  " << argv0 << " sharpen test.ppm 1.5 0.8 sharp.ppm\n"
+        << "  " << argv0 << " convert --to=ycbcr709 test.ppm ycc.ppm\n"
+        << "  " << argv0 << " convert --from=hsv --to=linear hsv.ppm linear.ppm\n"
+        << "  " << argv0 << " overlay photo.ppm logo.pam 20 20 marked.ppm\n"
+        << "  " << argv0 << " batch photos/ overlay logo.pam 20 20 --out=marked\n"
+        << "  " << argv0 << " batch photos/ resize 320 240 --interp=area --out=thumbs --jobs=8\n"
+        << "  " << argv0 << " batch photos/ resize 320 240 --out=thumbs --cache=/tmp/imgcache\n"
+        << "  " << argv0 << " blur --profile test.ppm gauss 2.5 blur.ppm 2>> profile.log\n";
 }
 
-int main(int argc, char** argv)
+// Splits argv into positional arguments and --name=value options; returns false on an unknown option.
+// Bare --name tokens other than --profile stay positional: they are pipeline stages.
+static bool parse_arguments(int argc, char** argv, std::vector<std::string>& args, ToolOptions& options)
 {
-    if (argc < 3)
+    for (int i = 1; i < argc; ++i)
     {
-        print_usage(argv[0]);
-        return 1;
+        const std::string arg = argv[i];
+        if (arg == "--profile")
+        {
+            options.profile = true;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0 || arg.find('=') == std::string::npos)
+        {
+            args.push_back(arg);
+            continue;
+        }
+
+        if (arg.rfind("--strip=", 0) == 0)
+        {
+            options.stripRows = std::atoi(arg.c_str() + 8);
+            if (options.stripRows <= 0)
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--threads=", 0) == 0)
+        {
+            options.threads = std::atoi(arg.c_str() + 10);
+            if (options.threads <= 0)
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--interp=", 0) == 0)
+        {
+            if (!parse_interpolation(arg.substr(9), options.interpolation))
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--out=", 0) == 0)
+        {
+            options.outDir = arg.substr(6);
+            if (options.outDir.empty())
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--jobs=", 0) == 0)
+        {
+            options.jobs = std::atoi(arg.c_str() + 7);
+            if (options.jobs <= 0)
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--border=", 0) == 0)
+        {
+            if (!parse_border_mode(arg.substr(9), options.border))
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--from=", 0) == 0)
+        {
+            if (!parse_color_space(arg.substr(7), options.colorFrom))
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--to=", 0) == 0)
+        {
+            if (!parse_color_space(arg.substr(5), options.colorTo))
+            {
+                return false;
+            }
+            options.hasColorTarget = true;
+        }
+        else if (arg.rfind("--cache=", 0) == 0)
+        {
+            options.cacheDir = arg.substr(8);
+            if (options.cacheDir.empty())
+            {
+                return false;
+            }
+        }
+        else if (arg.rfind("--cache-size=", 0) == 0)
+        {
+            const long long megabytes = std::atoll(arg.c_str() + 13);
+            if (megabytes <= 0)
+            {
+                return false;
+            }
+            options.cacheBytes = static_cast<std::uint64_t>(megabytes) << 20;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Stages are args[first, last); returns false on an unknown stage or missing/invalid numbers.
+static bool parse_pipeline(const std::vector<std::string>& args, std::size_t first, std::size_t last, Pipeline& pipeline)
+{
+    auto numbers = [&](std::size_t& i, int count, int* out)
+    {
+        if (i + static_cast<std::size_t>(count) >= last)
+        {
+            return false;
+        }
+        for (int k = 0; k < count; ++k)
+        {
+            out[k] = std::atoi(args[++i].c_str());
+        }
+        return true;
+    };
+    auto real = [&](std::size_t& i, double& out)
+    {
+        if (i + 1 >= last)
+        {
+            return false;
+        }
+        out = std::atof(args[++i].c_str());
+        return true;
+    };
+
+    for (std::size_t i = first; i < last; ++i)
+    {
+        const std::string& stage = args[i];
+        int v[4] = { 0, 0, 0, 0 };
+        double f = 0.0;
+        if (stage == "--crop" && numbers(i, 4, v))
+        {
+            pipeline.crop(v[0], v[1], v[2], v[3]);
+        }
+        else if (stage == "--resize" && numbers(i, 2, v))
+        {
+            pipeline.resize(v[0], v[1]);
+        }
+        else if (stage == "--gray")
+        {
+            pipeline.grayscale();
+        }
+        else if (stage == "--invert")
+        {
+            pipeline.invert();
+        }
+        else if (stage == "--brightness" && numbers(i, 1, v))
+        {
+            pipeline.brightness(v[0]);
+        }
+        else if (stage == "--contrast" && real(i, f))
+        {
+            pipeline.contrast(f);
+        }
+        else if (stage == "--gamma" && real(i, f) && f > 0.0)
+        {
+            pipeline.gamma(f);
+        }
+        else if (stage == "--threshold" && numbers(i, 1, v))
+        {
+            pipeline.threshold(v[0]);
+        }
+        else if (stage == "--posterize" && numbers(i, 1, v) && v[0] >= 2 && v[0] <= 256)
+        {
+            pipeline.posterize(v[0]);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The operation is args[first, end); returns false when it is unknown or its arguments are invalid.
+static bool parse_batch_operation(const std::vector<std::string>& args, std::size_t first,
+                                  const ToolOptions& options, BatchOperation& operation)
+{
+    const std::string& op = args[first];
+    const std::size_t argc = args.size() - first - 1;
+    auto number = [&](std::size_t k) { return std::atoi(args[first + 1 + k].c_str()); };
+
+    if (op == "invert" && argc == 0)
+    {
+        operation = [](const Image& img) { return invert(img); };
+    }
+    else if (op == "gray" && argc == 0)
+    {
+        operation = [](const Image& img) { return to_grayscale(img); };
+    }
+    else if (op == "equalize" && argc == 0)
+    {
+        operation = [](const Image& img) { return equalize(img); };
+    }
+    else if (op == "crop" && argc == 4)
+    {
+        const int x = number(0), y = number(1), w = number(2), h = number(3);
+        operation = [=](const Image& img) { return crop(img, x, y, w, h); };
+    }
+    else if (op == "resize" && argc == 2)
+    {
+        const int w = number(0), h = number(1);
+        const Interpolation interpolation = options.interpolation;
+        operation = [=](const Image& img) { return resize(img, w, h, interpolation); };
+    }
+    else if (op == "overlay" && argc == 3)
+    {
+        Image mark;
+        if (!load_image(args[first + 1], mark))
+        {
+            return false;
+        }
+        const int x = number(1), y = number(2);
+        operation = [mark, x, y](const Image& img)
+        {
+            Image out = img.clone();
+            return alpha_blend(out, mark, x, y) ? out : Image();
+        };
+    }
+    else if (op == "pipeline")
+    {
+        Pipeline pipeline;
+        if (argc == 0 || !parse_pipeline(args, first + 1, args.size(), pipeline))
+        {
+            return false;
+        }
+        operation = [pipeline](const Image& img) { return pipeline.run(img); };
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Everything besides the input bytes that changes a result: the op, its arguments args[first, last)
+// and the options the ops read. A single command and the same op in batch share entries.
+static std::string describe_operation(const std::string& op, const std::vector<std::string>& args,
+                                      std::size_t first, std::size_t last, const ToolOptions& options)
+{
+    std::string text = std::string(kCacheVersion) + "\n" + op;
+    for (std::size_t i = first; i < last; ++i)
+    {
+        text += "\n" + args[i];
+    }
+    // An overlay changes the result through its pixels, not just its name.
+    if (op == "overlay" && first < last)
+    {
+        std::ifstream file(args[first], std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        text += "\noverlay=" + std::to_string(hash_bytes(bytes.data(), bytes.size()));
+    }
+    text += "\ninterp=" + std::to_string(static_cast<int>(options.interpolation)) +
+            "\nborder=" + std::to_string(static_cast<int>(options.border)) +
+            "\nfrom=" + std::to_string(static_cast<int>(options.colorFrom)) +
+            "\nto=" + std::to_string(static_cast<int>(options.colorTo));
+    return text;
+}
+
+// Commands that read one image args[1] and write one file args.back(); overlay hashes its second input into the description.
+static bool is_cacheable(const std::vector<std::string>& args)
+{
+    static const char* const commands[] = { "equalize", "invert", "gray", "crop", "resize", "rotate", "transpose",
+                                            "flip", "pipeline", "blur", "sobel", "sharpen", "convert", "overlay" };
+    if (args.size() < 3)
+    {
+        return false;
+    }
+    for (const char* command : commands)
+    {
+        if (args[0] == command)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Inputs are mapped rather than read. save_image renames a finished temp file over its target, so
+// an output that is the input itself (flip x.ppm v x.ppm) never truncates pages still being read.
+static int load_or_report(const std::string& path, Image& img)
+{
+    if (!load_image_mapped(path, img))
+    {
+        std::cerr << "ERROR: failed to load image: " << path << "\n";
+        return 2;
+    }
+    return 0;
+}
+
+static int save_or_report(const std::string& path, const Image& img)
+{
+    if (!save_image(path, img))
+    {
+        std::cerr << "ERROR: failed to save image: " << path << "\n";
+        return 3;
     }
+    return 0;
+}
 
-    std::string cmd = argv[1];
+static int stream_or_report(bool ok, const std::string& inPath, const std::string& outPath)
+{
+    if (!ok)
+    {
+        std::cerr << "ERROR: streaming failed: " << inPath << " -> " << outPath << "\n";
+        return 2;
+    }
+    return 0;
+}
+
+static void write_json_string(std::ostream& os, const std::string& text)
+{
+    os << '"';
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            os << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            const char* hex = "0123456789abcdef";
+            os << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+        }
+        else
+        {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+// One line per run, so that production logs can be grepped and diffed.
+static void write_profile_json(std::ostream& os, const std::string& command, int rc, double seconds, const ProfileReport& report)
+{
+    auto throughput = [](std::uint64_t bytes, double time)
+    {
+        return time > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / time : 0.0;
+    };
+    os << "{\"command\": ";
+    write_json_string(os, command);
+    os << ", \"exit\": " << rc << ", \"instrumented\": " << (IMG_PROFILING ? "true" : "false")
+       << ", \"seconds\": " << seconds << ", \"stages\": [";
+    for (std::size_t k = 0; k < report.stages.size(); ++k)
+    {
+        const ProfileStage& stage = report.stages[k];
+        os << (k == 0 ? "" : ", ") << "{\"name\": ";
+        write_json_string(os, stage.name);
+        os << ", \"calls\": " << stage.calls << ", \"seconds\": " << stage.seconds
+           << ", \"bytes\": " << stage.bytes << ", \"mb_per_s\": " << throughput(stage.bytes, stage.seconds) << "}";
+    }
+    os << "], \"allocations\": " << report.allocations << ", \"allocated_bytes\": " << report.allocatedBytes << "}\n";
+}
+
+static void write_stats_json(std::ostream& os, const std::string& path, const Image& img, const ImageStats& stats)
+{
+    os << "{\n  \"file\": ";
+    write_json_string(os, path);
+    os << ",\n  \"width\": " << img.cols()
+       << ",\n  \"height\": " << img.rows()
+       << ",\n  \"depth\": " << img.elemSize1() * 8
+       << ",\n  \"pixels\": " << stats.pixels
+       << ",\n  \"channels\": [";
+    for (std::size_t k = 0; k < stats.channels.size(); ++k)
+    {
+        const ChannelStats& channel = stats.channels[k];
+        os << (k == 0 ? "\n" : ",\n")
+           << "    { \"min\": " << channel.min << ", \"max\": " << channel.max
+           << ", \"mean\": " << channel.mean << ", \"stddev\": " << channel.stddev
+           << ", \"histogram\": [";
+        for (std::size_t v = 0; v < channel.histogram.size(); ++v)
+        {
+            os << (v == 0 ? "" : ",") << channel.histogram[v];
+        }
+        os << "] }";
+    }
+    os << "\n  ]\n}\n";
+}
+
+static int run_command(const std::vector<std::string>& args, const ToolOptions& options, const char* argv0, ResultCache* cache)
+{
+    const std::string& cmd = args[0];
+    const bool streaming = options.stripRows > 0;
 
     if (cmd == "info")
     {
-        if (argc != 3)
+        if (args.size() != 2)
         {
-            print_usage(argv[0]);
+            print_usage(argv0);
             return 1;
         }
         Image img;
-        if (!load_image(argv[2], img))
+        if (int rc = load_or_report(args[1], img))
         {
-            std::cerr << "ERROR: failed to load image: " << argv[2] << "\n";
-            return 2;
+            return rc;
         }
-        std::cout << "File: " << argv[2] << "\n"
+        std::cout << "File: " << args[1] << "\n"
                   << "Size: " << img.cols() << " x " << img.rows() << "\n"
-                  << "Channels: " << img.channels() << "\n";
+                  << "Channels: " << img.channels() << "\n"
+                  << "Depth: " << img.elemSize1() * 8 << " bit\n";
         return 0;
     }
-    else if (cmd == "invert")
+    else if (cmd == "stats")
     {
-        if (argc != 4)
+        if (args.size() != 2)
         {
-            print_usage(argv[0]);
+            print_usage(argv0);
             return 1;
         }
         Image img;
-        if (!load_image(argv[2], img))
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        write_stats_json(std::cout, args[1], img, compute_stats(img));
+        return 0;
+    }
+    else if (cmd == "equalize")
+    {
+        if (args.size() != 3 || streaming)
         {
-            std::cerr << "ERROR: failed to load image: " << argv[2] << "\n";
+            print_usage(argv0);
+            return 1;
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        Image out = equalize(img);
+        if (out.empty())
+        {
+            std::cerr << "ERROR: equalize needs an 8-bit image\n";
             return 2;
         }
-        Image out = Invert(img);
-        if (!SaveImage(argv[3], out))
+        return save_or_report(args[2], out);
+    }
+    else if (cmd == "invert")
+    {
+        if (args.size() != 3)
         {
-            std::cerr << "ERROR: failed to save image: " << argv[3] << "\n";
-            return 3;
+            print_usage(argv0);
+            return 1;
         }
-        return 0;
+        if (streaming)
+        {
+            return stream_or_report(stream_invert(args[1], args[2], options.stripRows), args[1], args[2]);
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        return save_or_report(args[2], invert(img));
     }
     else if (cmd == "gray")
     {
-        if (argc != 4)
+        if (args.size() != 3)
         {
-            print_usage(argv[0]);
+            print_usage(argv0);
             return 1;
         }
-        Image img;
-        if (!load_image(argv[2], img))
+        if (streaming)
         {
-            std::cerr << "ERROR: failed to load image: " << argv[2] << "\n";
-            return 2;
+            return stream_or_report(stream_grayscale(args[1], args[2], options.stripRows), args[1], args[2]);
         }
-        Image out = ToGrayscale(img);
-        if (!SaveImage(argv[3], out))
+        Image img;
+        if (int rc = load_or_report(args[1], img))
         {
-            std::cerr << "ERROR: failed to save image: " << argv[3] << "\n";
-            return 3;
+            return rc;
         }
-        return 0;
+        return save_or_report(args[2], to_grayscale(img));
     }
     else if (cmd == "crop")
     {
-        if (argc != 8)
+        if (args.size() != 7)
         {
-            print_usage(argv[0]);
+            print_usage(argv0);
             return 1;
         }
-        const int x = std::atoi(argv[3]);
-        const int y = std::atoi(argv[4]);
-        const int w = std::atoi(argv[5]);
-        const int h = std::atoi(argv[6]);
+        const int x = std::atoi(args[2].c_str());
+        const int y = std::atoi(args[3].c_str());
+        const int w = std::atoi(args[4].c_str());
+        const int h = std::atoi(args[5].c_str());
 
+        if (streaming)
+        {
+            return stream_or_report(stream_crop(args[1], args[6], x, y, w, h, options.stripRows), args[1], args[6]);
+        }
         Image img;
-        if (!load_image(argv[2], img))
+        if (int rc = load_or_report(args[1], img))
         {
-            std::cerr << "ERROR: failed to load image: " << argv[2] << "\n";
-            return 2;
+            return rc;
         }
-        Image out = Crop(img, x, y, w, h);
+        Image out = crop(img, x, y, w, h);
         if (out.empty())
         {
             std::cerr << "ERROR: crop produced empty image (check bounds)\n";
             return 2;
         }
-        if (!SaveImage(argv[7], out))
-        {
-            std::cerr << "ERROR: failed to save image: " << argv[7] << "\n";
-            return 3;
-        }
-        return 0;
+        return save_or_report(args[6], out);
     }
     else if (cmd == "resize")
     {
-        if (argc != 6)
+        if (args.size() != 5)
         {
-            print_usage(argv[0]);
+            print_usage(argv0);
             return 1;
         }
-        const int newW = std::atoi(argv[3]);
-        const int newH = std::atoi(argv[4]);
+        const int newW = std::atoi(args[2].c_str());
+        const int newH = std::atoi(args[3].c_str());
 
+        if (streaming)
+        {
+            if (options.interpolation != Interpolation::Nearest)
+            {
+                std::cerr << "ERROR: --strip supports only nearest resize\n";
+                return 1;
+            }
+            return stream_or_report(stream_resize_nearest(args[1], args[4], newW, newH, options.stripRows), args[1], args[4]);
+        }
         Image img;
-        if (!load_image(argv[2], img))
+        if (int rc = load_or_report(args[1], img))
         {
-            std::cerr << "ERROR: failed to load image: " << argv[2] << "\n";
-            return 2;
+            return rc;
         }
-        Image out = ResizeNearest(img, newW, newH);
+        Image out = resize(img, newW, newH, options.interpolation);
         if (out.empty())
         {
             std::cerr << "ERROR: resize failed\n";
             return 2;
         }
-        if (!SaveImage(argv[5], out))
+        return save_or_report(args[4], out);
+    }
+    else if (cmd == "rotate" || cmd == "transpose" || cmd == "flip")
+    {
+        const bool transposing = cmd == "transpose";
+        const std::string mode = args.size() == 4 ? args[2] : std::string();
+        const bool known = transposing ? args.size() == 3
+                         : cmd == "rotate" ? mode == "90" || mode == "180" || mode == "270"
+                                           : mode == "h" || mode == "v";
+        if (!known || streaming)
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
         {
-            std::cerr << "ERROR: failed to save image: " << argv[5] << "\n";
-            return 3;
+            return rc;
         }
-        return 0;
+        Image out;
+        if (transposing)
+        {
+            out = transpose(img);
+        }
+        else if (cmd == "rotate")
+        {
+            out = mode == "90" ? rotate90(img) : mode == "180" ? rotate180(img) : rotate270(img);
+        }
+        else
+        {
+            // Flips are views: a flipV is saved row by row in place, a flipH is reversed in one copy.
+            out = mode == "h" ? img.flipH() : img.flipV();
+        }
+        return save_or_report(args.back(), out);
+    }
+    else if (cmd == "pipeline")
+    {
+        Pipeline pipeline;
+        if (args.size() < 3 || !parse_pipeline(args, 2, args.size() - 1, pipeline))
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        Image out = pipeline.run(img);
+        if (out.empty())
+        {
+            std::cerr << "ERROR: pipeline produced empty image (check crop bounds and sizes)\n";
+            return 2;
+        }
+        return save_or_report(args.back(), out);
+    }
+    else if (cmd == "blur" || cmd == "sobel" || cmd == "sharpen")
+    {
+        const std::size_t expected = cmd == "sobel" ? 3 : 5;
+        if (args.size() != expected || streaming)
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        Image out;
+        if (cmd == "sobel")
+        {
+            out = sobel(img, options.border);
+        }
+        else if (cmd == "sharpen")
+        {
+            out = unsharp_mask(img, std::atof(args[2].c_str()), std::atof(args[3].c_str()), options.border);
+        }
+        else if (args[2] == "gauss")
+        {
+            out = gaussian_blur(img, std::atof(args[3].c_str()), options.border);
+        }
+        else if (args[2] == "box")
+        {
+            out = box_blur(img, std::atoi(args[3].c_str()), options.border);
+        }
+        else
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        if (out.empty())
+        {
+            std::cerr << "ERROR: " << cmd << " failed (filters need an 8-bit image and positive sizes, radius at most 1024)\n";
+            return 2;
+        }
+        return save_or_report(args.back(), out);
+    }
+    else if (cmd == "overlay")
+    {
+        if (args.size() != 6 || streaming)
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        // Copy-on-write mapping: only the pages under the overlay get copied.
+        Image img;
+        if (!load_image_mapped(args[1], img, MapMode::CopyOnWrite))
+        {
+            std::cerr << "ERROR: failed to load image: " << args[1] << "\n";
+            return 2;
+        }
+        Image mark;
+        if (int rc = load_or_report(args[2], mark))
+        {
+            return rc;
+        }
+        if (!alpha_blend(img, mark, std::atoi(args[3].c_str()), std::atoi(args[4].c_str())))
+        {
+            std::cerr << "ERROR: overlay failed (needs 8-bit images: an overlay with alpha, 2 or 4 channels, and a base with the same colours)\n";
+            return 2;
+        }
+        return save_or_report(args[5], img);
+    }
+    else if (cmd == "convert")
+    {
+        if (args.size() != 3 || !options.hasColorTarget || streaming)
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        Image img;
+        if (int rc = load_or_report(args[1], img))
+        {
+            return rc;
+        }
+        Image out = convert_color(img, options.colorFrom, options.colorTo);
+        if (out.empty())
+        {
+            std::cerr << "ERROR: convert failed (srgb/linear need an 8- or 16-bit image, other spaces an 8-bit image with 3 or 4 channels)\n";
+            return 2;
+        }
+        return save_or_report(args[2], out);
+    }
+    else if (cmd == "batch")
+    {
+        BatchOperation operation;
+        if (args.size() < 3 || options.outDir.empty() || streaming ||
+            !parse_batch_operation(args, 2, options, operation))
+        {
+            print_usage(argv0);
+            return 1;
+        }
+        std::vector<std::string> inputs;
+        if (!list_batch_inputs(args[1], inputs))
+        {
+            std::cerr << "ERROR: failed to read manifest or directory: " << args[1] << "\n";
+            return 2;
+        }
+
+        const BatchReport report = run_batch(inputs, options.outDir, operation, options.jobs, cache,
+                                             describe_operation(args[2], args, 3, args.size(), options));
+        for (const BatchFailure& failure : report.failures)
+        {
+            std::cerr << "ERROR: " << failure.path << ": " << failure.reason << "\n";
+        }
+        const double seconds = report.seconds > 0.0 ? report.seconds : 1e-9;
+        std::cout << "Processed: " << report.succeeded << " ok, " << report.failures.size() << " failed\n"
+                  << "Time: " << report.seconds << " s\n"
+                  << "Throughput: " << static_cast<double>(report.succeeded) / seconds << " images/s, "
+                  << static_cast<double>(report.bytesRead) / (1024.0 * 1024.0) / seconds << " MB/s\n";
+        return report.failures.empty() ? 0 : 2;
     }
     else
+    {
+        print_usage(argv0);
+        return 1;
+    }
+}
+
+// The cache wraps every command that reads args[1] and writes args.back(); batch looks up each input itself.
+static int run_cached(const std::vector<std::string>& args, const ToolOptions& options, const char* argv0)
+{
+    ResultCache cache(options.cacheDir, options.cacheBytes);
+    if (!cache.valid())
+    {
+        std::cerr << "ERROR: cannot use cache directory: " << options.cacheDir << "\n";
+        return 2;
+    }
+
+    // A hit means an earlier run with the same command and arguments succeeded, so they are valid.
+    std::string key;
+    int rc = 0;
+    if (!is_cacheable(args) ||
+        !cache.key(args[1], describe_operation(args[0], args, 2, args.size() - 1, options), key) ||
+        !cache.fetch(key, args.back()))
+    {
+        rc = run_command(args, options, argv0, &cache);
+        if (rc == 0 && !key.empty())
+        {
+            cache.store(key, args.back());
+        }
+    }
+    std::cerr << "Cache: " << cache.hits() << " hits, " << cache.misses() << " misses\n";
+    return rc;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args;
+    ToolOptions options;
+    if (!parse_arguments(argc, argv, args, options) || args.size() < 2)
     {
         print_usage(argv[0]);
         return 1;
     }
+
+    if (options.threads > 0)
+    {
+        ThreadPool::setSharedThreadCount(options.threads);
+    }
+    set_profiling_enabled(options.profile);
+
+    const auto started = std::chrono::steady_clock::now();
+    const int rc = options.cacheDir.empty() ? run_command(args, options, argv[0], nullptr) : run_cached(args, options, argv[0]);
+    if (options.profile)
+    {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        write_profile_json(std::cerr, args[0], rc, seconds, profile_report());
+    }
+    return rc;
 }
@@ -1,25 +1,290 @@
 #include "ops.h"
+#include "lut.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
 #include <algorithm>
-#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+    // Wider depths run these typed loops; 8-bit images keep the SIMD row kernels.
+    template <typename T>
+    T luma_of(T R, T G, T B)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return R * 0.299f + G * 0.587f + B * 0.114f;
+        }
+        else
+        {
+            const std::uint32_t sum = R * std::uint32_t(kLumaR) + G * std::uint32_t(kLumaG) + B * std::uint32_t(kLumaB);
+            return static_cast<T>((sum + (1u << (kLumaShift - 1))) >> kLumaShift);
+        }
+    }
+
+    template <typename T>
+    void gray_samples(const T* src, T* dst, int cols, int channels)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const T* p = src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+            const T R = p[0];
+            const T G = (channels > 1) ? p[1] : R;
+            const T B = (channels > 2) ? p[2] : R;
+            dst[x] = luma_of(R, G, B);
+        }
+    }
+
+    template <typename T>
+    void gray_planar_samples(const T* r, const T* g, const T* b, T* dst, int cols)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            dst[x] = luma_of(r[x], g[x], b[x]);
+        }
+    }
+
+    template <typename T>
+    void gray_rows(const Image& src, Image& gray)
+    {
+        const int cols = src.cols();
+        const int ch = src.channels();
+        // A planar image reads R, G and B from their own planes, with the same fallbacks as interleaved pixels.
+        const int gPlane = ch > 1 ? 1 : 0;
+        const int bPlane = ch > 2 ? 2 : 0;
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * src.elemSize(), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                T* dst = gray.ptr<T>(y, 0);
+                if (!src.isPlanar())
+                {
+                    gray_samples(src.ptr<T>(y, 0), dst, cols, ch);
+                    continue;
+                }
+                const T* r = reinterpret_cast<const T*>(src.planePtr(0, y));
+                const T* g = reinterpret_cast<const T*>(src.planePtr(gPlane, y));
+                const T* b = reinterpret_cast<const T*>(src.planePtr(bPlane, y));
+                if constexpr (std::is_same_v<T, std::uint8_t>)
+                {
+                    kernels.grayPlanarRow(r, g, b, dst, cols);
+                }
+                else
+                {
+                    gray_planar_samples(r, g, b, dst, cols);
+                }
+            }
+        });
+    }
+
+    // fn(srcPlane, dstPlane) for every channel of a planar src, or fn(src, dst) once for an interleaved one.
+    template <typename F>
+    void for_each_plane(const Image& src, Image& dst, F&& fn)
+    {
+        if (!src.isPlanar())
+        {
+            fn(src, dst);
+            return;
+        }
+        for (int k = 0; k < src.channels(); ++k)
+        {
+            Image dstPlane = dst.plane(k);
+            fn(src.plane(k), dstPlane);
+        }
+    }
+
+    void invert_float_rows(const Image& src, Image& out)
+    {
+        const std::size_t samples = static_cast<std::size_t>(src.cols()) * static_cast<std::size_t>(src.channels());
+        parallel_rows(src.rows(), samples * sizeof(float), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                const float* s = src.ptr<float>(y, 0);
+                float* d = out.ptr<float>(y, 0);
+                for (std::size_t i = 0; i < samples; ++i)
+                {
+                    d[i] = 1.0f - s[i];
+                }
+            }
+        });
+    }
+
+    void resize_nearest_rows(const Image& src, Image& dst)
+    {
+        const int srcW = src.cols();
+        const int srcH = src.rows();
+        const int newWidth = dst.cols();
+        const int newHeight = dst.rows();
+        const std::size_t pixelBytes = src.elemSize();
+
+        const float scaleX = static_cast<float>(srcW) / static_cast<float>(newWidth);
+        const float scaleY = static_cast<float>(srcH) / static_cast<float>(newHeight);
+
+        std::vector<std::size_t> srcOffsets(static_cast<std::size_t>(newWidth));
+        for (int x = 0; x < newWidth; ++x)
+        {
+            int srcX = static_cast<int>(x * scaleX);
+            if (srcX >= srcW) srcX = srcW - 1;
+            srcOffsets[static_cast<std::size_t>(x)] = static_cast<std::size_t>(srcX) * pixelBytes;
+        }
+
+        parallel_rows(newHeight, dst.step(), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                int srcY = static_cast<int>(y * scaleY);
+                if (srcY >= srcH) srcY = srcH - 1;
+
+                const unsigned char* srcRow = src.ptr(srcY);
+                unsigned char* dstRow = dst.ptr(y);
+                for (int x = 0; x < newWidth; ++x)
+                {
+                    const unsigned char* s = srcRow + srcOffsets[static_cast<std::size_t>(x)];
+                    unsigned char* d = dstRow + static_cast<std::size_t>(x) * pixelBytes;
+                    for (std::size_t k = 0; k < pixelBytes; ++k)
+                    {
+                        d[k] = s[k];
+                    }
+                }
+            }
+        });
+    }
+
+    // A mirrored src is copied back to front, starting from the pixel lowest in memory.
+    void copy_rows(const Image& src, Image& dst)
+    {
+        const int cols = src.cols();
+        const std::size_t rowBytes = static_cast<std::size_t>(cols) * src.elemSize();
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows(src.rows(), rowBytes, [&](int begin, int end)
+        {
+            for (int r = begin; r < end; ++r)
+            {
+                if (src.isMirrored())
+                {
+                    kernels.reverseRow(src.ptr<unsigned char>(r, cols - 1), dst.ptr(r), cols, src.elemSize());
+                    continue;
+                }
+                std::memcpy(dst.ptr(r), src.ptr(r), rowBytes);
+            }
+        });
+    }
+
+    // Bands of whole tiles go to the pool; within a tile the source rows and the destination rows it
+    // fills stay in cache while transposeBlock swaps them.
+    void transpose_tiles(const Image& src, Image& dst)
+    {
+        if (src.isMirrored())
+        {
+            // The transpose of a row mirror is the transpose of the forward rows, stored bottom-up.
+            Image flipped = dst.flipV();
+            transpose_tiles(src.flipH(), flipped);
+            return;
+        }
+        const std::size_t elemBytes = src.elemSize();
+        const int tile = elemBytes <= 2 ? 64 : 32;
+        const int rows = src.rows();
+        const int cols = src.cols();
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows((rows + tile - 1) / tile, static_cast<std::size_t>(tile) * static_cast<std::size_t>(cols) * elemBytes, [&](int begin, int end)
+        {
+            for (int y = begin * tile; y < std::min(rows, end * tile); y += tile)
+            {
+                const int h = std::min(tile, rows - y);
+                for (int x = 0; x < cols; x += tile)
+                {
+                    kernels.transposeBlock(src.ptr<unsigned char>(y, x), src.step(), dst.ptr<unsigned char>(x, y), dst.step(),
+                                           h, std::min(tile, cols - x), elemBytes);
+                }
+            }
+        });
+    }
+
+    // Shared by both conversions: rows of `planar` and `interleaved` are exchanged through the kernels.
+    template <bool ToPlanar>
+    void convert_layout(const Image& src, Image& dst)
+    {
+        const Image& planar = ToPlanar ? dst : src;
+        const Image& interleaved = ToPlanar ? src : dst;
+        const int cols = src.cols();
+        const int ch = src.channels();
+        const std::size_t sampleBytes = src.elemSize1();
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows(src.rows(), static_cast<std::size_t>(cols) * src.elemSize(), [&](int begin, int end)
+        {
+            std::vector<unsigned char*> planes(static_cast<std::size_t>(ch));
+            for (int y = begin; y < end; ++y)
+            {
+                for (int k = 0; k < ch; ++k)
+                {
+                    planes[static_cast<std::size_t>(k)] = const_cast<unsigned char*>(planar.planePtr(k, y));
+                }
+                unsigned char* pixels = const_cast<unsigned char*>(interleaved.ptr(y));
+                if (sampleBytes == 1)
+                {
+                    if constexpr (ToPlanar)
+                    {
+                        kernels.deinterleaveRow(pixels, planes.data(), cols, ch);
+                    }
+                    else
+                    {
+                        kernels.interleaveRow(planes.data(), pixels, cols, ch);
+                    }
+                    continue;
+                }
+                for (int x = 0; x < cols; ++x)
+                {
+                    unsigned char* pixel = pixels + static_cast<std::size_t>(x) * static_cast<std::size_t>(ch) * sampleBytes;
+                    for (int k = 0; k < ch; ++k)
+                    {
+                        unsigned char* sample = planes[static_cast<std::size_t>(k)] + static_cast<std::size_t>(x) * sampleBytes;
+                        if constexpr (ToPlanar)
+                        {
+                            std::memcpy(sample, pixel + static_cast<std::size_t>(k) * sampleBytes, sampleBytes);
+                        }
+                        else
+                        {
+                            std::memcpy(pixel + static_cast<std::size_t>(k) * sampleBytes, sample, sampleBytes);
+                        }
+                    }
+                }
+            }
+        });
+    }
+}
 
 Image invert(const Image& src)
 {
+    IMG_PROFILE_SCOPE("invert", profile_bytes(src));
     if (src.empty())
     {
         return Image();
     }
+    if (src.isMirrored())
+    {
+        return invert(src.unmirrored());
+    }
 
-    Image out = src.clone();
-    const int totalComps = src.rows() * src.cols() * src.channels();
-    for (int i = 0; i < totalComps; ++i)
+    if (src.depth() != PixelDepth::F32)
     {
-        out.at(i) = static_cast<unsigned char>(255 - out.at(i));
+        // U8 and U16 samples invert to max - v, which is every byte through the invert table.
+        return apply_lut_bytes(src, kInvertLut);
     }
+
+    Image out(src.rows(), src.cols(), src.channels(), src.depth(), src.layout());
+    for_each_plane(src, out, invert_float_rows);
     return out;
 }
 
 Image to_grayscale(const Image& src)
 {
+    IMG_PROFILE_SCOPE("to_grayscale", profile_bytes(src));
     if (src.empty())
     {
         return Image();
@@ -29,82 +294,180 @@ Image to_grayscale(const Image& src)
     {
         return src.clone();
     }
+    if (src.isMirrored())
+    {
+        return to_grayscale(src.unmirrored());
+    }
 
     const int rows = src.rows();
     const int cols = src.cols();
     const int ch   = src.channels();
 
-    Image gray(rows, cols, 1);
-    for (int r = 0; r < rows; ++r)
+    Image gray(rows, cols, 1, src.depth());
+    if (src.depth() == PixelDepth::U16)
     {
-        for (int c = 0; c < cols; ++c)
-        {
-            const int base = (r * cols + c) * ch;
-            const unsigned char R = src.at(base + 0);
-            const unsigned char G = (ch > 1) ? src.at(base + 1) : R;
-            const unsigned char B = (ch > 2) ? src.at(base + 2) : R;
+        gray_rows<std::uint16_t>(src, gray);
+        return gray;
+    }
+    if (src.depth() == PixelDepth::F32)
+    {
+        gray_rows<float>(src, gray);
+        return gray;
+    }
+    if (src.isPlanar())
+    {
+        gray_rows<std::uint8_t>(src, gray);
+        return gray;
+    }
 
-            const float y = 0.299f * R + 0.587f * G + 0.114f * B;
-            unsigned char Y = static_cast<unsigned char>(std::clamp(static_cast<int>(std::lround(y)), 0, 255));
-            gray.at(r * cols + c) = Y;
+    const PixelKernels& kernels = active_kernels();
+    const bool continuous = src.isContinuous() && gray.isContinuous();
+    parallel_rows(rows, static_cast<std::size_t>(cols) * src.elemSize(), [&](int begin, int end)
+    {
+        if (continuous)
+        {
+            kernels.grayRow(src.ptr(begin), gray.ptr(begin), (end - begin) * cols, ch);
+            return;
         }
-    }
+        for (int y = begin; y < end; ++y)
+        {
+            kernels.grayRow(src.ptr(y), gray.ptr(y), cols, ch);
+        }
+    });
     return gray;
 }
 
 Image resize_nearest(const Image& src, int newWidth, int newHeight)
 {
+    IMG_PROFILE_SCOPE("resize_nearest", profile_bytes(src));
     if (src.empty() || newWidth <= 0 || newHeight <= 0)
     {
         return Image();
     }
+    if (src.isMirrored())
+    {
+        return resize_nearest(src.unmirrored(), newWidth, newHeight);
+    }
 
-    const int srcW = src.cols();
-    const int srcH = src.rows();
-    const int ch   = src.channels();
+    Image dst(newHeight, newWidth, src.channels(), src.depth(), src.layout());
+    for_each_plane(src, dst, resize_nearest_rows);
+    return dst;
+}
 
-    Image dst(newHeight, newWidth, ch);
+Image crop(const Image& src, int x, int y, int w, int h)
+{
+    IMG_PROFILE_SCOPE("crop", profile_bytes(src));
+    if (src.empty() || w <= 0 || h <= 0)
+    {
+        return Image();
+    }
 
-    const float scaleX = static_cast<float>(srcW) / static_cast<float>(newWidth);
-    const float scaleY = static_cast<float>(srcH) / static_cast<float>(newHeight);
+    int x2 = x + w;
+    int y2 = y + h;
 
-    for (int y = 0; y < newHeight; ++y)
+    Image view = src(Range(y, y2), Range(x, x2));
+    if (view.empty())
     {
-        int srcY = static_cast<int>(y * scaleY);
-        if (srcY >= srcH) srcY = srcH - 1;
+        return Image();
+    }
 
-        for (int x = 0; x < newWidth; ++x)
-        {
-            int srcX = static_cast<int>(x * scaleX);
-            if (srcX >= srcW) srcX = srcW - 1;
+    Image out(view.rows(), view.cols(), view.channels(), view.depth(), view.layout());
+    for_each_plane(view, out, copy_rows);
+    return out;
+}
 
-            const int srcBase = (srcY * srcW + srcX) * ch;
-            const int dstBase = (y * newWidth + x) * ch;
+Image to_planar(const Image& src)
+{
+    IMG_PROFILE_SCOPE("to_planar", profile_bytes(src));
+    if (src.empty() || src.isPlanar())
+    {
+        return src.clone();
+    }
+    if (src.isMirrored())
+    {
+        return to_planar(src.unmirrored());
+    }
+    Image dst(src.rows(), src.cols(), src.channels(), src.depth(), PixelLayout::Planar);
+    convert_layout<true>(src, dst);
+    return dst;
+}
 
-            for (int k = 0; k < ch; ++k)
-            {
-                dst.at(dstBase + k) = src.at(srcBase + k);
-            }
-        }
+Image to_interleaved(const Image& src)
+{
+    IMG_PROFILE_SCOPE("to_interleaved", profile_bytes(src));
+    if (src.empty() || !src.isPlanar())
+    {
+        return src.clone();
+    }
+    if (src.isMirrored())
+    {
+        return to_interleaved(src.unmirrored());
     }
+    Image dst(src.rows(), src.cols(), src.channels(), src.depth());
+    convert_layout<false>(src, dst);
+    return dst;
+}
 
+Image transpose(const Image& src)
+{
+    IMG_PROFILE_SCOPE("transpose", profile_bytes(src));
+    if (src.empty())
+    {
+        return Image();
+    }
+    Image dst(src.cols(), src.rows(), src.channels(), src.depth(), src.layout());
+    for_each_plane(src, dst, transpose_tiles);
     return dst;
 }
 
-Image crop(const Image& src, int x, int y, int w, int h)
+// Pixel (x, y) of the result is src(rows - 1 - x, y).
+Image rotate90(const Image& src)
 {
-    if (src.empty() || w <= 0 || h <= 0)
+    IMG_PROFILE_SCOPE("rotate90", profile_bytes(src));
+    return transpose(src.flipV());
+}
+
+Image rotate180(const Image& src)
+{
+    IMG_PROFILE_SCOPE("rotate180", profile_bytes(src));
+    if (src.empty())
     {
         return Image();
     }
+    Image dst(src.rows(), src.cols(), src.channels(), src.depth(), src.layout());
+    for_each_plane(src.flipV().flipH(), dst, copy_rows);
+    return dst;
+}
 
-    int x2 = x + w;
-    int y2 = y + h;
+// Pixel (x, y) of the result is src(x, cols - 1 - y).
+Image rotate270(const Image& src)
+{
+    IMG_PROFILE_SCOPE("rotate270", profile_bytes(src));
+    return transpose(src.flipH());
+}
 
-    Image view = src(Range(y, y2), Range(x, x2));
-    if (view.empty())
+Image merge_planes(const std::vector<Image>& planes)
+{
+    IMG_PROFILE_SCOPE("merge_planes", 0);
+    if (planes.empty())
     {
         return Image();
     }
-    return view.clone();
+    const Image& first = planes.front();
+    for (const Image& plane : planes)
+    {
+        if (plane.empty() || plane.channels() != 1 || plane.rows() != first.rows() ||
+            plane.cols() != first.cols() || plane.depth() != first.depth())
+        {
+            return Image();
+        }
+    }
+    Image dst(first.rows(), first.cols(), static_cast<int>(planes.size()), first.depth(), PixelLayout::Planar);
+    for (int k = 0; k < dst.channels(); ++k)
+    {
+        Image dstPlane = dst.plane(k);
+        copy_rows(planes[static_cast<std::size_t>(k)].plane(0), dstPlane);
+    }
+    IMG_PROFILE_BYTES(profile_bytes(dst));
+    return dst;
 }
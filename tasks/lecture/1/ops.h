@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "Image.h"
 
 Image invert(const Image& src);
@@ -8,3 +9,21 @@ Image to_grayscale(const Image& src);
 Image resize_nearest(const Image& src, int newWidth, int newHeight);
 
 Image crop(const Image& src, int x, int y, int w, int h);
+
+// Pixel (x, y) moves to (y, x). The rotations turn clockwise by the given angle. Mirrored
+// sources (Image::flipH) are read in place; flips themselves are the views Image::flipH()
+// and Image::flipV().
+Image transpose(const Image& src);
+Image rotate90(const Image& src);
+Image rotate180(const Image& src);
+Image rotate270(const Image& src);
+
+// Ops keep the layout of their source (to_grayscale returns one channel either way).
+// These convert between layouts; the result is packed, and a source already in the
+// requested layout is cloned.
+Image to_planar(const Image& src);
+Image to_interleaved(const Image& src);
+
+// Planar image whose plane k is a copy of planes[k]; the inputs must be single-channel
+// and agree in size and depth, otherwise the result is empty.
+Image merge_planes(const std::vector<Image>& planes);
@@ -1,176 +1,1176 @@
 #include "ppm_io.h"
-#include <fstream>
+#include "ops.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMG_HAVE_MMAP 1
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace
 {
-    bool next_token(std::istream& is, std::string& token)
+    constexpr std::size_t kBlockBytes = std::size_t(1) << 20;
+    constexpr int kAsciiValuesPerLine = 16;
+
+    inline bool is_space(int c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+    }
+
+    // Byte sources for the header scanner; both return EOF past the end.
+    // StreamSource goes through the streambuf directly: no sentry per character.
+    class StreamSource
+    {
+    public:
+        explicit StreamSource(std::istream& is)
+            : buffer(is.rdbuf())
+        {
+        }
+
+        int peek()
+        {
+            return buffer != nullptr ? buffer->sgetc() : EOF;
+        }
+
+        int get()
+        {
+            return buffer != nullptr ? buffer->sbumpc() : EOF;
+        }
+
+    private:
+        std::streambuf* buffer;
+    };
+
+    class MemorySource
     {
-        token.clear();
+    public:
+        MemorySource(const unsigned char* data, std::size_t size)
+            : begin(data), cursor(data), end(data + size)
+        {
+        }
+
+        int peek()
+        {
+            return cursor < end ? *cursor : EOF;
+        }
+
+        int get()
+        {
+            return cursor < end ? *cursor++ : EOF;
+        }
 
+        std::size_t consumed() const
+        {
+            return static_cast<std::size_t>(cursor - begin);
+        }
+
+    private:
+        const unsigned char* begin;
+        const unsigned char* cursor;
+        const unsigned char* end;
+    };
+
+    // Skips whitespace and '#' comments.
+    template <typename Source>
+    void skip_blanks(Source& src)
+    {
         for (;;)
         {
-            int c = is.peek();
-            if (c == EOF)
+            int c = src.peek();
+            if (is_space(c))
+            {
+                src.get();
+            }
+            else if (c == '#')
+            {
+                do
+                {
+                    c = src.get();
+                }
+                while (c != '\n' && c != EOF);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    // Skips whitespace and '#' comments, then reads one unsigned decimal number.
+    template <typename Source>
+    bool next_number(Source& src, int& value)
+    {
+        skip_blanks(src);
+        char digits[12];
+        std::size_t count = 0;
+        for (int c = src.peek(); c >= '0' && c <= '9'; c = src.peek())
+        {
+            if (count == sizeof(digits))
             {
                 return false;
             }
-            if (std::isspace(c))
+            digits[count++] = static_cast<char>(src.get());
+        }
+        if (count == 0)
+        {
+            return false;
+        }
+        const auto result = std::from_chars(digits, digits + count, value);
+        return result.ec == std::errc() && result.ptr == digits + count;
+    }
+
+    // Skips whitespace and '#' comments, then reads one PAM header keyword.
+    template <typename Source>
+    bool next_keyword(Source& src, std::string& word)
+    {
+        skip_blanks(src);
+        word.clear();
+        for (int c = src.peek(); c >= 'A' && c <= 'Z'; c = src.peek())
+        {
+            if (word.size() == 8)
             {
-                is.get();
-                continue;
+                return false;
             }
-            if (c == '#')
+            word += static_cast<char>(src.get());
+        }
+        return !word.empty();
+    }
+
+    // PAM (P7): "KEYWORD value" lines up to ENDHDR. TUPLTYPE is informative only; DEPTH gives the channels.
+    template <typename Source>
+    bool parse_pam_fields(Source& src, int& w, int& h, int& channels, int& maxval)
+    {
+        std::string word;
+        while (next_keyword(src, word))
+        {
+            if (word == "ENDHDR")
+            {
+                return src.get() == '\n' && channels >= 1 && channels <= 4;
+            }
+            if (word == "TUPLTYPE")
             {
-                is.get();
-                while (true)
+                for (int c = src.get(); c != '\n'; c = src.get())
                 {
-                    int d = is.get();
-                    if (d == '\n' || d == EOF)
+                    if (c == EOF)
                     {
-                        break;
+                        return false;
                     }
                 }
                 continue;
             }
-            break;
+            int* field = word == "WIDTH" ? &w : word == "HEIGHT" ? &h : word == "DEPTH" ? &channels
+                       : word == "MAXVAL" ? &maxval : nullptr;
+            if (field == nullptr || !next_number(src, *field))
+            {
+                return false;
+            }
         }
+        return false;
+    }
 
-        while (true)
+    template <typename Source>
+    bool parse_header(Source& src, PnmHeader& header)
+    {
+        if (src.get() != 'P')
         {
-            int c = is.peek();
-            if (c == EOF || std::isspace(c) || c == '#')
+            return false;
+        }
+        int channels = 0;
+        bool ascii = false;
+        bool pam = false;
+        switch (src.get())
+        {
+        case '2': channels = 1; ascii = true; break;
+        case '3': channels = 3; ascii = true; break;
+        case '5': channels = 1; break;
+        case '6': channels = 3; break;
+        case '7': pam = true; break;
+        default: return false;
+        }
+
+        int w = 0, h = 0, maxval = 0;
+        if (pam ? !is_space(src.get()) || !parse_pam_fields(src, w, h, channels, maxval)
+                : !next_number(src, w) || !next_number(src, h) || !next_number(src, maxval) || !is_space(src.get()))
+        {
+            return false;
+        }
+        if ((maxval != 255 && (maxval < 256 || maxval > 65535)) || w <= 0 || h <= 0)
+        {
+            return false;
+        }
+
+        header.width = w;
+        header.height = h;
+        header.channels = channels;
+        header.maxval = maxval;
+        header.ascii = ascii;
+        return true;
+    }
+
+    // Parses whitespace-separated samples from [p, end) until `out` reaches `outEnd` or the
+    // input runs out; returns where it stopped, nullptr on a malformed sample or one above maxval.
+    template <typename T>
+    const char* parse_ascii_samples(const char* p, const char* end, T*& out, T* outEnd, unsigned maxval)
+    {
+        while (out < outEnd)
+        {
+            while (p < end && is_space(*p))
+            {
+                ++p;
+            }
+            if (p == end)
             {
                 break;
             }
-            token.push_back(static_cast<char>(is.get()));
+            unsigned value = 0;
+            const auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc() || value > maxval || (result.ptr < end && !is_space(*result.ptr)))
+            {
+                return nullptr;
+            }
+            *out++ = static_cast<T>(value);
+            p = result.ptr;
         }
+        return p;
+    }
 
-        return !token.empty();
+    // Reads the body in large blocks; a number cut by the block end is carried into the next block.
+    template <typename T>
+    bool read_ascii_body(std::istream& is, T* out, std::size_t count, unsigned maxval)
+    {
+        T* const outEnd = out + count;
+        std::vector<char> block(kBlockBytes);
+        std::size_t carried = 0;
+        while (out < outEnd)
+        {
+            is.read(block.data() + carried, static_cast<std::streamsize>(block.size() - carried));
+            const std::size_t filled = carried + static_cast<std::size_t>(is.gcount());
+            const bool last = filled < block.size();
+            const char* const end = block.data() + filled;
+
+            const char* cut = end;
+            if (!last)
+            {
+                while (cut > block.data() && !is_space(cut[-1]))
+                {
+                    --cut;
+                }
+                if (cut == block.data())
+                {
+                    return false;
+                }
+            }
+            if (parse_ascii_samples(block.data(), cut, out, outEnd, maxval) == nullptr || last)
+            {
+                break;
+            }
+            carried = static_cast<std::size_t>(end - cut);
+            std::memmove(block.data(), cut, carried);
+        }
+        return out == outEnd;
     }
 
-    bool read_header(std::istream& is, std::string& magic, int& width, int& height, int& maxval)
+    template <typename T>
+    bool write_ascii_body(std::ostream& os, const Image& image)
     {
-        std::string tok;
+        const std::size_t rowSamples = static_cast<std::size_t>(image.cols()) * static_cast<std::size_t>(image.channels());
+        std::vector<char> block(kBlockBytes);
+        char* p = block.data();
+        // Room for one more "65535\n" without a bounds check per sample.
+        const char* const flushAt = block.data() + block.size() - 8;
+        int column = 0;
+        for (int r = 0; r < image.rows(); ++r)
+        {
+            const T* row = image.ptr<T>(r, 0);
+            for (std::size_t i = 0; i < rowSamples; ++i)
+            {
+                p = std::to_chars(p, p + 5, row[i]).ptr;
+                // Plain PNM lines stay under 70 characters.
+                const bool lineEnd = ++column == kAsciiValuesPerLine || i + 1 == rowSamples;
+                *p++ = lineEnd ? '\n' : ' ';
+                column = lineEnd ? 0 : column;
+                if (p >= flushAt)
+                {
+                    os.write(block.data(), p - block.data());
+                    p = block.data();
+                }
+            }
+        }
+        os.write(block.data(), p - block.data());
+        return static_cast<bool>(os);
+    }
+
+    PixelDepth depth_for_maxval(int maxval)
+    {
+        return maxval > 255 ? PixelDepth::U16 : PixelDepth::U8;
+    }
+
+    // Stretches samples in [0, maxval] to the full 16-bit range, so every U16 image means the same scale.
+    void rescale_samples(std::uint16_t* samples, std::size_t count, int maxval)
+    {
+        if (maxval == 65535)
+        {
+            return;
+        }
+        std::vector<std::uint16_t> lut(static_cast<std::size_t>(maxval) + 1);
+        for (std::size_t v = 0; v < lut.size(); ++v)
+        {
+            lut[v] = static_cast<std::uint16_t>((v * 65535u + static_cast<unsigned>(maxval) / 2) / static_cast<unsigned>(maxval));
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            samples[i] = lut[std::min<std::size_t>(samples[i], static_cast<std::size_t>(maxval))];
+        }
+    }
 
-        if (!next_token(is, magic))
+    // Decodes a binary 16-bit payload (big-endian) into the packed image; src may be img.data().
+    void decode_wide_payload(const unsigned char* src, Image& img, int maxval)
+    {
+        const std::size_t samples = static_cast<std::size_t>(img.total()) * static_cast<std::size_t>(img.channels());
+        active_kernels().swapBytes16(src, img.data(), samples);
+        rescale_samples(reinterpret_cast<std::uint16_t*>(img.data()), samples, maxval);
+    }
+
+    // Decodes an ASCII payload held in memory into the packed image.
+    bool decode_ascii_payload(const char* begin, const char* end, Image& img, int maxval)
+    {
+        const std::size_t samples = static_cast<std::size_t>(img.total()) * static_cast<std::size_t>(img.channels());
+        if (img.depth() == PixelDepth::U16)
+        {
+            std::uint16_t* out = reinterpret_cast<std::uint16_t*>(img.data());
+            std::uint16_t* const outEnd = out + samples;
+            if (parse_ascii_samples(begin, end, out, outEnd, static_cast<unsigned>(maxval)) == nullptr || out != outEnd)
+            {
+                return false;
+            }
+            rescale_samples(reinterpret_cast<std::uint16_t*>(img.data()), samples, maxval);
+            return true;
+        }
+        unsigned char* out = img.data();
+        return parse_ascii_samples(begin, end, out, out + samples, 255u) != nullptr && out == img.data() + samples;
+    }
+
+    // 16-bit rows go out big-endian through a staging block, never a copy of the whole image.
+    template <typename Sink>
+    bool write_swapped_rows(const Image& image, Sink&& sink)
+    {
+        const std::size_t rowBytes = static_cast<std::size_t>(image.cols()) * image.elemSize();
+        const std::size_t rowsPerBlock = std::max<std::size_t>(1, kBlockBytes / rowBytes);
+        std::vector<unsigned char> block(rowsPerBlock * rowBytes);
+        const PixelKernels& kernels = active_kernels();
+        std::size_t filled = 0;
+        for (int r = 0; r < image.rows(); ++r)
+        {
+            kernels.swapBytes16(image.ptr(r), block.data() + filled, rowBytes / 2);
+            filled += rowBytes;
+            if (filled == block.size() || r + 1 == image.rows())
+            {
+                if (!sink(block.data(), filled))
+                {
+                    return false;
+                }
+                filled = 0;
+            }
+        }
+        return true;
+    }
+
+    // ---------- QOI (https://qoiformat.org/qoi-specification.pdf) ----------
+    // Pixels travel as 32-bit R | G << 8 | B << 16 | A << 24 values.
+
+    constexpr unsigned char kQoiMagic[4] = { 'q', 'o', 'i', 'f' };
+    constexpr std::size_t kQoiHeaderBytes = 14;
+    constexpr unsigned char kQoiEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    // Limit of the reference implementation; also keeps every size computation far from overflow.
+    constexpr std::uint64_t kQoiMaxPixels = 400000000;
+    constexpr unsigned kQoiOpIndex = 0x00;
+    constexpr unsigned kQoiOpDiff = 0x40;
+    constexpr unsigned kQoiOpLuma = 0x80;
+    constexpr unsigned kQoiOpRun = 0xC0;
+    constexpr unsigned kQoiOpRgb = 0xFE;
+    constexpr unsigned kQoiOpRgba = 0xFF;
+    constexpr int kQoiMaxRun = 62;
+    constexpr std::uint32_t kQoiStart = 0xFF000000u;  // opaque black
+
+    bool has_qoi_magic(const unsigned char* data, std::size_t size)
+    {
+        return size >= sizeof(kQoiMagic) && std::memcmp(data, kQoiMagic, sizeof(kQoiMagic)) == 0;
+    }
+
+    bool is_qoi_path(const std::string& path)
+    {
+        if (path.size() < 4)
         {
             return false;
         }
+        std::string ext = path.substr(path.size() - 4);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ext == ".qoi";
+    }
+
+    // (r * 3 + g * 5 + b * 7 + a * 11) % 64 with one multiply: with the bytes spread 16 bits apart,
+    // bits 48..63 of the product hold exactly that sum, and the lower partial products never carry into them.
+    inline unsigned qoi_hash(std::uint32_t px)
+    {
+        const std::uint64_t spread = (px & 0x00FF00FFu) | (static_cast<std::uint64_t>(px & 0xFF00FF00u) << 24);
+        return static_cast<unsigned>((spread * 0x000300070005000Bull) >> 48) & 63u;
+    }
+
+    // Bytewise a + b modulo 256 in every lane.
+    inline std::uint32_t add_bytes(std::uint32_t a, std::uint32_t b)
+    {
+        return ((a & 0x7F7F7F7Fu) + (b & 0x7F7F7F7Fu)) ^ ((a ^ b) & 0x80808080u);
+    }
+
+    inline std::uint32_t pack_deltas(int dr, int dg, int db)
+    {
+        return static_cast<std::uint32_t>(dr & 0xFF) | static_cast<std::uint32_t>(dg & 0xFF) << 8 |
+               static_cast<std::uint32_t>(db & 0xFF) << 16;
+    }
+
+    inline void put_be32(unsigned char* p, std::uint32_t v)
+    {
+        p[0] = static_cast<unsigned char>(v >> 24);
+        p[1] = static_cast<unsigned char>(v >> 16);
+        p[2] = static_cast<unsigned char>(v >> 8);
+        p[3] = static_cast<unsigned char>(v);
+    }
+
+    inline std::uint32_t get_be32(const unsigned char* p)
+    {
+        return static_cast<std::uint32_t>(p[0]) << 24 | static_cast<std::uint32_t>(p[1]) << 16 |
+               static_cast<std::uint32_t>(p[2]) << 8 | p[3];
+    }
+
+    struct QoiState
+    {
+        std::uint32_t index[64] = {};
+        std::uint32_t prev = kQoiStart;
+        int run = 0;
+    };
+
+    // Appends the chunks of one row; runs carry over into the next row.
+    template <int Channels>
+    unsigned char* qoi_encode_row(QoiState& s, const unsigned char* row, int cols, unsigned char* out)
+    {
+        for (int x = 0; x < cols; ++x, row += Channels)
+        {
+            const std::uint32_t alpha = Channels == 4 ? static_cast<std::uint32_t>(row[3]) << 24 : kQoiStart;
+            const std::uint32_t px = static_cast<std::uint32_t>(row[0]) | static_cast<std::uint32_t>(row[1]) << 8 |
+                                     static_cast<std::uint32_t>(row[2]) << 16 | alpha;
+            if (px == s.prev)
+            {
+                if (++s.run == kQoiMaxRun)
+                {
+                    *out++ = static_cast<unsigned char>(kQoiOpRun | (kQoiMaxRun - 1));
+                    s.run = 0;
+                }
+                continue;
+            }
+            if (s.run > 0)
+            {
+                *out++ = static_cast<unsigned char>(kQoiOpRun | static_cast<unsigned>(s.run - 1));
+                s.run = 0;
+            }
+
+            const unsigned h = qoi_hash(px);
+            if (s.index[h] == px)
+            {
+                *out++ = static_cast<unsigned char>(kQoiOpIndex | h);
+            }
+            else if ((px ^ s.prev) >> 24 != 0)
+            {
+                s.index[h] = px;
+                out[0] = static_cast<unsigned char>(kQoiOpRgba);
+                out[1] = row[0];
+                out[2] = row[1];
+                out[3] = row[2];
+                out[4] = static_cast<unsigned char>(px >> 24);
+                out += 5;
+            }
+            else
+            {
+                s.index[h] = px;
+                // Channel differences wrap around like the samples themselves.
+                const int dr = static_cast<signed char>(static_cast<unsigned char>(px - s.prev));
+                const int dg = static_cast<signed char>(static_cast<unsigned char>((px >> 8) - (s.prev >> 8)));
+                const int db = static_cast<signed char>(static_cast<unsigned char>((px >> 16) - (s.prev >> 16)));
+                const int dgr = static_cast<signed char>(dr - dg);
+                const int dgb = static_cast<signed char>(db - dg);
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                    *out++ = static_cast<unsigned char>(kQoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7)
+                {
+                    out[0] = static_cast<unsigned char>(kQoiOpLuma | (dg + 32));
+                    out[1] = static_cast<unsigned char>((dgr + 8) << 4 | (dgb + 8));
+                    out += 2;
+                }
+                else
+                {
+                    out[0] = static_cast<unsigned char>(kQoiOpRgb);
+                    out[1] = row[0];
+                    out[2] = row[1];
+                    out[3] = row[2];
+                    out += 4;
+                }
+            }
+            s.prev = px;
+        }
+        return out;
+    }
 
-        if (!next_token(is, tok))
+    // Encodes row by row into a block that is handed to sink(data, size) whenever it might not hold
+    // another row, so memory stays at one block however large the image is.
+    template <typename Sink>
+    bool write_qoi(const Image& image, Sink&& sink)
+    {
+        const int channels = image.channels();
+        const int cols = image.cols();
+        // QOI_OP_RGBA is the longest chunk: 5 bytes per pixel, plus the run carried over from the previous row.
+        const std::size_t rowWorst = static_cast<std::size_t>(cols) * 5 + 1;
+        std::vector<unsigned char> block(std::max(kBlockBytes, rowWorst + kQoiHeaderBytes + sizeof(kQoiEnd) + 1));
+
+        std::memcpy(block.data(), kQoiMagic, sizeof(kQoiMagic));
+        put_be32(block.data() + 4, static_cast<std::uint32_t>(cols));
+        put_be32(block.data() + 8, static_cast<std::uint32_t>(image.rows()));
+        block[12] = static_cast<unsigned char>(channels);
+        block[13] = 0;  // sRGB with linear alpha
+        unsigned char* out = block.data() + kQoiHeaderBytes;
+
+        QoiState state;
+        for (int r = 0; r < image.rows(); ++r)
+        {
+            if (static_cast<std::size_t>(block.data() + block.size() - out) < rowWorst)
+            {
+                if (!sink(block.data(), static_cast<std::size_t>(out - block.data())))
+                {
+                    return false;
+                }
+                out = block.data();
+            }
+            out = channels == 4 ? qoi_encode_row<4>(state, image.ptr(r), cols, out)
+                                : qoi_encode_row<3>(state, image.ptr(r), cols, out);
+        }
+        if (static_cast<std::size_t>(block.data() + block.size() - out) < sizeof(kQoiEnd) + 1)
+        {
+            if (!sink(block.data(), static_cast<std::size_t>(out - block.data())))
+            {
+                return false;
+            }
+            out = block.data();
+        }
+        if (state.run > 0)
+        {
+            *out++ = static_cast<unsigned char>(kQoiOpRun | static_cast<unsigned>(state.run - 1));
+        }
+        std::memcpy(out, kQoiEnd, sizeof(kQoiEnd));
+        out += sizeof(kQoiEnd);
+        return sink(block.data(), static_cast<std::size_t>(out - block.data()));
+    }
+
+    template <int Channels>
+    inline unsigned char* put_pixel(unsigned char* o, std::uint32_t px)
+    {
+        o[0] = static_cast<unsigned char>(px);
+        o[1] = static_cast<unsigned char>(px >> 8);
+        o[2] = static_cast<unsigned char>(px >> 16);
+        if constexpr (Channels == 4)
+        {
+            o[3] = static_cast<unsigned char>(px >> 24);
+        }
+        return o + Channels;
+    }
+
+    // Every chunk is at most 5 bytes and the stream ends with the 8-byte end marker, so checking
+    // the chunk start against the marker keeps all reads inside the buffer.
+    template <int Channels>
+    bool qoi_decode_pixels(const unsigned char* p, const unsigned char* chunksEnd, unsigned char* o, std::size_t pixels)
+    {
+        std::uint32_t index[64] = {};
+        std::uint32_t px = kQoiStart;
+        unsigned char* const oEnd = o + pixels * Channels;
+        while (o != oEnd)
+        {
+            if (p >= chunksEnd)
+            {
+                return false;
+            }
+            const unsigned b1 = *p++;
+            switch (b1 >> 6)
+            {
+            case kQoiOpIndex >> 6:
+                // An index chunk names the slot of its own hash, so the table needs no update.
+                px = index[b1];
+                o = put_pixel<Channels>(o, px);
+                continue;
+            case kQoiOpDiff >> 6:
+                px = add_bytes(px, pack_deltas(static_cast<int>((b1 >> 4) & 3) - 2, static_cast<int>((b1 >> 2) & 3) - 2,
+                                               static_cast<int>(b1 & 3) - 2));
+                break;
+            case kQoiOpLuma >> 6:
+            {
+                const unsigned b2 = *p++;
+                const int dg = static_cast<int>(b1 & 0x3F) - 32;
+                px = add_bytes(px, pack_deltas(dg - 8 + static_cast<int>(b2 >> 4), dg, dg - 8 + static_cast<int>(b2 & 0x0F)));
+                break;
+            }
+            default:
+                if (b1 == kQoiOpRgb)
+                {
+                    px = (px & 0xFF000000u) | p[0] | static_cast<std::uint32_t>(p[1]) << 8 | static_cast<std::uint32_t>(p[2]) << 16;
+                    p += 3;
+                }
+                else if (b1 == kQoiOpRgba)
+                {
+                    px = p[0] | static_cast<std::uint32_t>(p[1]) << 8 | static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+                    p += 4;
+                }
+                else
+                {
+                    const std::size_t left = static_cast<std::size_t>(oEnd - o) / Channels;
+                    const std::size_t run = std::min<std::size_t>((b1 & 0x3F) + 1, left);
+                    for (std::size_t i = 0; i < run; ++i)
+                    {
+                        o = put_pixel<Channels>(o, px);
+                    }
+                    index[qoi_hash(px)] = px;
+                    continue;
+                }
+                break;
+            }
+            index[qoi_hash(px)] = px;
+            o = put_pixel<Channels>(o, px);
+        }
+        return true;
+    }
+
+    bool decode_qoi(const unsigned char* data, std::size_t size, Image& outImage)
+    {
+        if (size < kQoiHeaderBytes + sizeof(kQoiEnd) || !has_qoi_magic(data, size))
+        {
+            return false;
+        }
+        const std::uint32_t w = get_be32(data + 4);
+        const std::uint32_t h = get_be32(data + 8);
+        const int channels = data[12];
+        if (w == 0 || h == 0 || (channels != 3 && channels != 4) || data[13] > 1 ||
+            static_cast<std::uint64_t>(w) * h > kQoiMaxPixels)
+        {
+            return false;
+        }
+
+        Image img;
+        img.create(static_cast<int>(h), static_cast<int>(w), channels, PixelDepth::U8, 1);
+        if (img.empty())
+        {
+            return false;
+        }
+        const unsigned char* chunksEnd = data + size - sizeof(kQoiEnd);
+        const std::size_t pixels = static_cast<std::size_t>(w) * h;
+        const bool ok = channels == 4 ? qoi_decode_pixels<4>(data + kQoiHeaderBytes, chunksEnd, img.data(), pixels)
+                                      : qoi_decode_pixels<3>(data + kQoiHeaderBytes, chunksEnd, img.data(), pixels);
+        if (!ok)
+        {
+            return false;
+        }
+        outImage = std::move(img);
+        return true;
+    }
+
+#ifdef IMG_HAVE_MMAP
+    void unmap_buffer(unsigned char* base, std::size_t byteSize)
+    {
+        ::munmap(base, byteSize);
+    }
+
+#ifdef IOV_MAX
+    constexpr int kMaxIovecs = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+    constexpr int kMaxIovecs = 16;
+#endif
+
+    // writev until every vector is written, resuming after short writes.
+    bool write_vectors(int fd, iovec* iov, int count)
+    {
+        while (count > 0)
+        {
+            const ssize_t written = ::writev(fd, iov, count);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            std::size_t left = static_cast<std::size_t>(written);
+            while (count > 0 && left >= iov->iov_len)
+            {
+                left -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+        }
+        return true;
+    }
+#endif
+
+    bool save_qoi(const std::string& path, const Image& image)
+    {
+#ifdef IMG_HAVE_MMAP
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
         {
             return false;
         }
-        width = std::stoi(tok);
+        const bool ok = write_qoi(image, [fd](unsigned char* data, std::size_t size)
+        {
+            iovec block{ data, size };
+            return write_vectors(fd, &block, 1);
+        });
+        return (::close(fd) == 0) && ok;
+#else
+        std::ofstream ofs(path, std::ios::binary);
+        return ofs && write_qoi(image, [&ofs](unsigned char* data, std::size_t size)
+        {
+            return static_cast<bool>(ofs.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size)));
+        });
+#endif
+    }
+
+    bool save_pnm(const std::string& path, const Image& image, const SaveOptions& options)
+    {
+        const bool wide = image.depth() == PixelDepth::U16;
+        const int maxval = wide ? 65535 : 255;
 
-        if (!next_token(is, tok))
+        if (options.ascii)
+        {
+            std::ofstream ofs(path, std::ios::binary);
+            return ofs && write_pnm_header(ofs, image.cols(), image.rows(), image.channels(), true, maxval) &&
+                   (wide ? write_ascii_body<std::uint16_t>(ofs, image) : write_ascii_body<unsigned char>(ofs, image));
+        }
+
+        std::ostringstream headerStream;
+        if (!write_pnm_header(headerStream, image.cols(), image.rows(), image.channels(), false, maxval))
         {
             return false;
         }
-        height = std::stoi(tok);
+        const std::string header = headerStream.str();
+
+        // A continuous image is a single run; otherwise one run per row.
+        const bool continuous = image.isContinuous();
+        const int runs = continuous ? 1 : image.rows();
+        const std::size_t rowBytes = static_cast<std::size_t>(image.cols()) * image.elemSize();
+        const std::size_t runBytes = continuous ? rowBytes * static_cast<std::size_t>(image.rows()) : rowBytes;
 
-        if (!next_token(is, tok))
+#ifdef IMG_HAVE_MMAP
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
         {
             return false;
         }
-        maxval = std::stoi(tok);
 
-        char sep;
-        is.read(&sep, 1);
-        if (!is.good())
+        bool ok = true;
+#ifdef __linux__
+        if (options.preallocate)
+        {
+            const off_t total = static_cast<off_t>(header.size() + runBytes * static_cast<std::size_t>(runs));
+            // Filesystems without fallocate support report EOPNOTSUPP/EINVAL: the write still works.
+            ok = ::posix_fallocate(fd, 0, total) != ENOSPC;
+        }
+#else
+        (void)options;
+#endif
+
+        if (wide)
+        {
+            iovec head{ const_cast<char*>(header.data()), header.size() };
+            ok = ok && write_vectors(fd, &head, 1) &&
+                 write_swapped_rows(image, [fd](unsigned char* data, std::size_t size)
+                 {
+                     iovec block{ data, size };
+                     return write_vectors(fd, &block, 1);
+                 });
+            return (::close(fd) == 0) && ok;
+        }
+
+        std::vector<iovec> batch;
+        batch.reserve(kMaxIovecs);
+        batch.push_back(iovec{ const_cast<char*>(header.data()), header.size() });
+        for (int r = 0; ok && r < runs; ++r)
+        {
+            batch.push_back(iovec{ const_cast<unsigned char*>(image.ptr(r)), runBytes });
+            if (static_cast<int>(batch.size()) == kMaxIovecs || r + 1 == runs)
+            {
+                ok = write_vectors(fd, batch.data(), static_cast<int>(batch.size()));
+                batch.clear();
+            }
+        }
+        return (::close(fd) == 0) && ok;
+#else
+        (void)options;
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs || !ofs.write(header.data(), static_cast<std::streamsize>(header.size())))
         {
             return false;
         }
+        if (wide)
+        {
+            return write_swapped_rows(image, [&ofs](unsigned char* data, std::size_t size)
+            {
+                return static_cast<bool>(ofs.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size)));
+            });
+        }
+        for (int r = 0; r < runs; ++r)
+        {
+            ofs.write(reinterpret_cast<const char*>(image.ptr(r)), static_cast<std::streamsize>(runBytes));
+        }
+        return static_cast<bool>(ofs);
+#endif
+    }
 
-        return true;
+    // The file a save to path lands in: symlinks are followed, so the rename replaces what they
+    // point to and the links themselves survive.
+    std::filesystem::path resolve_links(const std::string& path)
+    {
+        std::filesystem::path target = path;
+        std::error_code ec;
+        for (int hops = 0; hops < 40 && std::filesystem::is_symlink(std::filesystem::symlink_status(target, ec)); ++hops)
+        {
+            const std::filesystem::path link = std::filesystem::read_symlink(target, ec);
+            if (ec)
+            {
+                break;
+            }
+            target = link.is_absolute() ? link : target.parent_path() / link;
+        }
+        return target;
     }
 
+    // <path>.tmp<pid>-<n>: next to the target, so the rename stays on one filesystem.
+    std::string temp_path(const std::string& path)
+    {
+        static std::atomic<unsigned> counter{ 0 };
+#ifdef IMG_HAVE_MMAP
+        const long process = static_cast<long>(::getpid());
+#else
+        const long process = 0;
+#endif
+        return path + ".tmp" + std::to_string(process) + "-" + std::to_string(counter++);
+    }
+
+    // Renames the finished temp file over path in one step, flushing it to disk first if asked.
+    bool replace_file(const std::string& temp, const std::string& path, bool sync)
+    {
+#ifdef IMG_HAVE_MMAP
+        if (sync)
+        {
+            const int fd = ::open(temp.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            const bool synced = ::fsync(fd) == 0;
+            if (::close(fd) != 0 || !synced)
+            {
+                return false;
+            }
+        }
+#else
+        (void)sync;
+#endif
+        return std::rename(temp.c_str(), path.c_str()) == 0;
+    }
 }
 
-bool load_image(const std::string& path, Image& outImage)
+bool read_pnm_header(std::istream& is, PnmHeader& header)
 {
-    std::ifstream ifs(path, std::ios::binary);
-    if (!ifs)
+    StreamSource src(is);
+    if (!parse_header(src, header))
     {
+        is.setstate(std::ios::failbit);
         return false;
     }
+    return true;
+}
 
-    std::string magic;
-    int w = 0, h = 0, maxval = 0;
-    if (!read_header(ifs, magic, w, h, maxval))
+bool write_pnm_header(std::ostream& os, int cols, int rows, int channels, bool ascii, int maxval)
+{
+    if (channels == 1)
     {
-        return false;
+        os << (ascii ? "P2\n" : "P5\n") << cols << " " << rows << "\n" << maxval << "\n";
+    }
+    else if (channels == 3)
+    {
+        os << (ascii ? "P3\n" : "P6\n") << cols << " " << rows << "\n" << maxval << "\n";
     }
-    if (maxval != 255)
+    else if ((channels == 2 || channels == 4) && !ascii)
+    {
+        os << "P7\nWIDTH " << cols << "\nHEIGHT " << rows << "\nDEPTH " << channels << "\nMAXVAL " << maxval
+           << "\nTUPLTYPE " << (channels == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA") << "\nENDHDR\n";
+    }
+    else
     {
         return false;
     }
+    return static_cast<bool>(os);
+}
 
-    int channels = 0;
-    if (magic == "P5")
+bool load_image(const std::string& path, Image& outImage)
+{
+    IMG_PROFILE_SCOPE("load_image", 0);
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
     {
-        channels = 1;
+        return false;
     }
-    else if (magic == "P6")
+
+    // QOI is decoded from the whole file in memory.
+    unsigned char magic[sizeof(kQoiMagic)] = {};
+    ifs.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    if (ifs && has_qoi_magic(magic, sizeof(magic)))
     {
-        channels = 3;
+        ifs.seekg(0, std::ios::end);
+        const std::streamoff fileSize = ifs.tellg();
+        std::vector<unsigned char> file(static_cast<std::size_t>(std::max<std::streamoff>(fileSize, 0)));
+        ifs.seekg(0);
+        if (!ifs.read(reinterpret_cast<char*>(file.data()), static_cast<std::streamsize>(file.size())) ||
+            !decode_qoi(file.data(), file.size(), outImage))
+        {
+            return false;
+        }
+        IMG_PROFILE_BYTES(profile_bytes(outImage));
+        return true;
     }
-    else
+    ifs.clear();
+    ifs.seekg(0);
+
+    PnmHeader header;
+    if (!read_pnm_header(ifs, header))
     {
         return false;
     }
+    const int w = header.width;
+    const int h = header.height;
+    const int channels = header.channels;
 
-    Image img(w > 0 && h > 0 ? h : 0, w > 0 ? w : 0, channels);
+    Image img;
+    img.create(h, w, channels, depth_for_maxval(header.maxval), 1);
     if (img.empty())
     {
         return false;
     }
 
-    const std::size_t bytes = static_cast<std::size_t>(w) * static_cast<std::size_t>(h) * static_cast<std::size_t>(channels);
-    ifs.read(reinterpret_cast<char*>(img.data()), static_cast<std::streamsize>(bytes));
-    if (!ifs)
+    const std::size_t samples = static_cast<std::size_t>(w) * static_cast<std::size_t>(h) * static_cast<std::size_t>(channels);
+    if (header.ascii)
     {
-        return false;
+        const bool ok = img.depth() == PixelDepth::U16
+            ? read_ascii_body(ifs, reinterpret_cast<std::uint16_t*>(img.data()), samples, static_cast<unsigned>(header.maxval))
+            : read_ascii_body(ifs, img.data(), samples, 255u);
+        if (!ok)
+        {
+            return false;
+        }
+        if (img.depth() == PixelDepth::U16)
+        {
+            rescale_samples(reinterpret_cast<std::uint16_t*>(img.data()), samples, header.maxval);
+        }
+    }
+    else
+    {
+        if (!ifs.read(reinterpret_cast<char*>(img.data()), static_cast<std::streamsize>(samples * img.elemSize1())))
+        {
+            return false;
+        }
+        if (img.depth() == PixelDepth::U16)
+        {
+            decode_wide_payload(img.data(), img, header.maxval);
+        }
     }
 
+    IMG_PROFILE_BYTES(profile_bytes(img));
     outImage = std::move(img);
     return true;
 }
 
-bool save_image(const std::string& path, const Image& image)
+bool load_image_mapped(const std::string& path, Image& outImage, MapMode mode)
 {
-    if (image.empty())
+    IMG_PROFILE_SCOPE("load_image_mapped", 0);
+#ifdef IMG_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
     {
         return false;
     }
 
-    const int ch = image.channels();
-    if (ch != 1 && ch != 3)
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0)
     {
+        ::close(fd);
         return false;
     }
 
-    Image toWrite = image.clone();
+    const std::size_t fileSize = static_cast<std::size_t>(st.st_size);
+    const int prot = (mode == MapMode::CopyOnWrite) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    const int flags = (mode == MapMode::CopyOnWrite) ? MAP_PRIVATE : MAP_SHARED;
+    void* mapping = ::mmap(nullptr, fileSize, prot, flags, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    unsigned char* base = static_cast<unsigned char*>(mapping);
 
-    std::ofstream ofs(path, std::ios::binary);
-    if (!ofs)
+    // QOI has to be decoded, so the image is a packed copy and the mapping goes away at once.
+    if (has_qoi_magic(base, fileSize))
+    {
+        const bool ok = decode_qoi(base, fileSize, outImage);
+        ::munmap(mapping, fileSize);
+        if (ok)
+        {
+            IMG_PROFILE_BYTES(profile_bytes(outImage));
+        }
+        return ok;
+    }
+
+    PnmHeader header;
+    MemorySource src(base, fileSize);
+    if (!parse_header(src, header))
+    {
+        ::munmap(mapping, fileSize);
+        return false;
+    }
+    const std::size_t dataOffset = src.consumed();
+    const int w = header.width;
+    const int h = header.height;
+    const int channels = header.channels;
+    const PixelDepth depth = depth_for_maxval(header.maxval);
+    const std::size_t bytes = static_cast<std::size_t>(w) * static_cast<std::size_t>(h) * static_cast<std::size_t>(channels) * depth_bytes(depth);
+    if (!header.ascii && fileSize < dataOffset + bytes)
     {
+        ::munmap(mapping, fileSize);
         return false;
     }
 
-    if (ch == 1)
+    // ASCII and big-endian 16-bit bodies are decoded straight from the mapping into a packed image.
+    if (header.ascii || depth != PixelDepth::U8)
     {
-        ofs << "P5\n" << image.cols() << " " << image.rows() << "\n255\n";
+        Image img;
+        img.create(h, w, channels, depth, 1);
+        bool ok = !img.empty();
+        if (ok && header.ascii)
+        {
+            ok = decode_ascii_payload(reinterpret_cast<const char*>(base + dataOffset),
+                                      reinterpret_cast<const char*>(base + fileSize), img, header.maxval);
+        }
+        else if (ok)
+        {
+            decode_wide_payload(base + dataOffset, img, header.maxval);
+        }
+        ::munmap(mapping, fileSize);
+        if (!ok)
+        {
+            return false;
+        }
+        IMG_PROFILE_BYTES(profile_bytes(img));
+        outImage = std::move(img);
+        return true;
     }
-    else
+
+    // The Image owns the mapping now, also when it comes back empty.
+    Image img(h, w, channels, base + dataOffset, Image::ExternalBuffer{ base, fileSize, unmap_buffer });
+    if (img.empty())
     {
-        ofs << "P6\n" << image.cols() << " " << image.rows() << "\n255\n";
+        return false;
     }
 
-    const std::size_t bytes = static_cast<std::size_t>(image.cols()) * static_cast<std::size_t>(image.rows()) * static_cast<std::size_t>(ch);
-    ofs.write(reinterpret_cast<const char*>(toWrite.data()), static_cast<std::streamsize>(bytes));
-    return static_cast<bool>(ofs);
+    // Zero-copy: the pages are read later, by whoever first touches the pixels.
+    IMG_PROFILE_BYTES(profile_bytes(img));
+    outImage = std::move(img);
+    return true;
+#else
+    (void)mode;
+    return load_image(path, outImage);
+#endif
+}
+
+bool save_image(const std::string& path, const Image& image, const SaveOptions& options)
+{
+    IMG_PROFILE_SCOPE("save_image", profile_bytes(image));
+    if (image.empty() || image.depth() == PixelDepth::F32)
+    {
+        return false;
+    }
+    if (image.isPlanar())
+    {
+        return save_image(path, to_interleaved(image), options);
+    }
+    if (image.isMirrored())
+    {
+        return save_image(path, image.unmirrored(), options);
+    }
+    const bool qoi = is_qoi_path(path);
+    if (qoi && (image.depth() != PixelDepth::U8 || (image.channels() != 3 && image.channels() != 4)))
+    {
+        return false;
+    }
+
+    auto write = [&](const std::string& file)
+    {
+        return qoi ? save_qoi(file, image) : save_pnm(file, image, options);
+    };
+    std::error_code ec;
+    const std::filesystem::file_status status = std::filesystem::status(path, ec);
+    const bool exists = std::filesystem::exists(status);
+    if (exists && !std::filesystem::is_regular_file(status))
+    {
+        // Devices and FIFOs (/dev/stdout, a pipe) cannot be renamed over; they take the bytes directly.
+        return write(path);
+    }
+    const std::string target = resolve_links(path).string();
+
+    // The file is written next to the target and renamed over it: a failed save leaves the old file alone,
+    // and an image mapped from path (load_image_mapped) keeps reading the old file until it is done.
+    // A replaced file keeps its permissions.
+    const std::string temp = temp_path(target);
+    bool ok = write(temp);
+    if (ok && exists)
+    {
+        std::filesystem::permissions(temp, status.permissions(), ec);
+        ok = !ec;
+    }
+    ok = ok && replace_file(temp, target, options.sync);
+    if (!ok)
+    {
+        std::remove(temp.c_str());
+    }
+    return ok;
 }
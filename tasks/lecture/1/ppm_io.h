@@ -1,7 +1,68 @@
 #pragma once
+#include <istream>
+#include <ostream>
 #include <string>
 #include "Image.h"
 
+struct PnmHeader
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    // 255 for 8-bit samples, 256..65535 for big-endian 16-bit ones.
+    int maxval = 255;
+    // P2/P3: the payload is whitespace-separated decimal samples.
+    bool ascii = false;
+};
+
+// Reads a P2/P3/P5/P6 header (comments allowed between fields) or a PAM (P7) header with 1 to 4
+// channels, and leaves the stream at the first payload byte.
+bool read_pnm_header(std::istream& is, PnmHeader& header);
+// 1 and 3 channels get a PGM/PPM header, 2 and 4 a binary PAM (P7) one with a GRAYSCALE_ALPHA or
+// RGB_ALPHA tuple type; plain PAM does not exist, so ascii fails for those.
+bool write_pnm_header(std::ostream& os, int cols, int rows, int channels, bool ascii = false, int maxval = 255);
+
+// Both loaders accept the ASCII formats too; those are decoded in large blocks with std::from_chars.
+// Files with maxval above 255 load as PixelDepth::U16, byte-swapped to host order and stretched to
+// the full 0..65535 range. Files starting with the QOI magic "qoif" are decoded as QOI, whatever
+// their name, into a packed 8-bit image with 3 or 4 channels.
 bool load_image(const std::string& path, Image& outImage);
 
-bool save_image(const std::string& path, const Image& image);
+// ReadOnly maps the file PROT_READ: pixels must not be written.
+// CopyOnWrite maps it MAP_PRIVATE: writes go to private pages, the file is untouched.
+enum class MapMode
+{
+    ReadOnly,
+    CopyOnWrite
+};
+
+// Zero-copy load: the returned Image points into the file mapping, which is
+// unmapped when the last reference goes away. Falls back to load_image where
+// mmap is unavailable. QOI files are decoded straight from the mapping instead.
+bool load_image_mapped(const std::string& path, Image& outImage, MapMode mode = MapMode::ReadOnly);
+
+struct SaveOptions
+{
+    // Reserves the whole file up front (posix_fallocate) so a large save fails early
+    // on a full disk and gets contiguous extents.
+    bool preallocate = false;
+    // Writes plain P2/P3 instead of binary P5/P6.
+    bool ascii = false;
+    // Flushes the new file to disk (fsync) before it replaces the old one, so a crash cannot
+    // leave a partly written file under the name. Costs one disk flush per save.
+    bool sync = false;
+};
+
+// Writes straight from the image: contiguous pixels in one go, strided views and
+// padded rows with batched writev, so no copy of the image is ever made. U16 images
+// are written with maxval 65535, byte-swapped through a small staging block;
+// F32 images have no PNM encoding and are rejected. Planar images are interleaved into
+// a temporary copy first.
+// Images with 2 or 4 channels (alpha last) are written as PAM (P7), whatever the extension.
+// A path ending in .qoi (any case) is written as QOI in one pass through a 1 MiB block;
+// that needs an 8-bit image with 3 or 4 channels, and of the options only sync applies.
+// Either way the file goes to <path>.tmp<pid>-<n> first and is renamed over path, so a
+// failed save keeps the old file and an image mapped from path can be saved back to it.
+// A symlink is followed and the file it points to replaced, keeping its permissions;
+// devices and FIFOs such as /dev/stdout are written directly.
+bool save_image(const std::string& path, const Image& image, const SaveOptions& options = SaveOptions());
@@ -0,0 +1,284 @@
+#include "resize.h"
+#include "ops.h"
+#include "Profile.h"
+#include "simd_kernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    constexpr int kCoefOne = 1 << kResizeCoefBits;
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr std::size_t kMaxCachedTables = 64;
+
+    // For output i the taps are source indices starts[i] .. starts[i] + taps - 1,
+    // weighted by weights[i * taps ...]; edge pixels are replicated into the window.
+    struct AxisCoefficients
+    {
+        int taps = 0;
+        std::vector<int> starts;
+        std::vector<std::int16_t> weights;
+    };
+
+    double lanczos3(double x)
+    {
+        x = std::fabs(x);
+        if (x < 1e-9)
+        {
+            return 1.0;
+        }
+        if (x >= 3.0)
+        {
+            return 0.0;
+        }
+        const double px = kPi * x;
+        return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+    }
+
+    std::shared_ptr<const AxisCoefficients> build_axis(int srcSize, int dstSize, Interpolation interpolation)
+    {
+        const double scale = static_cast<double>(srcSize) / static_cast<double>(dstSize);
+
+        // Clamping keeps the indices non-decreasing and gap-free, so merging with back() is enough.
+        std::vector<std::vector<std::pair<int, double>>> raw(static_cast<std::size_t>(dstSize));
+        for (int i = 0; i < dstSize; ++i)
+        {
+            std::vector<std::pair<int, double>>& taps = raw[static_cast<std::size_t>(i)];
+            auto add = [&](int j, double weight)
+            {
+                j = std::clamp(j, 0, srcSize - 1);
+                if (!taps.empty() && taps.back().first == j)
+                {
+                    taps.back().second += weight;
+                }
+                else
+                {
+                    taps.emplace_back(j, weight);
+                }
+            };
+
+            switch (interpolation)
+            {
+            case Interpolation::Area:
+            {
+                const double lo = i * scale;
+                const double hi = (i + 1) * scale;
+                for (int j = static_cast<int>(std::floor(lo)); j < hi; ++j)
+                {
+                    const double overlap = std::min(hi, j + 1.0) - std::max(lo, static_cast<double>(j));
+                    if (overlap > 1e-12)
+                    {
+                        add(j, overlap);
+                    }
+                }
+                break;
+            }
+            case Interpolation::Lanczos3:
+            {
+                const double filterScale = std::max(scale, 1.0);
+                const double support = 3.0 * filterScale;
+                const double center = (i + 0.5) * scale;
+                const int first = static_cast<int>(std::floor(center - support));
+                const int last = static_cast<int>(std::ceil(center + support));
+                for (int j = first; j <= last; ++j)
+                {
+                    add(j, lanczos3((j + 0.5 - center) / filterScale));
+                }
+                break;
+            }
+            default:
+            {
+                const double center = (i + 0.5) * scale - 0.5;
+                const int j0 = static_cast<int>(std::floor(center));
+                const double frac = center - j0;
+                add(j0, 1.0 - frac);
+                add(j0 + 1, frac);
+                break;
+            }
+            }
+        }
+
+        auto table = std::make_shared<AxisCoefficients>();
+        for (const auto& taps : raw)
+        {
+            table->taps = std::max(table->taps, taps.back().first - taps.front().first + 1);
+        }
+        table->starts.resize(static_cast<std::size_t>(dstSize));
+        table->weights.assign(static_cast<std::size_t>(dstSize) * static_cast<std::size_t>(table->taps), 0);
+
+        for (int i = 0; i < dstSize; ++i)
+        {
+            const std::vector<std::pair<int, double>>& taps = raw[static_cast<std::size_t>(i)];
+            const int start = std::min(taps.front().first, srcSize - table->taps);
+            table->starts[static_cast<std::size_t>(i)] = start;
+
+            double sum = 0.0;
+            for (const auto& tap : taps)
+            {
+                sum += tap.second;
+            }
+
+            std::int16_t* w = table->weights.data() + static_cast<std::size_t>(i) * static_cast<std::size_t>(table->taps);
+            int total = 0;
+            std::vector<int> slots;
+            for (const auto& tap : taps)
+            {
+                const int k = tap.first - start;
+                w[k] = static_cast<std::int16_t>(std::lround(tap.second / sum * kCoefOne));
+                total += w[k];
+                slots.push_back(k);
+            }
+            // Every row of weights must sum to exactly one. The rounding error is handed out a unit at a time
+            // over the largest taps, so no tap moves by more than about a unit: an area downscale by 1000
+            // rounds 16.38 down to 16 on every tap, and the 384 units left over would shift one pixel's weight 25-fold.
+            std::stable_sort(slots.begin(), slots.end(), [w](int a, int b) { return std::abs(w[a]) > std::abs(w[b]); });
+            const int unit = total < kCoefOne ? 1 : -1;
+            for (std::size_t n = 0; total != kCoefOne; ++n, total += unit)
+            {
+                w[slots[n % slots.size()]] = static_cast<std::int16_t>(w[slots[n % slots.size()]] + unit);
+            }
+        }
+        return table;
+    }
+
+    std::shared_ptr<const AxisCoefficients> axis_coefficients(int srcSize, int dstSize, Interpolation interpolation)
+    {
+        using Key = std::tuple<int, int, int>;
+        static std::mutex mutex;
+        static std::map<Key, std::shared_ptr<const AxisCoefficients>> cache;
+
+        const Key key{ srcSize, dstSize, static_cast<int>(interpolation) };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = cache.find(key);
+            if (it != cache.end())
+            {
+                return it->second;
+            }
+        }
+
+        std::shared_ptr<const AxisCoefficients> table = build_axis(srcSize, dstSize, interpolation);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cache.size() >= kMaxCachedTables)
+        {
+            cache.clear();
+        }
+        cache.emplace(key, table);
+        return table;
+    }
+}
+
+Image resize(const Image& src, int newWidth, int newHeight, Interpolation interpolation)
+{
+    IMG_PROFILE_SCOPE("resize", profile_bytes(src));
+    if (interpolation == Interpolation::Nearest)
+    {
+        return resize_nearest(src, newWidth, newHeight);
+    }
+    if (src.empty() || src.depth() != PixelDepth::U8 || newWidth <= 0 || newHeight <= 0)
+    {
+        return Image();
+    }
+    if (src.isMirrored())
+    {
+        return resize(src.unmirrored(), newWidth, newHeight, interpolation);
+    }
+    if (src.isPlanar())
+    {
+        // Each plane takes the single-channel path.
+        std::vector<Image> planes;
+        for (int k = 0; k < src.channels(); ++k)
+        {
+            planes.push_back(resize(src.plane(k), newWidth, newHeight, interpolation));
+        }
+        return merge_planes(planes);
+    }
+
+    const int srcW = src.cols();
+    const int srcH = src.rows();
+    const int ch   = src.channels();
+
+    // Same-size axes have identity weights, so their pass is skipped.
+    Image horizontal = src;
+    if (newWidth != srcW)
+    {
+        const std::shared_ptr<const AxisCoefficients> cx = axis_coefficients(srcW, newWidth, interpolation);
+        horizontal = Image(srcH, newWidth, ch);
+        if (horizontal.empty())
+        {
+            return Image();
+        }
+        const PixelKernels& kernels = active_kernels();
+        parallel_rows(srcH, static_cast<std::size_t>(srcW) * src.elemSize(), [&](int begin, int end)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                kernels.resizeRowH(src.ptr(y), horizontal.ptr(y), newWidth, ch, cx->starts.data(), cx->weights.data(), cx->taps);
+            }
+        });
+    }
+
+    if (newHeight == srcH)
+    {
+        return newWidth == srcW ? src.clone() : horizontal;
+    }
+
+    const std::shared_ptr<const AxisCoefficients> cy = axis_coefficients(srcH, newHeight, interpolation);
+    Image dst(newHeight, newWidth, ch);
+    if (dst.empty())
+    {
+        return Image();
+    }
+
+    const std::size_t rowBytes = static_cast<std::size_t>(newWidth) * dst.elemSize();
+    const PixelKernels& kernels = active_kernels();
+    parallel_rows(newHeight, rowBytes, [&](int begin, int end)
+    {
+        std::vector<const unsigned char*> rows(static_cast<std::size_t>(cy->taps));
+        for (int y = begin; y < end; ++y)
+        {
+            const int start = cy->starts[static_cast<std::size_t>(y)];
+            for (int t = 0; t < cy->taps; ++t)
+            {
+                rows[static_cast<std::size_t>(t)] = horizontal.ptr(start + t);
+            }
+            const std::int16_t* w = cy->weights.data() + static_cast<std::size_t>(y) * static_cast<std::size_t>(cy->taps);
+            kernels.resizeRowV(rows.data(), w, cy->taps, dst.ptr(y), rowBytes);
+        }
+    });
+    return dst;
+}
+
+bool parse_interpolation(const std::string& name, Interpolation& interpolation)
+{
+    if (name == "nearest")
+    {
+        interpolation = Interpolation::Nearest;
+    }
+    else if (name == "bilinear" || name == "linear")
+    {
+        interpolation = Interpolation::Bilinear;
+    }
+    else if (name == "area")
+    {
+        interpolation = Interpolation::Area;
+    }
+    else if (name == "lanczos" || name == "lanczos3")
+    {
+        interpolation = Interpolation::Lanczos3;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include "Image.h"
+
+enum class Interpolation
+{
+    Nearest,
+    Bilinear,
+    Area,
+    Lanczos3
+};
+
+// Separable resampling: a horizontal and a vertical pass with 14-bit fixed-point
+// coefficients. Coefficient tables are cached per (source size, target size, kind).
+// Nearest is forwarded to resize_nearest; the filtered kinds need an 8-bit image.
+Image resize(const Image& src, int newWidth, int newHeight, Interpolation interpolation);
+
+// Accepts "nearest", "bilinear", "area" and "lanczos" / "lanczos3".
+bool parse_interpolation(const std::string& name, Interpolation& interpolation);
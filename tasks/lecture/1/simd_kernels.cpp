@@ -0,0 +1,1583 @@
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMG_SIMD_X86 1
+#include <immintrin.h>
+#define IMG_TARGET_SSE2   __attribute__((target("sse2")))
+#define IMG_TARGET_AVX2   __attribute__((target("avx2")))
+#define IMG_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define IMG_TARGET_AVX512_VBMI __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#endif
+
+namespace
+{
+    inline unsigned char luma(unsigned r, unsigned g, unsigned b)
+    {
+        return static_cast<unsigned char>((r * kLumaR + g * kLumaG + b * kLumaB + (1u << (kLumaShift - 1))) >> kLumaShift);
+    }
+
+    void invert_row_scalar(const unsigned char* src, unsigned char* dst, std::size_t bytes)
+    {
+        for (std::size_t i = 0; i < bytes; ++i)
+        {
+            dst[i] = static_cast<unsigned char>(255 - src[i]);
+        }
+    }
+
+    void gray_row_scalar(const unsigned char* src, unsigned char* dst, int cols, int channels)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const unsigned char* p = src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+            const unsigned char R = p[0];
+            const unsigned char G = (channels > 1) ? p[1] : R;
+            const unsigned char B = (channels > 2) ? p[2] : R;
+            dst[x] = luma(R, G, B);
+        }
+    }
+
+    void swap_bytes16_scalar(const unsigned char* src, unsigned char* dst, std::size_t samples)
+    {
+        for (std::size_t i = 0; i < samples; ++i)
+        {
+            const unsigned char hi = src[2 * i];
+            dst[2 * i] = src[2 * i + 1];
+            dst[2 * i + 1] = hi;
+        }
+    }
+
+    // Pixels [x, cols) of the layout conversions; the vector paths finish their rows with these.
+    void deinterleave_from(const unsigned char* src, unsigned char* const* planes, int x, int cols, int channels)
+    {
+        for (; x < cols; ++x)
+        {
+            const unsigned char* p = src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+            for (int k = 0; k < channels; ++k)
+            {
+                planes[k][x] = p[k];
+            }
+        }
+    }
+
+    void interleave_from(const unsigned char* const* planes, unsigned char* dst, int x, int cols, int channels)
+    {
+        for (; x < cols; ++x)
+        {
+            unsigned char* p = dst + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+            for (int k = 0; k < channels; ++k)
+            {
+                p[k] = planes[k][x];
+            }
+        }
+    }
+
+    void gray_planar_from(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* dst, int x, int cols)
+    {
+        for (; x < cols; ++x)
+        {
+            dst[x] = luma(r[x], g[x], b[x]);
+        }
+    }
+
+    void deinterleave_row_scalar(const unsigned char* src, unsigned char* const* planes, int cols, int channels)
+    {
+        deinterleave_from(src, planes, 0, cols, channels);
+    }
+
+    void interleave_row_scalar(const unsigned char* const* planes, unsigned char* dst, int cols, int channels)
+    {
+        interleave_from(planes, dst, 0, cols, channels);
+    }
+
+    void gray_planar_row_scalar(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* dst, int cols)
+    {
+        gray_planar_from(r, g, b, dst, 0, cols);
+    }
+
+    void convolve_f32_scalar(const float* src, std::size_t tapStride, const float* weights, int taps, float* dst, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            float acc = 0.0f;
+            const float* s = src + i;
+            for (int t = 0; t < taps; ++t, s += tapStride)
+            {
+                acc += weights[t] * *s;
+            }
+            dst[i] = acc;
+        }
+    }
+
+    void color_matrix_row_scalar(const unsigned char* src, unsigned char* dst, int cols, int channels, const short* matrix, const int* bias)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const int a = src[0];
+            const int b = src[1];
+            const int c = src[2];
+            for (int k = 0; k < 3; ++k)
+            {
+                const int v = (matrix[3 * k] * a + matrix[3 * k + 1] * b + matrix[3 * k + 2] * c + bias[k]) >> kColorMatrixShift;
+                dst[k] = static_cast<unsigned char>(std::clamp(v, 0, 255));
+            }
+            if (channels == 4)
+            {
+                dst[3] = src[3];
+            }
+            src += channels;
+            dst += channels;
+        }
+    }
+
+    template <std::size_t N>
+    void reverse_pixels(const unsigned char* src, unsigned char* dst, int cols)
+    {
+        const unsigned char* s = src + static_cast<std::size_t>(cols) * N;
+        for (int x = 0; x < cols; ++x, dst += N)
+        {
+            s -= N;
+            std::memcpy(dst, s, N);
+        }
+    }
+
+    void reverse_row_scalar(const unsigned char* src, unsigned char* dst, int cols, std::size_t pixelBytes)
+    {
+        switch (pixelBytes)
+        {
+        case 1:  reverse_pixels<1>(src, dst, cols); return;
+        case 2:  reverse_pixels<2>(src, dst, cols); return;
+        case 3:  reverse_pixels<3>(src, dst, cols); return;
+        case 4:  reverse_pixels<4>(src, dst, cols); return;
+        case 6:  reverse_pixels<6>(src, dst, cols); return;
+        case 8:  reverse_pixels<8>(src, dst, cols); return;
+        case 12: reverse_pixels<12>(src, dst, cols); return;
+        case 16: reverse_pixels<16>(src, dst, cols); return;
+        default: break;
+        }
+        for (int x = 0; x < cols; ++x)
+        {
+            std::memcpy(dst + static_cast<std::size_t>(x) * pixelBytes, src + static_cast<std::size_t>(cols - 1 - x) * pixelBytes, pixelBytes);
+        }
+    }
+
+    // Walks src down its columns so that dst is written row after row.
+    template <std::size_t N>
+    void transpose_elements(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep, int rows, int cols)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const unsigned char* s = src + static_cast<std::size_t>(x) * N;
+            unsigned char* d = dst + static_cast<std::ptrdiff_t>(x) * dstStep;
+            for (int y = 0; y < rows; ++y, s += srcStep, d += N)
+            {
+                std::memcpy(d, s, N);
+            }
+        }
+    }
+
+    void transpose_block_scalar(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep,
+                                int rows, int cols, std::size_t elemBytes)
+    {
+        switch (elemBytes)
+        {
+        case 1:  transpose_elements<1>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 2:  transpose_elements<2>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 3:  transpose_elements<3>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 4:  transpose_elements<4>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 6:  transpose_elements<6>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 8:  transpose_elements<8>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 12: transpose_elements<12>(src, srcStep, dst, dstStep, rows, cols); return;
+        case 16: transpose_elements<16>(src, srcStep, dst, dstStep, rows, cols); return;
+        default: break;
+        }
+        for (int x = 0; x < cols; ++x)
+        {
+            for (int y = 0; y < rows; ++y)
+            {
+                std::memcpy(dst + static_cast<std::ptrdiff_t>(x) * dstStep + static_cast<std::size_t>(y) * elemBytes,
+                            src + static_cast<std::ptrdiff_t>(y) * srcStep + static_cast<std::size_t>(x) * elemBytes, elemBytes);
+            }
+        }
+    }
+
+    void halve_row_scalar(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int dstCols, int channels)
+    {
+        const std::size_t ch = static_cast<std::size_t>(channels);
+        const std::size_t samples = static_cast<std::size_t>(dstCols) * ch;
+        for (std::size_t j = 0; j < samples; ++j)
+        {
+            // Sample j of output pixel j / ch averages the same sample of source pixels 2 * (j / ch) and the next one.
+            const std::size_t i = 2 * j - j % ch;
+            dst[j] = static_cast<unsigned char>((top[i] + top[i + ch] + bottom[i] + bottom[i + ch] + 2) >> 2);
+        }
+    }
+
+    void lut_row_scalar(const unsigned char* src, unsigned char* dst, std::size_t bytes, const unsigned char* table)
+    {
+        for (std::size_t i = 0; i < bytes; ++i)
+        {
+            dst[i] = table[src[i]];
+        }
+    }
+
+    // v / 255 rounded to nearest, exact for v <= 255 * 255.
+    inline unsigned div255(unsigned v)
+    {
+        v += 128;
+        return (v + (v >> 8)) >> 8;
+    }
+
+    void blend_row_scalar(const unsigned char* src, unsigned char* dst, int cols, int srcChannels, int dstChannels, bool premultiplied)
+    {
+        const int colours = srcChannels - 1;
+        for (int x = 0; x < cols; ++x)
+        {
+            const unsigned char* s = src + static_cast<std::size_t>(x) * static_cast<std::size_t>(srcChannels);
+            unsigned char* d = dst + static_cast<std::size_t>(x) * static_cast<std::size_t>(dstChannels);
+            const unsigned a = s[colours];
+            const unsigned ia = 255 - a;
+            for (int k = 0; k < colours; ++k)
+            {
+                d[k] = static_cast<unsigned char>(premultiplied ? std::min(255u, s[k] + div255(d[k] * ia))
+                                                                : div255(s[k] * a + d[k] * ia));
+            }
+            if (dstChannels == srcChannels)
+            {
+                d[colours] = static_cast<unsigned char>(a + div255(d[colours] * ia));
+            }
+        }
+    }
+
+    inline unsigned char resize_saturate(int acc)
+    {
+        return static_cast<unsigned char>(std::clamp(acc >> kResizeCoefBits, 0, 255));
+    }
+
+    // Output pixels [x, dstCols) of resizeRowH; the vector paths finish their rows with this.
+    void resize_row_h_from(const unsigned char* src, unsigned char* dst, int x, int dstCols, int channels,
+                           const int* starts, const std::int16_t* weights, int taps)
+    {
+        const std::size_t ch = static_cast<std::size_t>(channels);
+        for (; x < dstCols; ++x)
+        {
+            const unsigned char* s = src + static_cast<std::size_t>(starts[x]) * ch;
+            const std::int16_t* w = weights + static_cast<std::size_t>(x) * static_cast<std::size_t>(taps);
+            unsigned char* d = dst + static_cast<std::size_t>(x) * ch;
+            for (std::size_t k = 0; k < ch; ++k)
+            {
+                int acc = 1 << (kResizeCoefBits - 1);
+                for (int t = 0; t < taps; ++t)
+                {
+                    acc += w[t] * s[static_cast<std::size_t>(t) * ch + k];
+                }
+                d[k] = resize_saturate(acc);
+            }
+        }
+    }
+
+    // Bytes [i, bytes) of resizeRowV.
+    void resize_row_v_from(const unsigned char* const* rows, const std::int16_t* weights, int taps, unsigned char* dst,
+                           std::size_t i, std::size_t bytes)
+    {
+        for (; i < bytes; ++i)
+        {
+            int acc = 1 << (kResizeCoefBits - 1);
+            for (int t = 0; t < taps; ++t)
+            {
+                acc += weights[t] * rows[t][i];
+            }
+            dst[i] = resize_saturate(acc);
+        }
+    }
+
+    void resize_row_h_scalar(const unsigned char* src, unsigned char* dst, int dstCols, int channels,
+                             const int* starts, const std::int16_t* weights, int taps)
+    {
+        resize_row_h_from(src, dst, 0, dstCols, channels, starts, weights, taps);
+    }
+
+    void resize_row_v_scalar(const unsigned char* const* rows, const std::int16_t* weights, int taps, unsigned char* dst, std::size_t bytes)
+    {
+        resize_row_v_from(rows, weights, taps, dst, 0, bytes);
+    }
+
+#ifdef IMG_SIMD_X86
+    // All vector paths convert pixels to 32-bit lanes laid out as R | G << 8 | B << 16 | X << 24
+    // and compute luma with two pmaddwd: (R, B) against (kLumaR, kLumaB) and (G, X) against (kLumaG, 0).
+
+    // ---------- SSE2 ----------
+
+    IMG_TARGET_SSE2 inline __m128i luma_sse2(__m128i px)
+    {
+        const __m128i mask  = _mm_set1_epi32(0x00FF00FF);
+        const __m128i wRB   = _mm_set1_epi32((kLumaB << 16) | kLumaR);
+        const __m128i wG    = _mm_set1_epi32(kLumaG);
+        const __m128i round = _mm_set1_epi32(1 << (kLumaShift - 1));
+
+        const __m128i rb = _mm_and_si128(px, mask);
+        const __m128i gx = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+        const __m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, wRB), _mm_madd_epi16(gx, wG));
+        return _mm_srli_epi32(_mm_add_epi32(sum, round), kLumaShift);
+    }
+
+    // Reads 16 bytes, uses the first 12 (four RGB pixels).
+    IMG_TARGET_SSE2 inline __m128i expand_rgb_sse2(const unsigned char* p)
+    {
+        const __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i m0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+        const __m128i m1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+        const __m128i m2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+        const __m128i m3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+
+        __m128i r = _mm_and_si128(v, m0);
+        r = _mm_or_si128(r, _mm_and_si128(_mm_slli_si128(v, 1), m1));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_slli_si128(v, 2), m2));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_slli_si128(v, 3), m3));
+        return r;
+    }
+
+    IMG_TARGET_SSE2 inline void store_luma8_sse2(unsigned char* dst, __m128i a, __m128i b)
+    {
+        const __m128i w = _mm_packs_epi32(a, b);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(w, w));
+    }
+
+    IMG_TARGET_SSE2 void invert_row_sse2(const unsigned char* src, unsigned char* dst, std::size_t bytes)
+    {
+        const __m128i ones = _mm_set1_epi8(static_cast<char>(0xFF));
+        std::size_t i = 0;
+        for (; i + 16 <= bytes; i += 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(v, ones));
+        }
+        invert_row_scalar(src + i, dst + i, bytes - i);
+    }
+
+    IMG_TARGET_SSE2 void gray_row_sse2(const unsigned char* src, unsigned char* dst, int cols, int channels)
+    {
+        int x = 0;
+        if (channels == 3)
+        {
+            // the second load ends at byte 3 * x + 28
+            for (; x + 10 <= cols; x += 8)
+            {
+                const unsigned char* p = src + 3 * static_cast<std::size_t>(x);
+                store_luma8_sse2(dst + x, luma_sse2(expand_rgb_sse2(p)), luma_sse2(expand_rgb_sse2(p + 12)));
+            }
+        }
+        else if (channels == 4)
+        {
+            for (; x + 8 <= cols; x += 8)
+            {
+                const unsigned char* p = src + 4 * static_cast<std::size_t>(x);
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+                store_luma8_sse2(dst + x, luma_sse2(a), luma_sse2(b));
+            }
+        }
+        gray_row_scalar(src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels), dst + x, cols - x, channels);
+    }
+
+    IMG_TARGET_SSE2 void swap_bytes16_sse2(const unsigned char* src, unsigned char* dst, std::size_t samples)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= samples; i += 8)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+        }
+        swap_bytes16_scalar(src + 2 * i, dst + 2 * i, samples - i);
+    }
+
+    // Byte `shift / 8` of every 32-bit lane of a, b, c and d, in order.
+    IMG_TARGET_SSE2 inline __m128i lane_bytes_sse2(__m128i a, __m128i b, __m128i c, __m128i d, int shift)
+    {
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        a = _mm_and_si128(_mm_srl_epi32(a, count), mask);
+        b = _mm_and_si128(_mm_srl_epi32(b, count), mask);
+        c = _mm_and_si128(_mm_srl_epi32(c, count), mask);
+        d = _mm_and_si128(_mm_srl_epi32(d, count), mask);
+        return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+    }
+
+    IMG_TARGET_SSE2 void deinterleave_row_sse2(const unsigned char* src, unsigned char* const* planes, int cols, int channels)
+    {
+        int x = 0;
+        if (channels == 3 || channels == 4)
+        {
+            // three channels: the last expand reads up to byte 3 * x + 52
+            const int guard = channels == 3 ? 18 : 16;
+            for (; x + guard <= cols; x += 16)
+            {
+                const unsigned char* p = src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+                __m128i px[4];
+                for (int i = 0; i < 4; ++i)
+                {
+                    px[i] = channels == 3 ? expand_rgb_sse2(p + 12 * i)
+                                          : _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+                }
+                for (int k = 0; k < channels; ++k)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[k] + x), lane_bytes_sse2(px[0], px[1], px[2], px[3], 8 * k));
+                }
+            }
+        }
+        deinterleave_from(src, planes, x, cols, channels);
+    }
+
+    IMG_TARGET_SSE2 void interleave_row_sse2(const unsigned char* const* planes, unsigned char* dst, int cols, int channels)
+    {
+        int x = 0;
+        if (channels == 4)
+        {
+            for (; x + 16 <= cols; x += 16)
+            {
+                const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[0] + x));
+                const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[1] + x));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[2] + x));
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[3] + x));
+                const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+                const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+                const __m128i baLo = _mm_unpacklo_epi8(b, a);
+                const __m128i baHi = _mm_unpackhi_epi8(b, a);
+                __m128i* out = reinterpret_cast<__m128i*>(dst + 4 * static_cast<std::size_t>(x));
+                _mm_storeu_si128(out, _mm_unpacklo_epi16(rgLo, baLo));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLo, baLo));
+                _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHi, baHi));
+                _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHi, baHi));
+            }
+        }
+        interleave_from(planes, dst, x, cols, channels);
+    }
+
+    IMG_TARGET_SSE2 void gray_planar_row_sse2(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* dst, int cols)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        int x = 0;
+        for (; x + 16 <= cols; x += 16)
+        {
+            // Build R | G << 8 | B << 16 lanes and reuse the interleaved luma.
+            const __m128i rv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x));
+            const __m128i gv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x));
+            const __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+            const __m128i rgLo = _mm_unpacklo_epi8(rv, gv);
+            const __m128i rgHi = _mm_unpackhi_epi8(rv, gv);
+            const __m128i bLo = _mm_unpacklo_epi8(bv, zero);
+            const __m128i bHi = _mm_unpackhi_epi8(bv, zero);
+            store_luma8_sse2(dst + x, luma_sse2(_mm_unpacklo_epi16(rgLo, bLo)), luma_sse2(_mm_unpackhi_epi16(rgLo, bLo)));
+            store_luma8_sse2(dst + x + 8, luma_sse2(_mm_unpacklo_epi16(rgHi, bHi)), luma_sse2(_mm_unpackhi_epi16(rgHi, bHi)));
+        }
+        gray_planar_from(r, g, b, dst, x, cols);
+    }
+
+    IMG_TARGET_SSE2 void convolve_f32_sse2(const float* src, std::size_t tapStride, const float* weights, int taps, float* dst, std::size_t count)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128 a = _mm_setzero_ps();
+            __m128 b = _mm_setzero_ps();
+            const float* s = src + i;
+            for (int t = 0; t < taps; ++t, s += tapStride)
+            {
+                const __m128 w = _mm_set1_ps(weights[t]);
+                a = _mm_add_ps(a, _mm_mul_ps(w, _mm_loadu_ps(s)));
+                b = _mm_add_ps(b, _mm_mul_ps(w, _mm_loadu_ps(s + 4)));
+            }
+            _mm_storeu_ps(dst + i, a);
+            _mm_storeu_ps(dst + i + 4, b);
+        }
+        convolve_f32_scalar(src + i, tapStride, weights, taps, dst + i, count - i);
+    }
+
+    // The colour matrix uses the same (R, B) and (G, X) pairs, one weight pair per output row.
+    struct ColorWeightsSse2
+    {
+        __m128i rb[3];
+        __m128i g[3];
+        __m128i bias[3];
+    };
+
+    IMG_TARGET_SSE2 inline ColorWeightsSse2 color_weights_sse2(const short* matrix, const int* bias)
+    {
+        ColorWeightsSse2 w;
+        for (int k = 0; k < 3; ++k)
+        {
+            const unsigned r = static_cast<unsigned short>(matrix[3 * k]);
+            const unsigned b = static_cast<unsigned short>(matrix[3 * k + 2]);
+            w.rb[k] = _mm_set1_epi32(static_cast<int>(r | (b << 16)));
+            w.g[k] = _mm_set1_epi32(static_cast<unsigned short>(matrix[3 * k + 1]));
+            w.bias[k] = _mm_set1_epi32(bias[k]);
+        }
+        return w;
+    }
+
+    // Four pixel lanes in, four lanes out with the transformed samples in bytes 0..2 and X kept in byte 3.
+    IMG_TARGET_SSE2 inline __m128i color_matrix_sse2(__m128i px, const ColorWeightsSse2& w)
+    {
+        const __m128i mask = _mm_set1_epi32(0x00FF00FF);
+        const __m128i rb = _mm_and_si128(px, mask);
+        const __m128i gx = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+        __m128i out[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            const __m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, w.rb[k]), _mm_madd_epi16(gx, w.g[k]));
+            out[k] = _mm_srai_epi32(_mm_add_epi32(sum, w.bias[k]), kColorMatrixShift);
+        }
+        // The signed then unsigned packs clamp to 0..255; bytes are R0..R3 G0..G3 B0..B3 X0..X3.
+        const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]), _mm_packs_epi32(out[2], _mm_srli_epi32(px, 24)));
+        const __m128i rg = _mm_unpacklo_epi8(bytes, _mm_srli_si128(bytes, 4));
+        const __m128i bx = _mm_unpacklo_epi8(_mm_srli_si128(bytes, 8), _mm_srli_si128(bytes, 12));
+        return _mm_unpacklo_epi16(rg, bx);
+    }
+
+    // Inverse of expand_rgb_sse2: writes bytes 0..2 of each lane, 12 bytes in total.
+    IMG_TARGET_SSE2 inline void store_rgb12_sse2(unsigned char* p, __m128i lanes)
+    {
+        const __m128i m0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+        const __m128i m1 = _mm_setr_epi32(static_cast<int>(0xFF000000), 0x0000FFFF, 0, 0);
+        const __m128i m2 = _mm_setr_epi32(0, static_cast<int>(0xFFFF0000), 0x000000FF, 0);
+        const __m128i m3 = _mm_setr_epi32(0, 0, static_cast<int>(0xFFFFFF00), 0);
+
+        __m128i r = _mm_and_si128(lanes, m0);
+        r = _mm_or_si128(r, _mm_and_si128(_mm_srli_si128(lanes, 1), m1));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_srli_si128(lanes, 2), m2));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_srli_si128(lanes, 3), m3));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), r);
+        const int tail = _mm_cvtsi128_si32(_mm_srli_si128(r, 8));
+        std::memcpy(p + 8, &tail, sizeof(tail));
+    }
+
+    IMG_TARGET_SSE2 void color_matrix_row_sse2(const unsigned char* src, unsigned char* dst, int cols, int channels, const short* matrix, const int* bias)
+    {
+        const ColorWeightsSse2 w = color_weights_sse2(matrix, bias);
+        int x = 0;
+        if (channels == 3)
+        {
+            // the load ends at byte 3 * x + 16
+            for (; x + 6 <= cols; x += 4)
+            {
+                const std::size_t offset = 3 * static_cast<std::size_t>(x);
+                store_rgb12_sse2(dst + offset, color_matrix_sse2(expand_rgb_sse2(src + offset), w));
+            }
+        }
+        else if (channels == 4)
+        {
+            for (; x + 4 <= cols; x += 4)
+            {
+                const std::size_t offset = 4 * static_cast<std::size_t>(x);
+                const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + offset));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset), color_matrix_sse2(px, w));
+            }
+        }
+        const std::size_t done = static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+        color_matrix_row_scalar(src + done, dst + done, cols - x, channels, matrix, bias);
+    }
+
+    // Reverses the order of the PixelBytes-wide lanes of v.
+    template <std::size_t PixelBytes>
+    IMG_TARGET_SSE2 inline __m128i reverse_lanes_sse2(__m128i v)
+    {
+        if constexpr (PixelBytes == 8)
+        {
+            return _mm_shuffle_epi32(v, 0x4E);
+        }
+        v = _mm_shuffle_epi32(v, 0x1B);
+        if constexpr (PixelBytes == 4)
+        {
+            return v;
+        }
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+        if constexpr (PixelBytes == 2)
+        {
+            return v;
+        }
+        return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    }
+
+    template <std::size_t PixelBytes>
+    IMG_TARGET_SSE2 void reverse_pixels_sse2(const unsigned char* src, unsigned char* dst, int cols)
+    {
+        const std::size_t bytes = static_cast<std::size_t>(cols) * PixelBytes;
+        std::size_t i = 0;
+        for (; i + 16 <= bytes; i += 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + bytes - i - 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), reverse_lanes_sse2<PixelBytes>(v));
+        }
+        // The pixels still missing at the end of dst are the first ones of src.
+        reverse_pixels<PixelBytes>(src, dst + i, static_cast<int>((bytes - i) / PixelBytes));
+    }
+
+    IMG_TARGET_SSE2 void reverse_row_sse2(const unsigned char* src, unsigned char* dst, int cols, std::size_t pixelBytes)
+    {
+        switch (pixelBytes)
+        {
+        case 1:  reverse_pixels_sse2<1>(src, dst, cols); return;
+        case 2:  reverse_pixels_sse2<2>(src, dst, cols); return;
+        case 4:  reverse_pixels_sse2<4>(src, dst, cols); return;
+        case 8:  reverse_pixels_sse2<8>(src, dst, cols); return;
+        default: reverse_row_scalar(src, dst, cols, pixelBytes); return;
+        }
+    }
+
+    // In-register transposes: each unpack round interleaves pairs of rows at twice the width of the
+    // previous one, until every register holds whole columns.
+    IMG_TARGET_SSE2 inline void transpose8x8_u8_sse2(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep)
+    {
+        __m128i r[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            r[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * srcStep));
+        }
+        const __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+        const __m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+        const __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+        const __m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+        const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+        const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+        const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+        const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+        // Columns 2i and 2i + 1.
+        const __m128i c[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2),
+                               _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+        for (int i = 0; i < 4; ++i)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + (2 * i) * dstStep), c[i]);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + (2 * i + 1) * dstStep), _mm_unpackhi_epi64(c[i], c[i]));
+        }
+    }
+
+    IMG_TARGET_SSE2 inline void transpose8x8_u16_sse2(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep)
+    {
+        __m128i r[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * srcStep));
+        }
+        __m128i a[8];
+        for (int i = 0; i < 4; ++i)
+        {
+            a[2 * i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+            a[2 * i + 1] = _mm_unpackhi_epi16(r[2 * i], r[2 * i + 1]);
+        }
+        // b[k] holds columns 2k and 2k + 1 of rows 0-3, b[k + 4] the same columns of rows 4-7.
+        __m128i b[8];
+        for (int half = 0; half < 2; ++half)
+        {
+            const __m128i* q = a + 4 * half;
+            b[4 * half + 0] = _mm_unpacklo_epi32(q[0], q[2]);
+            b[4 * half + 1] = _mm_unpackhi_epi32(q[0], q[2]);
+            b[4 * half + 2] = _mm_unpacklo_epi32(q[1], q[3]);
+            b[4 * half + 3] = _mm_unpackhi_epi32(q[1], q[3]);
+        }
+        for (int k = 0; k < 4; ++k)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (2 * k) * dstStep), _mm_unpacklo_epi64(b[k], b[k + 4]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (2 * k + 1) * dstStep), _mm_unpackhi_epi64(b[k], b[k + 4]));
+        }
+    }
+
+    IMG_TARGET_SSE2 inline void transpose4x4_u32_sse2(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep)
+    {
+        const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcStep));
+        const __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * srcStep));
+        const __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * srcStep));
+        const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        const __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+        const __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+        const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstStep), _mm_unpackhi_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * dstStep), _mm_unpacklo_epi64(t1, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * dstStep), _mm_unpackhi_epi64(t1, t3));
+    }
+
+    IMG_TARGET_SSE2 inline void transpose2x2_u64_sse2(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep)
+    {
+        const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcStep));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(r0, r1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstStep), _mm_unpackhi_epi64(r0, r1));
+    }
+
+    // Element sizes without a register transpose (3, 6, 12 bytes...) take the scalar copy.
+    IMG_TARGET_SSE2 void transpose_block_sse2(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep,
+                                              int rows, int cols, std::size_t elemBytes)
+    {
+        const int block = elemBytes == 1 || elemBytes == 2 ? 8 : elemBytes == 4 ? 4 : elemBytes == 8 ? 2 : 0;
+        if (block == 0)
+        {
+            transpose_block_scalar(src, srcStep, dst, dstStep, rows, cols, elemBytes);
+            return;
+        }
+        const int fullRows = rows - rows % block;
+        const int fullCols = cols - cols % block;
+        // Down the source columns, so each band of destination rows is written front to back.
+        for (int x = 0; x < fullCols; x += block)
+        {
+            for (int y = 0; y < fullRows; y += block)
+            {
+                const unsigned char* s = src + static_cast<std::ptrdiff_t>(y) * srcStep + static_cast<std::size_t>(x) * elemBytes;
+                unsigned char* d = dst + static_cast<std::ptrdiff_t>(x) * dstStep + static_cast<std::size_t>(y) * elemBytes;
+                switch (elemBytes)
+                {
+                case 1:  transpose8x8_u8_sse2(s, srcStep, d, dstStep); break;
+                case 2:  transpose8x8_u16_sse2(s, srcStep, d, dstStep); break;
+                case 4:  transpose4x4_u32_sse2(s, srcStep, d, dstStep); break;
+                default: transpose2x2_u64_sse2(s, srcStep, d, dstStep); break;
+                }
+            }
+        }
+        // Bottom rows across the full width, then the right columns of the blocked rows.
+        transpose_block_scalar(src + static_cast<std::ptrdiff_t>(fullRows) * srcStep, srcStep,
+                               dst + static_cast<std::size_t>(fullRows) * elemBytes, dstStep, rows - fullRows, cols, elemBytes);
+        transpose_block_scalar(src + static_cast<std::size_t>(fullCols) * elemBytes, srcStep,
+                               dst + static_cast<std::ptrdiff_t>(fullCols) * dstStep, dstStep, fullRows, cols - fullCols, elemBytes);
+    }
+
+    // Both 16-bit weights of taps t and t + 1 in every 32-bit lane, for pmaddwd against interleaved samples.
+    inline int resize_weight_pair(const std::int16_t* w, int t, int taps)
+    {
+        const std::uint16_t next = t + 1 < taps ? static_cast<std::uint16_t>(w[t + 1]) : 0;
+        return static_cast<int>(static_cast<std::uint16_t>(w[t]) | static_cast<std::uint32_t>(next) << 16);
+    }
+
+    // Sums of one 4-channel output pixel, one channel per 32-bit lane: the samples of two taps are interleaved
+    // per channel and multiplied against their weight pair by one pmaddwd.
+    IMG_TARGET_SSE2 inline __m128i resize_pixel4_sse2(const unsigned char* s, const std::int16_t* w, int taps)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_set1_epi32(1 << (kResizeCoefBits - 1));
+        int t = 0;
+        for (; t + 1 < taps; t += 2)
+        {
+            // two pixels as words R0 R1 G0 G1 B0 B1 A0 A1
+            const __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + t * 4)), zero);
+            const __m128i pairs = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(pairs, _mm_set1_epi32(resize_weight_pair(w, t, taps))));
+        }
+        if (t < taps)
+        {
+            std::int32_t last;
+            std::memcpy(&last, s + t * 4, 4);
+            const __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(last), zero), zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(resize_weight_pair(w, t, taps))));
+        }
+        return acc;
+    }
+
+    IMG_TARGET_SSE2 void resize_row_h_sse2(const unsigned char* src, unsigned char* dst, int dstCols, int channels,
+                                           const int* starts, const std::int16_t* weights, int taps)
+    {
+        int x = 0;
+        if (channels == 4)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 2 <= dstCols; x += 2)
+            {
+                const std::int16_t* w = weights + static_cast<std::size_t>(x) * static_cast<std::size_t>(taps);
+                const __m128i a = resize_pixel4_sse2(src + static_cast<std::size_t>(starts[x]) * 4, w, taps);
+                const __m128i b = resize_pixel4_sse2(src + static_cast<std::size_t>(starts[x + 1]) * 4, w + taps, taps);
+                const __m128i words = _mm_packs_epi32(_mm_srai_epi32(a, kResizeCoefBits), _mm_srai_epi32(b, kResizeCoefBits));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + static_cast<std::size_t>(x) * 4), _mm_packus_epi16(words, zero));
+            }
+        }
+        resize_row_h_from(src, dst, x, dstCols, channels, starts, weights, taps);
+    }
+
+    // Bytes [i, bytes) of resizeRowV, 16 at a time: rows t and t + 1 are interleaved byte by byte, widened
+    // and paired with (w[t], w[t + 1]).
+    IMG_TARGET_SSE2 void resize_row_v_sse2_from(const unsigned char* const* rows, const std::int16_t* weights, int taps,
+                                                unsigned char* dst, std::size_t i, std::size_t bytes)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= bytes; i += 16)
+        {
+            __m128i acc0 = _mm_set1_epi32(1 << (kResizeCoefBits - 1));
+            __m128i acc1 = acc0;
+            __m128i acc2 = acc0;
+            __m128i acc3 = acc0;
+            for (int t = 0; t < taps; t += 2)
+            {
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[t] + i));
+                const __m128i b = t + 1 < taps ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[t + 1] + i)) : zero;
+                const __m128i coef = _mm_set1_epi32(resize_weight_pair(weights, t, taps));
+                const __m128i lo = _mm_unpacklo_epi8(a, b);
+                const __m128i hi = _mm_unpackhi_epi8(a, b);
+                acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), coef));
+                acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), coef));
+                acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), coef));
+                acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), coef));
+            }
+            const __m128i w0 = _mm_packs_epi32(_mm_srai_epi32(acc0, kResizeCoefBits), _mm_srai_epi32(acc1, kResizeCoefBits));
+            const __m128i w1 = _mm_packs_epi32(_mm_srai_epi32(acc2, kResizeCoefBits), _mm_srai_epi32(acc3, kResizeCoefBits));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(w0, w1));
+        }
+        resize_row_v_from(rows, weights, taps, dst, i, bytes);
+    }
+
+    IMG_TARGET_SSE2 void resize_row_v_sse2(const unsigned char* const* rows, const std::int16_t* weights, int taps, unsigned char* dst, std::size_t bytes)
+    {
+        resize_row_v_sse2_from(rows, weights, taps, dst, 0, bytes);
+    }
+
+    // ---------- AVX2 ----------
+
+    IMG_TARGET_AVX2 inline __m256i luma_avx2(__m256i px)
+    {
+        const __m256i mask  = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i wRB   = _mm256_set1_epi32((kLumaB << 16) | kLumaR);
+        const __m256i wG    = _mm256_set1_epi32(kLumaG);
+        const __m256i round = _mm256_set1_epi32(1 << (kLumaShift - 1));
+
+        const __m256i rb = _mm256_and_si256(px, mask);
+        const __m256i gx = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+        const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, wRB), _mm256_madd_epi16(gx, wG));
+        return _mm256_srli_epi32(_mm256_add_epi32(sum, round), kLumaShift);
+    }
+
+    // Reads bytes [0, 28), uses the first 24 (eight RGB pixels).
+    IMG_TARGET_AVX2 inline __m256i expand_rgb_avx2(const unsigned char* p)
+    {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+        const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        return _mm256_shuffle_epi8(v, shuffle);
+    }
+
+    IMG_TARGET_AVX2 inline void store_luma16_avx2(unsigned char* dst, __m256i a, __m256i b)
+    {
+        // packs/packus work per 128-bit lane; the permute restores pixel order
+        const __m256i w = _mm256_packs_epi32(a, b);
+        const __m256i bytes = _mm256_packus_epi16(w, w);
+        const __m256i ordered = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 0, 0, 0, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(ordered));
+    }
+
+    IMG_TARGET_AVX2 void invert_row_avx2(const unsigned char* src, unsigned char* dst, std::size_t bytes)
+    {
+        const __m256i ones = _mm256_set1_epi8(static_cast<char>(0xFF));
+        std::size_t i = 0;
+        for (; i + 32 <= bytes; i += 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(v, ones));
+        }
+        invert_row_sse2(src + i, dst + i, bytes - i);
+    }
+
+    IMG_TARGET_AVX2 void gray_row_avx2(const unsigned char* src, unsigned char* dst, int cols, int channels)
+    {
+        int x = 0;
+        if (channels == 3)
+        {
+            // the last load ends at byte 3 * x + 52
+            for (; x + 18 <= cols; x += 16)
+            {
+                const unsigned char* p = src + 3 * static_cast<std::size_t>(x);
+                store_luma16_avx2(dst + x, luma_avx2(expand_rgb_avx2(p)), luma_avx2(expand_rgb_avx2(p + 24)));
+            }
+        }
+        else if (channels == 4)
+        {
+            for (; x + 16 <= cols; x += 16)
+            {
+                const unsigned char* p = src + 4 * static_cast<std::size_t>(x);
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+                store_luma16_avx2(dst + x, luma_avx2(a), luma_avx2(b));
+            }
+        }
+        gray_row_sse2(src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels), dst + x, cols - x, channels);
+    }
+
+    IMG_TARGET_AVX2 void swap_bytes16_avx2(const unsigned char* src, unsigned char* dst, std::size_t samples)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        std::size_t i = 0;
+        for (; i + 16 <= samples; i += 16)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i), _mm256_shuffle_epi8(v, shuffle));
+        }
+        swap_bytes16_sse2(src + 2 * i, dst + 2 * i, samples - i);
+    }
+
+    // Three-channel layout conversions use SSSE3 byte shuffles, available from this level on:
+    // 16 pixels are three 16-byte registers, and each output register ORs three shuffles.
+    IMG_TARGET_AVX2 void deinterleave_row_avx2(const unsigned char* src, unsigned char* const* planes, int cols, int channels)
+    {
+        if (channels != 3)
+        {
+            deinterleave_row_sse2(src, planes, cols, channels);
+            return;
+        }
+        const __m128i shuffles[3][3] = {
+            { _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13) },
+            { _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14) },
+            { _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),
+              _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15) },
+        };
+        int x = 0;
+        for (; x + 16 <= cols; x += 16)
+        {
+            const __m128i* p = reinterpret_cast<const __m128i*>(src + 3 * static_cast<std::size_t>(x));
+            const __m128i in[3] = { _mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2) };
+            for (int k = 0; k < 3; ++k)
+            {
+                const __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], shuffles[k][0]), _mm_shuffle_epi8(in[1], shuffles[k][1])),
+                                               _mm_shuffle_epi8(in[2], shuffles[k][2]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[k] + x), v);
+            }
+        }
+        deinterleave_from(src, planes, x, cols, channels);
+    }
+
+    IMG_TARGET_AVX2 void interleave_row_avx2(const unsigned char* const* planes, unsigned char* dst, int cols, int channels)
+    {
+        if (channels != 3)
+        {
+            interleave_row_sse2(planes, dst, cols, channels);
+            return;
+        }
+        // shuffles[o][k] places channel k into output register o
+        const __m128i shuffles[3][3] = {
+            { _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5),
+              _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1),
+              _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1) },
+            { _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1),
+              _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10),
+              _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1) },
+            { _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1),
+              _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1),
+              _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15) },
+        };
+        int x = 0;
+        for (; x + 16 <= cols; x += 16)
+        {
+            const __m128i in[3] = {
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[0] + x)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[1] + x)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[2] + x)),
+            };
+            __m128i* out = reinterpret_cast<__m128i*>(dst + 3 * static_cast<std::size_t>(x));
+            for (int o = 0; o < 3; ++o)
+            {
+                const __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], shuffles[o][0]), _mm_shuffle_epi8(in[1], shuffles[o][1])),
+                                               _mm_shuffle_epi8(in[2], shuffles[o][2]));
+                _mm_storeu_si128(out + o, v);
+            }
+        }
+        interleave_from(planes, dst, x, cols, channels);
+    }
+
+    IMG_TARGET_AVX2 inline __m256i planar_lanes_avx2(const unsigned char* r, const unsigned char* g, const unsigned char* b)
+    {
+        const __m256i rr = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(r)));
+        const __m256i gg = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(g)));
+        const __m256i bb = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b)));
+        return _mm256_or_si256(rr, _mm256_or_si256(_mm256_slli_epi32(gg, 8), _mm256_slli_epi32(bb, 16)));
+    }
+
+    IMG_TARGET_AVX2 void gray_planar_row_avx2(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* dst, int cols)
+    {
+        int x = 0;
+        for (; x + 16 <= cols; x += 16)
+        {
+            store_luma16_avx2(dst + x, luma_avx2(planar_lanes_avx2(r + x, g + x, b + x)),
+                              luma_avx2(planar_lanes_avx2(r + x + 8, g + x + 8, b + x + 8)));
+        }
+        gray_planar_row_sse2(r + x, g + x, b + x, dst + x, cols - x);
+    }
+
+    IMG_TARGET_AVX2 void convolve_f32_avx2(const float* src, std::size_t tapStride, const float* weights, int taps, float* dst, std::size_t count)
+    {
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m256 a = _mm256_setzero_ps();
+            __m256 b = _mm256_setzero_ps();
+            const float* s = src + i;
+            for (int t = 0; t < taps; ++t, s += tapStride)
+            {
+                const __m256 w = _mm256_set1_ps(weights[t]);
+                a = _mm256_add_ps(a, _mm256_mul_ps(w, _mm256_loadu_ps(s)));
+                b = _mm256_add_ps(b, _mm256_mul_ps(w, _mm256_loadu_ps(s + 8)));
+            }
+            _mm256_storeu_ps(dst + i, a);
+            _mm256_storeu_ps(dst + i + 8, b);
+        }
+        convolve_f32_sse2(src + i, tapStride, weights, taps, dst + i, count - i);
+    }
+
+    struct ColorWeightsAvx2
+    {
+        __m256i rb[3];
+        __m256i g[3];
+        __m256i bias[3];
+    };
+
+    IMG_TARGET_AVX2 inline ColorWeightsAvx2 color_weights_avx2(const short* matrix, const int* bias)
+    {
+        const ColorWeightsSse2 narrow = color_weights_sse2(matrix, bias);
+        ColorWeightsAvx2 w;
+        for (int k = 0; k < 3; ++k)
+        {
+            w.rb[k] = _mm256_broadcastsi128_si256(narrow.rb[k]);
+            w.g[k] = _mm256_broadcastsi128_si256(narrow.g[k]);
+            w.bias[k] = _mm256_broadcastsi128_si256(narrow.bias[k]);
+        }
+        return w;
+    }
+
+    // Same steps as color_matrix_sse2; packs and unpacks stay inside each 128-bit half, so pixel order is kept.
+    IMG_TARGET_AVX2 inline __m256i color_matrix_avx2(__m256i px, const ColorWeightsAvx2& w)
+    {
+        const __m256i mask = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i rb = _mm256_and_si256(px, mask);
+        const __m256i gx = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+        __m256i out[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, w.rb[k]), _mm256_madd_epi16(gx, w.g[k]));
+            out[k] = _mm256_srai_epi32(_mm256_add_epi32(sum, w.bias[k]), kColorMatrixShift);
+        }
+        const __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(out[0], out[1]), _mm256_packs_epi32(out[2], _mm256_srli_epi32(px, 24)));
+        const __m256i rg = _mm256_unpacklo_epi8(bytes, _mm256_srli_si256(bytes, 4));
+        const __m256i bx = _mm256_unpacklo_epi8(_mm256_srli_si256(bytes, 8), _mm256_srli_si256(bytes, 12));
+        return _mm256_unpacklo_epi16(rg, bx);
+    }
+
+    IMG_TARGET_AVX2 void color_matrix_row_avx2(const unsigned char* src, unsigned char* dst, int cols, int channels, const short* matrix, const int* bias)
+    {
+        const ColorWeightsAvx2 w = color_weights_avx2(matrix, bias);
+        int x = 0;
+        if (channels == 3)
+        {
+            // the load ends at byte 3 * x + 28
+            for (; x + 10 <= cols; x += 8)
+            {
+                const std::size_t offset = 3 * static_cast<std::size_t>(x);
+                const __m256i out = color_matrix_avx2(expand_rgb_avx2(src + offset), w);
+                store_rgb12_sse2(dst + offset, _mm256_castsi256_si128(out));
+                store_rgb12_sse2(dst + offset + 12, _mm256_extracti128_si256(out, 1));
+            }
+        }
+        else if (channels == 4)
+        {
+            for (; x + 8 <= cols; x += 8)
+            {
+                const std::size_t offset = 4 * static_cast<std::size_t>(x);
+                const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + offset));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + offset), color_matrix_avx2(px, w));
+            }
+        }
+        const std::size_t done = static_cast<std::size_t>(x) * static_cast<std::size_t>(channels);
+        color_matrix_row_sse2(src + done, dst + done, cols - x, channels, matrix, bias);
+    }
+
+    IMG_TARGET_AVX2 void reverse_row_avx2(const unsigned char* src, unsigned char* dst, int cols, std::size_t pixelBytes)
+    {
+        int x = 0;
+        if (pixelBytes == 3)
+        {
+            // Five pixels per shuffle. The load starts one byte before source pixel cols - x - 5 and the
+            // store spills one byte into pixel x + 5, which the next step overwrites.
+            const __m128i order = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -128);
+            for (; x + 6 <= cols; x += 5)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * static_cast<std::size_t>(cols - x - 5) - 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * static_cast<std::size_t>(x)), _mm_shuffle_epi8(v, order));
+            }
+        }
+        else if (pixelBytes == 1)
+        {
+            const __m256i order = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                                   15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+            for (; x + 32 <= cols; x += 32)
+            {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + (cols - x - 32)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, order), 0x4E));
+            }
+        }
+        else if (pixelBytes == 4)
+        {
+            const __m256i order = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+            for (; x + 8 <= cols; x += 8)
+            {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * static_cast<std::size_t>(cols - x - 8)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * static_cast<std::size_t>(x)), _mm256_permutevar8x32_epi32(v, order));
+            }
+        }
+        // Output pixels from x on are the first cols - x pixels of src.
+        reverse_row_sse2(src, dst + static_cast<std::size_t>(x) * pixelBytes, cols - x, pixelBytes);
+    }
+
+    // Twelve output samples per step from 24 bytes of each row: the rows are summed in 16-bit lanes, every lane
+    // gets the lane Channels further on, and the lanes that start a pixel pair are gathered with one shuffle.
+    template <int Channels>
+    IMG_TARGET_AVX2 void halve_row_ssse3(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int dstCols)
+    {
+        alignas(16) signed char lowOrder[16];
+        alignas(16) signed char highOrder[16];
+        for (int k = 0; k < 16; ++k)
+        {
+            lowOrder[k] = -128;
+            highOrder[k] = -128;
+        }
+        for (int lane = 0, out = 0; lane < 24; ++lane)
+        {
+            if (lane % (2 * Channels) < Channels)
+            {
+                if (lane < 16)
+                    lowOrder[out++] = static_cast<signed char>(lane);
+                else
+                    highOrder[out++] = static_cast<signed char>(lane - 16);
+            }
+        }
+        const __m128i lowShuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(lowOrder));
+        const __m128i highShuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(highOrder));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+
+        const std::size_t samples = static_cast<std::size_t>(dstCols) * Channels;
+        std::size_t j = 0;
+        for (; j + 12 <= samples; j += 12)
+        {
+            const std::size_t i = 2 * j;
+            const __m128i t0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+            const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i));
+            const __m128i t1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + i + 16));
+            const __m128i b1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + i + 16));
+            const __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(t0, zero), _mm_unpacklo_epi8(b0, zero));
+            const __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(t0, zero), _mm_unpackhi_epi8(b0, zero));
+            const __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(t1, zero), _mm_unpacklo_epi8(b1, zero));
+            const __m128i h0 = _mm_add_epi16(_mm_add_epi16(s0, _mm_alignr_epi8(s1, s0, 2 * Channels)), two);
+            const __m128i h1 = _mm_add_epi16(_mm_add_epi16(s1, _mm_alignr_epi8(s2, s1, 2 * Channels)), two);
+            const __m128i h2 = _mm_add_epi16(_mm_add_epi16(s2, _mm_srli_si128(s2, 2 * Channels)), two);
+            const __m128i low = _mm_packus_epi16(_mm_srli_epi16(h0, 2), _mm_srli_epi16(h1, 2));
+            const __m128i high = _mm_packus_epi16(_mm_srli_epi16(h2, 2), zero);
+            const __m128i out = _mm_or_si128(_mm_shuffle_epi8(low, lowShuffle), _mm_shuffle_epi8(high, highShuffle));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + j), out);
+            const int tail = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+            std::memcpy(dst + j + 8, &tail, 4);
+        }
+        halve_row_scalar(top + 2 * j, bottom + 2 * j, dst + j, static_cast<int>((samples - j) / Channels), Channels);
+    }
+
+    IMG_TARGET_AVX2 inline __m256i div255_epu16(__m256i v)
+    {
+        const __m256i t = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    // Eight RGBA source pixels per step in 16-bit lanes; a 3-channel destination is widened to RGBX with a
+    // byte shuffle per 128-bit half and narrowed back the same way. Returns the pixels done.
+    template <int DstChannels, bool Premultiplied>
+    IMG_TARGET_AVX2 int blend_rgba_avx2(const unsigned char* src, unsigned char* dst, int cols)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i full = _mm256_set1_epi16(255);
+        const __m256i alphaLo = _mm256_broadcastsi128_si256(_mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1));
+        const __m256i alphaHi = _mm256_broadcastsi128_si256(_mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1));
+        const __m256i widen = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+        const __m256i narrow = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        // Three-channel loads read 16 bytes from the last four pixels, so they stop early enough to stay in the row.
+        const int last = DstChannels == 4 ? cols - 8 : cols - 10;
+        int x = 0;
+        for (; x <= last; x += 8)
+        {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * static_cast<std::size_t>(x)));
+            unsigned char* out = dst + static_cast<std::size_t>(DstChannels) * static_cast<std::size_t>(x);
+            __m256i d;
+            if constexpr (DstChannels == 4)
+            {
+                d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out));
+            }
+            else
+            {
+                d = _mm256_shuffle_epi8(_mm256_set_m128i(_mm_loadu_si128(reinterpret_cast<const __m128i*>(out + 12)),
+                                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(out))), widen);
+            }
+
+            __m256i halves[2];
+            for (int h = 0; h < 2; ++h)
+            {
+                const __m256i sw = h == 0 ? _mm256_unpacklo_epi8(s, zero) : _mm256_unpackhi_epi8(s, zero);
+                const __m256i dw = h == 0 ? _mm256_unpacklo_epi8(d, zero) : _mm256_unpackhi_epi8(d, zero);
+                const __m256i a = _mm256_shuffle_epi8(s, h == 0 ? alphaLo : alphaHi);
+                const __m256i rest = _mm256_mullo_epi16(dw, _mm256_sub_epi16(full, a));
+                // s + div255(d * (255 - a)) is the premultiplied colour and, for both kinds, the new alpha.
+                const __m256i over = _mm256_add_epi16(sw, div255_epu16(rest));
+                if constexpr (Premultiplied)
+                {
+                    halves[h] = over;
+                }
+                else
+                {
+                    const __m256i colour = div255_epu16(_mm256_add_epi16(_mm256_mullo_epi16(sw, a), rest));
+                    halves[h] = _mm256_blend_epi16(colour, over, 0x88);
+                }
+            }
+            const __m256i r = _mm256_packus_epi16(halves[0], halves[1]);
+
+            if constexpr (DstChannels == 4)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), r);
+            }
+            else
+            {
+                // The first 16-byte store spills into pixel 4, which the second store then rewrites.
+                const __m256i packed = _mm256_shuffle_epi8(r, narrow);
+                const __m128i high = _mm256_extracti128_si256(packed, 1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 12), high);
+                const int tail = _mm_cvtsi128_si32(_mm_srli_si128(high, 8));
+                std::memcpy(out + 20, &tail, 4);
+            }
+        }
+        return x;
+    }
+
+    // Grey + alpha sources keep the scalar loop: watermarks and overlays are RGBA.
+    IMG_TARGET_AVX2 void blend_row_avx2(const unsigned char* src, unsigned char* dst, int cols, int srcChannels, int dstChannels,
+                                        bool premultiplied)
+    {
+        int x = 0;
+        if (srcChannels == 4)
+        {
+            x = dstChannels == 4 ? (premultiplied ? blend_rgba_avx2<4, true>(src, dst, cols) : blend_rgba_avx2<4, false>(src, dst, cols))
+                                 : (premultiplied ? blend_rgba_avx2<3, true>(src, dst, cols) : blend_rgba_avx2<3, false>(src, dst, cols));
+        }
+        blend_row_scalar(src + static_cast<std::size_t>(x) * static_cast<std::size_t>(srcChannels),
+                         dst + static_cast<std::size_t>(x) * static_cast<std::size_t>(dstChannels), cols - x, srcChannels, dstChannels,
+                         premultiplied);
+    }
+
+    IMG_TARGET_AVX2 void halve_row_avx2(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int dstCols, int channels)
+    {
+        switch (channels)
+        {
+        case 1:  halve_row_ssse3<1>(top, bottom, dst, dstCols); return;
+        case 2:  halve_row_ssse3<2>(top, bottom, dst, dstCols); return;
+        case 3:  halve_row_ssse3<3>(top, bottom, dst, dstCols); return;
+        case 4:  halve_row_ssse3<4>(top, bottom, dst, dstCols); return;
+        default: halve_row_scalar(top, bottom, dst, dstCols, channels); return;
+        }
+    }
+
+    IMG_TARGET_AVX2 inline __m256i resize_lanes_avx2(__m128i lo, __m128i hi)
+    {
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+
+    // Two 4-channel output pixels at a time, one per 128-bit lane, laid out as in resize_pixel4_sse2.
+    IMG_TARGET_AVX2 void resize_row_h_avx2(const unsigned char* src, unsigned char* dst, int dstCols, int channels,
+                                           const int* starts, const std::int16_t* weights, int taps)
+    {
+        int x = 0;
+        if (channels == 4)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            for (; x + 2 <= dstCols; x += 2)
+            {
+                const unsigned char* s0 = src + static_cast<std::size_t>(starts[x]) * 4;
+                const unsigned char* s1 = src + static_cast<std::size_t>(starts[x + 1]) * 4;
+                const std::int16_t* w0 = weights + static_cast<std::size_t>(x) * static_cast<std::size_t>(taps);
+                const std::int16_t* w1 = w0 + taps;
+                __m256i acc = _mm256_set1_epi32(1 << (kResizeCoefBits - 1));
+                int t = 0;
+                for (; t + 1 < taps; t += 2)
+                {
+                    const __m256i px = _mm256_unpacklo_epi8(resize_lanes_avx2(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s0 + t * 4)),
+                                                                              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s1 + t * 4))), zero);
+                    const __m256i pairs = _mm256_unpacklo_epi16(px, _mm256_srli_si256(px, 8));
+                    const __m256i coef = resize_lanes_avx2(_mm_set1_epi32(resize_weight_pair(w0, t, taps)),
+                                                           _mm_set1_epi32(resize_weight_pair(w1, t, taps)));
+                    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, coef));
+                }
+                if (t < taps)
+                {
+                    std::int32_t last0;
+                    std::int32_t last1;
+                    std::memcpy(&last0, s0 + t * 4, 4);
+                    std::memcpy(&last1, s1 + t * 4, 4);
+                    const __m256i px = _mm256_unpacklo_epi16(
+                        _mm256_unpacklo_epi8(resize_lanes_avx2(_mm_cvtsi32_si128(last0), _mm_cvtsi32_si128(last1)), zero), zero);
+                    const __m256i coef = resize_lanes_avx2(_mm_set1_epi32(resize_weight_pair(w0, t, taps)),
+                                                           _mm_set1_epi32(resize_weight_pair(w1, t, taps)));
+                    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(px, coef));
+                }
+                // Each lane packs to four bytes at its bottom.
+                const __m256i words = _mm256_packs_epi32(_mm256_srai_epi32(acc, kResizeCoefBits), zero);
+                const __m256i packed = _mm256_packus_epi16(words, zero);
+                const std::int32_t out0 = _mm256_cvtsi256_si32(packed);
+                const std::int32_t out1 = _mm256_extract_epi32(packed, 4);
+                std::memcpy(dst + static_cast<std::size_t>(x) * 4, &out0, 4);
+                std::memcpy(dst + static_cast<std::size_t>(x) * 4 + 4, &out1, 4);
+            }
+        }
+        resize_row_h_from(src, dst, x, dstCols, channels, starts, weights, taps);
+    }
+
+    // 32 bytes at a time as resize_row_v_sse2_from; unpacking and packing both stay inside the 128-bit lanes,
+    // so the bytes come out in order without a permute.
+    IMG_TARGET_AVX2 void resize_row_v_avx2(const unsigned char* const* rows, const std::int16_t* weights, int taps, unsigned char* dst, std::size_t bytes)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 32 <= bytes; i += 32)
+        {
+            __m256i acc0 = _mm256_set1_epi32(1 << (kResizeCoefBits - 1));
+            __m256i acc1 = acc0;
+            __m256i acc2 = acc0;
+            __m256i acc3 = acc0;
+            for (int t = 0; t < taps; t += 2)
+            {
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[t] + i));
+                const __m256i b = t + 1 < taps ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[t + 1] + i)) : zero;
+                const __m256i coef = _mm256_set1_epi32(resize_weight_pair(weights, t, taps));
+                const __m256i lo = _mm256_unpacklo_epi8(a, b);
+                const __m256i hi = _mm256_unpackhi_epi8(a, b);
+                acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), coef));
+                acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), coef));
+                acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), coef));
+                acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), coef));
+            }
+            const __m256i w0 = _mm256_packs_epi32(_mm256_srai_epi32(acc0, kResizeCoefBits), _mm256_srai_epi32(acc1, kResizeCoefBits));
+            const __m256i w1 = _mm256_packs_epi32(_mm256_srai_epi32(acc2, kResizeCoefBits), _mm256_srai_epi32(acc3, kResizeCoefBits));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(w0, w1));
+        }
+        resize_row_v_sse2_from(rows, weights, taps, dst, i, bytes);
+    }
+
+    // ---------- AVX-512 (F + BW) ----------
+
+    // GCC 12's unmasked AVX-512 intrinsics pass _mm512_undefined_* as their merge source, which
+    // -Wmaybe-uninitialized reports at -O2 once they are inlined here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+    IMG_TARGET_AVX512 inline __m512i luma_avx512(__m512i px)
+    {
+        const __m512i mask  = _mm512_set1_epi32(0x00FF00FF);
+        const __m512i wRB   = _mm512_set1_epi32((kLumaB << 16) | kLumaR);
+        const __m512i wG    = _mm512_set1_epi32(kLumaG);
+        const __m512i round = _mm512_set1_epi32(1 << (kLumaShift - 1));
+
+        const __m512i rb = _mm512_and_si512(px, mask);
+        const __m512i gx = _mm512_and_si512(_mm512_srli_epi32(px, 8), mask);
+        const __m512i sum = _mm512_add_epi32(_mm512_madd_epi16(rb, wRB), _mm512_madd_epi16(gx, wG));
+        return _mm512_srli_epi32(_mm512_add_epi32(sum, round), kLumaShift);
+    }
+
+    // Reads bytes [0, 52), uses the first 48 (sixteen RGB pixels).
+    IMG_TARGET_AVX512 inline __m512i expand_rgb_avx512(const unsigned char* p)
+    {
+        __m512i v = _mm512_castsi128_si512(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 24)), 2);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 36)), 3);
+        const __m512i shuffle = _mm512_broadcast_i32x4(
+            _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+        return _mm512_shuffle_epi8(v, shuffle);
+    }
+
+    IMG_TARGET_AVX512 void invert_row_avx512(const unsigned char* src, unsigned char* dst, std::size_t bytes)
+    {
+        const __m512i ones = _mm512_set1_epi32(-1);
+        std::size_t i = 0;
+        for (; i + 64 <= bytes; i += 64)
+        {
+            const __m512i v = _mm512_loadu_si512(src + i);
+            _mm512_storeu_si512(dst + i, _mm512_xor_si512(v, ones));
+        }
+        invert_row_avx2(src + i, dst + i, bytes - i);
+    }
+
+    IMG_TARGET_AVX512 void gray_row_avx512(const unsigned char* src, unsigned char* dst, int cols, int channels)
+    {
+        int x = 0;
+        if (channels == 3)
+        {
+            for (; x + 18 <= cols; x += 16)
+            {
+                const __m512i y = luma_avx512(expand_rgb_avx512(src + 3 * static_cast<std::size_t>(x)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm512_cvtepi32_epi8(y));
+            }
+        }
+        else if (channels == 4)
+        {
+            for (; x + 16 <= cols; x += 16)
+            {
+                const __m512i y = luma_avx512(_mm512_loadu_si512(src + 4 * static_cast<std::size_t>(x)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm512_cvtepi32_epi8(y));
+            }
+        }
+        gray_row_avx2(src + static_cast<std::size_t>(x) * static_cast<std::size_t>(channels), dst + x, cols - x, channels);
+    }
+
+    IMG_TARGET_AVX512 void swap_bytes16_avx512(const unsigned char* src, unsigned char* dst, std::size_t samples)
+    {
+        const __m512i shuffle = _mm512_broadcast_i32x4(
+            _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+        std::size_t i = 0;
+        for (; i + 32 <= samples; i += 32)
+        {
+            const __m512i v = _mm512_loadu_si512(src + 2 * i);
+            _mm512_storeu_si512(dst + 2 * i, _mm512_shuffle_epi8(v, shuffle));
+        }
+        swap_bytes16_avx2(src + 2 * i, dst + 2 * i, samples - i);
+    }
+
+    // The whole table fits four zmm registers: vpermi2b looks up the low and high halves by the
+    // index's low seven bits, and its top bit picks between them.
+    IMG_TARGET_AVX512_VBMI void lut_row_vbmi(const unsigned char* src, unsigned char* dst, std::size_t bytes, const unsigned char* table)
+    {
+        const __m512i t0 = _mm512_loadu_si512(table);
+        const __m512i t1 = _mm512_loadu_si512(table + 64);
+        const __m512i t2 = _mm512_loadu_si512(table + 128);
+        const __m512i t3 = _mm512_loadu_si512(table + 192);
+        std::size_t i = 0;
+        for (; i < bytes; i += 64)
+        {
+            const __mmask64 live = bytes - i >= 64 ? ~__mmask64{ 0 } : (__mmask64{ 1 } << (bytes - i)) - 1;
+            const __m512i v = _mm512_maskz_loadu_epi8(live, src + i);
+            const __m512i low = _mm512_permutex2var_epi8(t0, v, t1);
+            const __m512i high = _mm512_permutex2var_epi8(t2, v, t3);
+            _mm512_mask_storeu_epi8(dst + i, live, _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), low, high));
+        }
+    }
+
+    // A 256-entry lookup needs byte permutes across a whole table: pshufb only reaches 16 entries, and sixteen
+    // of them per vector lose to the scalar loop, so the lookup is vectorised only where VBMI is present.
+    void lut_row_avx512(const unsigned char* src, unsigned char* dst, std::size_t bytes, const unsigned char* table)
+    {
+        static const bool vbmi = __builtin_cpu_supports("avx512vbmi");
+        if (vbmi)
+        {
+            lut_row_vbmi(src, dst, bytes, table);
+        }
+        else
+        {
+            lut_row_scalar(src, dst, bytes, table);
+        }
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+    const PixelKernels kScalarKernels{ SimdLevel::Scalar, invert_row_scalar, gray_row_scalar, swap_bytes16_scalar,
+                                       deinterleave_row_scalar, interleave_row_scalar, gray_planar_row_scalar,
+                                       convolve_f32_scalar, color_matrix_row_scalar, reverse_row_scalar,
+                                       transpose_block_scalar, halve_row_scalar, lut_row_scalar, blend_row_scalar,
+                                       resize_row_h_scalar, resize_row_v_scalar };
+#ifdef IMG_SIMD_X86
+    // Halving and blending gather their output with SSSE3 byte shuffles, so SSE2 keeps the scalar loops.
+    const PixelKernels kSse2Kernels{ SimdLevel::SSE2, invert_row_sse2, gray_row_sse2, swap_bytes16_sse2,
+                                     deinterleave_row_sse2, interleave_row_sse2, gray_planar_row_sse2,
+                                     convolve_f32_sse2, color_matrix_row_sse2, reverse_row_sse2,
+                                     transpose_block_sse2, halve_row_scalar, lut_row_scalar, blend_row_scalar,
+                                     resize_row_h_sse2, resize_row_v_sse2 };
+    // Transposes stay on SSE2: an 8x8 byte block already fills 64-bit lanes, and wider blocks would
+    // need cross-lane permutes on every round.
+    const PixelKernels kAvx2Kernels{ SimdLevel::AVX2, invert_row_avx2, gray_row_avx2, swap_bytes16_avx2,
+                                     deinterleave_row_avx2, interleave_row_avx2, gray_planar_row_avx2,
+                                     convolve_f32_avx2, color_matrix_row_avx2, reverse_row_avx2,
+                                     transpose_block_sse2, halve_row_avx2, lut_row_scalar, blend_row_avx2,
+                                     resize_row_h_avx2, resize_row_v_avx2 };
+    // The layout, colour and resize kernels are shuffle- and load-bound, so AVX-512 keeps the AVX2 ones. AVX-512F also
+    // implies FMA, and a fused multiply-add would round differently from the other levels.
+    const PixelKernels kAvx512Kernels{ SimdLevel::AVX512, invert_row_avx512, gray_row_avx512, swap_bytes16_avx512,
+                                       deinterleave_row_avx2, interleave_row_avx2, gray_planar_row_avx2,
+                                       convolve_f32_avx2, color_matrix_row_avx2, reverse_row_avx2,
+                                       transpose_block_sse2, halve_row_avx2, lut_row_avx512, blend_row_avx2,
+                                       resize_row_h_avx2, resize_row_v_avx2 };
+#endif
+}
+
+bool simd_level_supported(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return true;
+#ifdef IMG_SIMD_X86
+    case SimdLevel::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SimdLevel::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SimdLevel::AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return false;
+    }
+}
+
+SimdLevel detect_simd_level()
+{
+    for (SimdLevel level : { SimdLevel::AVX512, SimdLevel::AVX2, SimdLevel::SSE2 })
+    {
+        if (simd_level_supported(level))
+        {
+            return level;
+        }
+    }
+    return SimdLevel::Scalar;
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::SSE2:   return "sse2";
+    case SimdLevel::AVX2:   return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+    default:                return "scalar";
+    }
+}
+
+const PixelKernels& kernels_for(SimdLevel level)
+{
+#ifdef IMG_SIMD_X86
+    switch (level)
+    {
+    case SimdLevel::SSE2:   return kSse2Kernels;
+    case SimdLevel::AVX2:   return kAvx2Kernels;
+    case SimdLevel::AVX512: return kAvx512Kernels;
+    default:                break;
+    }
+#else
+    (void)level;
+#endif
+    return kScalarKernels;
+}
+
+const PixelKernels& active_kernels()
+{
+    static const PixelKernels& kernels = kernels_for(detect_simd_level());
+    return kernels;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+// Row kernels operate on one contiguous run of bytes; callers walk the rows.
+struct PixelKernels
+{
+    SimdLevel level;
+    void (*invertRow)(const unsigned char* src, unsigned char* dst, std::size_t bytes);
+    void (*grayRow)(const unsigned char* src, unsigned char* dst, int cols, int channels);
+    // Reverses the byte order of `samples` 16-bit values (big-endian PNM payload <-> host); src may equal dst.
+    void (*swapBytes16)(const unsigned char* src, unsigned char* dst, std::size_t samples);
+    // Interleaved <-> planar for 8-bit samples: planes[k] holds channel k of `cols` pixels.
+    void (*deinterleaveRow)(const unsigned char* src, unsigned char* const* planes, int cols, int channels);
+    void (*interleaveRow)(const unsigned char* const* planes, unsigned char* dst, int cols, int channels);
+    // Luma of `cols` pixels whose R, G and B samples are in separate rows.
+    void (*grayPlanarRow)(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* dst, int cols);
+    // dst[i] = sum over t < taps of weights[t] * src[i + t * tapStride], summed in tap order, for i < count.
+    void (*convolveF32)(const float* src, std::size_t tapStride, const float* weights, int taps, float* dst, std::size_t count);
+    // 8-bit affine colour transform of pixels with 3 or 4 samples: for k < 3, out[k] = saturate((matrix[3k] * in[0]
+    // + matrix[3k + 1] * in[1] + matrix[3k + 2] * in[2] + bias[k]) >> kColorMatrixShift); a fourth sample is copied.
+    void (*colorMatrixRow)(const unsigned char* src, unsigned char* dst, int cols, int channels, const short* matrix, const int* bias);
+    // Copies `cols` pixels of pixelBytes each in reverse order: dst starts with the last pixel of src.
+    void (*reverseRow)(const unsigned char* src, unsigned char* dst, int cols, std::size_t pixelBytes);
+    // Element (x, y) of dst = element (y, x) of src for a rows x cols block of elemBytes-wide elements;
+    // the steps are the byte distances between rows and may be negative.
+    void (*transposeBlock)(const unsigned char* src, std::ptrdiff_t srcStep, unsigned char* dst, std::ptrdiff_t dstStep,
+                           int rows, int cols, std::size_t elemBytes);
+    // 2x2 box average of 8-bit pixels: output pixel x averages pixels 2x and 2x + 1 of rows top and bottom,
+    // (a + b + c + d + 2) >> 2 per sample, for x < dstCols.
+    void (*halveRow)(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int dstCols, int channels);
+    // dst[i] = table[src[i]] for i < bytes, through a 256-entry table; src may equal dst.
+    void (*lutRow)(const unsigned char* src, unsigned char* dst, std::size_t bytes, const unsigned char* table);
+    // Source-over of `cols` 8-bit pixels whose alpha is the last of srcChannels (2 or 4) samples onto dst pixels
+    // with the same colours and dstChannels = srcChannels or srcChannels - 1. With a = source alpha and
+    // div255(v) = v / 255 rounded: colour = div255(s * a + d * (255 - a)), or for premultiplied sources
+    // min(255, s + div255(d * (255 - a))); a destination alpha becomes a + div255(d * (255 - a)).
+    void (*blendRow)(const unsigned char* src, unsigned char* dst, int cols, int srcChannels, int dstChannels, bool premultiplied);
+    // Separable resampling with kResizeCoefBits fixed-point weights; each output is the weighted sum plus half
+    // a unit, shifted down and saturated to 0..255. Horizontal: output pixel x < dstCols weights `taps` pixels
+    // of src from pixel starts[x] by weights[x * taps ...].
+    void (*resizeRowH)(const unsigned char* src, unsigned char* dst, int dstCols, int channels,
+                       const int* starts, const std::int16_t* weights, int taps);
+    // Vertical: dst[i] = sum over t < taps of weights[t] * rows[t][i], for i < bytes.
+    void (*resizeRowV)(const unsigned char* const* rows, const std::int16_t* weights, int taps, unsigned char* dst, std::size_t bytes);
+};
+
+// BT.601 luma in 15-bit fixed point: Y = (R*9798 + G*19235 + B*3735 + 2^14) >> 15.
+inline constexpr int kLumaShift = 15;
+inline constexpr int kLumaR = 9798;
+inline constexpr int kLumaG = 19235;
+inline constexpr int kLumaB = 3735;
+
+// Fixed-point scale of colorMatrixRow coefficients; |coefficient| < 2, so a row fits madd's 16-bit weights.
+inline constexpr int kColorMatrixShift = 14;
+
+// Fixed-point scale of resize weights: a row of weights sums to 1 << kResizeCoefBits, and Lanczos lobes stay
+// within madd's 16-bit range.
+inline constexpr int kResizeCoefBits = 14;
+
+SimdLevel detect_simd_level();
+bool simd_level_supported(SimdLevel level);
+const char* simd_level_name(SimdLevel level);
+
+const PixelKernels& kernels_for(SimdLevel level);
+const PixelKernels& active_kernels();
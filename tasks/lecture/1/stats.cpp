@@ -0,0 +1,295 @@
+#include "stats.h"
+#include "Profile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+
+namespace
+{
+    constexpr std::size_t kBins = 256;
+    // Each channel histogram has this many copies, picked by pixel index, so runs of equal
+    // samples increment different counters instead of waiting on one store after another.
+    constexpr std::size_t kCopies = 4;
+
+    // Sums of one row and channel for wide depths; kept per row and added up in row order,
+    // so the result does not depend on how the rows were split between threads.
+    // NaN samples are left out, so count can be below the row width.
+    struct RowMoments
+    {
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        std::uint64_t count = 0;
+    };
+
+    template <typename T>
+    std::size_t bin_of(T v)
+    {
+        if constexpr (std::is_same_v<T, std::uint8_t>)
+        {
+            return v;
+        }
+        else if constexpr (std::is_same_v<T, std::uint16_t>)
+        {
+            return static_cast<std::size_t>(v >> 8);
+        }
+        else
+        {
+            // Written so that NaN, which fails every comparison, lands in bin 0 like negative values.
+            return static_cast<std::size_t>((v >= 0.0f ? std::min(v, 1.0f) : 0.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    template <typename T>
+    void scan_rows(const Image& img, int begin, int end, std::uint64_t* counts, RowMoments* moments)
+    {
+        const std::size_t cols = static_cast<std::size_t>(img.cols());
+        const std::size_t ch = static_cast<std::size_t>(img.channels());
+        for (int y = begin; y < end; ++y)
+        {
+            const T* row = img.ptr<T>(y, 0);
+            auto count_pixel = [&](std::size_t x, std::uint64_t* copy)
+            {
+                const T* p = row + x * ch;
+                for (std::size_t k = 0; k < ch; ++k)
+                {
+                    ++copy[k * kBins + bin_of(p[k])];
+                }
+            };
+            std::size_t x = 0;
+            for (; x + kCopies <= cols; x += kCopies)
+            {
+                for (std::size_t c = 0; c < kCopies; ++c)
+                {
+                    count_pixel(x + c, counts + c * ch * kBins);
+                }
+            }
+            for (; x < cols; ++x)
+            {
+                count_pixel(x, counts);
+            }
+
+            if constexpr (!std::is_same_v<T, std::uint8_t>)
+            {
+                RowMoments* m = moments + static_cast<std::size_t>(y) * ch;
+                for (std::size_t x = 0; x < cols; ++x)
+                {
+                    for (std::size_t k = 0; k < ch; ++k)
+                    {
+                        const double v = row[x * ch + k];
+                        if (std::isnan(v))
+                        {
+                            continue;
+                        }
+                        ++m[k].count;
+                        m[k].sum += v;
+                        m[k].sumSquares += v * v;
+                        m[k].min = std::min(m[k].min, v);
+                        m[k].max = std::max(m[k].max, v);
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void collect(const Image& img, ImageStats& stats)
+    {
+        const std::size_t ch = static_cast<std::size_t>(img.channels());
+        std::vector<std::uint64_t> totals(ch * kBins, 0);
+        std::vector<RowMoments> moments(std::is_same_v<T, std::uint8_t> ? 0 : static_cast<std::size_t>(img.rows()) * ch);
+        std::mutex totalsMutex;
+
+        parallel_rows(img.rows(), static_cast<std::size_t>(img.cols()) * img.elemSize(), [&](int begin, int end)
+        {
+            std::vector<std::uint64_t> counts(kCopies * ch * kBins, 0);
+            scan_rows<T>(img, begin, end, counts.data(), moments.data());
+
+            std::lock_guard<std::mutex> lock(totalsMutex);
+            for (std::size_t c = 0; c < kCopies; ++c)
+            {
+                for (std::size_t i = 0; i < ch * kBins; ++i)
+                {
+                    totals[i] += counts[c * ch * kBins + i];
+                }
+            }
+        });
+
+        for (std::size_t k = 0; k < ch; ++k)
+        {
+            ChannelStats& channel = stats.channels[k];
+            double n = static_cast<double>(stats.pixels);
+            std::copy(totals.begin() + static_cast<std::ptrdiff_t>(k * kBins),
+                      totals.begin() + static_cast<std::ptrdiff_t>((k + 1) * kBins), channel.histogram.begin());
+
+            double sum = 0.0;
+            double sumSquares = 0.0;
+            if constexpr (std::is_same_v<T, std::uint8_t>)
+            {
+                // 8-bit moments follow exactly from the histogram.
+                std::uint64_t s1 = 0;
+                std::uint64_t s2 = 0;
+                for (std::size_t v = 0; v < kBins; ++v)
+                {
+                    s1 += v * channel.histogram[v];
+                    s2 += v * v * channel.histogram[v];
+                }
+                sum = static_cast<double>(s1);
+                sumSquares = static_cast<double>(s2);
+                const auto first = std::find_if(channel.histogram.begin(), channel.histogram.end(), [](std::uint64_t c) { return c != 0; });
+                const auto last = std::find_if(channel.histogram.rbegin(), channel.histogram.rend(), [](std::uint64_t c) { return c != 0; });
+                channel.min = static_cast<double>(first - channel.histogram.begin());
+                channel.max = static_cast<double>(kBins - 1 - static_cast<std::size_t>(last - channel.histogram.rbegin()));
+            }
+            else
+            {
+                RowMoments total;
+                for (int y = 0; y < img.rows(); ++y)
+                {
+                    const RowMoments& m = moments[static_cast<std::size_t>(y) * ch + k];
+                    total.count += m.count;
+                    sum += m.sum;
+                    sumSquares += m.sumSquares;
+                    total.min = std::min(total.min, m.min);
+                    total.max = std::max(total.max, m.max);
+                }
+                if (total.count == 0)
+                {
+                    // Nothing but NaN: the channel keeps the zeros of an empty one.
+                    continue;
+                }
+                channel.min = total.min;
+                channel.max = total.max;
+                n = static_cast<double>(total.count);
+            }
+            channel.mean = sum / n;
+            channel.stddev = std::sqrt(std::max(0.0, sumSquares / n - channel.mean * channel.mean));
+        }
+    }
+}
+
+ImageStats compute_stats(const Image& img)
+{
+    IMG_PROFILE_SCOPE("compute_stats", profile_bytes(img));
+    ImageStats stats;
+    if (img.empty())
+    {
+        return stats;
+    }
+    if (img.isMirrored())
+    {
+        // Only the order of the pixels differs.
+        return compute_stats(img.flipH());
+    }
+    stats.pixels = static_cast<std::uint64_t>(img.rows()) * static_cast<std::uint64_t>(img.cols());
+    stats.channels.resize(static_cast<std::size_t>(img.channels()));
+    if (img.isPlanar())
+    {
+        // Every plane is a single-channel image of its own.
+        for (int k = 0; k < img.channels(); ++k)
+        {
+            stats.channels[static_cast<std::size_t>(k)] = compute_stats(img.plane(k)).channels[0];
+        }
+        return stats;
+    }
+    switch (img.depth())
+    {
+    case PixelDepth::U8:
+        collect<std::uint8_t>(img, stats);
+        break;
+    case PixelDepth::U16:
+        collect<std::uint16_t>(img, stats);
+        break;
+    case PixelDepth::F32:
+        collect<float>(img, stats);
+        break;
+    }
+    return stats;
+}
+
+Image equalize(const Image& src)
+{
+    IMG_PROFILE_SCOPE("equalize", profile_bytes(src));
+    if (src.empty() || src.depth() != PixelDepth::U8)
+    {
+        return Image();
+    }
+    if (src.isMirrored())
+    {
+        return equalize(src.unmirrored());
+    }
+
+    const ImageStats stats = compute_stats(src);
+    const std::size_t ch = static_cast<std::size_t>(src.channels());
+    std::vector<unsigned char> luts(ch * kBins);
+    for (std::size_t k = 0; k < ch; ++k)
+    {
+        const std::array<std::uint64_t, 256>& histogram = stats.channels[k].histogram;
+        unsigned char* lut = luts.data() + k * kBins;
+        const std::uint64_t cdfMin = *std::find_if(histogram.begin(), histogram.end(), [](std::uint64_t c) { return c != 0; });
+        const std::uint64_t range = stats.pixels - cdfMin;
+        std::uint64_t cdf = 0;
+        for (std::size_t v = 0; v < kBins; ++v)
+        {
+            cdf += histogram[v];
+            if (range == 0)
+            {
+                lut[v] = static_cast<unsigned char>(v);
+            }
+            else
+            {
+                // Values below the channel minimum never occur; the guard only keeps the subtraction defined.
+                const std::uint64_t above = cdf > cdfMin ? cdf - cdfMin : 0;
+                lut[v] = static_cast<unsigned char>((above * 255 + range / 2) / range);
+            }
+        }
+    }
+
+    const int cols = src.cols();
+    Image dst(src.rows(), cols, src.channels(), PixelDepth::U8, src.layout());
+    if (src.isPlanar())
+    {
+        for (std::size_t k = 0; k < ch; ++k)
+        {
+            const Image from = src.plane(static_cast<int>(k));
+            Image to = dst.plane(static_cast<int>(k));
+            const unsigned char* lut = luts.data() + k * kBins;
+            parallel_rows(src.rows(), static_cast<std::size_t>(cols), [&](int begin, int end)
+            {
+                for (int y = begin; y < end; ++y)
+                {
+                    const unsigned char* s = from.ptr(y);
+                    unsigned char* d = to.ptr(y);
+                    for (int x = 0; x < cols; ++x)
+                    {
+                        d[x] = lut[s[x]];
+                    }
+                }
+            });
+        }
+        return dst;
+    }
+    parallel_rows(src.rows(), static_cast<std::size_t>(cols) * ch, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; ++y)
+        {
+            const unsigned char* s = src.ptr(y);
+            unsigned char* d = dst.ptr(y);
+            for (int x = 0; x < cols; ++x)
+            {
+                for (std::size_t k = 0; k < ch; ++k)
+                {
+                    d[k] = luts[k * kBins + s[k]];
+                }
+                s += ch;
+                d += ch;
+            }
+        }
+    });
+    return dst;
+}
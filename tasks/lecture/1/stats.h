@@ -0,0 +1,31 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "Image.h"
+
+// Histogram bins cover the nominal range of the depth: 8-bit samples map one to one,
+// 16-bit samples by their high byte, float samples by round(clamp(v, 0, 1) * 255).
+// min/max/mean/stddev are in sample units (0..255, 0..65535 or raw floats).
+// NaN samples count in bin 0 but are left out of min/max/mean/stddev.
+struct ChannelStats
+{
+    std::array<std::uint64_t, 256> histogram{};
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;  // population
+};
+
+struct ImageStats
+{
+    std::uint64_t pixels = 0;
+    std::vector<ChannelStats> channels;
+};
+
+// One pass over the image (any depth, layout or ROI view); empty stats for an empty image.
+ImageStats compute_stats(const Image& img);
+
+// Per-channel histogram equalization of an 8-bit image; constant channels are kept as they are.
+// Returns an empty Image for an empty or non-8-bit source.
+Image equalize(const Image& src);
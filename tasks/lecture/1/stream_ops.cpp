@@ -0,0 +1,296 @@
+#include "stream_ops.h"
+#include "ops.h"
+#include "ppm_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace
+{
+    class StripReader
+    {
+    public:
+        bool open(const std::string& path)
+        {
+            ifs.open(path, std::ios::binary);
+            if (!ifs || !read_pnm_header(ifs, header) || header.ascii || header.maxval != 255)
+            {
+                return false;
+            }
+            payloadOffset = ifs.tellg();
+            nextRow = 0;
+            return payloadOffset > 0;
+        }
+
+        const PnmHeader& info() const
+        {
+            return header;
+        }
+
+        std::size_t rowBytes() const
+        {
+            return static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.channels);
+        }
+
+        bool seekRow(int row)
+        {
+            if (row == nextRow)
+            {
+                return true;
+            }
+            ifs.seekg(payloadOffset + static_cast<std::streamoff>(row) * static_cast<std::streamoff>(rowBytes()));
+            nextRow = row;
+            return static_cast<bool>(ifs);
+        }
+
+        // Reads the next `count` rows into `strip`, reusing its buffer when the shape allows.
+        bool readRows(Image& strip, int count)
+        {
+            strip.create(count, header.width, header.channels, 1);
+            if (strip.empty())
+            {
+                return false;
+            }
+            ifs.read(reinterpret_cast<char*>(strip.data()), static_cast<std::streamsize>(rowBytes() * static_cast<std::size_t>(count)));
+            nextRow += count;
+            return static_cast<bool>(ifs);
+        }
+
+    private:
+        std::ifstream ifs;
+        PnmHeader header;
+        std::streamoff payloadOffset = 0;
+        int nextRow = 0;
+    };
+
+    // Strips go to <path>.tmp<pid>-<n>, renamed over path by finish(): the output may be the very file
+    // StripReader is reading, and an unfinished stream leaves no partial file behind.
+    class StripWriter
+    {
+    public:
+        StripWriter() = default;
+        StripWriter(const StripWriter&) = delete;
+        StripWriter& operator=(const StripWriter&) = delete;
+
+        ~StripWriter()
+        {
+            if (!tempPath.empty())
+            {
+                ofs.close();
+                std::remove(tempPath.c_str());
+            }
+        }
+
+        bool open(const std::string& path, int cols, int rows, int channels)
+        {
+            static std::atomic<unsigned> counter{ 0 };
+#if defined(__unix__) || defined(__APPLE__)
+            const long process = static_cast<long>(::getpid());
+#else
+            const long process = 0;
+#endif
+            targetPath = path;
+            tempPath = path + ".tmp" + std::to_string(process) + "-" + std::to_string(counter++);
+            ofs.open(tempPath, std::ios::binary);
+            return ofs && write_pnm_header(ofs, cols, rows, channels);
+        }
+
+        bool writeRows(const Image& strip)
+        {
+            const std::size_t rowBytes = static_cast<std::size_t>(strip.cols()) * strip.elemSize();
+            if (strip.isContinuous())
+            {
+                ofs.write(reinterpret_cast<const char*>(strip.ptr(0)), static_cast<std::streamsize>(rowBytes * static_cast<std::size_t>(strip.rows())));
+            }
+            else
+            {
+                strip.forEachRow([&](const unsigned char* row, int)
+                {
+                    ofs.write(reinterpret_cast<const char*>(row), static_cast<std::streamsize>(rowBytes));
+                });
+            }
+            return static_cast<bool>(ofs);
+        }
+
+        bool finish()
+        {
+            ofs.close();
+            if (!ofs || std::rename(tempPath.c_str(), targetPath.c_str()) != 0)
+            {
+                return false;
+            }
+            tempPath.clear();
+            return true;
+        }
+
+    private:
+        std::ofstream ofs;
+        std::string targetPath;
+        std::string tempPath;
+    };
+
+    // Runs a row-local op (each output row depends only on the same input row) strip by strip.
+    template <typename Op>
+    bool stream_rowwise(const std::string& inPath, const std::string& outPath, int stripRows, int outChannels, Op op)
+    {
+        StripReader reader;
+        if (stripRows <= 0 || !reader.open(inPath))
+        {
+            return false;
+        }
+        const PnmHeader& info = reader.info();
+
+        StripWriter writer;
+        if (!writer.open(outPath, info.width, info.height, outChannels > 0 ? outChannels : info.channels))
+        {
+            return false;
+        }
+
+        Image strip;
+        for (int row = 0; row < info.height; row += stripRows)
+        {
+            const int count = std::min(stripRows, info.height - row);
+            if (!reader.readRows(strip, count) || !writer.writeRows(op(strip)))
+            {
+                return false;
+            }
+        }
+        return writer.finish();
+    }
+}
+
+bool stream_invert(const std::string& inPath, const std::string& outPath, int stripRows)
+{
+    return stream_rowwise(inPath, outPath, stripRows, 0, [](const Image& strip) { return invert(strip); });
+}
+
+bool stream_grayscale(const std::string& inPath, const std::string& outPath, int stripRows)
+{
+    return stream_rowwise(inPath, outPath, stripRows, 1, [](const Image& strip) { return to_grayscale(strip); });
+}
+
+bool stream_crop(const std::string& inPath, const std::string& outPath, int x, int y, int w, int h, int stripRows)
+{
+    StripReader reader;
+    if (stripRows <= 0 || w <= 0 || h <= 0 || !reader.open(inPath))
+    {
+        return false;
+    }
+    const PnmHeader& info = reader.info();
+
+    // Same bounds rules as crop(): negative origins are rejected, far edges are clamped.
+    if (x < 0 || y < 0)
+    {
+        return false;
+    }
+    const int x0 = x;
+    const int y0 = y;
+    const int x1 = std::min(x + w, info.width);
+    const int y1 = std::min(y + h, info.height);
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return false;
+    }
+
+    StripWriter writer;
+    if (!writer.open(outPath, x1 - x0, y1 - y0, info.channels) || !reader.seekRow(y0))
+    {
+        return false;
+    }
+
+    Image strip;
+    for (int row = y0; row < y1; row += stripRows)
+    {
+        const int count = std::min(stripRows, y1 - row);
+        if (!reader.readRows(strip, count) || !writer.writeRows(strip.colRange(Range(x0, x1))))
+        {
+            return false;
+        }
+    }
+    return writer.finish();
+}
+
+bool stream_resize_nearest(const std::string& inPath, const std::string& outPath, int newWidth, int newHeight, int stripRows)
+{
+    StripReader reader;
+    if (stripRows <= 0 || newWidth <= 0 || newHeight <= 0 || !reader.open(inPath))
+    {
+        return false;
+    }
+    const PnmHeader& info = reader.info();
+    const int srcW = info.width;
+    const int srcH = info.height;
+    const int ch   = info.channels;
+
+    StripWriter writer;
+    if (!writer.open(outPath, newWidth, newHeight, ch))
+    {
+        return false;
+    }
+
+    // Same mapping as resize_nearest, so the output is identical to the in-memory path.
+    const float scaleX = static_cast<float>(srcW) / static_cast<float>(newWidth);
+    const float scaleY = static_cast<float>(srcH) / static_cast<float>(newHeight);
+
+    std::vector<std::size_t> srcOffsets(static_cast<std::size_t>(newWidth));
+    for (int x = 0; x < newWidth; ++x)
+    {
+        int srcX = static_cast<int>(x * scaleX);
+        if (srcX >= srcW) srcX = srcW - 1;
+        srcOffsets[static_cast<std::size_t>(x)] = static_cast<std::size_t>(srcX) * static_cast<std::size_t>(ch);
+    }
+
+    // Only the source rows that some output row samples are read; the rest are skipped with a seek.
+    Image srcRow;
+    int loadedRow = -1;
+    Image strip;
+    for (int row = 0; row < newHeight; row += stripRows)
+    {
+        const int count = std::min(stripRows, newHeight - row);
+        strip.create(count, newWidth, ch);
+        if (strip.empty())
+        {
+            return false;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            int srcY = static_cast<int>((row + i) * scaleY);
+            if (srcY >= srcH) srcY = srcH - 1;
+
+            if (srcY != loadedRow)
+            {
+                if (!reader.seekRow(srcY) || !reader.readRows(srcRow, 1))
+                {
+                    return false;
+                }
+                loadedRow = srcY;
+            }
+
+            const unsigned char* s = srcRow.ptr(0);
+            unsigned char* d = strip.ptr(i);
+            for (int x = 0; x < newWidth; ++x)
+            {
+                const unsigned char* sp = s + srcOffsets[static_cast<std::size_t>(x)];
+                for (int k = 0; k < ch; ++k)
+                {
+                    d[k] = sp[k];
+                }
+                d += ch;
+            }
+        }
+
+        if (!writer.writeRows(strip))
+        {
+            return false;
+        }
+    }
+    return writer.finish();
+}
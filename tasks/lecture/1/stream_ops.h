@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+// Strip-based variants of the ops in ops.h: the PPM/PGM payload is read
+// stripRows rows at a time and written out in order, so peak memory is
+// bounded by the strip size instead of the image size.
+
+inline constexpr int kDefaultStripRows = 64;
+
+bool stream_invert(const std::string& inPath, const std::string& outPath, int stripRows = kDefaultStripRows);
+
+bool stream_grayscale(const std::string& inPath, const std::string& outPath, int stripRows = kDefaultStripRows);
+
+bool stream_crop(const std::string& inPath, const std::string& outPath,
+                 int x, int y, int w, int h, int stripRows = kDefaultStripRows);
+
+bool stream_resize_nearest(const std::string& inPath, const std::string& outPath,
+                           int newWidth, int newHeight, int stripRows = kDefaultStripRows);
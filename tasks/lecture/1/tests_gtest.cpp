@@ -1,6 +1,37 @@
 #include <gtest/gtest.h>
 #include "Image.h"
 #include "Range.h"
+#include "ops.h"
+#include "ppm_io.h"
+#include "simd_kernels.h"
+#include "stream_ops.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+#include "ImageAllocator.h"
+#include "resize.h"
+#include "batch.h"
+#include "filters.h"
+#include "stats.h"
+#include "color.h"
+#include "ImagePyramid.h"
+#include "ResultCache.h"
+#include "Profile.h"
+#include "lut.h"
+#include "composite.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+#include <vector>
 
 TEST(RangeTest, Basics)
 {
@@ -126,3 +157,2206 @@ TEST(ImageTest, ExternalBufferLifetime)
 
     EXPECT_EQ(external[0], 77);
 }
+
+namespace
+{
+    int releasedBuffers = 0;
+
+    void count_release(unsigned char*, std::size_t)
+    {
+        ++releasedBuffers;
+    }
+
+    class FailingAllocator : public ImageAllocator
+    {
+    public:
+        explicit FailingAllocator(bool throws)
+            : throws(throws)
+        {
+        }
+
+        unsigned char* allocate(std::size_t) override
+        {
+            if (throws)
+            {
+                throw std::bad_alloc();
+            }
+            return nullptr;
+        }
+
+        void deallocate(unsigned char*, std::size_t) override
+        {
+        }
+
+    private:
+        bool throws;
+    };
+}
+
+TEST(ImageTest, ExternalBufferIsReleasedWhenConstructionFails)
+{
+    unsigned char external[16] = {};
+    const Image::ExternalBuffer buffer{ external, sizeof(external), count_release };
+
+    releasedBuffers = 0;
+    {
+        Image adopted(4, 4, 1, external, buffer);
+        EXPECT_FALSE(adopted.empty());
+        EXPECT_EQ(releasedBuffers, 0);
+    }
+    EXPECT_EQ(releasedBuffers, 1);
+
+    EXPECT_TRUE(Image(0, 4, 1, external, buffer).empty());
+    EXPECT_EQ(releasedBuffers, 2);
+
+    FailingAllocator returnsNull(false);
+    Image::setDefaultAllocator(&returnsNull);
+    EXPECT_TRUE(Image(4, 4, 1, external, buffer).empty());
+    EXPECT_EQ(releasedBuffers, 3);
+
+    FailingAllocator throwing(true);
+    Image::setDefaultAllocator(&throwing);
+    EXPECT_THROW(Image(4, 4, 1, external, buffer), std::bad_alloc);
+    EXPECT_EQ(releasedBuffers, 4);
+    Image::setDefaultAllocator(nullptr);
+}
+
+TEST(SimdKernelsTest, EveryLevelMatchesScalar)
+{
+    const PixelKernels& scalar = kernels_for(SimdLevel::Scalar);
+    const int widths[] = { 1, 7, 17, 33, 64, 101 };
+
+    for (SimdLevel level : { SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512 })
+    {
+        if (!simd_level_supported(level))
+        {
+            continue;
+        }
+        const PixelKernels& kernels = kernels_for(level);
+        SCOPED_TRACE(simd_level_name(level));
+
+        for (int ch = 1; ch <= 5; ++ch)
+        {
+            for (int cols : widths)
+            {
+                std::vector<unsigned char> src(static_cast<std::size_t>(cols) * ch);
+                unsigned state = 12345u + static_cast<unsigned>(cols * 7 + ch);
+                for (unsigned char& v : src)
+                {
+                    state = state * 1103515245u + 12345u;
+                    v = static_cast<unsigned char>(state >> 16);
+                }
+
+                std::vector<unsigned char> expected(src.size()), actual(src.size());
+                scalar.invertRow(src.data(), expected.data(), src.size());
+                kernels.invertRow(src.data(), actual.data(), src.size());
+                EXPECT_EQ(expected, actual) << "invert ch=" << ch << " cols=" << cols;
+
+                const Lut table = make_lut([](int v) { return v * 37 + 11; });
+                scalar.lutRow(src.data(), expected.data(), src.size(), table.data());
+                kernels.lutRow(src.data(), actual.data(), src.size(), table.data());
+                EXPECT_EQ(expected, actual) << "lut ch=" << ch << " cols=" << cols;
+
+                std::vector<unsigned char> grayExpected(cols), grayActual(cols);
+                scalar.grayRow(src.data(), grayExpected.data(), cols, ch);
+                kernels.grayRow(src.data(), grayActual.data(), cols, ch);
+                EXPECT_EQ(grayExpected, grayActual) << "gray ch=" << ch << " cols=" << cols;
+
+                const std::size_t samples = src.size() / 2;
+                scalar.swapBytes16(src.data(), expected.data(), samples);
+                kernels.swapBytes16(src.data(), actual.data(), samples);
+                EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + 2 * samples, actual.begin()))
+                    << "swap16 ch=" << ch << " cols=" << cols;
+
+                // Three taps with the sample stride of an interleaved row, as the horizontal filter pass uses them.
+                const float weights[] = { 0.25f, -1.5f, 0.3f };
+                std::vector<float> floats(src.begin(), src.end());
+                const std::size_t count = cols > 2 ? floats.size() - 2 * static_cast<std::size_t>(ch) : 0;
+                std::vector<float> convExpected(count), convActual(count);
+                scalar.convolveF32(floats.data(), static_cast<std::size_t>(ch), weights, 3, convExpected.data(), count);
+                kernels.convolveF32(floats.data(), static_cast<std::size_t>(ch), weights, 3, convActual.data(), count);
+                EXPECT_EQ(convExpected, convActual) << "convolve ch=" << ch << " cols=" << cols;
+
+                std::vector<std::vector<unsigned char>> planesExpected(ch, std::vector<unsigned char>(cols));
+                std::vector<std::vector<unsigned char>> planesActual = planesExpected;
+                std::vector<unsigned char*> expectedPtrs, actualPtrs;
+                for (int k = 0; k < ch; ++k)
+                {
+                    expectedPtrs.push_back(planesExpected[k].data());
+                    actualPtrs.push_back(planesActual[k].data());
+                }
+                scalar.deinterleaveRow(src.data(), expectedPtrs.data(), cols, ch);
+                kernels.deinterleaveRow(src.data(), actualPtrs.data(), cols, ch);
+                EXPECT_EQ(planesExpected, planesActual) << "deinterleave ch=" << ch << " cols=" << cols;
+
+                std::vector<unsigned char> back(src.size());
+                kernels.interleaveRow(actualPtrs.data(), back.data(), cols, ch);
+                EXPECT_EQ(src, back) << "interleave ch=" << ch << " cols=" << cols;
+
+                if (ch >= 3)
+                {
+                    scalar.grayPlanarRow(expectedPtrs[0], expectedPtrs[1], expectedPtrs[2], grayExpected.data(), cols);
+                    kernels.grayPlanarRow(expectedPtrs[0], expectedPtrs[1], expectedPtrs[2], grayActual.data(), cols);
+                    EXPECT_EQ(grayExpected, grayActual) << "gray planar ch=" << ch << " cols=" << cols;
+                }
+
+                if (ch == 3 || ch == 4)
+                {
+                    // Mixed signs and a bias that pushes some results out of 0..255 to exercise the clamping.
+                    const short matrix[] = { 16384, -9000, 30000, -2000, 12000, 7000, 5000, -16000, -8000 };
+                    const int bias[] = { -200 << kColorMatrixShift, 8192, 300 << kColorMatrixShift };
+                    scalar.colorMatrixRow(src.data(), expected.data(), cols, ch, matrix, bias);
+                    kernels.colorMatrixRow(src.data(), actual.data(), cols, ch, matrix, bias);
+                    EXPECT_EQ(expected, actual) << "color matrix ch=" << ch << " cols=" << cols;
+                }
+
+                // Pixels of ch bytes, and of 2 * ch bytes over half as many pixels.
+                for (int pixelBytes : { ch, 2 * ch })
+                {
+                    const int pixels = static_cast<int>(src.size()) / pixelBytes;
+                    scalar.reverseRow(src.data(), expected.data(), pixels, static_cast<std::size_t>(pixelBytes));
+                    kernels.reverseRow(src.data(), actual.data(), pixels, static_cast<std::size_t>(pixelBytes));
+                    EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + pixels * pixelBytes, actual.begin()))
+                        << "reverse pixelBytes=" << pixelBytes << " cols=" << cols;
+                }
+
+                // Pixel pairs of src over those of a reversed copy; an odd last pixel is left out.
+                const std::vector<unsigned char> bottom(src.rbegin(), src.rend());
+                const int halfCols = cols / 2;
+                scalar.halveRow(src.data(), bottom.data(), expected.data(), halfCols, ch);
+                kernels.halveRow(src.data(), bottom.data(), actual.data(), halfCols, ch);
+                EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + halfCols * ch, actual.begin()))
+                    << "halve ch=" << ch << " cols=" << cols;
+
+                // Resampling weights of mixed sign that sum to one, over windows of 1 to 5 pixels; some sums fall
+                // outside 0..255 and saturate.
+                for (int taps = 1; taps <= std::min(cols, 5); taps += 2)
+                {
+                    std::vector<int> starts(static_cast<std::size_t>(cols));
+                    std::vector<std::int16_t> coefs(static_cast<std::size_t>(cols * taps));
+                    for (int x = 0; x < cols; ++x)
+                    {
+                        starts[static_cast<std::size_t>(x)] = (x * 7) % (cols - taps + 1);
+                        int rest = 1 << kResizeCoefBits;
+                        for (int t = 1; t < taps; ++t)
+                        {
+                            const int w = (x * 977 + t * 4099) % 9000 - 3000;
+                            coefs[static_cast<std::size_t>(x * taps + t)] = static_cast<std::int16_t>(w);
+                            rest -= w;
+                        }
+                        coefs[static_cast<std::size_t>(x * taps)] = static_cast<std::int16_t>(rest);
+                    }
+                    scalar.resizeRowH(src.data(), expected.data(), cols, ch, starts.data(), coefs.data(), taps);
+                    kernels.resizeRowH(src.data(), actual.data(), cols, ch, starts.data(), coefs.data(), taps);
+                    EXPECT_EQ(expected, actual) << "resize h ch=" << ch << " cols=" << cols << " taps=" << taps;
+
+                    std::vector<const unsigned char*> rows(static_cast<std::size_t>(taps), src.data());
+                    for (int t = 1; t < taps; t += 2)
+                    {
+                        rows[static_cast<std::size_t>(t)] = bottom.data();
+                    }
+                    scalar.resizeRowV(rows.data(), coefs.data(), taps, expected.data(), src.size());
+                    kernels.resizeRowV(rows.data(), coefs.data(), taps, actual.data(), src.size());
+                    EXPECT_EQ(expected, actual) << "resize v ch=" << ch << " cols=" << cols << " taps=" << taps;
+                }
+
+                // src pixels over the reversed bytes, onto destinations with and without alpha.
+                for (int dstCh : { ch - 1, ch })
+                {
+                    if ((ch != 2 && ch != 4) || dstCh == 0)
+                    {
+                        continue;
+                    }
+                    for (bool premultiplied : { false, true })
+                    {
+                        expected.assign(bottom.begin(), bottom.begin() + cols * dstCh);
+                        actual = expected;
+                        scalar.blendRow(src.data(), expected.data(), cols, ch, dstCh, premultiplied);
+                        kernels.blendRow(src.data(), actual.data(), cols, ch, dstCh, premultiplied);
+                        EXPECT_EQ(expected, actual) << "blend ch=" << ch << " dst=" << dstCh << " premultiplied="
+                                                    << premultiplied << " cols=" << cols;
+                    }
+                }
+            }
+        }
+
+        // Blocks with partial 8x8 tiles on both edges, read bottom-up through a negative step.
+        for (std::size_t elemBytes : { 1u, 2u, 3u, 4u, 8u, 12u })
+        {
+            const int rows = 21;
+            const int cols = 13;
+            const std::ptrdiff_t srcStep = static_cast<std::ptrdiff_t>(cols * elemBytes + 5);
+            const std::ptrdiff_t dstStep = static_cast<std::ptrdiff_t>(rows * elemBytes + 3);
+            std::vector<unsigned char> src(static_cast<std::size_t>(srcStep) * rows);
+            for (std::size_t i = 0; i < src.size(); ++i)
+            {
+                src[i] = static_cast<unsigned char>(i * 37 + elemBytes);
+            }
+            const unsigned char* lastRow = src.data() + (rows - 1) * srcStep;
+            std::vector<unsigned char> expected(static_cast<std::size_t>(dstStep) * cols), actual(expected.size());
+            scalar.transposeBlock(lastRow, -srcStep, expected.data(), dstStep, rows, cols, elemBytes);
+            kernels.transposeBlock(lastRow, -srcStep, actual.data(), dstStep, rows, cols, elemBytes);
+            for (int x = 0; x < cols; ++x)
+            {
+                for (int y = 0; y < rows; ++y)
+                {
+                    const unsigned char* want = lastRow - y * srcStep + x * elemBytes;
+                    ASSERT_TRUE(std::equal(want, want + elemBytes, expected.data() + x * dstStep + y * elemBytes));
+                    ASSERT_TRUE(std::equal(want, want + elemBytes, actual.data() + x * dstStep + y * elemBytes))
+                        << "transpose elemBytes=" << elemBytes << " x=" << x << " y=" << y;
+                }
+            }
+        }
+    }
+}
+
+TEST(OpsTest, InvertAndGrayOnRoi)
+{
+    Image base(4, 40, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>(i * 31);
+    }
+
+    Image roi = base(Range(1, 3), Range(5, 37));
+    Image inv = invert(roi);
+    Image gray = to_grayscale(roi);
+    ASSERT_EQ(inv.rows(), 2);
+    ASSERT_EQ(gray.cols(), 32);
+    ASSERT_EQ(gray.channels(), 1);
+
+    for (int i = 0; i < roi.total() * roi.channels(); ++i)
+    {
+        EXPECT_EQ(inv.at(i), 255 - roi.at(i));
+    }
+    for (int p = 0; p < roi.total(); ++p)
+    {
+        const int R = roi.at(p * 3), G = roi.at(p * 3 + 1), B = roi.at(p * 3 + 2);
+        const int Y = (R * kLumaR + G * kLumaG + B * kLumaB + (1 << (kLumaShift - 1))) >> kLumaShift;
+        EXPECT_EQ(gray.at(p), Y);
+    }
+}
+
+TEST(ImageTest, RowPointersAndContinuity)
+{
+    Image base(4, 6, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>(i);
+    }
+    EXPECT_TRUE(base.isContinuous());
+    EXPECT_EQ(base.step(), static_cast<std::ptrdiff_t>(18));
+    EXPECT_EQ(base.ptr(2), base.data() + 36);
+
+    Image roi = base(Range(1, 4), Range(2, 5));
+    EXPECT_FALSE(roi.isContinuous());
+    EXPECT_TRUE(roi.row(0).isContinuous());
+    EXPECT_EQ(roi.ptr(1), base.ptr<unsigned char>(2, 2));
+    EXPECT_EQ(*roi.ptr<unsigned char>(2, 1), base.at((3 * 6 + 3) * 3));
+
+    int rowsSeen = 0;
+    for (const unsigned char* row : static_cast<const Image&>(roi).rowPointers())
+    {
+        EXPECT_EQ(row, roi.ptr(rowsSeen));
+        ++rowsSeen;
+    }
+    EXPECT_EQ(rowsSeen, 3);
+
+    int pixels = 0;
+    roi.forEachPixel([&](unsigned char* px) { px[0] = 0; ++pixels; });
+    EXPECT_EQ(pixels, roi.total());
+    EXPECT_EQ(base.at((1 * 6 + 2) * 3), 0);
+    EXPECT_NE(base.at((1 * 6 + 1) * 3), 0);
+
+    Image deep = roi.clone();
+    EXPECT_TRUE(deep.isContinuous());
+    deep.forEachRow([&](const unsigned char* row, int y)
+    {
+        for (int k = 0; k < deep.cols() * deep.channels(); ++k)
+        {
+            EXPECT_EQ(row[k], roi.ptr(y)[k]);
+        }
+    });
+}
+
+TEST(OpsTest, ResizeNearestFromRoi)
+{
+    Image base(8, 8, 1);
+    for (int i = 0; i < 64; ++i)
+    {
+        base.at(i) = static_cast<unsigned char>(i);
+    }
+    Image roi = base(Range(2, 6), Range(4, 8));
+    Image up = resize_nearest(roi, 8, 8);
+    ASSERT_EQ(up.rows(), 8);
+    ASSERT_EQ(up.cols(), 8);
+    for (int y = 0; y < 8; ++y)
+    {
+        for (int x = 0; x < 8; ++x)
+        {
+            EXPECT_EQ(*up.ptr<unsigned char>(y, x), *roi.ptr<unsigned char>(y / 2, x / 2));
+        }
+    }
+}
+
+TEST(PpmIoTest, MappedLoadMatchesBufferedAndCopyOnWrite)
+{
+    const std::string path = ::testing::TempDir() + "mapped_load.ppm";
+    Image src(5, 7, 3);
+    for (int i = 0; i < src.total() * src.channels(); ++i)
+    {
+        src.at(i) = static_cast<unsigned char>(i * 3);
+    }
+    ASSERT_TRUE(save_image(path, src));
+
+    Image mapped;
+    ASSERT_TRUE(load_image_mapped(path, mapped));
+    EXPECT_EQ(mapped.rows(), 5);
+    EXPECT_EQ(mapped.cols(), 7);
+    EXPECT_EQ(mapped.channels(), 3);
+    EXPECT_EQ(mapped.countRef(), static_cast<std::size_t>(1));
+    for (int i = 0; i < src.total() * src.channels(); ++i)
+    {
+        EXPECT_EQ(mapped.at(i), src.at(i));
+    }
+
+    Image view = mapped(Range(1, 3), Range(2, 4));
+    EXPECT_EQ(view.countRef(), static_cast<std::size_t>(2));
+    mapped.release();
+    EXPECT_EQ(view.at(0), src.at((1 * 7 + 2) * 3));
+
+    Image cow;
+    ASSERT_TRUE(load_image_mapped(path, cow, MapMode::CopyOnWrite));
+    cow.at(0) = 200;
+    EXPECT_EQ(cow.at(0), 200);
+
+    Image reloaded;
+    ASSERT_TRUE(load_image(path, reloaded));
+    EXPECT_EQ(reloaded.at(0), src.at(0));
+}
+
+namespace
+{
+    bool same_pixels(const Image& a, const Image& b)
+    {
+        if (a.rows() != b.rows() || a.cols() != b.cols() || a.channels() != b.channels() || a.depth() != b.depth())
+        {
+            return false;
+        }
+        for (int i = 0; i < a.total() * static_cast<int>(a.elemSize()); ++i)
+        {
+            if (a.at(i) != b.at(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+TEST(StreamOpsTest, StripResultsMatchInMemoryOps)
+{
+    const std::string dir = ::testing::TempDir();
+    const std::string inPath = dir + "stream_in.ppm";
+    const std::string outPath = dir + "stream_out.ppm";
+
+    Image src(37, 23, 3);
+    for (int i = 0; i < src.total() * src.channels(); ++i)
+    {
+        src.at(i) = static_cast<unsigned char>(i * 7 + i / 5);
+    }
+    ASSERT_TRUE(save_image(inPath, src));
+
+    Image streamed;
+    ASSERT_TRUE(stream_invert(inPath, outPath, 5));
+    ASSERT_TRUE(load_image(outPath, streamed));
+    EXPECT_TRUE(same_pixels(streamed, invert(src)));
+
+    ASSERT_TRUE(stream_grayscale(inPath, outPath, 4));
+    ASSERT_TRUE(load_image(outPath, streamed));
+    EXPECT_TRUE(same_pixels(streamed, to_grayscale(src)));
+
+    ASSERT_TRUE(stream_crop(inPath, outPath, 3, 6, 15, 40, 7));
+    ASSERT_TRUE(load_image(outPath, streamed));
+    EXPECT_TRUE(same_pixels(streamed, crop(src, 3, 6, 15, 40)));
+    EXPECT_FALSE(stream_crop(inPath, outPath, 30, 0, 5, 5, 7));
+
+    for (const auto& size : { std::pair<int, int>{ 10, 9 }, std::pair<int, int>{ 50, 80 } })
+    {
+        ASSERT_TRUE(stream_resize_nearest(inPath, outPath, size.first, size.second, 3));
+        ASSERT_TRUE(load_image(outPath, streamed));
+        EXPECT_TRUE(same_pixels(streamed, resize_nearest(src, size.first, size.second)));
+    }
+
+    // The output may be the input itself: it is replaced only once the stream has completed.
+    const std::string selfPath = dir + "stream_self.ppm";
+    ASSERT_TRUE(save_image(selfPath, src));
+    ASSERT_TRUE(stream_invert(selfPath, selfPath, 16));
+    ASSERT_TRUE(load_image(selfPath, streamed));
+    EXPECT_TRUE(same_pixels(streamed, invert(src)));
+    EXPECT_FALSE(stream_crop(selfPath, selfPath, 30, 0, 5, 5, 7));
+    ASSERT_TRUE(load_image(selfPath, streamed));
+    EXPECT_TRUE(same_pixels(streamed, invert(src)));
+}
+
+TEST(ThreadPoolTest, ParallelForCoversEveryIndexOnce)
+{
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> hits(1000);
+    pool.parallelFor(1000, 7, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            hits[static_cast<std::size_t>(i)].fetch_add(1);
+        }
+    });
+    for (const std::atomic<int>& h : hits)
+    {
+        EXPECT_EQ(h.load(), 1);
+    }
+
+    std::atomic<int> inner{ 0 };
+    pool.parallelFor(8, 1, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            pool.parallelFor(10, 1, [&](int b, int e) { inner.fetch_add(e - b); });
+        }
+    });
+    EXPECT_EQ(inner.load(), 80);
+}
+
+TEST(ThreadPoolTest, OpsAreIdenticalForAnyThreadCount)
+{
+    Image src(203, 157, 3);
+    for (int i = 0; i < src.total() * src.channels(); ++i)
+    {
+        src.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 13);
+    }
+    Image roi = src(Range(3, 200), Range(5, 150));
+
+    ThreadPool::setSharedThreadCount(1);
+    const Image inv = invert(roi);
+    const Image gray = to_grayscale(roi);
+    const Image small = resize_nearest(roi, 61, 1000);
+    const Image cut = crop(src, 10, 20, 100, 150);
+
+    for (int threads : { 2, 3, 8 })
+    {
+        ThreadPool::setSharedThreadCount(threads);
+        EXPECT_TRUE(same_pixels(inv, invert(roi)));
+        EXPECT_TRUE(same_pixels(gray, to_grayscale(roi)));
+        EXPECT_TRUE(same_pixels(small, resize_nearest(roi, 61, 1000)));
+        EXPECT_TRUE(same_pixels(cut, crop(src, 10, 20, 100, 150)));
+    }
+    ThreadPool::setSharedThreadCount(0);
+}
+
+TEST(PipelineTest, FusedRunMatchesEagerOps)
+{
+    Image src(61, 83, 3);
+    for (int i = 0; i < src.total() * src.channels(); ++i)
+    {
+        src.at(i) = static_cast<unsigned char>((i * 40503u) >> 7);
+    }
+
+    Image eager = resize_nearest(to_grayscale(crop(src, 5, 7, 70, 50)), 33, 91);
+    Image fused = Pipeline().crop(5, 7, 70, 50).grayscale().resize(33, 91).run(src);
+    EXPECT_TRUE(same_pixels(eager, fused));
+
+    eager = invert(crop(resize_nearest(invert(src), 200, 40), 30, 3, 100, 30));
+    fused = Pipeline().invert().resize(200, 40).crop(30, 3, 100, 30).invert().run(src);
+    EXPECT_TRUE(same_pixels(eager, fused));
+
+    eager = invert(to_grayscale(invert(crop(src, 10, 10, 40, 40))));
+    fused = Pipeline().crop(10, 10, 40, 40).invert().grayscale().invert().grayscale().run(src);
+    EXPECT_TRUE(same_pixels(eager, fused));
+
+    EXPECT_TRUE(Pipeline().crop(100, 0, 10, 10).run(src).empty());
+    EXPECT_TRUE(Pipeline().crop(-1, 0, 10, 10).run(src).empty());
+}
+
+TEST(LutTest, TablesComposeAndRunInOnePass)
+{
+    static_assert(kInvertLut[0] == 255 && kInvertLut[200] == 55);
+    static_assert(lut_threshold(128)[127] == 0 && lut_threshold(128)[128] == 255);
+    static_assert(chain_luts(kInvertLut, kInvertLut) == kIdentityLut);
+    static_assert(lut_posterize(256) == kIdentityLut && lut_contrast(1.0) == kIdentityLut);
+
+    const Lut gamma = lut_gamma(2.2);
+    const Lut poster = lut_posterize(4);
+    for (int v = 0; v < 256; ++v)
+    {
+        const std::size_t i = static_cast<std::size_t>(v);
+        EXPECT_EQ(lut_brightness(-40)[i], std::max(v - 40, 0));
+        EXPECT_EQ(lut_contrast(2.0)[i], std::clamp(static_cast<int>(std::lround((v - 127.5) * 2.0 + 127.5)), 0, 255));
+        EXPECT_EQ(gamma[i], std::lround(255.0 * std::pow(v / 255.0, 1.0 / 2.2)));
+        EXPECT_EQ(poster[i], (v / 64) * 85);
+    }
+    EXPECT_EQ(lut_gamma(0.0), kIdentityLut);
+
+    // An ROI of a planar image, a mirrored view, and 16-bit sources for the byte-wise pass.
+    Image base(37, 29, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 40503u) >> 5);
+    }
+    const Lut chain = chain_luts(chain_luts(kInvertLut, gamma), lut_threshold(128));
+    for (const Image& src : { base, to_planar(base)(Range(3, 30), Range(2, 27)), base.flipH() })
+    {
+        const Image packed = src.unmirrored().clone();
+        const Image mapped = apply_lut(src, chain);
+        ASSERT_FALSE(mapped.empty());
+        EXPECT_EQ(mapped.layout(), src.layout());
+        for (int i = 0; i < packed.total() * packed.channels(); ++i)
+        {
+            ASSERT_EQ(mapped.at(i), chain[packed.at(i)]);
+        }
+        EXPECT_TRUE(same_pixels(apply_lut(src, kInvertLut), invert(src)));
+        EXPECT_TRUE(same_pixels(apply_lut(src, kIdentityLut), packed));
+    }
+    EXPECT_TRUE(apply_lut(Image(4, 4, 1, PixelDepth::U16), kInvertLut).empty());
+
+    // Point ops on both sides of a grayscale fuse into one table each.
+    Image eager = apply_lut(apply_lut(invert(base), gamma), lut_threshold(128));
+    Image fused = Pipeline().invert().gamma(2.2).threshold(128).run(base);
+    EXPECT_TRUE(same_pixels(eager, fused));
+
+    eager = apply_lut(to_grayscale(apply_lut(resize_nearest(base, 50, 20), lut_brightness(30))), poster);
+    fused = Pipeline().brightness(30).resize(50, 20).grayscale().posterize(4).run(base);
+    EXPECT_TRUE(same_pixels(eager, fused));
+
+    const Image planar = to_planar(base);
+    EXPECT_TRUE(same_pixels(Pipeline().contrast(1.5).invert().run(planar),
+                            to_planar(Pipeline().contrast(1.5).invert().run(base))));
+    EXPECT_TRUE(Pipeline().gamma(2.2).run(Image(4, 4, 1, PixelDepth::F32)).empty());
+}
+
+TEST(ImageTest, MoveLeavesSourceEmptyAndKeepsRefCount)
+{
+    static_assert(std::is_nothrow_move_constructible_v<Image>);
+    static_assert(std::is_nothrow_move_assignable_v<Image>);
+
+    Image a = Image::values(3, 3, 1, 4);
+    Image view = a.row(1);
+    const unsigned char* pixels = a.data();
+    EXPECT_EQ(a.countRef(), static_cast<std::size_t>(2));
+
+    Image b(std::move(a));
+    EXPECT_TRUE(a.empty());
+    EXPECT_EQ(a.countRef(), static_cast<std::size_t>(0));
+    EXPECT_EQ(b.data(), pixels);
+    EXPECT_EQ(b.countRef(), static_cast<std::size_t>(2));
+
+    Image c = Image::zeros(2, 2, 1);
+    c = std::move(b);
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(c.data(), pixels);
+    EXPECT_EQ(c.countRef(), static_cast<std::size_t>(2));
+
+    c = std::move(c);
+    EXPECT_EQ(c.data(), pixels);
+}
+
+TEST(ImageTest, ConcurrentCopiesAndViewsKeepRefCountExact)
+{
+    Image shared = Image::values(64, 64, 3, 1);
+    constexpr int kThreads = 8;
+    constexpr int kIterations = 20000;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&shared, t]()
+        {
+            for (int i = 0; i < kIterations; ++i)
+            {
+                Image copy = shared;
+                Image view = copy(Range(i % 32, 64), Range(t, 64));
+                Image moved = std::move(view);
+                Image other;
+                other = moved;
+                EXPECT_GE(other.countRef(), static_cast<std::size_t>(4));
+            }
+        });
+    }
+    for (std::thread& th : threads)
+    {
+        th.join();
+    }
+
+    EXPECT_EQ(shared.countRef(), static_cast<std::size_t>(1));
+}
+
+TEST(ImageAllocatorTest, PoolRecyclesBuffersAndControlBlocks)
+{
+    PoolAllocator pool;
+    Image::setDefaultAllocator(&pool);
+    {
+        Image first(100, 120, 3);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(first.data()) % ImageAllocator::kAlignment, 0u);
+        const unsigned char* pixels = first.data();
+        first.release();
+
+        PoolAllocator::Stats afterRelease = pool.stats();
+        EXPECT_EQ(afterRelease.misses, 2u);
+        EXPECT_EQ(afterRelease.blocksHeld, 2u);
+        EXPECT_GE(afterRelease.bytesHeld, static_cast<std::size_t>(100 * 120 * 3));
+
+        Image second(100, 120, 3);
+        EXPECT_EQ(second.data(), pixels);
+        EXPECT_EQ(pool.stats().hits, 2u);
+        EXPECT_EQ(pool.stats().blocksHeld, 0u);
+    }
+    Image::setDefaultAllocator(nullptr);
+    pool.trim();
+    EXPECT_EQ(pool.stats().bytesHeld, 0u);
+
+    EXPECT_EQ(PoolAllocator::sizeClass(1), 64u);
+    EXPECT_EQ(PoolAllocator::sizeClass(65), 80u);
+    EXPECT_EQ(PoolAllocator::sizeClass(1000), 1024u);
+    EXPECT_EQ(PoolAllocator::sizeClass(1025), 1280u);
+}
+
+TEST(ImageAllocatorTest, PaddedRowsWorkEverywhere)
+{
+    Image padded;
+    padded.create(9, 21, 3, 64);
+    ASSERT_FALSE(padded.empty());
+    EXPECT_EQ(padded.step(), 64);
+    EXPECT_FALSE(padded.isContinuous());
+    for (int y = 0; y < padded.rows(); ++y)
+    {
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(padded.ptr(y)) % 64, 0u);
+    }
+
+    Image packed(9, 21, 3);
+    for (int i = 0; i < packed.total() * packed.channels(); ++i)
+    {
+        packed.at(i) = static_cast<unsigned char>(i * 13);
+        padded.at(i) = packed.at(i);
+    }
+
+    EXPECT_TRUE(padded.clone().isContinuous());
+    EXPECT_TRUE(same_pixels(padded.clone(), packed));
+
+    Image::setDefaultRowAlignment(32);
+    EXPECT_TRUE(same_pixels(invert(padded), invert(packed)));
+    EXPECT_TRUE(same_pixels(to_grayscale(padded), to_grayscale(packed)));
+    EXPECT_TRUE(same_pixels(resize_nearest(padded, 40, 5), resize_nearest(packed, 40, 5)));
+    EXPECT_TRUE(same_pixels(crop(padded, 2, 3, 10, 4), crop(packed, 2, 3, 10, 4)));
+    EXPECT_EQ(invert(packed).step(), 64);
+    Image::setDefaultRowAlignment(1);
+}
+
+TEST(ResizeTest, KernelsKeepIdentityConstantsAndExactValues)
+{
+    const Interpolation kinds[] = { Interpolation::Bilinear, Interpolation::Area, Interpolation::Lanczos3 };
+    for (int ch : { 1, 3, 4 })
+    {
+        Image img(23, 37, ch);
+        Image flat(23, 37, ch);
+        for (int i = 0; i < img.total() * ch; ++i)
+        {
+            img.at(i) = static_cast<unsigned char>((i * 73 + i / 7) & 0xFF);
+            flat.at(i) = 77;
+        }
+        for (Interpolation kind : kinds)
+        {
+            EXPECT_TRUE(same_pixels(resize(img, 37, 23, kind), img));
+
+            Image scaled = resize(flat, 61, 9, kind);
+            ASSERT_EQ(scaled.cols(), 61);
+            ASSERT_EQ(scaled.rows(), 9);
+            for (int i = 0; i < scaled.total() * ch; ++i)
+            {
+                ASSERT_EQ(scaled.at(i), 77);
+            }
+        }
+
+        // 2x area downscale is the rounded average of pairs, first along rows, then along columns.
+        Image even(8, 12, ch);
+        for (int i = 0; i < even.total() * ch; ++i)
+        {
+            even.at(i) = static_cast<unsigned char>((i * 151) & 0xFF);
+        }
+        Image half = resize(even, 6, 4, Interpolation::Area);
+        ASSERT_EQ(half.cols(), 6);
+        for (int y = 0; y < 4; ++y)
+        {
+            for (int x = 0; x < 6; ++x)
+            {
+                for (int k = 0; k < ch; ++k)
+                {
+                    auto row = [&](int sy) { return (even.ptr<unsigned char>(sy, 2 * x)[k] + even.ptr<unsigned char>(sy, 2 * x + 1)[k] + 1) >> 1; };
+                    EXPECT_EQ(half.ptr<unsigned char>(y, x)[k], (row(2 * y) + row(2 * y + 1) + 1) >> 1);
+                }
+            }
+        }
+    }
+
+    Image ramp(1, 2, 1);
+    ramp.ptr<unsigned char>(0, 0)[0] = 0;
+    ramp.ptr<unsigned char>(0, 1)[0] = 255;
+    Image up = resize(ramp, 4, 1, Interpolation::Bilinear);
+    ASSERT_EQ(up.cols(), 4);
+    EXPECT_EQ(up.ptr<unsigned char>(0, 0)[0], 0);
+    EXPECT_EQ(up.ptr<unsigned char>(0, 1)[0], 64);
+    EXPECT_EQ(up.ptr<unsigned char>(0, 2)[0], 191);
+    EXPECT_EQ(up.ptr<unsigned char>(0, 3)[0], 255);
+
+    EXPECT_TRUE(resize(ramp, 0, 3, Interpolation::Lanczos3).empty());
+    EXPECT_TRUE(same_pixels(resize(ramp, 5, 3, Interpolation::Nearest), resize_nearest(ramp, 5, 3)));
+
+    // A 1000x area downscale along either axis stays within one level of the exact mean, even with
+    // a bright first pixel in every window where the weights' rounding error used to pile up.
+    Image wide(2, 3000, 4);
+    for (int i = 0; i < wide.total() * 4; ++i)
+    {
+        wide.at(i) = static_cast<unsigned char>((i / 4) % 1000 == 0 ? 255 : (i * 2654435761u) >> 27);
+    }
+    for (const Image& src : { wide, transpose(wide) })
+    {
+        const bool across = src.cols() == 3000;
+        const Image small = resize(src, across ? 3 : 2, across ? 2 : 3, Interpolation::Area);
+        for (int y = 0; y < small.rows(); ++y)
+        {
+            for (int x = 0; x < small.cols(); ++x)
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    double sum = 0.0;
+                    for (int j = 0; j < 1000; ++j)
+                    {
+                        sum += across ? src.ptr<unsigned char>(y, 1000 * x + j)[k] : src.ptr<unsigned char>(1000 * y + j, x)[k];
+                    }
+                    EXPECT_NEAR(small.ptr<unsigned char>(y, x)[k], sum / 1000, 1.0) << x << "," << y << "," << k;
+                }
+            }
+        }
+    }
+}
+
+TEST(ResizeTest, ResultDoesNotDependOnThreadCount)
+{
+    Image img(301, 257, 4);
+    for (int i = 0; i < img.total() * 4; ++i)
+    {
+        img.at(i) = static_cast<unsigned char>((i * 31 + i / 1000) & 0xFF);
+    }
+    Image roi = img(Range(3, 290), Range(5, 250));
+
+    ThreadPool::setSharedThreadCount(1);
+    const Image down = resize(roi, 100, 80, Interpolation::Lanczos3);
+    const Image up = resize(roi, 400, 500, Interpolation::Bilinear);
+    ThreadPool::setSharedThreadCount(4);
+    EXPECT_TRUE(same_pixels(resize(roi, 100, 80, Interpolation::Lanczos3), down));
+    EXPECT_TRUE(same_pixels(resize(roi, 400, 500, Interpolation::Bilinear), up));
+    ThreadPool::setSharedThreadCount(0);
+}
+
+TEST(BatchTest, ProcessesEveryInputAndReportsFailures)
+{
+    const std::string dir = ::testing::TempDir() + "batch_in";
+    const std::string out = ::testing::TempDir() + "batch_out";
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove_all(out);
+    std::filesystem::create_directories(dir);
+
+    std::vector<Image> sources;
+    for (int k = 0; k < 6; ++k)
+    {
+        Image img(10 + k, 12, 3);
+        for (int i = 0; i < img.total() * 3; ++i)
+        {
+            img.at(i) = static_cast<unsigned char>(i * 7 + k);
+        }
+        ASSERT_TRUE(save_image(dir + "/img" + std::to_string(k) + ".ppm", img));
+        sources.push_back(img);
+    }
+    std::ofstream(dir + "/broken.ppm") << "P6\n2 2\n255\n";
+    std::ofstream(dir + "/notes.txt") << "ignored";
+
+    std::vector<std::string> inputs;
+    ASSERT_TRUE(list_batch_inputs(dir, inputs));
+    ASSERT_EQ(inputs.size(), 7u);
+
+    const BatchReport report = run_batch(inputs, out, [](const Image& img) { return to_grayscale(img); }, 3);
+    EXPECT_EQ(report.succeeded, 6u);
+    ASSERT_EQ(report.failures.size(), 1u);
+    EXPECT_EQ(report.failures[0].path, dir + "/broken.ppm");
+    EXPECT_EQ(report.bytesRead, static_cast<std::uint64_t>((10 + 11 + 12 + 13 + 14 + 15) * 12 * 3));
+
+    for (int k = 0; k < 6; ++k)
+    {
+        Image result;
+        ASSERT_TRUE(load_image(batch_output_path(out, dir + "/img" + std::to_string(k) + ".ppm", 1), result));
+        EXPECT_TRUE(same_pixels(result, to_grayscale(sources[static_cast<std::size_t>(k)])));
+    }
+
+    const std::string manifest = ::testing::TempDir() + "batch_manifest.txt";
+    std::ofstream(manifest) << "# inputs\n" << inputs[0] << "\n\n  " << inputs[1] << "  \n";
+    ASSERT_TRUE(list_batch_inputs(manifest, inputs));
+    EXPECT_EQ(inputs.size(), 2u);
+    EXPECT_EQ(inputs[1], dir + "/img0.ppm");
+
+    // Inputs that would share an output name: same stem in one directory, same name in two.
+    std::filesystem::create_directories(dir + "/d1");
+    std::filesystem::create_directories(dir + "/d2");
+    ASSERT_TRUE(save_image(dir + "/d1/img0.ppm", sources[1]));
+    ASSERT_TRUE(save_image(dir + "/d2/img0.pgm", to_grayscale(sources[2])));
+    ASSERT_TRUE(save_image(dir + "/img1.pgm", to_grayscale(sources[3])));
+    std::filesystem::remove_all(out);
+    const std::vector<std::string> clashing = { dir + "/img0.ppm", dir + "/d1/img0.ppm", dir + "/img1.ppm",
+                                                dir + "/d2/img0.pgm", dir + "/img1.pgm" };
+    const BatchReport clashes = run_batch(clashing, out, [](const Image& img) { return invert(img); }, 2);
+    EXPECT_EQ(clashes.succeeded, 2u);
+    ASSERT_EQ(clashes.failures.size(), 3u);
+    EXPECT_EQ(clashes.failures[0].path, dir + "/d1/img0.ppm");
+    EXPECT_EQ(clashes.failures[0].reason, "output name collides with " + dir + "/img0.ppm");
+    EXPECT_EQ(clashes.failures[1].path, dir + "/d2/img0.pgm");
+    EXPECT_EQ(clashes.failures[2].path, dir + "/img1.pgm");
+    EXPECT_EQ(clashes.failures[2].reason, "output name collides with " + dir + "/img1.ppm");
+    Image result;
+    ASSERT_TRUE(load_image(batch_output_path(out, dir + "/img0.ppm", 3), result));
+    EXPECT_TRUE(same_pixels(result, invert(sources[0])));
+    ASSERT_TRUE(load_image(batch_output_path(out, dir + "/img1.ppm", 3), result));
+    EXPECT_TRUE(same_pixels(result, invert(sources[1])));
+    EXPECT_FALSE(std::filesystem::exists(batch_output_path(out, dir + "/img1.pgm", 1)));
+}
+
+TEST(PpmIoTest, SaveWritesViewsAndPaddedRowsWithoutCopies)
+{
+    const std::string path = ::testing::TempDir() + "save_view.ppm";
+    Image padded;
+    padded.create(40, 33, 3, 64);
+    for (int i = 0; i < padded.total() * 3; ++i)
+    {
+        padded.at(i) = static_cast<unsigned char>(i * 11 + 5);
+    }
+    const Image roi = padded(Range(3, 37), Range(2, 31));
+
+    for (const Image* img : { static_cast<const Image*>(&padded), &roi })
+    {
+        Image::bufferPool().resetStats();
+        ASSERT_TRUE(save_image(path, *img));
+        const PoolAllocator::Stats stats = Image::bufferPool().stats();
+        EXPECT_EQ(stats.hits + stats.misses, 0u);
+
+        Image loaded;
+        ASSERT_TRUE(load_image(path, loaded));
+        EXPECT_TRUE(same_pixels(loaded, *img));
+    }
+
+    SaveOptions options;
+    options.preallocate = true;
+    Image gray = to_grayscale(roi);
+    ASSERT_TRUE(save_image(path, gray, options));
+    Image loaded;
+    ASSERT_TRUE(load_image(path, loaded));
+    EXPECT_TRUE(same_pixels(loaded, gray));
+    EXPECT_EQ(std::filesystem::file_size(path), 13u + 34u * 29u);
+
+    EXPECT_FALSE(save_image(path, Image(2, 2, 5)));
+    EXPECT_FALSE(save_image(::testing::TempDir() + "missing_dir/x.ppm", gray));
+}
+
+TEST(PpmIoTest, SavingAMappedImageOverItsOwnFile)
+{
+    Image base(40, 70, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 24);
+    }
+    for (const char* name : { "self.ppm", "self.qoi" })
+    {
+        const std::string path = ::testing::TempDir() + name;
+        ASSERT_TRUE(save_image(path, base));
+
+        // The mapped pixels are still the old file while the new one is written.
+        Image mapped;
+        ASSERT_TRUE(load_image_mapped(path, mapped));
+        SaveOptions synced;
+        synced.sync = true;
+        ASSERT_TRUE(save_image(path, mapped(Range(5, 35), Range(10, 60)), synced));
+        Image reloaded;
+        ASSERT_TRUE(load_image(path, reloaded));
+        EXPECT_TRUE(same_pixels(reloaded, base(Range(5, 35), Range(10, 60)))) << name;
+
+        // A failed save leaves the file as it was and no temp file behind.
+        ASSERT_FALSE(save_image(path, Image(2, 2, 5)));
+        ASSERT_TRUE(load_image(path, reloaded));
+        EXPECT_EQ(reloaded.cols(), 50);
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(::testing::TempDir()))
+    {
+        EXPECT_EQ(entry.path().filename().string().find("self.ppm.tmp"), std::string::npos);
+    }
+
+    // A replaced file keeps its permissions, a symlink keeps pointing at it and a device is written in place.
+    namespace fs = std::filesystem;
+    const std::string path = ::testing::TempDir() + "self.ppm";
+    const std::string link = ::testing::TempDir() + "self_link.ppm";
+    fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    fs::remove(link);
+    fs::create_symlink(path, link);
+    ASSERT_TRUE(save_image(link, base));
+    EXPECT_TRUE(fs::is_symlink(fs::symlink_status(link)));
+    EXPECT_EQ(fs::status(path).permissions(), fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    Image reloaded;
+    ASSERT_TRUE(load_image(path, reloaded));
+    EXPECT_TRUE(same_pixels(reloaded, base));
+    if (fs::is_character_file("/dev/null"))
+    {
+        EXPECT_TRUE(save_image("/dev/null", base));
+        EXPECT_TRUE(fs::is_character_file("/dev/null"));
+    }
+}
+
+TEST(PpmIoTest, AsciiFormatsRoundTripAndRejectBadSamples)
+{
+    const std::string dir = ::testing::TempDir();
+
+    // Large enough that the buffered reader carries numbers across block boundaries.
+    Image color(600, 700, 3);
+    for (int i = 0; i < color.total() * 3; ++i)
+    {
+        color.at(i) = static_cast<unsigned char>((i * 37 + i / 701) & 0xFF);
+    }
+    const Image view = color(Range(5, 405), Range(17, 650));
+    SaveOptions ascii;
+    ascii.ascii = true;
+    for (const Image& img : { view, to_grayscale(view) })
+    {
+        const std::string path = dir + "ascii_roundtrip.pnm";
+        ASSERT_TRUE(save_image(path, img, ascii));
+        Image buffered, mapped;
+        ASSERT_TRUE(load_image(path, buffered));
+        ASSERT_TRUE(load_image_mapped(path, mapped));
+        EXPECT_TRUE(same_pixels(buffered, img));
+        EXPECT_TRUE(same_pixels(mapped, img));
+    }
+
+    const std::string commented = dir + "ascii_commented.pgm";
+    std::ofstream(commented) << "P2\n# scanner\n3 # width\n2\n255\n0 1 2\n\t253  254\n255\n";
+    Image small;
+    ASSERT_TRUE(load_image(commented, small));
+    ASSERT_EQ(small.cols(), 3);
+    ASSERT_EQ(small.rows(), 2);
+    for (int i = 0; i < 6; ++i)
+    {
+        EXPECT_EQ(small.at(i), i < 3 ? i : 250 + i);
+    }
+
+    const std::string outOfRange = dir + "ascii_bad.pgm";
+    std::ofstream(outOfRange) << "P2 2 1 255 12 256\n";
+    EXPECT_FALSE(load_image(outOfRange, small));
+    EXPECT_FALSE(load_image_mapped(outOfRange, small));
+
+    const std::string truncated = dir + "ascii_short.ppm";
+    std::ofstream(truncated) << "P3 2 1 255 1 2 3 4 5\n";
+    EXPECT_FALSE(load_image(truncated, small));
+    EXPECT_FALSE(load_image_mapped(truncated, small));
+
+    const std::string garbage = dir + "ascii_garbage.pgm";
+    std::ofstream(garbage) << "P2 2 1 255 12x 3\n";
+    EXPECT_FALSE(load_image(garbage, small));
+}
+
+TEST(DepthTest, SixteenBitAndFloatImagesThroughOpsAndPnm)
+{
+    Image wide(6, 5, 3, PixelDepth::U16);
+    ASSERT_EQ(wide.depth(), PixelDepth::U16);
+    EXPECT_EQ(wide.elemSize(), 6u);
+    EXPECT_EQ(wide.step(), 30);
+    for (int y = 0; y < 6; ++y)
+    {
+        for (int x = 0; x < 5; ++x)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                wide.ptr<std::uint16_t>(y, x)[k] = static_cast<std::uint16_t>(y * 10000 + x * 1000 + k * 300 + 7);
+            }
+        }
+    }
+
+    const Image view = wide(Range(1, 5), Range(2, 5));
+    EXPECT_EQ(view.depth(), PixelDepth::U16);
+    EXPECT_EQ(view.ptr<std::uint16_t>(0, 0)[1], wide.ptr<std::uint16_t>(1, 2)[1]);
+    EXPECT_EQ(view.clone().depth(), PixelDepth::U16);
+
+    const Image inv = invert(view);
+    const Image gray = to_grayscale(view);
+    ASSERT_EQ(gray.depth(), PixelDepth::U16);
+    for (int y = 0; y < view.rows(); ++y)
+    {
+        for (int x = 0; x < view.cols(); ++x)
+        {
+            const std::uint16_t* p = view.ptr<std::uint16_t>(y, x);
+            EXPECT_EQ(inv.ptr<std::uint16_t>(y, x)[2], 65535 - p[2]);
+            const unsigned luma = (p[0] * 9798u + p[1] * 19235u + p[2] * 3735u + 16384u) >> 15;
+            EXPECT_EQ(gray.ptr<std::uint16_t>(y, x)[0], luma);
+        }
+    }
+    EXPECT_TRUE(same_pixels(crop(wide, 2, 1, 3, 4), view.clone()));
+    EXPECT_TRUE(same_pixels(resize_nearest(view, 3, 4), view.clone()));
+    EXPECT_TRUE(same_pixels(Pipeline().crop(2, 1, 3, 4).invert().run(wide), inv));
+    EXPECT_TRUE(resize(view, 6, 8, Interpolation::Bilinear).empty());
+
+    const std::string dir = ::testing::TempDir();
+    SaveOptions ascii;
+    ascii.ascii = true;
+    for (const SaveOptions& options : { SaveOptions(), ascii })
+    {
+        const std::string path = dir + "wide.ppm";
+        ASSERT_TRUE(save_image(path, view, options));
+        Image buffered, mapped;
+        ASSERT_TRUE(load_image(path, buffered));
+        ASSERT_TRUE(load_image_mapped(path, mapped));
+        EXPECT_EQ(buffered.depth(), PixelDepth::U16);
+        EXPECT_TRUE(same_pixels(buffered, view));
+        EXPECT_TRUE(same_pixels(mapped, view));
+    }
+
+    // Big-endian payload with a 12-bit maxval is stretched to the full range.
+    const std::string twelveBit = dir + "twelve_bit.pgm";
+    {
+        std::ofstream ofs(twelveBit, std::ios::binary);
+        ofs << "P5\n3 1\n4095\n";
+        const unsigned char payload[] = { 0x00, 0x00, 0x08, 0x00, 0x0F, 0xFF };
+        ofs.write(reinterpret_cast<const char*>(payload), sizeof(payload));
+    }
+    for (bool useMapping : { false, true })
+    {
+        Image scan;
+        ASSERT_TRUE(useMapping ? load_image_mapped(twelveBit, scan) : load_image(twelveBit, scan));
+        ASSERT_EQ(scan.depth(), PixelDepth::U16);
+        EXPECT_EQ(scan.ptr<std::uint16_t>(0, 0)[0], 0);
+        EXPECT_EQ(scan.ptr<std::uint16_t>(0, 1)[0], 32776);
+        EXPECT_EQ(scan.ptr<std::uint16_t>(0, 2)[0], 65535);
+    }
+
+    Image unit(2, 3, 3, PixelDepth::F32);
+    for (int y = 0; y < 2; ++y)
+    {
+        for (int x = 0; x < 3; ++x)
+        {
+            float* p = unit.ptr<float>(y, x);
+            p[0] = 0.25f * x;
+            p[1] = 0.5f;
+            p[2] = 0.1f * y;
+        }
+    }
+    const Image unitGray = to_grayscale(unit);
+    ASSERT_EQ(unitGray.depth(), PixelDepth::F32);
+    EXPECT_FLOAT_EQ(unitGray.ptr<float>(1, 2)[0], 0.5f * 0.299f + 0.5f * 0.587f + 0.1f * 0.114f);
+    EXPECT_FLOAT_EQ(invert(unit).ptr<float>(0, 1)[0], 0.75f);
+    EXPECT_FALSE(save_image(dir + "float.ppm", unit));
+}
+
+TEST(FilterTest, KernelsMatchReferencesOnRoi)
+{
+    Image src(150, 300, 3);
+    for (int i = 0; i < src.total() * 3; ++i)
+    {
+        src.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 11);
+    }
+    // Wider than one tile, and the parent's pixels around it must not leak in.
+    Image roi = src(Range(4, 140), Range(7, 290));
+
+    EXPECT_TRUE(same_pixels(separable_filter(roi, { 1.0f }, { 0.0f, 1.0f, 0.0f }), roi.clone()));
+    EXPECT_TRUE(same_pixels(gaussian_blur(roi, 1.7), gaussian_blur(roi.clone(), 1.7)));
+
+    for (int radius : { 2, 5 })
+    {
+        Image blurred = box_blur(roi, radius, BorderMode::Reflect);
+        ASSERT_EQ(blurred.cols(), roi.cols());
+        const int area = (2 * radius + 1) * (2 * radius + 1);
+        for (int y = 0; y < roi.rows(); y += 9)
+        {
+            for (int x = 0; x < roi.cols(); x += 5)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    auto reflect = [](int i, int n) { return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i); };
+                    int sum = 0;
+                    for (int dy = -radius; dy <= radius; ++dy)
+                    {
+                        for (int dx = -radius; dx <= radius; ++dx)
+                        {
+                            sum += roi.ptr<unsigned char>(reflect(y + dy, roi.rows()), reflect(x + dx, roi.cols()))[k];
+                        }
+                    }
+                    ASSERT_EQ(blurred.ptr<unsigned char>(y, x)[k], (sum + area / 2) / area);
+                }
+            }
+        }
+    }
+
+    Image flat = Image::values(70, 90, 4, 123);
+    Image smooth = gaussian_blur(flat, 3.0, BorderMode::Replicate);
+    for (int i = 0; i < smooth.total() * 4; ++i)
+    {
+        ASSERT_EQ(smooth.at(i), 123);
+    }
+
+    Image gray(1, 1, 1);
+    EXPECT_TRUE(gaussian_blur(gray, 0.0).empty());
+    // Radii past 1024 are refused up front instead of allocating and running for ever.
+    EXPECT_EQ(gaussian_blur(gray, 1024 / 3.0).at(0), gray.at(0));
+    EXPECT_TRUE(gaussian_blur(gray, 341.5).empty());
+    EXPECT_TRUE(gaussian_blur(gray, 200000.0).empty());
+    EXPECT_TRUE(gaussian_blur(gray, 1e300).empty());
+    EXPECT_TRUE(unsharp_mask(gray, 200000.0, 1.0).empty());
+    EXPECT_TRUE(box_blur(gray, 1025).empty());
+    EXPECT_TRUE(separable_filter(gray, { 1.0f, 1.0f }, { 1.0f }).empty());
+    EXPECT_TRUE(box_blur(Image(4, 4, 1, PixelDepth::U16), 1).empty());
+}
+
+TEST(FilterTest, BordersSobelAndThreadCount)
+{
+    Image row(1, 5, 1);
+    for (int x = 0; x < 5; ++x)
+    {
+        row.ptr<unsigned char>(0, x)[0] = static_cast<unsigned char>(10 * (x + 1));
+    }
+    // out(x) = src(x - 1): the first pixel shows what the border supplies.
+    const std::vector<float> shift{ 1.0f, 0.0f, 0.0f };
+    EXPECT_EQ(separable_filter(row, shift, { 1.0f }, BorderMode::Zero).ptr<unsigned char>(0, 0)[0], 0);
+    EXPECT_EQ(separable_filter(row, shift, { 1.0f }, BorderMode::Replicate).ptr<unsigned char>(0, 0)[0], 10);
+    EXPECT_EQ(separable_filter(row, shift, { 1.0f }, BorderMode::Reflect).ptr<unsigned char>(0, 0)[0], 20);
+    EXPECT_EQ(separable_filter(row, shift, { 1.0f }, BorderMode::Reflect).ptr<unsigned char>(0, 4)[0], 40);
+
+    Image step = Image::zeros(20, 20, 1);
+    for (int y = 0; y < 20; ++y)
+    {
+        for (int x = 10; x < 20; ++x)
+        {
+            step.ptr<unsigned char>(y, x)[0] = 50;
+        }
+    }
+    Image edges = sobel(step);
+    EXPECT_EQ(edges.ptr<unsigned char>(5, 9)[0], 200);
+    EXPECT_EQ(edges.ptr<unsigned char>(5, 10)[0], 200);
+    EXPECT_EQ(edges.ptr<unsigned char>(5, 3)[0], 0);
+    EXPECT_EQ(edges.ptr<unsigned char>(0, 15)[0], 0);
+
+    Image img(277, 301, 3);
+    for (int i = 0; i < img.total() * 3; ++i)
+    {
+        img.at(i) = static_cast<unsigned char>((i * 31 + i / 1000) & 0xFF);
+    }
+    ThreadPool::setSharedThreadCount(1);
+    const Image blur = gaussian_blur(img, 2.0, BorderMode::Zero);
+    const Image box = box_blur(img, 3, BorderMode::Replicate);
+    const Image grad = sobel(img);
+    const Image sharp = unsharp_mask(img, 1.0, 1.5);
+    ThreadPool::setSharedThreadCount(4);
+    EXPECT_TRUE(same_pixels(gaussian_blur(img, 2.0, BorderMode::Zero), blur));
+    EXPECT_TRUE(same_pixels(box_blur(img, 3, BorderMode::Replicate), box));
+    EXPECT_TRUE(same_pixels(sobel(img), grad));
+    EXPECT_TRUE(same_pixels(unsharp_mask(img, 1.0, 1.5), sharp));
+    ThreadPool::setSharedThreadCount(0);
+
+    EXPECT_TRUE(same_pixels(unsharp_mask(img, 1.0, 0.0), img));
+}
+
+TEST(StatsTest, RoiStatsMatchBruteForceForEveryDepth)
+{
+    Image src(97, 131, 3);
+    for (int i = 0; i < src.total() * 3; ++i)
+    {
+        src.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 9);
+    }
+    Image roi = src(Range(5, 90), Range(11, 120));
+
+    ThreadPool::setSharedThreadCount(1);
+    const ImageStats single = compute_stats(roi);
+    ThreadPool::setSharedThreadCount(4);
+    const ImageStats stats = compute_stats(roi);
+    ThreadPool::setSharedThreadCount(0);
+
+    ASSERT_EQ(stats.channels.size(), 3u);
+    EXPECT_EQ(stats.pixels, static_cast<std::uint64_t>(roi.rows()) * roi.cols());
+    for (int k = 0; k < 3; ++k)
+    {
+        std::array<std::uint64_t, 256> histogram{};
+        double sum = 0.0, sumSquares = 0.0;
+        int lo = 255, hi = 0;
+        for (int y = 0; y < roi.rows(); ++y)
+        {
+            for (int x = 0; x < roi.cols(); ++x)
+            {
+                const int v = roi.ptr<unsigned char>(y, x)[k];
+                ++histogram[static_cast<std::size_t>(v)];
+                sum += v;
+                sumSquares += static_cast<double>(v) * v;
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+        }
+        const double n = static_cast<double>(stats.pixels);
+        const ChannelStats& c = stats.channels[static_cast<std::size_t>(k)];
+        EXPECT_EQ(c.histogram, histogram);
+        EXPECT_EQ(c.histogram, single.channels[static_cast<std::size_t>(k)].histogram);
+        EXPECT_EQ(c.min, lo);
+        EXPECT_EQ(c.max, hi);
+        EXPECT_NEAR(c.mean, sum / n, 1e-9);
+        EXPECT_NEAR(c.stddev, std::sqrt(sumSquares / n - (sum / n) * (sum / n)), 1e-6);
+    }
+
+    Image wide(2, 2, 1, PixelDepth::U16);
+    const std::uint16_t samples[] = { 0, 1000, 65535, 3000 };
+    for (int i = 0; i < 4; ++i)
+    {
+        wide.ptr<std::uint16_t>(i / 2, i % 2)[0] = samples[i];
+    }
+    const ImageStats wideStats = compute_stats(wide);
+    EXPECT_EQ(wideStats.channels[0].min, 0.0);
+    EXPECT_EQ(wideStats.channels[0].max, 65535.0);
+    EXPECT_DOUBLE_EQ(wideStats.channels[0].mean, 69535.0 / 4);
+    EXPECT_EQ(wideStats.channels[0].histogram[0], 1u);   // 0
+    EXPECT_EQ(wideStats.channels[0].histogram[3], 1u);   // 1000 >> 8
+    EXPECT_EQ(wideStats.channels[0].histogram[11], 1u);  // 3000 >> 8
+    EXPECT_EQ(wideStats.channels[0].histogram[255], 1u);
+
+    Image real(1, 2, 1, PixelDepth::F32);
+    real.ptr<float>(0, 0)[0] = -0.5f;
+    real.ptr<float>(0, 1)[0] = 0.5f;
+    const ImageStats realStats = compute_stats(real);
+    EXPECT_EQ(realStats.channels[0].min, -0.5);
+    EXPECT_DOUBLE_EQ(realStats.channels[0].stddev, 0.5);
+    EXPECT_EQ(realStats.channels[0].histogram[0], 1u);
+    EXPECT_EQ(realStats.channels[0].histogram[128], 1u);
+
+    // NaN samples land in bin 0 and stay out of the moments; an all-NaN channel reads as zeros.
+    Image holes(3, 5, 2, PixelDepth::F32);
+    for (int i = 0; i < 15; ++i)
+    {
+        float* p = holes.ptr<float>(i / 5, i % 5);
+        p[0] = i % 4 == 0 ? std::numeric_limits<float>::quiet_NaN() : 2.0f;
+        p[1] = std::numeric_limits<float>::quiet_NaN();
+    }
+    holes.ptr<float>(2, 4)[0] = -1.0f;
+    const ImageStats holeStats = compute_stats(holes);
+    EXPECT_EQ(holeStats.channels[0].histogram[0], 5u);
+    EXPECT_EQ(holeStats.channels[0].histogram[255], 10u);
+    EXPECT_EQ(holeStats.channels[0].min, -1.0);
+    EXPECT_EQ(holeStats.channels[0].max, 2.0);
+    EXPECT_DOUBLE_EQ(holeStats.channels[0].mean, (10 * 2.0 - 1.0) / 11);
+    EXPECT_EQ(holeStats.channels[1].histogram[0], 15u);
+    EXPECT_EQ(holeStats.channels[1].min, 0.0);
+    EXPECT_EQ(holeStats.channels[1].mean, 0.0);
+    EXPECT_EQ(holeStats.channels[1].stddev, 0.0);
+
+    EXPECT_TRUE(compute_stats(Image()).channels.empty());
+}
+
+TEST(StatsTest, EqualizeStretchesCdfAndKeepsConstantChannels)
+{
+    Image img(4, 8, 2);
+    for (int y = 0; y < 4; ++y)
+    {
+        for (int x = 0; x < 8; ++x)
+        {
+            img.ptr<unsigned char>(y, x)[0] = static_cast<unsigned char>(100 + (x / 2));  // four values, 8 pixels each
+            img.ptr<unsigned char>(y, x)[1] = 42;
+        }
+    }
+    Image roi = img(Range(1, 3), Range(0, 8));
+    Image out = equalize(roi);
+    ASSERT_EQ(out.rows(), 2);
+    // cdf = 4, 8, 12, 16 with cdfMin = 4: (cdf - 4) * 255 / 12, rounded.
+    const int expected[] = { 0, 85, 170, 255 };
+    for (int x = 0; x < 8; ++x)
+    {
+        EXPECT_EQ(out.ptr<unsigned char>(1, x)[0], expected[x / 2]);
+        EXPECT_EQ(out.ptr<unsigned char>(1, x)[1], 42);
+    }
+    EXPECT_TRUE(equalize(Image(2, 2, 1, PixelDepth::U16)).empty());
+}
+
+TEST(PlanarTest, LayoutConversionViewsAndRoi)
+{
+    Image base(6, 41, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>(i * 37 + 11);
+    }
+    Image roi = base(Range(1, 5), Range(3, 38));
+
+    Image planar = to_planar(roi);
+    ASSERT_TRUE(planar.isPlanar());
+    ASSERT_EQ(planar.channels(), 3);
+    EXPECT_TRUE(planar.isContinuous());
+    EXPECT_EQ(planar.planeStep(), static_cast<std::size_t>(planar.step()) * static_cast<std::size_t>(planar.rows()));
+    for (int y = 0; y < roi.rows(); ++y)
+    {
+        for (int x = 0; x < roi.cols(); ++x)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                ASSERT_EQ(planar.planePtr(k, y)[x], roi.ptr<unsigned char>(y, x)[k]);
+                ASSERT_EQ(planar.plane(k).ptr<unsigned char>(y, x)[0], roi.ptr<unsigned char>(y, x)[k]);
+            }
+        }
+    }
+    EXPECT_TRUE(same_pixels(to_interleaved(planar), roi));
+    EXPECT_TRUE(roi.plane(1).empty());
+
+    // A view into a planar image keeps all planes; writes through a plane view reach the parent.
+    Image planarRoi = planar(Range(1, 3), Range(4, 20));
+    ASSERT_TRUE(planarRoi.isPlanar());
+    EXPECT_FALSE(planarRoi.isContinuous());
+    EXPECT_TRUE(same_pixels(to_interleaved(planarRoi), roi(Range(1, 3), Range(4, 20))));
+    Image copy = planarRoi.clone();
+    EXPECT_TRUE(copy.isPlanar());
+    EXPECT_TRUE(same_pixels(to_interleaved(copy), to_interleaved(planarRoi)));
+    Image green = planarRoi.plane(1);
+    green.ptr<unsigned char>(0, 0)[0] = 7;
+    EXPECT_EQ(planar.planePtr(1, 1)[4], 7);
+    EXPECT_NE(copy.planePtr(1, 0)[0], 7);
+
+    Image wide = to_planar(to_interleaved(Image(3, 5, 2, PixelDepth::U16)));
+    EXPECT_EQ(wide.depth(), PixelDepth::U16);
+    EXPECT_TRUE(wide.isPlanar());
+
+    EXPECT_TRUE(merge_planes({ roi, roi }).empty());
+    EXPECT_TRUE(merge_planes({ to_grayscale(roi), Image(4, 34, 1) }).empty());
+    EXPECT_TRUE(merge_planes({ to_grayscale(roi), Image(4, 35, 1, PixelDepth::U16) }).empty());
+    Image merged = merge_planes({ planar.plane(2), planar.plane(0) });
+    ASSERT_EQ(merged.channels(), 2);
+    EXPECT_TRUE(same_pixels(merged.plane(0), planar.plane(2)));
+    EXPECT_TRUE(same_pixels(merged.plane(1), planar.plane(0)));
+}
+
+TEST(PlanarTest, OpsFiltersAndStatsMatchInterleaved)
+{
+    Image base(37, 53, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 7919) >> 3);
+    }
+    const Image roi = base(Range(2, 35), Range(1, 50));
+    const Image planar = to_planar(roi);
+
+    EXPECT_TRUE(same_pixels(to_interleaved(invert(planar)), invert(roi)));
+    EXPECT_TRUE(same_pixels(to_grayscale(planar), to_grayscale(roi)));
+    EXPECT_TRUE(same_pixels(to_interleaved(resize_nearest(planar, 20, 61)), resize_nearest(roi, 20, 61)));
+    EXPECT_TRUE(same_pixels(to_interleaved(crop(planar, 3, 4, 30, 20)), crop(roi, 3, 4, 30, 20)));
+    EXPECT_TRUE(same_pixels(to_interleaved(resize(planar, 31, 17, Interpolation::Bilinear)), resize(roi, 31, 17, Interpolation::Bilinear)));
+    EXPECT_TRUE(same_pixels(to_interleaved(gaussian_blur(planar, 1.5)), gaussian_blur(roi, 1.5)));
+    EXPECT_TRUE(same_pixels(to_interleaved(box_blur(planar, 3, BorderMode::Zero)), box_blur(roi, 3, BorderMode::Zero)));
+    EXPECT_TRUE(same_pixels(to_interleaved(sobel(planar)), sobel(roi)));
+    EXPECT_TRUE(same_pixels(to_interleaved(equalize(planar)), equalize(roi)));
+    EXPECT_TRUE(invert(planar).isPlanar());
+    EXPECT_TRUE(gaussian_blur(planar, 1.5).isPlanar());
+
+    const ImageStats a = compute_stats(planar);
+    const ImageStats b = compute_stats(roi);
+    ASSERT_EQ(a.channels.size(), b.channels.size());
+    for (std::size_t k = 0; k < a.channels.size(); ++k)
+    {
+        EXPECT_EQ(a.channels[k].histogram, b.channels[k].histogram);
+        EXPECT_DOUBLE_EQ(a.channels[k].mean, b.channels[k].mean);
+        EXPECT_DOUBLE_EQ(a.channels[k].stddev, b.channels[k].stddev);
+    }
+
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string planarPath = (dir / "planar_save_test.ppm").string();
+    const std::string packedPath = (dir / "packed_save_test.ppm").string();
+    ASSERT_TRUE(save_image(planarPath, planar));
+    ASSERT_TRUE(save_image(packedPath, roi));
+    Image fromPlanar, fromPacked;
+    ASSERT_TRUE(load_image(planarPath, fromPlanar));
+    ASSERT_TRUE(load_image(packedPath, fromPacked));
+    EXPECT_TRUE(same_pixels(fromPlanar, fromPacked));
+    std::filesystem::remove(planarPath);
+    std::filesystem::remove(packedPath);
+}
+
+TEST(ColorTest, ConversionsMatchFloatReferences)
+{
+    Image base(9, 70, 4);
+    unsigned state = 2024u;
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        state = state * 1103515245u + 12345u;
+        base.at(i) = static_cast<unsigned char>(state >> 16);
+    }
+    const Image roi = base(Range(1, 8), Range(3, 66));
+    Image rgb3(roi.rows(), roi.cols(), 3);
+    for (int y = 0; y < roi.rows(); ++y)
+    {
+        for (int x = 0; x < roi.cols(); ++x)
+        {
+            std::copy(roi.ptr<unsigned char>(y, x), roi.ptr<unsigned char>(y, x) + 3, rgb3.ptr<unsigned char>(y, x));
+        }
+    }
+
+    const double weights[2][2] = { { 0.299, 0.114 }, { 0.2126, 0.0722 } };
+    const ColorSpace spaces[2] = { ColorSpace::YCbCr601, ColorSpace::YCbCr709 };
+    for (int i = 0; i < 2; ++i)
+    {
+        for (const Image& src : { roi, rgb3 })
+        {
+            const Image ycc = convert_color(src, ColorSpace::SRGB, spaces[i]);
+            const Image back = convert_color(ycc, spaces[i], ColorSpace::SRGB);
+            ASSERT_EQ(ycc.channels(), src.channels());
+            const double kr = weights[i][0];
+            const double kb = weights[i][1];
+            for (int y = 0; y < src.rows(); ++y)
+            {
+                for (int x = 0; x < src.cols(); ++x)
+                {
+                    const unsigned char* p = src.ptr<unsigned char>(y, x);
+                    const unsigned char* q = ycc.ptr<unsigned char>(y, x);
+                    const double Y = kr * p[0] + (1.0 - kr - kb) * p[1] + kb * p[2];
+                    const double cb = std::clamp((p[2] - Y) / (2.0 - 2.0 * kb) + 128.0, 0.0, 255.0);
+                    const double cr = std::clamp((p[0] - Y) / (2.0 - 2.0 * kr) + 128.0, 0.0, 255.0);
+                    EXPECT_LE(std::abs(q[0] - Y), 0.51);
+                    EXPECT_LE(std::abs(q[1] - cb), 0.51);
+                    EXPECT_LE(std::abs(q[2] - cr), 0.51);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        EXPECT_LE(std::abs(back.ptr<unsigned char>(y, x)[k] - p[k]), 3) << "k=" << k;
+                    }
+                    if (src.channels() == 4)
+                    {
+                        EXPECT_EQ(q[3], p[3]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Primaries, grays and the hue wrap-around of HSV.
+    Image swatch(1, 5, 3);
+    const unsigned char colours[5][3] = { { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }, { 90, 90, 90 }, { 255, 0, 1 } };
+    const unsigned char hsv[5][3] = { { 0, 255, 255 }, { 85, 255, 255 }, { 171, 255, 255 }, { 0, 0, 90 }, { 0, 255, 255 } };
+    for (int x = 0; x < 5; ++x)
+    {
+        std::copy(colours[x], colours[x] + 3, swatch.ptr<unsigned char>(0, x));
+    }
+    const Image swatchHsv = convert_color(swatch, ColorSpace::SRGB, ColorSpace::HSV);
+    for (int x = 0; x < 5; ++x)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            EXPECT_EQ(swatchHsv.ptr<unsigned char>(0, x)[k], hsv[x][k]) << "x=" << x << " k=" << k;
+        }
+    }
+    const Image hsvBack = convert_color(convert_color(roi, ColorSpace::SRGB, ColorSpace::HSV), ColorSpace::HSV, ColorSpace::SRGB);
+    for (int i = 0; i < roi.total() * 4; ++i)
+    {
+        EXPECT_LE(std::abs(hsvBack.at(i) - roi.at(i)), 3) << i;
+    }
+
+    // Transfer tables against the formula, alpha untouched, and 16-bit depth.
+    const Image linear = convert_color(roi, ColorSpace::SRGB, ColorSpace::Linear);
+    for (int i = 0; i < roi.total() * 4; ++i)
+    {
+        const double v = roi.at(i) / 255.0;
+        const double l = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+        EXPECT_EQ(linear.at(i), i % 4 == 3 ? roi.at(i) : static_cast<int>(std::lround(l * 255.0)));
+    }
+    Image wide(2, 3, 1, PixelDepth::U16);
+    wide.ptr<std::uint16_t>(0, 0)[0] = 0;
+    wide.ptr<std::uint16_t>(0, 1)[0] = 32768;
+    wide.ptr<std::uint16_t>(0, 2)[0] = 65535;
+    const Image wideLinear = convert_color(wide, ColorSpace::SRGB, ColorSpace::Linear);
+    EXPECT_EQ(wideLinear.ptr<std::uint16_t>(0, 0)[0], 0);
+    EXPECT_EQ(wideLinear.ptr<std::uint16_t>(0, 1)[0], 14028);  // round(65535 * srgb_to_linear(32768 / 65535))
+    EXPECT_EQ(wideLinear.ptr<std::uint16_t>(0, 2)[0], 65535);
+    EXPECT_EQ(convert_color(convert_color(wide, ColorSpace::SRGB, ColorSpace::Linear), ColorSpace::Linear, ColorSpace::SRGB).ptr<std::uint16_t>(0, 2)[0], 65535);
+
+    // Planar sources give the same samples in planar layout; chained conversions go through sRGB.
+    const Image planar = to_planar(roi);
+    EXPECT_TRUE(same_pixels(to_interleaved(convert_color(planar, ColorSpace::SRGB, ColorSpace::YCbCr601)),
+                            convert_color(roi, ColorSpace::SRGB, ColorSpace::YCbCr601)));
+    EXPECT_TRUE(same_pixels(to_interleaved(convert_color(planar, ColorSpace::SRGB, ColorSpace::Linear)), linear));
+    EXPECT_TRUE(convert_color(planar, ColorSpace::SRGB, ColorSpace::HSV).isPlanar());
+    EXPECT_TRUE(same_pixels(convert_color(roi, ColorSpace::HSV, ColorSpace::YCbCr709),
+                            convert_color(convert_color(roi, ColorSpace::HSV, ColorSpace::SRGB), ColorSpace::SRGB, ColorSpace::YCbCr709)));
+
+    EXPECT_TRUE(convert_color(Image(2, 2, 2), ColorSpace::SRGB, ColorSpace::HSV).empty());
+    EXPECT_TRUE(convert_color(Image(2, 2, 3, PixelDepth::U16), ColorSpace::SRGB, ColorSpace::YCbCr601).empty());
+    EXPECT_TRUE(convert_color(Image(2, 2, 3, PixelDepth::F32), ColorSpace::SRGB, ColorSpace::Linear).empty());
+    ColorSpace parsed = ColorSpace::SRGB;
+    EXPECT_TRUE(parse_color_space("ycbcr709", parsed));
+    EXPECT_EQ(parsed, ColorSpace::YCbCr709);
+    EXPECT_FALSE(parse_color_space("lab", parsed));
+}
+
+TEST(PpmIoTest, QoiMatchesSpecAndRoundTrips)
+{
+    // One chunk of each kind, worked out by hand from the specification.
+    Image rgba(1, 5, 4);
+    const unsigned char pixels[5][4] = { { 0, 0, 0, 255 }, { 1, 0, 255, 255 }, { 10, 20, 30, 255 }, { 10, 20, 30, 128 }, { 1, 0, 255, 255 } };
+    for (int x = 0; x < 5; ++x)
+    {
+        std::copy(pixels[x], pixels[x] + 4, rgba.ptr<unsigned char>(0, x));
+    }
+    const std::string specPath = ::testing::TempDir() + "spec.QOI";
+    ASSERT_TRUE(save_image(specPath, rgba));
+    std::ifstream specFile(specPath, std::ios::binary);
+    const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(specFile)), std::istreambuf_iterator<char>());
+    const std::vector<unsigned char> expected = {
+        'q', 'o', 'i', 'f', 0, 0, 0, 5, 0, 0, 0, 1, 4, 0,
+        0xC0,                          // run of the initial opaque black
+        0x79,                          // diff +1, 0, -1
+        0xFE, 10, 20, 30,              // rgb
+        0xFF, 10, 20, 30, 128,         // rgba
+        0x31,                          // index of (1, 0, 255, 255)
+        0, 0, 0, 0, 0, 0, 0, 1 };
+    EXPECT_EQ(bytes, expected);
+    Image decoded;
+    ASSERT_TRUE(load_image(specPath, decoded));
+    EXPECT_TRUE(same_pixels(decoded, rgba));
+
+    // Smooth gradients, flat areas with runs longer than 62 that cross rows, and noise, read from an ROI.
+    for (int ch : { 3, 4 })
+    {
+        Image base(50, 90, ch);
+        for (int y = 0; y < base.rows(); ++y)
+        {
+            for (int x = 0; x < base.cols(); ++x)
+            {
+                unsigned char* p = base.ptr<unsigned char>(y, x);
+                for (int k = 0; k < ch; ++k)
+                {
+                    p[k] = y < 10 ? 77 : y < 30 ? static_cast<unsigned char>(x * 2 + y + k * 40)
+                                                : static_cast<unsigned char>((x * 7919 + y * 104729 + k * 31) >> 3);
+                }
+            }
+        }
+        const Image roi = base(Range(2, 48), Range(5, 85));
+        const std::string path = ::testing::TempDir() + "roundtrip" + std::to_string(ch) + ".qoi";
+        ASSERT_TRUE(save_image(path, roi));
+        Image buffered;
+        Image mapped;
+        ASSERT_TRUE(load_image(path, buffered));
+        ASSERT_TRUE(load_image_mapped(path, mapped));
+        EXPECT_TRUE(same_pixels(buffered, roi));
+        EXPECT_TRUE(same_pixels(mapped, roi));
+        EXPECT_LT(std::filesystem::file_size(path), static_cast<std::uintmax_t>(roi.total()) * static_cast<std::uintmax_t>(ch));
+
+        ASSERT_TRUE(save_image(path, to_planar(roi)));
+        ASSERT_TRUE(load_image(path, buffered));
+        EXPECT_TRUE(same_pixels(buffered, roi));
+    }
+
+    // A tall RGBA column that spills over the 1 MiB write block. The first block is filled up to
+    // 5 free bytes right before a row that flushes a carried-over run and then needs a 5-byte chunk.
+    {
+        constexpr int kRgbaRows = ((1 << 20) - 14 - 5 - 2) / 5;
+        Image column(kRgbaRows + 14, 1, 4);
+        for (int y = 0; y < kRgbaRows; ++y)
+        {
+            unsigned char* p = column.ptr<unsigned char>(y, 0);
+            p[0] = static_cast<unsigned char>(y);
+            p[1] = static_cast<unsigned char>(y >> 8);
+            p[2] = static_cast<unsigned char>(y >> 16);
+            p[3] = static_cast<unsigned char>(y % 2 == 0 ? 200 : 100);
+        }
+        for (int y = kRgbaRows; y < kRgbaRows + 3; ++y)
+        {
+            // Two one-byte chunks, then the start of a run.
+            std::copy_n(column.ptr<unsigned char>(y - 1, 0), 4, column.ptr<unsigned char>(y, 0));
+            column.ptr<unsigned char>(y, 0)[0] = static_cast<unsigned char>(column.ptr<unsigned char>(y, 0)[0] + (y < kRgbaRows + 2 ? 1 : 0));
+        }
+        for (int y = kRgbaRows + 3; y < column.rows(); ++y)
+        {
+            const unsigned char p[4] = { 1, 2, static_cast<unsigned char>(y), static_cast<unsigned char>(50 + y % 3) };
+            std::copy_n(p, 4, column.ptr<unsigned char>(y, 0));
+        }
+        const std::string path = ::testing::TempDir() + "column.qoi";
+        ASSERT_TRUE(save_image(path, column));
+        EXPECT_GT(std::filesystem::file_size(path), std::uintmax_t(1) << 20);
+        Image decoded;
+        ASSERT_TRUE(load_image(path, decoded));
+        EXPECT_TRUE(same_pixels(decoded, column));
+    }
+
+    // Unsupported images are refused; truncated or malformed files fail to load.
+    EXPECT_FALSE(save_image(::testing::TempDir() + "gray.qoi", Image(4, 4, 1)));
+    EXPECT_FALSE(save_image(::testing::TempDir() + "wide.qoi", Image(4, 4, 3, PixelDepth::U16)));
+    const std::string broken = ::testing::TempDir() + "broken.qoi";
+    std::ofstream(broken, std::ios::binary).write(reinterpret_cast<const char*>(expected.data()), 20);
+    Image img;
+    EXPECT_FALSE(load_image(broken, img));
+    EXPECT_FALSE(load_image_mapped(broken, img));
+    std::vector<unsigned char> badChannels = expected;
+    badChannels[12] = 2;
+    std::ofstream(broken, std::ios::binary).write(reinterpret_cast<const char*>(badChannels.data()), static_cast<std::streamsize>(badChannels.size()));
+    EXPECT_FALSE(load_image(broken, img));
+}
+
+TEST(PpmIoTest, PamCarriesAlphaChannels)
+{
+    // 2- and 4-channel images of both depths, saved from ROIs, come back through both loaders.
+    for (int ch : { 2, 4 })
+    {
+        for (PixelDepth depth : { PixelDepth::U8, PixelDepth::U16 })
+        {
+            Image base(23, 31, ch, depth);
+            for (int i = 0; i < base.total() * static_cast<int>(base.elemSize()); ++i)
+            {
+                base.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 23);
+            }
+            const Image roi = base(Range(1, 20), Range(3, 30));
+            const std::string path = ::testing::TempDir() + "alpha" + std::to_string(ch) + ".pam";
+            ASSERT_TRUE(save_image(path, roi));
+            Image buffered;
+            Image mapped;
+            ASSERT_TRUE(load_image(path, buffered));
+            ASSERT_TRUE(load_image_mapped(path, mapped));
+            EXPECT_TRUE(same_pixels(buffered, roi)) << "ch=" << ch;
+            EXPECT_TRUE(same_pixels(mapped, roi)) << "ch=" << ch;
+        }
+    }
+
+    std::ostringstream header;
+    ASSERT_TRUE(write_pnm_header(header, 640, 480, 4));
+    EXPECT_EQ(header.str(), "P7\nWIDTH 640\nHEIGHT 480\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n");
+    EXPECT_FALSE(write_pnm_header(header, 640, 480, 2, true));
+    SaveOptions ascii;
+    ascii.ascii = true;
+    EXPECT_FALSE(save_image(::testing::TempDir() + "plain.pam", Image(2, 2, 4), ascii));
+
+    // Fields in any order with comments; a header without DEPTH or ENDHDR is rejected.
+    std::istringstream commented("P7\n# made by hand\nDEPTH 2\nMAXVAL 65535 # wide\nHEIGHT 3\nWIDTH 5\nTUPLTYPE GRAYSCALE_ALPHA\nENDHDR\nxyz");
+    PnmHeader parsed;
+    ASSERT_TRUE(read_pnm_header(commented, parsed));
+    EXPECT_EQ(parsed.width, 5);
+    EXPECT_EQ(parsed.height, 3);
+    EXPECT_EQ(parsed.channels, 2);
+    EXPECT_EQ(parsed.maxval, 65535);
+    EXPECT_EQ(commented.get(), 'x');
+    for (const char* bad : { "P7\nWIDTH 5\nHEIGHT 3\nMAXVAL 255\nENDHDR\n", "P7\nWIDTH 5\nHEIGHT 3\nDEPTH 3\nMAXVAL 255\n",
+                             "P7\nWIDTH 5\nHEIGHT 3\nDEPTH 5\nMAXVAL 255\nENDHDR\n", "P7\nWIDTH 5\nHEIGHT 3\nDEPTH 1\nSIZE 9\nENDHDR\n" })
+    {
+        std::istringstream is(bad);
+        EXPECT_FALSE(read_pnm_header(is, parsed)) << bad;
+    }
+}
+
+TEST(GeometryTest, FlipViewsTransposeAndRotations)
+{
+    Image base(70, 131, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 24);
+    }
+    const Image roi = base(Range(3, 68), Range(2, 129));
+    const int rows = roi.rows();
+    const int cols = roi.cols();
+
+    // Flips share the pixels and only change the walk.
+    const Image h = roi.flipH();
+    const Image v = roi.flipV();
+    EXPECT_EQ(h.countRef(), base.countRef());
+    EXPECT_TRUE(h.isMirrored());
+    EXPECT_FALSE(v.isMirrored());
+    EXPECT_FALSE(h.isContinuous());
+    EXPECT_EQ(h.pixelStep(), -roi.pixelStep());
+    EXPECT_EQ(v.step(), -roi.step());
+    EXPECT_EQ(h.ptr<unsigned char>(4, 0), roi.ptr<unsigned char>(4, cols - 1));
+    EXPECT_EQ(v.ptr(0), roi.ptr(rows - 1));
+    EXPECT_EQ(h.flipH().ptr<unsigned char>(4, 9), roi.ptr<unsigned char>(4, 9));
+    EXPECT_EQ(h(Range(1, 5), Range(2, 6)).ptr<unsigned char>(0, 0), roi.ptr<unsigned char>(1, cols - 3));
+    EXPECT_EQ(h.at(5 * cols * 3 + 7 * 3 + 2), roi.ptr<unsigned char>(5, cols - 8)[2]);
+    int pixels = 0;
+    h.forEachPixel([&](const unsigned char*) { ++pixels; });
+    EXPECT_EQ(pixels, roi.total());
+
+    Image hExpected(rows, cols, 3), vExpected(rows, cols, 3);
+    for (int y = 0; y < rows; ++y)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            std::copy_n(roi.ptr<unsigned char>(y, cols - 1 - x), 3, hExpected.ptr<unsigned char>(y, x));
+            std::copy_n(roi.ptr<unsigned char>(rows - 1 - y, x), 3, vExpected.ptr<unsigned char>(y, x));
+        }
+    }
+    EXPECT_TRUE(same_pixels(h.clone(), hExpected));
+    EXPECT_TRUE(h.clone().isContinuous());
+    EXPECT_TRUE(same_pixels(v.clone(), vExpected));
+    EXPECT_TRUE(same_pixels(crop(h, 4, 5, 40, 30), crop(hExpected, 4, 5, 40, 30)));
+
+    // Every op sees a mirrored source the same as its copy.
+    EXPECT_TRUE(same_pixels(invert(h), invert(hExpected)));
+    EXPECT_TRUE(same_pixels(to_grayscale(h), to_grayscale(hExpected)));
+    EXPECT_TRUE(same_pixels(to_grayscale(v), to_grayscale(vExpected)));
+    EXPECT_TRUE(same_pixels(resize(h, 50, 41, Interpolation::Bilinear), resize(hExpected, 50, 41, Interpolation::Bilinear)));
+    EXPECT_TRUE(same_pixels(gaussian_blur(h, 1.2), gaussian_blur(hExpected, 1.2)));
+    EXPECT_TRUE(same_pixels(box_blur(v, 2), box_blur(vExpected, 2)));
+    EXPECT_TRUE(same_pixels(equalize(h), equalize(hExpected)));
+    EXPECT_TRUE(same_pixels(convert_color(h, ColorSpace::SRGB, ColorSpace::HSV), convert_color(hExpected, ColorSpace::SRGB, ColorSpace::HSV)));
+    EXPECT_TRUE(same_pixels(to_interleaved(to_planar(h)), hExpected));
+    EXPECT_TRUE(same_pixels(Pipeline().crop(3, 2, 60, 50).grayscale().run(h), Pipeline().crop(3, 2, 60, 50).grayscale().run(hExpected)));
+    EXPECT_EQ(compute_stats(h).channels[1].histogram, compute_stats(hExpected).channels[1].histogram);
+    for (const Image& flipped : { h, v })
+    {
+        const std::string path = ::testing::TempDir() + "flipped.ppm";
+        ASSERT_TRUE(save_image(path, flipped));
+        Image loaded;
+        ASSERT_TRUE(load_image(path, loaded));
+        EXPECT_TRUE(same_pixels(loaded, flipped.clone()));
+    }
+    {
+        // "imgtool flip x.ppm v x.ppm": the flipped view walks the mapping of the file being replaced.
+        const std::string path = ::testing::TempDir() + "flip_self.ppm";
+        ASSERT_TRUE(save_image(path, roi));
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            Image mapped;
+            ASSERT_TRUE(load_image_mapped(path, mapped));
+            ASSERT_TRUE(save_image(path, pass == 0 ? mapped.flipV() : mapped.flipH()));
+        }
+        Image loaded;
+        ASSERT_TRUE(load_image(path, loaded));
+        EXPECT_TRUE(same_pixels(loaded, vExpected.flipH().clone()));
+    }
+
+    // Element sizes 1 to 16 bytes, planar images and a mirrored source, on any thread count.
+    auto check_transpose = [](const Image& src, const Image& dst, bool rotate)
+    {
+        ASSERT_EQ(dst.rows(), src.cols());
+        ASSERT_EQ(dst.cols(), src.rows());
+        const int planes = src.isPlanar() ? src.channels() : 1;
+        const std::size_t bytes = src.isPlanar() ? src.elemSize1() : src.elemSize();
+        for (int k = 0; k < planes; ++k)
+        {
+            const Image from = src.isPlanar() ? src.plane(k) : src;
+            const Image to = dst.isPlanar() ? dst.plane(k) : dst;
+            for (int y = 0; y < to.rows(); ++y)
+            {
+                for (int x = 0; x < to.cols(); ++x)
+                {
+                    // rotate90: (x, y) comes from (y, rows - 1 - x).
+                    const unsigned char* want = from.ptr<unsigned char>(rotate ? from.rows() - 1 - x : x, y);
+                    ASSERT_TRUE(std::equal(want, want + bytes, to.ptr<unsigned char>(y, x))) << "x=" << x << " y=" << y;
+                }
+            }
+        }
+    };
+    ThreadPool::setSharedThreadCount(3);
+    check_transpose(roi, transpose(roi), false);
+    check_transpose(roi, rotate90(roi), true);
+    check_transpose(h, transpose(h), false);
+    check_transpose(to_planar(roi), transpose(to_planar(roi)), false);
+    for (int ch : { 1, 2, 4 })
+    {
+        for (PixelDepth depth : { PixelDepth::U8, PixelDepth::U16, PixelDepth::F32 })
+        {
+            Image img(45, 77, ch, depth);
+            for (int i = 0; i < img.total() * static_cast<int>(img.elemSize()); ++i)
+            {
+                img.at(i) = static_cast<unsigned char>(i * 31 + ch);
+            }
+            SCOPED_TRACE(img.elemSize());
+            check_transpose(img, transpose(img), false);
+            check_transpose(img, rotate90(img), true);
+        }
+    }
+    ThreadPool::setSharedThreadCount(0);
+
+    // Rotations compose: 180 = 90 twice, 270 = 90 three times and four quarter turns are the identity.
+    EXPECT_TRUE(same_pixels(rotate180(roi), rotate90(rotate90(roi))));
+    EXPECT_TRUE(same_pixels(rotate180(roi), hExpected.flipV().clone()));
+    EXPECT_TRUE(same_pixels(rotate270(roi), rotate90(rotate180(roi))));
+    EXPECT_TRUE(same_pixels(rotate90(rotate270(roi)), roi));
+    EXPECT_TRUE(same_pixels(transpose(transpose(roi)), roi));
+    EXPECT_TRUE(rotate270(to_planar(roi)).isPlanar());
+    EXPECT_TRUE(same_pixels(to_interleaved(rotate270(to_planar(roi))), rotate270(roi)));
+    EXPECT_TRUE(transpose(Image()).empty());
+    EXPECT_TRUE(Image().flipH().empty());
+}
+
+TEST(PyramidTest, LevelsAreSharedBoxAverages)
+{
+    Image base(77, 140, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 24);
+    }
+    const Image roi = base(Range(2, 75), Range(1, 139));
+
+    ImagePyramid pyramid(roi);
+    ASSERT_EQ(pyramid.levelCount(), 7);
+    EXPECT_TRUE(pyramid.level(7).empty());
+    EXPECT_EQ(pyramid.level(0).ptr(0), roi.ptr(0));
+    EXPECT_EQ(base.countRef(), 3u);
+
+    // Each level is the 2x2 average of the one above, odd edges dropped.
+    for (int k = 1; k < pyramid.levelCount(); ++k)
+    {
+        const Image up = pyramid.level(k - 1);
+        const Image level = pyramid.level(k);
+        ASSERT_EQ(level.rows(), up.rows() / 2);
+        ASSERT_EQ(level.cols(), up.cols() / 2);
+        for (int y = 0; y < level.rows(); ++y)
+        {
+            for (int x = 0; x < level.cols(); ++x)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    const int sum = up.ptr<unsigned char>(2 * y, 2 * x)[c] + up.ptr<unsigned char>(2 * y, 2 * x + 1)[c] +
+                                    up.ptr<unsigned char>(2 * y + 1, 2 * x)[c] + up.ptr<unsigned char>(2 * y + 1, 2 * x + 1)[c];
+                    ASSERT_EQ(level.ptr<unsigned char>(y, x)[c], (sum + 2) >> 2) << "k=" << k << " x=" << x << " y=" << y;
+                }
+            }
+        }
+    }
+    EXPECT_EQ(pyramid.level(6).rows(), 1);
+    EXPECT_EQ(pyramid.level(6).cols(), 2);
+
+    // Levels are built once and handed out as views.
+    const Image first = pyramid.level(2);
+    EXPECT_EQ(pyramid.level(2).ptr(0), first.ptr(0));
+    EXPECT_EQ(first.countRef(), 2u);
+
+    // resize starts from the smallest level covering the target.
+    EXPECT_TRUE(same_pixels(pyramid.resize(30, 16), resize_nearest(pyramid.level(2), 30, 16)));
+    EXPECT_TRUE(same_pixels(pyramid.resize(35, 18, Interpolation::Bilinear), resize(pyramid.level(1), 35, 18, Interpolation::Bilinear)));
+    EXPECT_TRUE(same_pixels(pyramid.resize(200, 90, Interpolation::Bilinear), resize(roi, 200, 90, Interpolation::Bilinear)));
+    const Image exact = pyramid.resize(34, 18);
+    EXPECT_TRUE(same_pixels(exact, pyramid.level(2)));
+    EXPECT_NE(exact.ptr(0), pyramid.level(2).ptr(0));
+    EXPECT_TRUE(pyramid.resize(0, 5).empty());
+
+    // Concurrent first use builds every level once.
+    ImagePyramid shared(roi);
+    std::vector<std::thread> threads;
+    std::vector<Image> results(4);
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t] { results[static_cast<std::size_t>(t)] = shared.resize(20 + t, 10); });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < 4; ++t)
+    {
+        EXPECT_TRUE(same_pixels(results[static_cast<std::size_t>(t)], resize_nearest(pyramid.level(2), 20 + t, 10)));
+    }
+
+    // Other depths, planar images and mirrored sources.
+    for (PixelDepth depth : { PixelDepth::U16, PixelDepth::F32 })
+    {
+        Image img(9, 6, 2, depth);
+        for (int i = 0; i < img.total() * 2; ++i)
+        {
+            if (depth == PixelDepth::U16)
+                img.ptr<std::uint16_t>(0, 0)[i] = static_cast<std::uint16_t>(i * 997);
+            else
+                img.ptr<float>(0, 0)[i] = static_cast<float>(i) * 0.5f;
+        }
+        const Image half = ImagePyramid(img).level(1);
+        ASSERT_EQ(half.rows(), 4);
+        ASSERT_EQ(half.cols(), 3);
+        if (depth == PixelDepth::U16)
+        {
+            const int sum = 0 + 2 + 12 + 14;
+            EXPECT_EQ(half.ptr<std::uint16_t>(0, 0)[0], (sum * 997 + 2) >> 2);
+        }
+        else
+        {
+            EXPECT_FLOAT_EQ(half.ptr<float>(1, 2)[1], 0.25f * (33 + 35 + 45 + 47) * 0.5f);
+        }
+    }
+    EXPECT_TRUE(same_pixels(to_interleaved(ImagePyramid(to_planar(roi)).level(3)), pyramid.level(3)));
+    EXPECT_TRUE(same_pixels(ImagePyramid(roi.flipH()).level(2), ImagePyramid(roi.flipH().clone()).level(2)));
+}
+
+TEST(ResultCacheTest, KeysHitsEvictionAndBatch)
+{
+    // XXH64 reference values; the second input covers the 32-byte stripes.
+    EXPECT_EQ(hash_bytes("", 0), 0xEF46DB3751D8E999ull);
+    EXPECT_EQ(hash_bytes("abc", 3), 0x44BC2CF5AD770999ull);
+    const std::string sentence = "Nobody inspects the spammish repetition";
+    EXPECT_EQ(hash_bytes(sentence.data(), sentence.size()), 0xFBCEA83C8A378BF1ull);
+
+    const std::string dir = ::testing::TempDir() + "cache_in";
+    const std::string cacheDir = ::testing::TempDir() + "cache_entries";
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove_all(cacheDir);
+    std::filesystem::remove_all(cacheDir + "_small");
+    std::filesystem::create_directories(dir);
+
+    std::vector<std::string> inputs;
+    for (int k = 0; k < 4; ++k)
+    {
+        Image img(20, 30 + k, 3);
+        for (int i = 0; i < img.total() * 3; ++i)
+        {
+            img.at(i) = static_cast<unsigned char>(i * 13 + k);
+        }
+        inputs.push_back(dir + "/img" + std::to_string(k) + ".ppm");
+        ASSERT_TRUE(save_image(inputs.back(), img));
+    }
+
+    ResultCache cache(cacheDir, 1u << 20);
+    ASSERT_TRUE(cache.valid());
+    std::string key, other;
+    ASSERT_TRUE(cache.key(inputs[0], "invert", key));
+    EXPECT_EQ(key.size(), 16u);
+    ASSERT_TRUE(cache.key(inputs[0], "invert", other));
+    EXPECT_EQ(other, key);
+    ASSERT_TRUE(cache.key(inputs[0], "gray", other));
+    EXPECT_NE(other, key);
+    ASSERT_TRUE(cache.key(inputs[1], "invert", other));
+    EXPECT_NE(other, key);
+    EXPECT_FALSE(cache.key(dir + "/missing.ppm", "invert", other));
+
+    // Miss, store, then a hit that reproduces the file byte for byte.
+    const std::string out = dir + "/result.ppm";
+    EXPECT_FALSE(cache.fetch(key, out));
+    Image loaded;
+    ASSERT_TRUE(load_image(inputs[0], loaded));
+    ASSERT_TRUE(save_image(out, invert(loaded)));
+    ASSERT_TRUE(cache.store(key, out));
+    std::filesystem::remove(out);
+    EXPECT_FALSE(cache.fetch(key, dir + "/result.qoi"));
+    ASSERT_TRUE(cache.fetch(key, out));
+    Image served;
+    ASSERT_TRUE(load_image(out, served));
+    EXPECT_TRUE(same_pixels(served, invert(loaded)));
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 2u);
+
+    // A hit over an existing output replaces it through a temporary file that does not stay behind.
+    ASSERT_TRUE(save_image(out, loaded));
+    ASSERT_TRUE(cache.fetch(key, out));
+    ASSERT_TRUE(load_image(out, served));
+    EXPECT_TRUE(same_pixels(served, invert(loaded)));
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+    {
+        EXPECT_EQ(entry.path().filename().string().find(".tmp"), std::string::npos);
+    }
+
+    // A second run of the same batch is served from the cache with identical files.
+    const std::string batchOut = ::testing::TempDir() + "cache_out";
+    std::filesystem::remove_all(batchOut);
+    auto gray = [](const Image& img) { return to_grayscale(img); };
+    ResultCache batchCache(cacheDir, 1u << 20);
+    EXPECT_EQ(run_batch(inputs, batchOut, gray, 2, &batchCache, "gray").succeeded, 4u);
+    EXPECT_EQ(batchCache.misses(), 4u);
+    std::filesystem::remove_all(batchOut);
+    const BatchReport cached = run_batch(inputs, batchOut, gray, 2, &batchCache, "gray");
+    EXPECT_EQ(cached.succeeded, 4u);
+    EXPECT_EQ(cached.bytesRead, 0u);
+    EXPECT_EQ(batchCache.hits(), 4u);
+    for (const std::string& input : inputs)
+    {
+        Image result, source;
+        ASSERT_TRUE(load_image(batch_output_path(batchOut, input, 1), result));
+        ASSERT_TRUE(load_image(input, source));
+        EXPECT_TRUE(same_pixels(result, to_grayscale(source)));
+    }
+
+    // Over the bound the least recently used entries go first; no temporary files are left.
+    const std::uint64_t entrySize = std::filesystem::file_size(out);
+    ResultCache small(cacheDir + "_small", 3 * entrySize);
+    std::vector<std::string> keys;
+    for (int k = 0; k < 3; ++k)
+    {
+        keys.emplace_back();
+        ASSERT_TRUE(small.key(inputs[0], "op" + std::to_string(k), keys.back()));
+        ASSERT_TRUE(small.store(keys.back(), out));
+        const auto when = std::filesystem::file_time_type::clock::now() - std::chrono::hours(10 - k);
+        std::filesystem::last_write_time(cacheDir + "_small/" + keys.back() + ".ppm", when);
+    }
+    ASSERT_TRUE(small.fetch(keys[0], dir + "/touched.ppm"));
+    keys.emplace_back();
+    ASSERT_TRUE(small.key(inputs[0], "op3", keys.back()));
+    ASSERT_TRUE(small.store(keys.back(), out));
+    EXPECT_TRUE(small.fetch(keys[0], dir + "/touched.ppm"));
+    EXPECT_FALSE(small.fetch(keys[1], dir + "/touched.ppm"));
+    EXPECT_TRUE(small.fetch(keys[3], dir + "/touched.ppm"));
+    int files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(cacheDir + "_small"))
+    {
+        EXPECT_EQ(entry.path().filename().string().find(".tmp"), std::string::npos);
+        ++files;
+    }
+    EXPECT_LE(files, 3);
+}
+
+TEST(ProfileTest, StagesBytesAndAllocations)
+{
+    Image img(30, 40, 3);
+    for (int i = 0; i < img.total() * 3; ++i)
+    {
+        img.at(i) = static_cast<unsigned char>(i * 5);
+    }
+    const std::uint64_t bytes = 30 * 40 * 3;
+    auto find = [](const ProfileReport& report, const std::string& name) -> const ProfileStage*
+    {
+        for (const ProfileStage& stage : report.stages)
+        {
+            if (stage.name == name)
+            {
+                return &stage;
+            }
+        }
+        return nullptr;
+    };
+
+    // Nothing is recorded while profiling is off.
+    reset_profile();
+    invert(img);
+    EXPECT_TRUE(profile_report().stages.empty());
+
+    set_profiling_enabled(true);
+    const std::string path = ::testing::TempDir() + "profile.ppm";
+    ASSERT_TRUE(save_image(path, invert(img.flipH())));
+    Image loaded;
+    ASSERT_TRUE(load_image(path, loaded));
+    const Image copy = loaded.clone();
+    rotate90(img);
+    set_profiling_enabled(false);
+    const ProfileReport report = profile_report();
+    reset_profile();
+
+#if IMG_PROFILING
+    // invert recurses once for the mirrored source, and rotate90 runs transpose inside its own stage.
+    const ProfileStage* inverted = find(report, "invert");
+    ASSERT_NE(inverted, nullptr);
+    EXPECT_EQ(inverted->calls, 1u);
+    EXPECT_EQ(inverted->bytes, bytes);
+    ASSERT_NE(find(report, "clone"), nullptr);
+    EXPECT_EQ(find(report, "clone")->calls, 2u);
+    EXPECT_EQ(find(report, "clone")->bytes, 2 * bytes);
+    ASSERT_NE(find(report, "load_image"), nullptr);
+    EXPECT_EQ(find(report, "load_image")->bytes, bytes);
+    ASSERT_NE(find(report, "save_image"), nullptr);
+    ASSERT_NE(find(report, "transpose"), nullptr);
+    EXPECT_GE(find(report, "rotate90")->seconds, find(report, "transpose")->seconds);
+    // unmirrored, invert, load, clone and rotate90 each allocate one image.
+    EXPECT_EQ(report.allocations, 5u);
+    EXPECT_EQ(report.allocatedBytes, 5 * bytes);
+#else
+    EXPECT_TRUE(report.stages.empty());
+    EXPECT_EQ(report.allocations, 0u);
+#endif
+}
+
+TEST(CompositeTest, AlphaBlendInPlaceOnViews)
+{
+    // Straight RGBA overlay with every alpha from transparent to opaque.
+    Image mark(9, 40, 4);
+    for (int i = 0; i < mark.total() * mark.channels(); ++i)
+    {
+        mark.at(i) = static_cast<unsigned char>((i * 2654435761u) >> 24);
+    }
+    mark.at(3) = 0;
+    mark.at(7) = 255;
+
+    Image base(30, 60, 3);
+    for (int i = 0; i < base.total() * base.channels(); ++i)
+    {
+        base.at(i) = static_cast<unsigned char>((i * 40503u) >> 6);
+    }
+    const Image original = base.clone();
+
+    // The view starts at (10, 5) of base; the overlay hangs off its left edge by 4 columns.
+    Image view = base(Range(5, 25), Range(10, 50));
+    ASSERT_TRUE(alpha_blend(view, mark, -4, 3));
+    for (int y = 0; y < base.rows(); ++y)
+    {
+        for (int x = 0; x < base.cols(); ++x)
+        {
+            const int mx = x - 6;
+            const int my = y - 8;
+            const bool covered = mx >= 4 && mx < 40 && my >= 0 && my < 9 && x < 50;
+            for (int k = 0; k < 3; ++k)
+            {
+                const int d = original.ptr<unsigned char>(y, x)[k];
+                int want = d;
+                if (covered)
+                {
+                    const unsigned char* m = mark.ptr<unsigned char>(my, mx);
+                    want = static_cast<int>(std::lround((m[k] * m[3] + d * (255 - m[3])) / 255.0));
+                }
+                ASSERT_EQ(base.ptr<unsigned char>(y, x)[k], want) << x << "," << y << "," << k;
+            }
+        }
+    }
+
+    // Premultiplied blending of premultiplied images agrees with straight blending onto opaque pixels,
+    // and with itself on planar and mirrored destinations.
+    Image opaque = original.clone();
+    Image rgba(30, 60, 4);
+    for (int y = 0; y < rgba.rows(); ++y)
+    {
+        for (int x = 0; x < rgba.cols(); ++x)
+        {
+            std::copy_n(original.ptr<unsigned char>(y, x), 3, rgba.ptr<unsigned char>(y, x));
+            rgba.ptr<unsigned char>(y, x)[3] = static_cast<unsigned char>(x < 30 ? 255 : x * 4);
+        }
+    }
+    const Image premultiplied = premultiply(mark);
+    ASSERT_TRUE(alpha_blend(opaque, mark, 12, 7));
+    Image composed = rgba.clone();
+    ASSERT_TRUE(alpha_blend(composed, premultiplied, 12, 7, AlphaMode::Premultiplied));
+    for (int y = 0; y < 30; ++y)
+    {
+        for (int x = 0; x < 30; ++x)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                EXPECT_NEAR(composed.ptr<unsigned char>(y, x)[k], opaque.ptr<unsigned char>(y, x)[k], 1);
+            }
+            EXPECT_EQ(composed.ptr<unsigned char>(y, x)[3], 255);
+        }
+    }
+    Image planar = to_planar(rgba);
+    ASSERT_TRUE(alpha_blend(planar, premultiplied, 12, 7, AlphaMode::Premultiplied));
+    EXPECT_TRUE(same_pixels(to_interleaved(planar), composed));
+    Image mirrored = rgba.clone().flipH();
+    ASSERT_TRUE(alpha_blend(mirrored, premultiplied.flipH(), 60 - 12 - 40, 7, AlphaMode::Premultiplied));
+    EXPECT_TRUE(same_pixels(mirrored.unmirrored().flipH().unmirrored(), composed));
+
+    // Premultiplying and back restores colours to within the precision alpha leaves them.
+    const Image restored = unpremultiply(premultiplied);
+    for (int i = 0; i < mark.total(); ++i)
+    {
+        const int a = mark.at(4 * i + 3);
+        ASSERT_EQ(restored.at(4 * i + 3), a);
+        for (int k = 0; k < 3 && a > 0; ++k)
+        {
+            ASSERT_NEAR(restored.at(4 * i + k), mark.at(4 * i + k), 128.0 / a + 0.5);
+        }
+    }
+
+    // Overlays without alpha or with other colours are refused; one outside dst changes nothing.
+    EXPECT_FALSE(alpha_blend(base, Image(4, 4, 3), 0, 0));
+    EXPECT_FALSE(alpha_blend(base, Image(4, 4, 2), 0, 0));
+    EXPECT_FALSE(alpha_blend(base, Image(4, 4, 4, PixelDepth::U16), 0, 0));
+    EXPECT_TRUE(premultiply(Image(4, 4, 3)).empty());
+    const Image before = base.clone();
+    EXPECT_TRUE(alpha_blend(base, mark, 60, 0));
+    EXPECT_TRUE(alpha_blend(base, mark, -40, -9));
+    EXPECT_TRUE(same_pixels(base, before));
+
+    // "imgtool overlay f.ppm mark.pam 5 5 f.ppm": blending a mapped file and saving it over itself,
+    // from a clone as the command does and in place on a copy-on-write mapping.
+    const std::string path = ::testing::TempDir() + "overlay_self.ppm";
+    Image expected = original.clone();
+    ASSERT_TRUE(alpha_blend(expected, mark, 5, 5));
+    for (MapMode mode : { MapMode::ReadOnly, MapMode::CopyOnWrite })
+    {
+        ASSERT_TRUE(save_image(path, original));
+        Image mapped;
+        ASSERT_TRUE(load_image_mapped(path, mapped, mode));
+        Image out = mode == MapMode::ReadOnly ? mapped.clone() : mapped;
+        ASSERT_TRUE(alpha_blend(out, mark, 5, 5));
+        ASSERT_TRUE(save_image(path, out));
+        Image reloaded;
+        ASSERT_TRUE(load_image(path, reloaded));
+        EXPECT_TRUE(same_pixels(reloaded, expected));
+    }
+}